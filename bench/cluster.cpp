@@ -0,0 +1,175 @@
+#include "ClusterSessions.h"
+#include "Session.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ctime>
+
+using namespace vpn;
+
+// Session replication against cluster size. N nodes run their ClusterLinks over loopback in one
+// process, node 0 holds every session, and each round it sends one packet on every session and
+// syncs, as its snapshot thread does once a second under load. Reported per node count:
+//   first:  the sync that replicates the sessions to the other nodes (they build their tables)
+//   steady: later syncs, which only update the replicas' counters and windows
+// each as node 0's CPU time in Sync (records are sealed once per datagram, then sent to each
+// other node), the time until every other node applied every record, and the records lost on the
+// way. All nodes share the machine's cores, so the wall time includes every receiver's work.
+//
+// Usage: bench_cluster [SESSIONS] [ROUNDS]   (default 2000 sessions, 10 rounds)
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t POOL = 0x0000000A;    // 10.0.0.0/16
+constexpr uint32_t GATEWAY = 0x0100000A; // 10.0.0.1
+const std::vector<uint8_t> KEY(ClusterLink::KEY_LEN, 0x42);
+
+// What ClusterSessions needs of a session's state (see vpn_server's ClientContext)
+struct Context {
+    Context(std::shared_ptr<Session> s, const utils::Endpoint& ep, uint32_t v)
+        : session(std::move(s)), index(session->Index()), vip(v), last_seen(ClusterSessions<Context>::Now()), endpoint_(ep) {}
+
+    const utils::Endpoint& GetEndpoint() const { return endpoint_; }
+    void SetEndpoint(const utils::Endpoint& endpoint) { endpoint_ = endpoint; }
+
+    std::shared_ptr<Session> session;
+    uint32_t index;
+    uint32_t vip;
+    std::atomic<int64_t> last_seen;
+    std::atomic<bool> authenticated = false;
+    std::atomic<uint64_t> synced_counter = 0;
+    std::atomic<uint64_t> synced_rx = 0;
+    std::atomic<int64_t> synced_seen = 0;
+    uint64_t provisional_rx = 0;
+    uint64_t remote_counter = 0;
+    std::atomic<int64_t> remote_sent = 0;
+    std::weak_ptr<Context> predecessor;
+    std::atomic<bool> taking_over = false;
+
+private:
+    utils::Endpoint endpoint_;
+};
+
+struct Node {
+    ClusterSessions<Context>::Sessions sessions;
+    ClusterSessions<Context>::Clients clients{POOL, 16, GATEWAY};
+    ClusterLink link;
+    ClusterSessions<Context> cluster{link, sessions, clients, nullptr};
+
+    Node(uint32_t self, const std::vector<ClusterLink::Node>& nodes) : link(self, nodes, KEY) {
+        link.SetSessionsHandler([this](uint32_t, const std::vector<SessionRecord>& records) { cluster.OnSessions(records); });
+        link.Start();
+    }
+};
+
+int64_t ThreadCpuNanos() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+uint16_t FreePort() {
+    utils::UdpSocket socket;
+    socket.Bind(0);
+    utils::Endpoint bound = {};
+    socklen_t length = sizeof(bound);
+    getsockname(socket.Handle(), reinterpret_cast<sockaddr*>(&bound), &length);
+    return ntohs(bound.sin6_port);
+}
+
+struct Round {
+    double sync_ms = 0;    // Node 0's CPU time in Sync
+    double applied_ms = 0; // Until every other node applied every record
+    uint64_t lost = 0;
+};
+
+// One packet on every session, then a sync; waits up to a second for the other nodes
+Round SyncRound(std::vector<std::unique_ptr<Node>>& nodes, const std::vector<std::shared_ptr<Context>>& contexts) {
+    const uint8_t payload[64] = {0x45};
+    for (const auto& ctx : contexts) {
+        auto packet = utils::PacketBuffer::Copy(payload, sizeof(payload));
+        ctx->session->Encrypt(packet);
+    }
+    std::vector<uint64_t> before;
+    for (const auto& node : nodes) before.push_back(node->cluster.RecordsReceived());
+
+    Round round;
+    auto start = Clock::now();
+    int64_t cpu = ThreadCpuNanos();
+    size_t sent = nodes[0]->cluster.Sync();
+    round.sync_ms = static_cast<double>(ThreadCpuNanos() - cpu) / 1e6;
+    auto deadline = start + std::chrono::seconds(1);
+    for (size_t i = 1; i < nodes.size(); ++i) {
+        while (nodes[i]->cluster.RecordsReceived() - before[i] < sent && Clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        round.lost += sent - (nodes[i]->cluster.RecordsReceived() - before[i]);
+    }
+    round.applied_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return round;
+}
+
+void Report(const char* name, const Round& round, size_t records) {
+    std::cout << "  " << std::left << std::setw(7) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(8) << round.sync_ms << " ms sync CPU" << std::setw(9) << round.applied_ms << " ms applied"
+              << std::setprecision(0) << std::setw(10) << records / (round.applied_ms / 1000) << " records/s per node"
+              << std::setw(6) << round.lost << " lost" << std::endl;
+}
+
+void Run(uint32_t count, size_t sessions, size_t rounds) {
+    std::vector<ClusterLink::Node> addresses(count);
+    for (uint32_t id = 0; id < count; ++id) {
+        addresses[id].id = id;
+        utils::ParseEndpoint("127.0.0.1", FreePort(), addresses[id].address);
+    }
+    std::vector<std::unique_ptr<Node>> nodes;
+    for (uint32_t id = 0; id < count; ++id) nodes.push_back(std::make_unique<Node>(id, addresses));
+    // Heartbeats go out once a second: wait for every node to hear node 0
+    auto deadline = Clock::now() + std::chrono::seconds(3);
+    for (uint32_t id = 1; id < count; ++id) {
+        while (!nodes[id]->link.Alive(0) && Clock::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // One handshake, its keys reused under every index
+    Session client(false), server(true);
+    client.HandleHandshake(server.HandleHandshake(client.InitiateHandshake()));
+    SessionState state = server.Export(0);
+    std::vector<std::shared_ptr<Context>> contexts;
+    utils::Endpoint endpoint;
+    utils::ParseEndpoint("127.0.0.1", 40000, endpoint);
+    for (size_t i = 0; i < sessions; ++i) {
+        state.index = static_cast<uint32_t>(i + 1);
+        auto session = std::make_shared<Session>(state);
+        nodes[0]->cluster.SetNonceStripe(*session);
+        uint32_t vip = htonl(ntohl(POOL) + 2 + static_cast<uint32_t>(i));
+        auto ctx = std::make_shared<Context>(session, endpoint, vip);
+        nodes[0]->sessions.Insert(ctx->index, ctx);
+        nodes[0]->clients.Assign(vip, ctx);
+        contexts.push_back(ctx);
+    }
+
+    std::cout << count << " nodes:" << std::endl;
+    Report("first", SyncRound(nodes, contexts), sessions);
+    Round steady;
+    for (size_t i = 0; i < rounds; ++i) {
+        Round round = SyncRound(nodes, contexts);
+        steady.sync_ms += round.sync_ms / rounds;
+        steady.applied_ms += round.applied_ms / rounds;
+        steady.lost += round.lost;
+    }
+    Report("steady", steady, sessions);
+}
+
+int main(int argc, char** argv) {
+    size_t sessions = argc > 1 ? std::stoul(argv[1]) : 2000;
+    size_t rounds = argc > 2 ? std::stoul(argv[2]) : 10;
+    if (sessions > 60000) sessions = 60000; // The pool is a /16
+
+    std::cout << "Syncing " << sessions << " changed sessions from node 0 to the other nodes over loopback:" << std::endl;
+    for (uint32_t count : {2u, 3u, 4u, 8u}) Run(count, sessions, rounds);
+    return 0;
+}
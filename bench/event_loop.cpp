@@ -0,0 +1,116 @@
+#include "EventLoop.h"
+#include "UdpSocket.h"
+#include "PacketBuffer.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ctime>
+
+using namespace vpn;
+
+// The worker's event loop on its own, io_uring against the blocking backend. A sender thread
+// floods a loopback socket the loop drives; the loop's handler keeps each datagram and its batch
+// end handler sends the burst on to a sink with SendBatch, as a worker forwards hairpinned
+// traffic. Reported from EventLoop::Stats: syscalls per datagram (received and sent), and the
+// loop thread's CPU time (CLOCK_THREAD_CPUTIME_ID) per datagram received.
+//
+// Usage: bench_event_loop [PACKETS] [SIZE]   (default 1M datagrams of 1300 bytes)
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t BATCH = utils::UdpSocket::MAX_BATCH;
+
+uint16_t LocalPort(const utils::UdpSocket& socket) {
+    utils::Endpoint bound = {};
+    socklen_t length = sizeof(bound);
+    getsockname(socket.Handle(), reinterpret_cast<sockaddr*>(&bound), &length);
+    return ntohs(bound.sin6_port);
+}
+
+int64_t ThreadCpuNanos() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+void Run(std::unique_ptr<utils::EventLoop> loop, size_t packets, size_t size) {
+    utils::UdpSocket front, sink, client;
+    for (auto* socket : {&front, &sink, &client}) socket->Bind(0, false);
+    front.EnableGro();
+    front.EnableGso();
+    client.EnableGso();
+    utils::Endpoint to_front, to_sink;
+    utils::ParseEndpoint("127.0.0.1", LocalPort(front), to_front);
+    utils::ParseEndpoint("127.0.0.1", LocalPort(sink), to_sink);
+
+    std::atomic<bool> done = false;
+    std::thread drain([&] {
+        std::vector<std::vector<uint8_t>> buffers(BATCH, std::vector<uint8_t>(65535));
+        utils::Datagram batch[BATCH];
+        for (size_t i = 0; i < BATCH; ++i) batch[i] = {buffers[i].data(), buffers[i].size()};
+        while (!done) sink.ReceiveBatch(batch, BATCH);
+    });
+    std::thread sender([&] {
+        std::vector<uint8_t> payload(size, 0x5A);
+        std::vector<utils::Datagram> batch(BATCH);
+        for (auto& datagram : batch) datagram = {payload.data(), 0, payload.size(), to_front};
+        while (!done) {
+            client.SendBatch(batch.data(), batch.size());
+            std::this_thread::yield(); // Lets the loop keep up, so few datagrams are lost on the way in
+        }
+    });
+
+    // Forward every datagram to the sink, a burst at a time
+    std::vector<utils::PacketBuffer> held;
+    std::vector<utils::Datagram> outgoing;
+    size_t received = 0;
+    loop->AddSocket(front, [&](utils::PacketBuffer& packet, const utils::Endpoint&) {
+        held.push_back(std::move(packet));
+        if (++received == packets) loop->Stop();
+    });
+    loop->SetBatchEndHandler([&] {
+        for (auto& packet : held) outgoing.push_back({packet.data(), 0, packet.size(), to_sink});
+        loop->SendBatch(sink, outgoing.data(), outgoing.size());
+        outgoing.clear();
+        held.clear();
+    });
+
+    auto before = loop->GetStats();
+    int64_t cpu = ThreadCpuNanos();
+    auto start = Clock::now();
+    loop->Run();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    cpu = ThreadCpuNanos() - cpu;
+    auto after = loop->GetStats();
+
+    done = true;
+    sender.join();
+    uint8_t byte = 0;
+    utils::Datagram wake = {&byte, 1, 1, to_sink};
+    client.SendBatch(&wake, 1); // Wakes the drain thread
+    drain.join();
+
+    uint64_t in = after.packets_received - before.packets_received;
+    uint64_t out = after.packets_sent - before.packets_sent;
+    uint64_t syscalls = after.syscalls - before.syscalls;
+    std::cout << "  " << std::left << std::setw(9) << loop->Name() << std::right << std::fixed << std::setprecision(0)
+              << std::setw(10) << in / seconds << " datagrams/s in, " << std::setw(8) << out << " out, "
+              << std::setprecision(3) << static_cast<double>(syscalls) / (in + out) << " syscalls/datagram, "
+              << std::setprecision(0) << static_cast<double>(cpu) / in << " ns CPU/datagram" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t packets = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t size = argc > 2 ? std::stoul(argv[2]) : 1300;
+
+    std::cout << size << "-byte datagrams, received and forwarded by one event loop:" << std::endl;
+    if (auto loop = utils::EventLoop::CreateIoUring()) Run(std::move(loop), packets, size);
+    else std::cout << "  io_uring unavailable" << std::endl;
+    Run(utils::EventLoop::CreateBlocking(), packets, size);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "Session.h"
+#include "Ticket.h"
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+
+using namespace vpn;
+
+// Handshakes per second on one core, full (X25519) against resumed (HKDF only), as a server sees
+// them in a reconnect storm: the hellos are made beforehand and only the server's side is timed,
+// then the client's side of the same handshakes.
+//
+// Usage: bench_handshake [COUNT]   (default 2000 of each)
+
+using Clock = std::chrono::steady_clock;
+
+double PerSecond(size_t count, Clock::duration elapsed) {
+    return count / std::chrono::duration<double>(elapsed).count();
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 2000;
+    protocol::TicketKey ticket_key;
+
+    // Full handshakes
+    std::vector<std::unique_ptr<Session>> clients;
+    std::vector<std::vector<uint8_t>> hellos;
+    for (size_t i = 0; i < count; ++i) {
+        clients.push_back(std::make_unique<Session>(false));
+        hellos.push_back(clients.back()->InitiateHandshake());
+    }
+    std::vector<std::vector<uint8_t>> replies(count);
+    auto start = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        Session server(true, &ticket_key);
+        replies[i] = server.HandleHandshake(hellos[i]);
+    }
+    auto full_server = Clock::now() - start;
+    start = Clock::now();
+    for (size_t i = 0; i < count; ++i) clients[i]->HandleHandshake(replies[i]);
+    auto full_client = Clock::now() - start;
+
+    // Resumptions, with the tickets the full handshakes handed out
+    std::vector<std::unique_ptr<Session>> resumed;
+    for (size_t i = 0; i < count; ++i) {
+        auto state = clients[i]->GetResumptionState();
+        if (!state) {
+            std::cerr << "Full handshake " << i << " issued no ticket" << std::endl;
+            return 1;
+        }
+        resumed.push_back(std::make_unique<Session>(false));
+        hellos[i] = resumed.back()->InitiateResumption(*state);
+    }
+    start = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        Session server(true, &ticket_key);
+        replies[i] = server.HandleHandshake(hellos[i]);
+    }
+    auto resume_server = Clock::now() - start;
+    start = Clock::now();
+    for (size_t i = 0; i < count; ++i) resumed[i]->HandleHandshake(replies[i]);
+    auto resume_client = Clock::now() - start;
+
+    for (const auto& session : resumed) {
+        if (!session->IsEstablished() || !session->IsResumed()) {
+            std::cerr << "A resumption failed" << std::endl;
+            return 1;
+        }
+    }
+
+    double full = PerSecond(count, full_server);
+    double resume = PerSecond(count, resume_server);
+    std::cout << "full handshake: " << static_cast<uint64_t>(full) << "/s server, "
+              << static_cast<uint64_t>(PerSecond(count, full_client)) << "/s client" << std::endl;
+    std::cout << "resumption:     " << static_cast<uint64_t>(resume) << "/s server, "
+              << static_cast<uint64_t>(PerSecond(count, resume_client)) << "/s client" << std::endl;
+    std::cout << "resumption is " << resume / full << "x the server's full handshake rate" << std::endl;
+    return 0;
+}
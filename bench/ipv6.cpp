@@ -0,0 +1,163 @@
+#include "Session.h"
+#include "Ticket.h"
+#include "Protocol.h"
+#include "RoutingTable.h"
+#include "PacketBuffer.h"
+#include "UdpSocket.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstring>
+
+using namespace vpn;
+
+// IPv6 against IPv4 on both layers of the data path, one thread:
+//  - inner: the server's per-packet work for a client-to-client packet (open, check the source
+//    routes back to the sender, route the destination, seal for the receiver) on IPv4 packets
+//    and on IPv6 packets of the same size between the clients' derived addresses;
+//  - outer: sealed-size datagrams sent in bursts over loopback to 127.0.0.1 and to ::1.
+//
+// Usage: bench_ipv6 [PACKETS] [SIZE]   (default 1M packets of 1280 bytes)
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SENDER = 0x0200000A;   // 10.0.0.2, network byte order
+constexpr uint32_t RECEIVER = 0x0300000A; // 10.0.0.3
+
+// The server's routing step: the pool route, with IPv6 addresses mirrored from it
+uint32_t Route(const utils::RoutingTable& routes, const utils::PacketBuffer& packet, bool source) {
+    if (packet[0] >> 4 == 4) {
+        uint32_t ip;
+        std::memcpy(&ip, packet.data() + (source ? 12 : 16), 4);
+        auto hop = routes.Lookup(ip);
+        return hop ? (*hop ? *hop : ip) : 0;
+    }
+    const uint8_t* ip = packet.data() + (source ? 8 : 24);
+    if (std::memcmp(ip, protocol::VIP6_PREFIX.data(), protocol::VIP6_PREFIX.size()) != 0) return 0;
+    uint32_t vip;
+    std::memcpy(&vip, ip + protocol::VIP6_PREFIX.size(), 4);
+    return routes.Lookup(vip) ? vip : 0;
+}
+
+utils::PacketBuffer InnerPacket(bool v6, size_t size) {
+    auto packet = utils::PacketBuffer::Allocate(size);
+    std::memset(packet.data(), 0, size);
+    if (v6) {
+        packet[0] = 0x60;
+        auto source = protocol::EmbedVip6(SENDER);
+        auto destination = protocol::EmbedVip6(RECEIVER);
+        std::memcpy(packet.data() + 8, source.data(), 16);
+        std::memcpy(packet.data() + 24, destination.data(), 16);
+    } else {
+        packet[0] = 0x45;
+        std::memcpy(packet.data() + 12, &SENDER, 4);
+        std::memcpy(packet.data() + 16, &RECEIVER, 4);
+    }
+    return packet;
+}
+
+// Packets per second through the server's per-packet work
+double Forward(bool v6, size_t packets, size_t size, const utils::RoutingTable& routes) {
+    protocol::TicketKey ticket_key;
+    Session client(false), server(true, &ticket_key);
+    client.HandleHandshake(server.HandleHandshake(client.InitiateHandshake()));
+
+    // Sealed by the client beforehand; each round opens a copy, as a received datagram would be
+    constexpr size_t DISTINCT = 1024;
+    std::vector<utils::PacketBuffer> sealed;
+    for (size_t i = 0; i < DISTINCT; ++i) {
+        sealed.push_back(InnerPacket(v6, size));
+        client.Encrypt(sealed.back());
+    }
+
+    size_t forwarded = 0;
+    Clock::duration elapsed{};
+    auto start = Clock::now();
+    for (size_t i = 0; i < packets; ++i) {
+        // Counters must only be accepted once: reseal when the round comes back around, off the clock
+        if (i && i % DISTINCT == 0) {
+            elapsed += Clock::now() - start;
+            for (auto& packet : sealed) {
+                packet = InnerPacket(v6, size);
+                client.Encrypt(packet);
+            }
+            start = Clock::now();
+        }
+        auto packet = utils::PacketBuffer::Copy(sealed[i % DISTINCT].data(), sealed[i % DISTINCT].size());
+        if (!server.Decrypt(packet)) continue;
+        if (Route(routes, packet, true) != SENDER || Route(routes, packet, false) != RECEIVER) continue;
+        server.Encrypt(packet);
+        ++forwarded;
+    }
+    elapsed += Clock::now() - start;
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    if (forwarded != packets) std::cerr << (packets - forwarded) << " packets were not forwarded" << std::endl;
+    return packets / seconds;
+}
+
+// Datagrams per second sent to `destination` on loopback, 64 per batch
+double Send(const char* destination, size_t packets, size_t size) {
+    utils::UdpSocket receiver;
+    receiver.Bind(0, false);
+    utils::Endpoint bound = {};
+    socklen_t length = sizeof(bound);
+    getsockname(receiver.Handle(), reinterpret_cast<sockaddr*>(&bound), &length);
+    utils::Endpoint to;
+    utils::ParseEndpoint(destination, ntohs(bound.sin6_port), to);
+
+    std::atomic<bool> done = false;
+    std::thread drain([&] {
+        utils::Datagram batch[utils::UdpSocket::MAX_BATCH];
+        std::vector<std::vector<uint8_t>> buffers(utils::UdpSocket::MAX_BATCH, std::vector<uint8_t>(2048));
+        for (size_t i = 0; i < utils::UdpSocket::MAX_BATCH; ++i) batch[i] = {buffers[i].data(), buffers[i].size()};
+        while (!done) receiver.ReceiveBatch(batch, utils::UdpSocket::MAX_BATCH);
+    });
+
+    utils::UdpSocket sender;
+    sender.Bind(0, false);
+    std::vector<uint8_t> payload(size);
+    std::vector<utils::Datagram> batch(utils::UdpSocket::MAX_BATCH);
+    for (auto& datagram : batch) {
+        datagram.data = payload.data();
+        datagram.length = payload.size();
+        datagram.addr = to;
+    }
+    auto start = Clock::now();
+    for (size_t sent = 0; sent < packets; sent += batch.size()) sender.SendBatch(batch.data(), batch.size());
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    done = true;
+    sender.SendBatch(batch.data(), 1); // Wakes the receive thread
+    drain.join();
+    return packets / seconds;
+}
+
+void Report(const char* name, double per_second, size_t size) {
+    std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(8) << per_second / 1e6 << " Mpps" << std::setw(8) << per_second * size * 8 / 1e9 << " Gbit/s" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t packets = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t size = argc > 2 ? std::stoul(argv[2]) : 1280;
+    if (size < 40 || size + protocol::DATA_HEADER_SIZE + crypto::TAG_LEN > utils::PacketBuffer::BUFFER_SIZE - utils::PacketBuffer::HEADROOM) {
+        std::cerr << "SIZE must be between 40 and " << utils::PacketBuffer::BUFFER_SIZE - utils::PacketBuffer::HEADROOM - protocol::DATA_HEADER_SIZE - crypto::TAG_LEN << std::endl;
+        return 1;
+    }
+
+    utils::RoutingTable routes;
+    routes.Add(0x0000000A, 24, 0); // 10.0.0.0/24, the pool: each address is its own client
+
+    std::cout << size << "-byte inner packets" << std::endl;
+    Report("forward IPv4", Forward(false, packets, size, routes), size);
+    Report("forward IPv6", Forward(true, packets, size, routes), size);
+    size_t sealed = size + protocol::DATA_HEADER_SIZE + crypto::TAG_LEN;
+    std::cout << sealed << "-byte datagrams on loopback" << std::endl;
+    Report("send to 127.0.0.1", Send("127.0.0.1", packets, sealed), sealed);
+    Report("send to ::1", Send("::1", packets, sealed), sealed);
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include "Steering.h"
+#include "Protocol.h"
+#include "UdpSocket.h"
+#include "Random.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <ctime>
+
+using namespace vpn;
+
+// What vpn_lb adds per forwarded datagram. A relay thread receives bursts of Data packets on
+// loopback and sends them on: as a plain UDP proxy (one backend, datagram unchanged), spread over
+// four backends by session index, and as vpn_lb does it (the same, with the steering header
+// prepended). Each burst is queued per backend so each backend's share leaves in one send. The
+// relay's own CPU time (CLOCK_THREAD_CPUTIME_ID) per datagram is reported, so the sender and sink
+// threads sharing the cores do not count. Steering on its own is timed too.
+//
+// Usage: bench_lb [PACKETS] [SIZE]   (default 1M datagrams of 1300 bytes)
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t BACKENDS = 4;
+constexpr size_t BATCH = utils::UdpSocket::MAX_BATCH;
+
+enum class Mode { Proxy, Spread, Steer };
+
+uint16_t LocalPort(const utils::UdpSocket& socket) {
+    utils::Endpoint bound = {};
+    socklen_t length = sizeof(bound);
+    getsockname(socket.Handle(), reinterpret_cast<sockaddr*>(&bound), &length);
+    return ntohs(bound.sin6_port);
+}
+
+int64_t ThreadCpuNanos() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Data packets with random session indexes
+std::vector<std::vector<uint8_t>> MakePackets(size_t count, size_t size) {
+    std::vector<std::vector<uint8_t>> packets(count, std::vector<uint8_t>(size));
+    for (auto& packet : packets) {
+        auto index = crypto::Random::Generate(protocol::INDEX_SIZE);
+        packet[0] = static_cast<uint8_t>(protocol::PacketType::Data);
+        std::memcpy(packet.data() + protocol::DATA_INDEX_OFFSET, index.data(), index.size());
+    }
+    return packets;
+}
+
+// Relay CPU ns per datagram
+double Relay(Mode mode, size_t packets, size_t size) {
+    utils::UdpSocket front, back, sink, client;
+    for (auto* socket : {&front, &back, &sink, &client}) socket->Bind(0, false);
+    back.EnableGso();
+    client.EnableGso();
+
+    // Four backends, all the sink's port on different loopback addresses
+    std::vector<utils::Endpoint> backends(BACKENDS);
+    for (size_t i = 0; i < BACKENDS; ++i) utils::ParseEndpoint("127.0.0." + std::to_string(i + 1), LocalPort(sink), backends[i]);
+    utils::Endpoint to_front;
+    utils::ParseEndpoint("127.0.0.1", LocalPort(front), to_front);
+
+    std::atomic<bool> done = false;
+    std::thread drain([&] {
+        std::vector<std::vector<uint8_t>> buffers(BATCH, std::vector<uint8_t>(2048));
+        utils::Datagram batch[BATCH];
+        for (size_t i = 0; i < BATCH; ++i) batch[i] = {buffers[i].data(), buffers[i].size()};
+        while (!done) sink.ReceiveBatch(batch, BATCH);
+    });
+    std::thread sender([&] {
+        auto payloads = MakePackets(BATCH * 16, size);
+        std::vector<utils::Datagram> batch(BATCH);
+        for (size_t round = 0; !done; ++round) {
+            for (size_t i = 0; i < BATCH; ++i) {
+                auto& payload = payloads[(round * BATCH + i) % payloads.size()];
+                batch[i].data = payload.data();
+                batch[i].length = payload.size();
+                batch[i].addr = to_front;
+            }
+            client.SendBatch(batch.data(), batch.size());
+            std::this_thread::yield(); // Lets the relay keep up, so few datagrams are lost on the way in
+        }
+    });
+
+    // Received at STEER_HEADER_SIZE into each buffer, leaving room for the header in front
+    std::vector<std::vector<uint8_t>> buffers(BATCH, std::vector<uint8_t>(protocol::STEER_HEADER_SIZE + 2048));
+    utils::Datagram received[BATCH];
+    std::vector<std::vector<utils::Datagram>> queues(BACKENDS);
+    size_t relayed = 0;
+    int64_t cpu = 0;
+    while (relayed < packets) {
+        for (size_t i = 0; i < BATCH; ++i) received[i] = {buffers[i].data() + protocol::STEER_HEADER_SIZE, 2048};
+        int count = front.ReceiveBatch(received, BATCH);
+        int64_t start = ThreadCpuNanos();
+        for (int i = 0; i < count; ++i) {
+            utils::Datagram datagram = received[i];
+            size_t backend = 0;
+            if (mode != Mode::Proxy) {
+                int chosen = protocol::SteerToBackend(datagram.data, datagram.length, datagram.addr, BACKENDS);
+                if (chosen < 0) continue;
+                backend = static_cast<size_t>(chosen);
+            }
+            if (mode == Mode::Steer) {
+                protocol::WriteSteerHeader(datagram.data - protocol::STEER_HEADER_SIZE, datagram.addr);
+                datagram.data -= protocol::STEER_HEADER_SIZE;
+                datagram.length += protocol::STEER_HEADER_SIZE;
+            }
+            datagram.addr = backends[backend];
+            datagram.tos = 0;
+            queues[backend].push_back(datagram);
+        }
+        for (auto& queue : queues) {
+            if (queue.empty()) continue;
+            back.SendBatch(queue.data(), queue.size());
+            queue.clear();
+        }
+        cpu += ThreadCpuNanos() - start;
+        relayed += count > 0 ? static_cast<size_t>(count) : 0;
+    }
+
+    done = true;
+    sender.join();
+    utils::Datagram wake = {buffers[0].data(), 1, 1, backends[0]};
+    back.SendBatch(&wake, 1); // Wakes the drain thread
+    drain.join();
+    return static_cast<double>(cpu) / relayed;
+}
+
+int main(int argc, char** argv) {
+    size_t packets = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t size = argc > 2 ? std::stoul(argv[2]) : 1300;
+
+    // Steering alone: the per-datagram decision and header
+    auto payloads = MakePackets(1024, size);
+    utils::Endpoint client;
+    utils::ParseEndpoint("192.0.2.1", 40000, client);
+    uint8_t header[protocol::STEER_HEADER_SIZE];
+    size_t spread[BACKENDS] = {};
+    auto start = Clock::now();
+    for (size_t i = 0; i < packets; ++i) {
+        const auto& payload = payloads[i % payloads.size()];
+        int backend = protocol::SteerToBackend(payload.data(), payload.size(), client, BACKENDS);
+        protocol::WriteSteerHeader(header, client);
+        spread[backend]++;
+    }
+    double steering = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / packets;
+
+    double proxy = Relay(Mode::Proxy, packets, size);
+    double spread_out = Relay(Mode::Spread, packets, size);
+    double lb = Relay(Mode::Steer, packets, size);
+    std::cout << size << "-byte datagrams, relay CPU per datagram:" << std::endl << std::fixed << std::setprecision(1);
+    std::cout << "  plain UDP proxy     " << std::setw(8) << proxy << " ns" << std::endl;
+    std::cout << "  over 4 backends     " << std::setw(8) << spread_out << " ns  (" << std::showpos << spread_out - proxy << std::noshowpos << " ns)" << std::endl;
+    std::cout << "  vpn_lb forwarding   " << std::setw(8) << lb << " ns  (" << std::showpos << lb - proxy << std::noshowpos << " ns)" << std::endl;
+    std::cout << "  steering alone      " << std::setw(8) << steering << " ns  (backends got";
+    for (size_t count : spread) std::cout << " " << count * 100 / packets << "%";
+    std::cout << ")" << std::endl;
+    return 0;
+}
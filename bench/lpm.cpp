@@ -0,0 +1,114 @@
+#include "RoutingTable.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <array>
+#include <cstring>
+
+using namespace vpn;
+
+// Longest-prefix-match lookups per second with 100k routes, IPv4 (DIR-24-8) and IPv6, for
+// addresses under a route and for random ones. Prefix lengths follow a BGP-like mix: mostly /24
+// (/48 for IPv6), some shorter, a tenth longer so second-level groups are exercised.
+//
+// Usage: bench_lpm [ROUTES] [LOOKUPS]   (default 100000 routes, 10M lookups per run)
+
+using Clock = std::chrono::steady_clock;
+volatile uint64_t sink; // Keeps the lookups from being optimized out
+
+uint32_t ToNetwork(uint32_t host) {
+    uint32_t net;
+    uint8_t bytes[4] = {uint8_t(host >> 24), uint8_t(host >> 16), uint8_t(host >> 8), uint8_t(host)};
+    std::memcpy(&net, bytes, 4);
+    return net;
+}
+
+template <typename Lookup>
+double LookupsPerSecond(size_t lookups, size_t addresses, Lookup&& lookup) {
+    uint64_t hits = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < lookups; ++i) hits += lookup(i % addresses);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    sink = hits;
+    return lookups / seconds;
+}
+
+void Report(const char* name, double per_second) {
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(8) << per_second / 1e6 << "M/s" << std::setw(8) << 1e9 / per_second << " ns" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t routes = argc > 1 ? std::stoul(argv[1]) : 100000;
+    size_t lookups = argc > 2 ? std::stoul(argv[2]) : 10000000;
+    constexpr size_t ADDRESSES = 1 << 20;
+    std::mt19937 random(42);
+
+    // IPv4
+    auto length4 = [&]() -> uint8_t {
+        uint32_t r = random() % 100;
+        if (r < 60) return 24;
+        if (r < 90) return static_cast<uint8_t>(16 + random() % 8);
+        return static_cast<uint8_t>(25 + random() % 8);
+    };
+    utils::RoutingTable table;
+    std::vector<uint32_t> prefixes;
+    auto start = Clock::now();
+    for (size_t i = 0; i < routes; ++i) {
+        uint8_t length = length4();
+        uint32_t prefix = random() & ~0u << (32 - length);
+        if (!table.Add(ToNetwork(prefix), length, static_cast<uint32_t>(i))) {
+            std::cerr << "IPv4 table full after " << i << " routes" << std::endl;
+            return 1;
+        }
+        prefixes.push_back(prefix);
+    }
+    double build = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    std::cout << routes << " IPv4 routes added in " << std::setprecision(0) << std::fixed << build << " ms" << std::endl;
+
+    std::vector<uint32_t> routed(ADDRESSES), any(ADDRESSES);
+    for (auto& address : routed) address = ToNetwork(prefixes[random() % routes] | (random() & 0xFF));
+    for (auto& address : any) address = random();
+    Report("IPv4 routed addresses", LookupsPerSecond(lookups, ADDRESSES, [&](size_t i) { return table.Lookup(routed[i]).has_value(); }));
+    Report("IPv4 random addresses", LookupsPerSecond(lookups, ADDRESSES, [&](size_t i) { return table.Lookup(any[i]).has_value(); }));
+
+    // IPv6
+    auto length6 = [&]() -> uint8_t {
+        uint32_t r = random() % 100;
+        if (r < 60) return 48;
+        if (r < 90) return static_cast<uint8_t>(29 + random() % 19);
+        return static_cast<uint8_t>(49 + random() % 16);
+    };
+    utils::RoutingTable6 table6;
+    std::vector<std::array<uint8_t, 16>> prefixes6;
+    start = Clock::now();
+    for (size_t i = 0; i < routes; ++i) {
+        uint8_t length = length6();
+        std::array<uint8_t, 16> prefix = {0x20, 0x01};
+        for (size_t byte = 2; byte < 16; ++byte) prefix[byte] = static_cast<uint8_t>(random());
+        for (size_t bit = length; bit < 128; ++bit) prefix[bit / 8] &= static_cast<uint8_t>(~(0x80 >> (bit % 8)));
+        if (!table6.Add(prefix.data(), length, static_cast<uint32_t>(i))) {
+            std::cerr << "IPv6 table full after " << i << " routes" << std::endl;
+            return 1;
+        }
+        prefixes6.push_back(prefix);
+    }
+    build = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    std::cout << routes << " IPv6 routes added in " << std::setprecision(0) << build << " ms" << std::endl;
+
+    std::vector<std::array<uint8_t, 16>> routed6(ADDRESSES), any6(ADDRESSES);
+    for (auto& address : routed6) {
+        address = prefixes6[random() % routes];
+        for (size_t byte = 8; byte < 16; ++byte) address[byte] = static_cast<uint8_t>(random());
+    }
+    for (auto& address : any6) {
+        address = {0x20, 0x01};
+        for (size_t byte = 2; byte < 16; ++byte) address[byte] = static_cast<uint8_t>(random());
+    }
+    Report("IPv6 routed addresses", LookupsPerSecond(lookups, ADDRESSES, [&](size_t i) { return table6.Lookup(routed6[i].data()).has_value(); }));
+    Report("IPv6 random addresses", LookupsPerSecond(lookups, ADDRESSES, [&](size_t i) { return table6.Lookup(any6[i].data()).has_value(); }));
+    return 0;
+}
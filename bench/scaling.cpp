@@ -0,0 +1,120 @@
+#include "ConcurrentMap.h"
+#include "Rcu.h"
+#include "Session.h"
+#include "Affinity.h"
+#include "PacketBuffer.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace vpn;
+
+// Forwarding throughput against worker count. Each pinned worker thread seals a packet on a
+// session's client side, then looks the session up by index and opens it, as a worker does for
+// an incoming Data packet. Two ways to own the sessions:
+//   shared: one ConcurrentMap (the server's 64-shard copy-on-write table) and any worker handles
+//           any session, so sessions' nonce counters and replay windows are touched from every core
+//   owned:  each worker has a plain map of the sessions whose index is its id modulo the worker
+//           count, and only ever handles those
+// Scaling is the throughput against N times the one-worker throughput.
+//
+// Usage: bench_scaling [SESSIONS] [MILLISECONDS] [SIZE]   (default 1024 sessions, 500 ms, 1300 bytes)
+
+constexpr size_t BURST = 32;
+
+struct Pair {
+    std::shared_ptr<Session> client;
+    std::shared_ptr<Session> server;
+};
+
+std::vector<Pair> MakeSessions(uint32_t count) {
+    std::vector<Pair> pairs;
+    for (uint32_t i = 0; i < count; ++i) {
+        auto client = std::make_shared<Session>(false);
+        auto server = std::make_shared<Session>(true);
+        server->SetIndex(i);
+        client->HandleHandshake(server->HandleHandshake(client->InitiateHandshake()));
+        pairs.push_back({client, server});
+    }
+    return pairs;
+}
+
+// Packets per second over all workers
+double Run(const std::vector<Pair>& pairs, size_t workers, bool owned, std::chrono::milliseconds duration, size_t size) {
+    utils::ConcurrentMap<uint32_t, std::shared_ptr<Session>> shared;
+    std::vector<std::unordered_map<uint32_t, std::shared_ptr<Session>>> own(workers);
+    std::vector<std::vector<uint32_t>> mine(workers); // Indexes each worker sends on
+    for (uint32_t i = 0; i < pairs.size(); ++i) {
+        if (owned) own[i % workers][i] = pairs[i].server;
+        else shared.Insert(i, pairs[i].server);
+        mine[owned ? i % workers : 0].push_back(i);
+    }
+
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> total = 0;
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; ++w) {
+        threads.emplace_back([&, w] {
+            const std::vector<uint32_t>& indexes = mine[owned ? w : 0];
+            std::minstd_rand random(static_cast<uint32_t>(w + 1));
+            std::vector<uint8_t> payload(size, 0x45);
+            uint64_t packets = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                utils::Rcu::ReadGuard guard;
+                for (size_t i = 0; i < BURST; ++i) {
+                    uint32_t index = indexes[random() % indexes.size()];
+                    auto packet = utils::PacketBuffer::Copy(payload.data(), payload.size());
+                    pairs[index].client->Encrypt(packet);
+                    std::shared_ptr<Session> session;
+                    if (owned) {
+                        auto it = own[w].find(protocol::DataIndex(packet.data()));
+                        if (it != own[w].end()) session = it->second;
+                    } else if (auto entry = shared.Find(protocol::DataIndex(packet.data()))) {
+                        session = *entry;
+                    }
+                    if (session && session->Decrypt(packet)) ++packets;
+                }
+            }
+            total += packets;
+        });
+        utils::PinThreadToCore(threads.back(), static_cast<unsigned>(w));
+    }
+
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto& thread : threads) thread.join();
+    utils::Rcu::Reclaim();
+    return total / std::chrono::duration<double>(duration).count();
+}
+
+int main(int argc, char** argv) {
+    uint32_t sessions = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 1024;
+    std::chrono::milliseconds duration(argc > 2 ? std::stoul(argv[2]) : 500);
+    size_t size = argc > 3 ? std::stoul(argv[3]) : 1300;
+    unsigned cores = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+
+    auto pairs = MakeSessions(sessions);
+    std::cout << cores << " CPUs, " << sessions << " sessions, " << size << "-byte packets sealed and opened, packets/s (scaling)" << std::endl;
+    std::cout << std::setw(8) << "workers" << std::setw(24) << "shared" << std::setw(24) << "owned" << std::endl;
+    double shared_one = 0, owned_one = 0;
+    for (size_t workers = 1; workers <= cores; workers *= 2) {
+        double shared = Run(pairs, workers, false, duration, size);
+        double owned = Run(pairs, workers, true, duration, size);
+        if (workers == 1) {
+            shared_one = shared;
+            owned_one = owned;
+        }
+        std::cout << std::setw(8) << workers << std::fixed << std::setprecision(0)
+                  << std::setw(16) << shared << " (" << std::setprecision(2) << shared / (shared_one * workers) << ")"
+                  << std::setprecision(0) << std::setw(16) << owned << " (" << std::setprecision(2) << owned / (owned_one * workers) << ")" << std::endl;
+        if (workers * 2 > cores && workers != cores) workers = cores / 2; // Ends with every core
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "ConcurrentMap.h"
+#include "Rcu.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+using namespace vpn;
+
+// Session lookups per second with 1, 4, 16 and 64 threads looking up random sessions while one
+// more thread adds and removes sessions (a handshake storm), for the RCU-sharded map the server
+// uses and for the single mutex-guarded map it replaced. Lookups hold a read guard per burst of
+// 32 and copy the shared_ptr, as the workers do.
+//
+// Usage: bench_sessions [SESSIONS] [MILLISECONDS]   (default 10000 sessions, 500 ms per run)
+
+struct Context {
+    uint32_t vip = 0;
+};
+
+constexpr size_t BURST = 32;
+
+class MutexMap {
+public:
+    std::shared_ptr<Context> Find(uint32_t key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = map_.find(key);
+        return it == map_.end() ? nullptr : it->second;
+    }
+    void Insert(uint32_t key, std::shared_ptr<Context> value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        map_[key] = std::move(value);
+    }
+    void Erase(uint32_t key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        map_.erase(key);
+    }
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<uint32_t, std::shared_ptr<Context>> map_;
+};
+
+class RcuMap {
+public:
+    std::shared_ptr<Context> Find(uint32_t key) const {
+        auto entry = map_.Find(key);
+        return entry ? *entry : nullptr;
+    }
+    void Insert(uint32_t key, std::shared_ptr<Context> value) { map_.Insert(key, std::move(value)); }
+    void Erase(uint32_t key) { map_.Erase(key); }
+private:
+    utils::ConcurrentMap<uint32_t, std::shared_ptr<Context>> map_;
+};
+
+// Lookups per second across all threads
+template <typename Map>
+double Run(size_t threads, uint32_t sessions, std::chrono::milliseconds duration) {
+    Map map;
+    for (uint32_t i = 0; i < sessions; ++i) map.Insert(i, std::make_shared<Context>());
+
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> total = 0;
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < threads; ++t) {
+        readers.emplace_back([&, t] {
+            std::minstd_rand random(static_cast<uint32_t>(t + 1));
+            uint64_t lookups = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                utils::Rcu::ReadGuard guard;
+                for (size_t i = 0; i < BURST; ++i) map.Find(random() % sessions);
+                lookups += BURST;
+            }
+            total += lookups;
+        });
+    }
+    // Handshakes: a new session replaces an old one, and the retired tables are reclaimed
+    std::thread writer([&] {
+        uint32_t next = sessions;
+        while (!stop.load(std::memory_order_relaxed)) {
+            map.Insert(next, std::make_shared<Context>());
+            map.Erase(next - sessions);
+            ++next;
+            utils::Rcu::Reclaim();
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto& reader : readers) reader.join();
+    writer.join();
+    utils::Rcu::Reclaim();
+    return total / std::chrono::duration<double>(duration).count();
+}
+
+int main(int argc, char** argv) {
+    uint32_t sessions = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 10000;
+    std::chrono::milliseconds duration(argc > 2 ? std::stoul(argv[2]) : 500);
+
+    std::cout << std::thread::hardware_concurrency() << " CPUs, " << sessions << " sessions, lookups/s" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(16) << "rcu-sharded" << std::setw(16) << "mutex" << std::endl;
+    for (size_t threads : {1, 4, 16, 64}) {
+        double rcu = Run<RcuMap>(threads, sessions, duration);
+        double mutex = Run<MutexMap>(threads, sessions, duration);
+        std::cout << std::setw(8) << threads << std::fixed << std::setprecision(0)
+                  << std::setw(16) << rcu << std::setw(16) << mutex << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "EgressScheduler.h"
+#include "PacketBuffer.h"
+#include "Protocol.h"
+#include "CryptoDefs.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace vpn;
+
+// Egress scheduler, in two parts:
+//  - latency: a light client sending a small packet every millisecond, alone and then next to a
+//    bulk client that keeps its queue full, through a 1 Gbit/s link simulated in virtual time.
+//    With per-client queues the light client's delay stays about one packet's transmission, where
+//    one shared FIFO (the bulk client's queue) would hold it behind the whole backlog;
+//  - cost: real time per packet through Enqueue and Dequeue with many backlogged clients.
+//
+// Usage: bench_shaper [CLIENTS]   (default 1000 clients in the cost run)
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t OVERHEAD = protocol::DATA_HEADER_SIZE + crypto::TAG_LEN;
+constexpr int64_t NS_PER_BYTE = 8;         // 1 Gbit/s
+constexpr int64_t LIGHT_INTERVAL = 1000000; // 1 ms
+constexpr size_t LIGHT_SIZE = 100;
+constexpr size_t BULK_SIZE = 1280;
+constexpr uint32_t LIGHT = 1, BULK = 2;
+
+struct Percentiles {
+    double p50 = 0, p99 = 0, max = 0; // Microseconds
+};
+
+Percentiles Summarize(std::vector<int64_t>& delays) {
+    std::sort(delays.begin(), delays.end());
+    if (delays.empty()) return {};
+    return {delays[delays.size() / 2] / 1e3, delays[delays.size() * 99 / 100] / 1e3, delays.back() / 1e3};
+}
+
+// Light client's delays, enqueue to the end of its transmission, over `duration` virtual ns.
+// `shared`: the light client's packets join the bulk client's queue, as in a single FIFO.
+Percentiles Simulate(bool bulk, bool shared, int64_t duration) {
+    utils::EgressScheduler egress(2048, 512, OVERHEAD);
+    std::vector<utils::EgressScheduler::Packet> out;
+    std::vector<int64_t> delays;
+    int64_t now = 0;
+    int64_t next_light = 0;
+    while (now < duration) {
+        if (bulk) {
+            while (egress.Admit(BULK, utils::TrafficClass::BestEffort)) {
+                egress.Enqueue(BULK, utils::TrafficClass::BestEffort, nullptr, utils::PacketBuffer::Allocate(BULK_SIZE), false, now);
+            }
+        }
+        if (now >= next_light) {
+            uint32_t flow = shared ? BULK : LIGHT;
+            egress.Enqueue(flow, utils::TrafficClass::BestEffort, nullptr, utils::PacketBuffer::Allocate(LIGHT_SIZE), false, now);
+            next_light += LIGHT_INTERVAL;
+        }
+        if (egress.Empty()) {
+            now = next_light; // Link idle until the next packet
+            continue;
+        }
+
+        out.clear();
+        egress.Dequeue(out, 1, now);
+        for (const auto& packet : out) {
+            now += static_cast<int64_t>(packet.data.size() + OVERHEAD) * NS_PER_BYTE;
+            if (packet.data.size() == LIGHT_SIZE) delays.push_back(now - packet.enqueued);
+        }
+    }
+    return Summarize(delays);
+}
+
+void Report(const char* name, const Percentiles& p) {
+    std::cout << std::left << std::setw(34) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << p.p50 << std::setw(10) << p.p99 << std::setw(10) << p.max << std::endl;
+}
+
+// Real ns per packet through Enqueue and Dequeue with `clients` backlogged flows
+double Cost(uint32_t clients) {
+    utils::EgressScheduler egress(2048, 512, OVERHEAD);
+    std::vector<utils::EgressScheduler::Packet> out;
+    std::vector<utils::PacketBuffer> buffers;
+    for (size_t i = 0; i < 4 * size_t(clients); ++i) buffers.push_back(utils::PacketBuffer::Allocate(BULK_SIZE));
+
+    constexpr size_t ROUNDS = 200;
+    size_t packets = 0;
+    auto start = Clock::now();
+    for (size_t round = 0; round < ROUNDS; ++round) {
+        int64_t now = static_cast<int64_t>(round);
+        for (uint32_t flow = 0; flow < clients; ++flow) {
+            for (size_t i = 0; i < 4; ++i) {
+                egress.Enqueue(flow, utils::TrafficClass::BestEffort, nullptr, std::move(buffers.back()), false, now);
+                buffers.pop_back();
+            }
+        }
+        while (egress.Dequeue(out, 64, now) > 0) {
+            for (auto& packet : out) buffers.push_back(std::move(packet.data));
+            packets += out.size();
+            out.clear();
+        }
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / packets;
+}
+
+int main(int argc, char** argv) {
+    uint32_t clients = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 1000;
+    constexpr int64_t DURATION = 2000000000; // 2 s of virtual time
+
+    std::cout << std::left << std::setw(34) << "Light client delay (us)" << std::right
+              << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+    Report("alone", Simulate(false, false, DURATION));
+    Report("with a bulk client", Simulate(true, false, DURATION));
+    Report("with a bulk client, one FIFO", Simulate(true, true, DURATION));
+    std::cout << std::fixed << std::setprecision(0) << "Enqueue + Dequeue, " << clients << " backlogged clients: "
+              << Cost(clients) << " ns per packet" << std::endl;
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "UdpSocket.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <ctime>
+
+using namespace vpn;
+
+// UDP segmentation offloads on loopback. A sender thread sends bursts of 64 equal-size datagrams
+// to one destination with SendBatch, and a receiver thread takes them with ReceiveBatch, with GSO
+// and GRO each on or off. Reported per datagram: the sender's and the receiver's CPU time
+// (CLOCK_THREAD_CPUTIME_ID), and how many datagrams each SendBatch (one sendmmsg) and each
+// ReceiveBatch (one recvmmsg) moved. GSO shows up as less sender CPU for the same syscall count
+// (one super-buffer instead of 64 messages); GRO as more datagrams per receive.
+//
+// Usage: bench_udp_offload [PACKETS] [SIZE]   (default 1M datagrams of 1300 bytes)
+
+constexpr size_t BATCH = utils::UdpSocket::MAX_BATCH;
+
+uint16_t LocalPort(const utils::UdpSocket& socket) {
+    utils::Endpoint bound = {};
+    socklen_t length = sizeof(bound);
+    getsockname(socket.Handle(), reinterpret_cast<sockaddr*>(&bound), &length);
+    return ntohs(bound.sin6_port);
+}
+
+int64_t ThreadCpuNanos() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+void Run(bool gso, bool gro, size_t packets, size_t size) {
+    utils::UdpSocket sender, receiver;
+    sender.Bind(0, false);
+    receiver.Bind(0, false);
+    if (gso && !sender.EnableGso()) {
+        std::cout << "  GSO unavailable" << std::endl;
+        return;
+    }
+    if (gro && !receiver.EnableGro()) {
+        std::cout << "  GRO unavailable" << std::endl;
+        return;
+    }
+    timeval timeout = {0, 100000}; // So the receiver notices the end even if the last burst was lost
+    setsockopt(receiver.Handle(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    utils::Endpoint to_receiver;
+    utils::ParseEndpoint("127.0.0.1", LocalPort(receiver), to_receiver);
+
+    std::atomic<bool> done = false;
+    uint64_t sent = 0, sends = 0;
+    int64_t send_cpu = 0;
+    std::thread sending([&] {
+        std::vector<uint8_t> payload(size, 0x5A);
+        std::vector<utils::Datagram> batch(BATCH, {payload.data(), 0, payload.size(), to_receiver});
+        int64_t start = ThreadCpuNanos();
+        while (!done.load(std::memory_order_relaxed)) {
+            int n = sender.SendBatch(batch.data(), batch.size());
+            sent += n > 0 ? static_cast<uint64_t>(n) : 0;
+            sends++;
+            std::this_thread::yield(); // Lets the receiver keep up, so few datagrams are lost
+        }
+        send_cpu = ThreadCpuNanos() - start;
+    });
+
+    std::vector<std::vector<uint8_t>> buffers(BATCH, std::vector<uint8_t>(65535));
+    utils::Datagram batch[BATCH];
+    uint64_t received = 0, receives = 0;
+    int64_t start = ThreadCpuNanos();
+    while (received < packets) {
+        for (size_t i = 0; i < BATCH; ++i) batch[i] = {buffers[i].data(), buffers[i].size()};
+        int n = receiver.ReceiveBatch(batch, BATCH);
+        if (n <= 0) continue;
+        receives++;
+        for (int i = 0; i < n; ++i) utils::ForEachSegment(batch[i], [&](const uint8_t*, size_t) { received++; });
+    }
+    int64_t receive_cpu = ThreadCpuNanos() - start;
+    done = true;
+    sending.join();
+
+    std::cout << "  GSO " << (gso ? "on " : "off") << " GRO " << (gro ? "on " : "off") << std::fixed << std::setprecision(0)
+              << std::setw(8) << static_cast<double>(send_cpu) / sent << " ns send" << std::setw(8)
+              << static_cast<double>(receive_cpu) / received << " ns receive" << std::setprecision(1) << std::setw(8)
+              << static_cast<double>(sent) / sends << " datagrams/send" << std::setw(8)
+              << static_cast<double>(received) / receives << " datagrams/receive" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t packets = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t size = argc > 2 ? std::stoul(argv[2]) : 1300;
+
+    std::cout << size << "-byte datagrams on loopback, CPU per datagram:" << std::endl;
+    for (bool gso : {false, true}) {
+        for (bool gro : {false, true}) Run(gso, gro, packets, size);
+    }
+    return 0;
+}
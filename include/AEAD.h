@@ -11,6 +11,12 @@ namespace vpn::crypto {
 
         // Decrypt data. Input ciphertext should have tag appended.
         static std::optional<Bytes> Decrypt(const Bytes& key, const Bytes& nonce, const Bytes& ciphertext, const Bytes& aad = {});
+
+        // In place, for the data path: `data` is encrypted over itself and the tag written to `tag`
+        // (TAG_LEN bytes). `nonce` is NONCE_LEN bytes.
+        static void EncryptInPlace(const Bytes& key, const Byte* nonce, Byte* data, size_t length, Byte* tag);
+        // Returns false if `tag` does not authenticate `data`, whose contents are then undefined
+        static bool DecryptInPlace(const Bytes& key, const Byte* nonce, Byte* data, size_t length, const Byte* tag);
     };
 
 }
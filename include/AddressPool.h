@@ -0,0 +1,160 @@
+#pragma once
+#include "Rcu.h"
+#include <memory>
+#include <optional>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace vpn::utils {
+
+    // Virtual IP pool for one IPv4 subnet, doubling as the VIP -> Value routing table.
+    // Entries live in a flat array indexed by host offset within the subnet, so a lookup is a
+    // subtraction, a bounds check and one atomic load: no hashing, no tree walk. Readers are
+    // RCU-protected and wait-free like ConcurrentMap; writers (handshakes) serialize on a mutex.
+    // Addresses are in network byte order at the interface, as they appear in packets.
+    template <typename Value>
+    class AddressPool {
+    public:
+        // network: subnet address. gateway: our own address in the subnet, never handed out.
+        AddressPool(uint32_t network, uint8_t prefix_len, uint32_t gateway)
+            : network_(ntohl(network)), prefix_len_(prefix_len) {
+            if (prefix_len < 16 || prefix_len > 30) throw std::runtime_error("Address pool prefix must be /16../30");
+            size_ = size_t(1) << (32 - prefix_len);
+            if (network_ & (size_ - 1)) throw std::runtime_error("Address pool network has host bits set");
+
+            slots_ = std::make_unique<Slot[]>(size_);
+            reserved_ = std::make_unique<bool[]>(size_);
+            reserved_[0] = true;         // Network address
+            reserved_[size_ - 1] = true; // Broadcast
+            if (auto offset = Offset(gateway)) reserved_[*offset] = true;
+            next_ = 1;
+            end_ = size_;
+        }
+
+        ~AddressPool() {
+            for (size_t i = 0; i < size_; ++i) delete slots_[i].load(std::memory_order_relaxed);
+        }
+
+        AddressPool(const AddressPool&) = delete;
+        AddressPool& operator=(const AddressPool&) = delete;
+
+        // Hand out addresses only from slice `part` of `parts` equal slices (a cluster node's share),
+        // so nodes never pick the same free address. Assign and a preferred address still reach
+        // the whole pool.
+        void Partition(size_t part, size_t parts) {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            begin_ = size_ * part / parts;
+            end_ = size_ * (part + 1) / parts;
+            next_ = begin_;
+        }
+
+        std::optional<Value> Find(uint32_t vip) const {
+            uint32_t offset = ntohl(vip) - network_; // Wraps for addresses below the subnet
+            if (offset >= size_) return std::nullopt;
+            Rcu::ReadGuard guard;
+            const Entry* entry = slots_[offset].load(std::memory_order_seq_cst);
+            if (!entry) return std::nullopt;
+            return entry->value;
+        }
+
+        // Take a free address, `preferred` if it is free and in the pool. nullopt when exhausted.
+        std::optional<uint32_t> Allocate(Value value, uint32_t preferred = 0) {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            auto offset = Offset(preferred);
+            if (!offset || slots_[*offset].load(std::memory_order_relaxed)) {
+                offset.reset();
+                // Next-fit from where the last allocation stopped
+                size_t span = end_ - begin_;
+                for (size_t i = 0; i < span && !offset; ++i) {
+                    size_t candidate = begin_ + (next_ - begin_ + i) % span;
+                    if (!reserved_[candidate] && !slots_[candidate].load(std::memory_order_relaxed)) offset = candidate;
+                }
+                if (!offset) return std::nullopt;
+                next_ = begin_ + (*offset + 1 - begin_) % span;
+            }
+            Publish(*offset, std::move(value));
+            return htonl(network_ + static_cast<uint32_t>(*offset));
+        }
+
+        // Bind `vip` to `value`, replacing any current holder. False if `vip` is not assignable.
+        bool Assign(uint32_t vip, Value value) {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            auto offset = Offset(vip);
+            if (!offset) return false;
+            Publish(*offset, std::move(value));
+            return true;
+        }
+
+        // Bind `vip` to `value` if it is free or still held by `expected`. False otherwise.
+        bool Replace(uint32_t vip, const Value& expected, Value value) {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            auto offset = Offset(vip);
+            if (!offset) return false;
+            const Entry* entry = slots_[*offset].load(std::memory_order_relaxed);
+            if (entry && !(entry->value == expected)) return false;
+            Publish(*offset, std::move(value));
+            return true;
+        }
+
+        bool Release(uint32_t vip) {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            auto offset = Offset(vip);
+            if (!offset) return false;
+            const Entry* old_entry = slots_[*offset].exchange(nullptr, std::memory_order_seq_cst);
+            if (!old_entry) return false;
+            Rcu::Retire([old_entry] { delete old_entry; });
+            return true;
+        }
+
+        // Visits every assigned address (vip in network byte order)
+        template <typename Fn>
+        void ForEach(Fn&& fn) const {
+            Rcu::ReadGuard guard;
+            for (size_t i = 0; i < size_; ++i) {
+                if (const Entry* entry = slots_[i].load(std::memory_order_seq_cst)) {
+                    fn(htonl(network_ + static_cast<uint32_t>(i)), entry->value);
+                }
+            }
+        }
+
+        uint8_t PrefixLength() const { return prefix_len_; }
+        uint32_t Network() const { return htonl(network_); }
+
+    private:
+        struct Entry {
+            Value value;
+        };
+        using Slot = std::atomic<const Entry*>;
+
+        // Host offset of an assignable address in the pool
+        std::optional<size_t> Offset(uint32_t vip) const {
+            uint32_t offset = ntohl(vip) - network_;
+            if (offset >= size_ || reserved_[offset]) return std::nullopt;
+            return offset;
+        }
+
+        void Publish(size_t offset, Value value) {
+            const Entry* old_entry = slots_[offset].exchange(new Entry{std::move(value)}, std::memory_order_seq_cst);
+            if (old_entry) Rcu::Retire([old_entry] { delete old_entry; });
+        }
+
+        uint32_t network_; // Host byte order
+        uint8_t prefix_len_;
+        size_t size_;
+        std::unique_ptr<Slot[]> slots_;
+        std::unique_ptr<bool[]> reserved_;
+        size_t next_;
+        size_t begin_ = 0; // Allocation slice, see Partition
+        size_t end_;
+        std::mutex write_mutex_;
+    };
+
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <thread>
+
+namespace vpn::utils {
+
+    // Pin a thread to one CPU core. Returns false if the platform refused (the thread keeps running unpinned).
+    bool PinThreadToCore(std::thread& thread, unsigned core);
+
+}
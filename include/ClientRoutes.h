@@ -0,0 +1,51 @@
+#pragma once
+#include "RoutingTable.h"
+#include "PacketBuffer.h"
+#include <cstdint>
+
+namespace vpn::protocol {
+
+    // The server's inner-address routing: destination prefix -> client VIP, longest match wins.
+    // The pool subnet routes every address to itself (next hop 0); peer routes add networks behind a
+    // client (site-to-site). The pool's IPv6 mirror (VIP6_PREFIX) is matched before the table: client
+    // addresses sit 13 levels deep in RoutingTable6, and a 12-byte compare is cheaper than that walk.
+    // Same threading rules as RoutingTable: build, then only read.
+    struct ClientRoutes {
+        utils::RoutingTable routes;
+        utils::RoutingTable6 routes6;
+
+        // VIP of the client that `ip` (network byte order) routes to, 0 if none
+        uint32_t ToVip(uint32_t ip) const;
+        uint32_t ToVip6(const uint8_t* ip) const;
+        // VIP of the client owning an inner packet's destination (or source) address, 0 if unroutable
+        uint32_t Route(const utils::PacketBuffer& packet, bool source) const;
+    };
+
+    // Decrements the TTL (IPv4, updating the checksum) or hop limit (IPv6) as the kernel's forwarding
+    // would. False if the packet would expire here: the kernel then has to answer it.
+    bool DecrementTtl(utils::PacketBuffer& packet);
+
+    // What the server does with an inner packet opened from a client
+    enum class Forward {
+        Drop,    // Its source does not route back to the client that sent it
+        Tun,     // Written to the TUN device, for the host
+        Hairpin, // Re-sealed for another client without the TUN device
+    };
+
+    // The ingress filter, then hairpinning. A client may only send from its own address and the
+    // networks routed to it, whichever way the packet would leave, so a spoofed packet never reaches
+    // another client. With `hairpin`, a packet for a client `connected(vip)` accepts goes straight to
+    // it (`dest_vip`) with its TTL decremented; anything else, including a packet that would expire,
+    // goes to the TUN device untouched.
+    template <typename Connected>
+    Forward ForwardFromClient(const ClientRoutes& routes, utils::PacketBuffer& packet, uint32_t from_vip, bool hairpin,
+                              Connected&& connected, uint32_t& dest_vip) {
+        uint32_t source_vip = routes.Route(packet, true);
+        if (!source_vip || source_vip != from_vip) return Forward::Drop;
+        if (!hairpin) return Forward::Tun;
+        dest_vip = routes.Route(packet, false);
+        if (!dest_vip || !connected(dest_vip) || !DecrementTtl(packet)) return Forward::Tun;
+        return Forward::Hairpin;
+    }
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "SessionStore.h"
+#include "UdpSocket.h"
+#include "ReplayWindow.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <optional>
+#include <functional>
+#include <thread>
+#include <cstdint>
+
+namespace vpn {
+
+    // Replication channel between the server processes (nodes) of a cluster. A node sends the
+    // sessions it establishes or updates to the other nodes, which then accept the sessions'
+    // packets too, and a heartbeat every second. UDP, best effort: a lost update is repaired by
+    // the next one, and a node that (re)starts is sent every session again (see SetJoinHandler).
+    //
+    // Datagram: [Magic "VPNC"][Node 4][Nonce 12][Body...][Tag 16], the body sealed with the
+    // cluster key (records carry session keys) and the header authenticated with it.
+    // Body: [Boot 8][Sequence 8][Type 1][Count 2][Items...]. Items are SessionStore records or
+    // session indexes. Boot (the sender's start time) and Sequence reject replayed datagrams.
+    class ClusterLink {
+    public:
+        struct Node {
+            uint32_t id = 0;          // 0 .. nodes-1
+            utils::Endpoint address = {};
+        };
+
+        using SessionsHandler = std::function<void(uint32_t node, const std::vector<SessionRecord>& records)>;
+        using RemovedHandler = std::function<void(uint32_t node, const std::vector<uint32_t>& indexes)>;
+        using NodeHandler = std::function<void(uint32_t node)>;
+
+        static constexpr size_t KEY_LEN = 32;
+        static constexpr int64_t HEARTBEAT_MS = 1000;
+        static constexpr int64_t TIMEOUT_MS = 3000; // Silent this long: the node counts as down
+
+        // Binds the port of `self`'s address. Throws if `nodes` has no entry for `self`.
+        ClusterLink(uint32_t self, std::vector<Node> nodes, const std::vector<uint8_t>& key);
+        ~ClusterLink();
+
+        ClusterLink(const ClusterLink&) = delete;
+        ClusterLink& operator=(const ClusterLink&) = delete;
+
+        // Handlers run on the link's thread; set them before Start
+        void SetSessionsHandler(SessionsHandler handler) { on_sessions_ = std::move(handler); }
+        void SetRemovedHandler(RemovedHandler handler) { on_removed_ = std::move(handler); }
+        void SetJoinHandler(NodeHandler handler) { on_join_ = std::move(handler); } // Node came up
+        void SetDownHandler(NodeHandler handler) { on_down_ = std::move(handler); } // Node went silent
+        void Start();
+
+        // To every other node, or to `node` only. Any thread.
+        void SendSessions(const std::vector<SessionRecord>& records, std::optional<uint32_t> node = std::nullopt);
+        void SendRemoved(const std::vector<uint32_t>& indexes);
+
+        uint32_t Self() const { return self_; }
+        uint32_t NodeCount() const { return static_cast<uint32_t>(nodes_.size()); }
+        bool Alive(uint32_t node) const;
+
+    private:
+        enum class Type : uint8_t { Heartbeat = 1, Sessions = 2, Removed = 3 };
+
+        struct Peer {
+            std::atomic<int64_t> last_heard{0}; // Steady clock, ms; 0 if never
+            uint64_t boot = 0;                  // Link thread only
+            std::unique_ptr<protocol::ReplayWindow> window;
+        };
+
+        void Run();
+        void Send(Type type, uint16_t count, const uint8_t* items, size_t size, std::optional<uint32_t> node);
+        void Receive(const std::vector<uint8_t>& datagram);
+
+        uint32_t self_;
+        std::vector<Node> nodes_;
+        std::vector<uint8_t> key_;
+        uint64_t boot_;
+        std::atomic<uint64_t> sequence_{0};
+        std::unique_ptr<Peer[]> peers_;
+        utils::UdpSocket socket_;
+        std::atomic<bool> running_{false};
+        std::thread thread_;
+
+        SessionsHandler on_sessions_;
+        RemovedHandler on_removed_;
+        NodeHandler on_join_;
+        NodeHandler on_down_;
+    };
+
+}
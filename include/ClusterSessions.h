@@ -0,0 +1,245 @@
+#pragma once
+#include "Cluster.h"
+#include "SessionStore.h"
+#include "Ticket.h"
+#include "ConcurrentMap.h"
+#include "AddressPool.h"
+#include "Rcu.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+namespace vpn {
+
+    // Added to the send counter of a session learned from another node. Must exceed what that node
+    // sends between two syncs, so packets sent from here after a failover are ahead of the peer's
+    // replay window rather than behind it.
+    // Rounded up to whole rounds of the nodes' nonce stripes (see ClusterCounterMargin), so a moved
+    // counter still tells which node sent last.
+    constexpr uint64_t CLUSTER_COUNTER_MARGIN = uint64_t(1) << 24;
+    // Added to the receive counter of a session first learned from another node, which may have
+    // received more since its record was taken: those packets must not be accepted here again. The
+    // window moves back to the exact point with the owner's next record, if nothing came here first.
+    // About a busy client's packets per sync interval.
+    constexpr uint64_t CLUSTER_RX_MARGIN = uint64_t(1) << 18;
+    constexpr auto CLUSTER_SYNC_INTERVAL = std::chrono::seconds(1);
+    // Another node's records showed it sending to a client this recently: that node is the client's
+    // sender, and this one leaves the client to it (see OtherNodeSending). Well inside the client's
+    // PEER_DEAD_SECONDS, so a skipped keepalive answer is never missed.
+    constexpr int64_t CLUSTER_SENDER_SECONDS = 3;
+
+    // CLUSTER_COUNTER_MARGIN for a cluster of `nodes`
+    uint64_t ClusterCounterMargin(uint32_t nodes);
+
+    // A session first learned from another node's record: counters moved ahead by the margins and
+    // nonces striped for node `self` of `nodes`. `provisional_rx` is where its receive window starts.
+    std::shared_ptr<Session> ReplicateSession(const SessionRecord& record, const protocol::TicketKey* ticket_key,
+                                              uint32_t self, uint32_t nodes, uint64_t& provisional_rx);
+    // A later record for a session held here: stays ahead of the sender's send counter, and stops
+    // accepting what the sender received (exactly, while the window is still provisional)
+    void UpdateReplica(Session& session, uint64_t& provisional_rx, const SessionRecord& record, uint32_t nodes);
+
+    // A server's sessions across the cluster: what a node tells the others about its sessions over
+    // the ClusterLink, and what it does with theirs. Every node holds every established session, so
+    // whichever node a client's packets reach can open them and answer.
+    //
+    // Only one node may send to a client at a time. Nodes send from disjoint nonce stripes a
+    // NONCE_BLOCK apart, and each moves its counter CLUSTER_COUNTER_MARGIN past the others' on
+    // every record, so packets from two nodes in turn land far outside the client's replay
+    // window and one node's are dropped. The node that sends a client's return traffic (whose
+    // TUN device the kernel routes it to) is that client's sender; the others stop answering its
+    // keepalives and hairpinning to it while OtherNodeSending.
+    //
+    // Context is the server's state for one session, held by shared_ptr in two tables: `sessions`
+    // by session index (a null context reserves an index) and `clients` by VIP. It has session,
+    // index, vip, last_seen, authenticated, synced_counter, synced_rx, synced_seen, provisional_rx,
+    // remote_counter, remote_sent, predecessor and taking_over, GetEndpoint and SetEndpoint (see
+    // vpn_server's ClientContext), and a constructor from (std::shared_ptr<Session>, const
+    // utils::Endpoint&, uint32_t vip).
+    template <typename Context>
+    class ClusterSessions {
+    public:
+        using Sessions = utils::ConcurrentMap<uint32_t, std::shared_ptr<Context>>;
+        using Clients = utils::AddressPool<std::shared_ptr<Context>>;
+
+        ClusterSessions(ClusterLink& link, Sessions& sessions, Clients& clients, const protocol::TicketKey* ticket_key)
+            : link_(link), sessions_(sessions), clients_(clients), ticket_key_(ticket_key) {}
+
+        ClusterLink& Link() const { return link_; }
+
+        // Nodes sending on the same session use disjoint nonce blocks (see Session::SetNonceStripe)
+        void SetNonceStripe(Session& session) const { session.SetNonceStripe(link_.Self(), link_.NodeCount()); }
+
+        // Tells the other nodes about a new or changed session
+        void Announce(Context& ctx) {
+            SessionRecord record = MakeRecord(ctx, 0);
+            MarkSynced(ctx, record.state.tx_nonce_counter, record.state.rx_nonce_next, ctx.last_seen.load(std::memory_order_relaxed));
+            link_.SendSessions({record});
+            sent_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Every CLUSTER_SYNC_INTERVAL: sessions that sent or received since they were last announced.
+        // The other nodes use the send counter to stay ahead of the peer's replay window, the receive
+        // window so packets received here cannot be replayed to them, and last_seen to tell idle
+        // sessions. Returns the records sent.
+        size_t Sync() {
+            std::vector<SessionRecord> records;
+            sessions_.ForEach([&](uint32_t, const std::shared_ptr<Context>& ctx) {
+                if (!ctx || !ctx->session->IsEstablished() || ctx->taking_over) return;
+                uint64_t counter = ctx->session->TxCounter();
+                uint64_t rx = ctx->session->RxNext();
+                int64_t seen = ctx->last_seen.load(std::memory_order_relaxed);
+                if (counter == ctx->synced_counter.load(std::memory_order_relaxed) && rx == ctx->synced_rx.load(std::memory_order_relaxed) &&
+                    seen == ctx->synced_seen.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                MarkSynced(*ctx, counter, rx, seen);
+                records.push_back(MakeRecord(*ctx, 0));
+            });
+            if (records.empty()) return 0;
+            link_.SendSessions(records);
+            sent_.fetch_add(records.size(), std::memory_order_relaxed);
+            return records.size();
+        }
+
+        // To a node that came up: every established session. Returns the records sent.
+        size_t SendAll(uint32_t node) {
+            std::vector<SessionRecord> records;
+            sessions_.ForEach([&](uint32_t, const std::shared_ptr<Context>& ctx) {
+                if (ctx && ctx->session->IsEstablished() && !ctx->taking_over) records.push_back(MakeRecord(*ctx, 0));
+            });
+            link_.SendSessions(records, node);
+            sent_.fetch_add(records.size(), std::memory_order_relaxed);
+            return records.size();
+        }
+
+        // Sessions dropped here
+        void SendRemoved(const std::vector<uint32_t>& indexes) { link_.SendRemoved(indexes); }
+
+        // Link thread: sessions established or updated on another node. Returns the ones it
+        // replicated here for the first time.
+        std::vector<std::shared_ptr<Context>> OnSessions(const std::vector<SessionRecord>& records) {
+            received_.fetch_add(records.size(), std::memory_order_relaxed);
+            std::vector<std::shared_ptr<Context>> replicated;
+            for (const auto& record : records) {
+                utils::Endpoint endpoint = record.GetEndpoint();
+                auto entry = sessions_.Find(record.state.index);
+                if (entry && !*entry) continue; // Index reserved by a handshake here; the client will pick one node
+                std::shared_ptr<Context> ctx = entry ? *entry : nullptr;
+
+                if (ctx) {
+                    NoteSender(*ctx, record.state.tx_nonce_counter);
+                    UpdateReplica(*ctx->session, ctx->provisional_rx, record, link_.NodeCount());
+                    utils::Rcu::ReadGuard guard;
+                    if (!SameEndpoint(ctx->GetEndpoint(), endpoint)) ctx->SetEndpoint(endpoint);
+                } else {
+                    uint64_t provisional_rx = 0;
+                    auto session = ReplicateSession(record, ticket_key_, link_.Self(), link_.NodeCount(), provisional_rx);
+                    ctx = std::make_shared<Context>(session, endpoint, record.virtual_ip);
+                    ctx->authenticated = true;
+                    ctx->provisional_rx = provisional_rx;
+                    NoteSender(*ctx, record.state.tx_nonce_counter);
+                    if (!sessions_.TryInsert(ctx->index, ctx)) continue;
+                    replicated.push_back(ctx);
+                }
+
+                // Received from the owner, so neither counts as a change to announce back
+                ctx->last_seen.store(Now(), std::memory_order_relaxed);
+                MarkSynced(*ctx, ctx->session->TxCounter(), ctx->session->RxNext(), ctx->last_seen.load(std::memory_order_relaxed));
+                if (ctx->vip) {
+                    auto holder = clients_.Find(ctx->vip);
+                    if (!holder || *holder != ctx) clients_.Assign(ctx->vip, ctx);
+                }
+            }
+            return replicated;
+        }
+
+        // Link thread: sessions another node dropped (resumed elsewhere, idle, or their address was reclaimed)
+        void OnRemoved(const std::vector<uint32_t>& indexes) {
+            for (uint32_t index : indexes) {
+                auto entry = sessions_.Find(index);
+                if (!entry || !*entry) continue;
+                std::shared_ptr<Context> ctx = *entry;
+                sessions_.Erase(index);
+                auto holder = ctx->vip ? clients_.Find(ctx->vip) : std::nullopt;
+                if (holder && *holder == ctx) clients_.Release(ctx->vip);
+            }
+        }
+
+        // Another node sent to the client in the last CLUSTER_SENDER_SECONDS. Any thread.
+        bool OtherNodeSending(const Context& ctx) const {
+            int64_t sent = ctx.remote_sent.load(std::memory_order_relaxed);
+            return sent && Now() - sent < CLUSTER_SENDER_SECONDS;
+        }
+
+        // Session records exchanged with the other nodes
+        uint64_t RecordsSent() const { return sent_.load(std::memory_order_relaxed); }
+        uint64_t RecordsReceived() const { return received_.load(std::memory_order_relaxed); }
+
+        // As saved in a snapshot or sent to the other nodes, the send counter `counter_margin` ahead
+        static SessionRecord MakeRecord(const Context& ctx, uint64_t counter_margin) {
+            utils::Rcu::ReadGuard guard;
+            SessionRecord record;
+            record.virtual_ip = ctx.vip;
+            record.SetEndpoint(ctx.GetEndpoint());
+            record.state = ctx.session->Export(counter_margin);
+            return record;
+        }
+
+        // Steady clock, as Context::last_seen counts it
+        static int64_t Now() {
+            return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+    private:
+        // A record's send counter moved on, and the last counter below it is in another node's
+        // stripe: that node sent to the client since the previous record
+        void NoteSender(Context& ctx, uint64_t counter) {
+            if (counter <= ctx.remote_counter) return;
+            ctx.remote_counter = counter;
+            if (Session::CounterStripe(counter, link_.NodeCount()) != link_.Self()) ctx.remote_sent.store(Now(), std::memory_order_relaxed);
+        }
+
+        static bool SameEndpoint(const utils::Endpoint& a, const utils::Endpoint& b) {
+            return a.sin6_port == b.sin6_port && std::memcmp(&a.sin6_addr, &b.sin6_addr, sizeof(a.sin6_addr)) == 0;
+        }
+
+        static void MarkSynced(Context& ctx, uint64_t counter, uint64_t rx, int64_t seen) {
+            ctx.synced_counter.store(counter, std::memory_order_relaxed);
+            ctx.synced_rx.store(rx, std::memory_order_relaxed);
+            ctx.synced_seen.store(seen, std::memory_order_relaxed);
+        }
+
+        ClusterLink& link_;
+        Sessions& sessions_;
+        Clients& clients_;
+        const protocol::TicketKey* ticket_key_;
+        std::atomic<uint64_t> sent_{0};
+        std::atomic<uint64_t> received_{0};
+    };
+
+    // First authenticated packet of a session resumed from one that still held its address: only the
+    // client that redeemed the ticket can have sealed it, so the address (and the routes through it)
+    // moves over and the predecessor is dropped, here and, with a `cluster`, on the other nodes. False
+    // if the predecessor is gone meanwhile (its address may be another client's by now); this session
+    // is then dropped too, and the client has to reconnect.
+    template <typename Context>
+    bool TakeOver(utils::ConcurrentMap<uint32_t, std::shared_ptr<Context>>& sessions, utils::AddressPool<std::shared_ptr<Context>>& clients,
+                  const std::shared_ptr<Context>& ctx, ClusterSessions<Context>* cluster) {
+        std::shared_ptr<Context> previous = ctx->predecessor.lock();
+        if (!previous || !clients.Replace(ctx->vip, previous, ctx)) {
+            sessions.Erase(ctx->index);
+            return false;
+        }
+        sessions.Erase(previous->index);
+        if (cluster) {
+            cluster->SendRemoved({previous->index});
+            cluster->Announce(*ctx);
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include "Rcu.h"
+#include <unordered_map>
+#include <optional>
+#include <atomic>
+#include <mutex>
+#include <array>
+#include <functional>
+
+namespace vpn::utils {
+
+    // Sharded copy-on-write hash map with RCU-protected, wait-free lookups.
+    // Each shard publishes an immutable table through an atomic pointer. Writers serialize per shard,
+    // copy the shard's table, modify the copy and swap it in, so a lookup never waits for an insert.
+    // Meant for read-mostly maps such as session tables, where writes happen once per handshake.
+    template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>, size_t Shards = 64>
+    class ConcurrentMap {
+    public:
+        using Table = std::unordered_map<Key, Value, Hash, KeyEqual>;
+
+        ConcurrentMap() {
+            for (auto& shard : shards_) shard.table.store(new Table(), std::memory_order_relaxed);
+        }
+
+        ~ConcurrentMap() {
+            for (auto& shard : shards_) delete shard.table.load(std::memory_order_relaxed);
+        }
+
+        ConcurrentMap(const ConcurrentMap&) = delete;
+        ConcurrentMap& operator=(const ConcurrentMap&) = delete;
+
+        std::optional<Value> Find(const Key& key) const {
+            Rcu::ReadGuard guard;
+            const Table* table = ShardFor(key).table.load(std::memory_order_seq_cst);
+            auto it = table->find(key);
+            if (it == table->end()) return std::nullopt;
+            return it->second;
+        }
+
+        // Insert or replace
+        void Insert(const Key& key, Value value) {
+            Update(key, [&](Table& table) { table.insert_or_assign(key, std::move(value)); });
+        }
+
+        // Insert unless `key` is present; false if it was
+        bool TryInsert(const Key& key, Value value) {
+            bool inserted = false;
+            Update(key, [&](Table& table) { inserted = table.try_emplace(key, std::move(value)).second; });
+            return inserted;
+        }
+
+        bool Erase(const Key& key) {
+            bool erased = false;
+            Update(key, [&](Table& table) { erased = table.erase(key) > 0; });
+            return erased;
+        }
+
+        // Visits a consistent snapshot of each shard (not of the whole map)
+        template <typename Fn>
+        void ForEach(Fn&& fn) const {
+            Rcu::ReadGuard guard;
+            for (const auto& shard : shards_) {
+                for (const auto& [key, value] : *shard.table.load(std::memory_order_seq_cst)) fn(key, value);
+            }
+        }
+
+        size_t Size() const {
+            Rcu::ReadGuard guard;
+            size_t size = 0;
+            for (const auto& shard : shards_) size += shard.table.load(std::memory_order_seq_cst)->size();
+            return size;
+        }
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<const Table*> table;
+            std::mutex write_mutex;
+        };
+
+        // Shard on mixed high bits so keys within a shard still spread over the table's buckets
+        static size_t ShardIndex(const Key& key) {
+            uint64_t h = static_cast<uint64_t>(Hash{}(key)) * 0x9E3779B97F4A7C15ull;
+            return static_cast<size_t>(h >> 32) % Shards;
+        }
+
+        Shard& ShardFor(const Key& key) { return shards_[ShardIndex(key)]; }
+        const Shard& ShardFor(const Key& key) const { return shards_[ShardIndex(key)]; }
+
+        template <typename Fn>
+        void Update(const Key& key, Fn&& modify) {
+            Shard& shard = ShardFor(key);
+            std::lock_guard<std::mutex> lock(shard.write_mutex);
+
+            const Table* old_table = shard.table.load(std::memory_order_relaxed);
+            auto* new_table = new Table(*old_table);
+            modify(*new_table);
+            shard.table.store(new_table, std::memory_order_seq_cst);
+
+            Rcu::Retire([old_table] { delete old_table; });
+        }
+
+        std::array<Shard, Shards> shards_;
+    };
+
+}
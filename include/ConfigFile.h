@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vpn::utils {
+
+    // Line-based configuration file:
+    //
+    //   # comment
+    //   key = value
+    //   [section argument]
+    //   key = value
+    //
+    // Settings before the first header belong to an unnamed section. Keys may repeat (e.g. one
+    // `route` per line). Errors are std::runtime_error naming the file and line.
+    class ConfigFile {
+    public:
+        struct Setting {
+            std::string key;
+            std::string value;
+            int line = 0;
+        };
+
+        struct Section {
+            std::string name;     // Empty for the settings before the first header
+            std::string argument; // What follows the name in the header, may be empty
+            int line = 0;
+            std::vector<Setting> settings;
+        };
+
+        static ConfigFile Load(const std::string& path);
+        static ConfigFile Parse(const std::string& text, const std::string& origin);
+
+        const std::vector<Section>& Sections() const { return sections_; }
+
+        // Typed values; throw naming the setting's line
+        uint64_t Unsigned(const Setting& setting, uint64_t max) const;
+        double Number(const Setting& setting) const;
+        bool Bool(const Setting& setting) const;
+        [[noreturn]] void Fail(int line, const std::string& message) const;
+
+    private:
+        std::string origin_;
+        std::vector<Section> sections_;
+    };
+
+}
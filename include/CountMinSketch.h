@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace vpn::utils {
+
+    // Approximate event counts per key in fixed memory, however many keys there are: DEPTH rows of
+    // `width` counters, a 128-bit key (e.g. an IPv6 address) hashed to one counter in each row.
+    // The estimate is the smallest of a key's counters, never below its true count; it is higher
+    // only if the key collides in every row. Rows are seeded, so keys cannot be picked to collide
+    // without knowing the seed, and updates are conservative (only the smallest counters grow),
+    // which keeps overestimates down.
+    // Counts decay: all counters halve every `half_life`, so an estimate covers roughly the last
+    // two half-lives and a steady rate r per half-life settles at 2r.
+    // Lock-free. An Add racing with a decay may be lost; that is fine for rate limiting.
+    class CountMinSketch {
+    public:
+        static constexpr size_t DEPTH = 4;
+
+        // `width` is rounded up to a power of two. Times are in ns on any monotonic clock.
+        CountMinSketch(size_t width, int64_t half_life_ns, uint64_t seed) : half_life_(half_life_ns) {
+            size_t rounded = 1;
+            while (rounded < width) rounded <<= 1;
+            mask_ = rounded - 1;
+            counters_ = std::make_unique<std::atomic<uint32_t>[]>(DEPTH * rounded);
+            for (size_t row = 0; row < DEPTH; ++row) seeds_[row] = Mix(seed + row + 1);
+        }
+
+        // Counts one event for the key (high, low) and returns its estimate, this event included
+        uint32_t Add(uint64_t high, uint64_t low, int64_t now) {
+            Decay(now);
+            std::atomic<uint32_t>* slots[DEPTH];
+            uint32_t estimate = UINT32_MAX;
+            for (size_t row = 0; row < DEPTH; ++row) {
+                slots[row] = &counters_[row * (mask_ + 1) + (Mix(Mix(high ^ seeds_[row]) ^ low) & mask_)];
+                uint32_t count = slots[row]->load(std::memory_order_relaxed);
+                if (count < estimate) estimate = count;
+            }
+            if (estimate == UINT32_MAX) return estimate;
+            uint32_t next = estimate + 1;
+            for (auto* slot : slots) {
+                uint32_t count = slot->load(std::memory_order_relaxed);
+                while (count < next && !slot->compare_exchange_weak(count, next, std::memory_order_relaxed)) {}
+            }
+            return next;
+        }
+
+        size_t MemoryBytes() const { return DEPTH * (mask_ + 1) * sizeof(uint32_t); }
+
+    private:
+        // SplitMix64 finalizer
+        static uint64_t Mix(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xBF58476D1CE4E5B9ull;
+            x ^= x >> 27;
+            x *= 0x94D049BB133111EBull;
+            return x ^ (x >> 31);
+        }
+
+        // The first caller past the deadline halves every counter (once per half-life elapsed)
+        void Decay(int64_t now) {
+            int64_t deadline = next_decay_.load(std::memory_order_relaxed);
+            if (now < deadline) return;
+            int64_t halvings = deadline ? (now - deadline) / half_life_ + 1 : 0;
+            if (!next_decay_.compare_exchange_strong(deadline, now + half_life_, std::memory_order_relaxed) || !halvings) return;
+            unsigned shift = halvings < 32 ? static_cast<unsigned>(halvings) : 32;
+            for (size_t i = 0; i < DEPTH * (mask_ + 1); ++i) {
+                uint32_t count = counters_[i].load(std::memory_order_relaxed);
+                if (count) counters_[i].store(shift < 32 ? count >> shift : 0, std::memory_order_relaxed);
+            }
+        }
+
+        size_t mask_;
+        int64_t half_life_;
+        uint64_t seeds_[DEPTH];
+        std::unique_ptr<std::atomic<uint32_t>[]> counters_;
+        std::atomic<int64_t> next_decay_{0}; // 0: not started
+    };
+
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include "TokenBucket.h"
+#include "Qos.h"
+#include "PacketBuffer.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+
+namespace vpn::utils {
+
+    // Per-client fair queuing with rate limits and service classes, for one sending thread
+    // (not thread-safe, except Stats).
+    // Packets queue per class (see Qos.h), and within a class per flow (client), before they are
+    // sealed: the caller seals each as it leaves, so nonce counters follow the order packets are
+    // sent in however the scheduler reorders them, and a packet that is shaped out never uses one.
+    // Realtime is served first, always; the other classes take turns, Interactive:BestEffort:Bulk
+    // sending 8:4:1 packets per round. Within a class, backlogged flows are served deficit round
+    // robin, a quantum of bytes per turn, so a bulk sender delays anyone else by at most one round.
+    // A flow whose TokenBucket is empty is skipped until it refills: its packets wait (shaping)
+    // rather than being dropped, up to `flow_limit` queued packets per class, after which Admit
+    // refuses more.
+    // Queues are rings that only grow and a flow's entry outlives its backlog, so once every
+    // flow has been seen (flows are client VIPs, bounded by the pool) queuing allocates nothing.
+    class EgressScheduler {
+    public:
+        struct Packet {
+            PacketBuffer data;
+            uint32_t flow = 0;
+            TrafficClass cls = TrafficClass::BestEffort;
+            bool traced = false;  // Sampled for the packet trace (see Trace.h)
+            int64_t enqueued = 0; // TokenBucket::Now() clock
+        };
+
+        // Written by the owning thread, readable from any thread
+        struct ClassStats {
+            std::atomic<uint64_t> packets{0};          // Sent
+            std::atomic<uint64_t> drops{0};            // Refused by Admit
+            std::atomic<uint64_t> depth{0};            // Queued now
+            std::atomic<uint64_t> sojourn_total_ns{0}; // Summed over sent packets
+            std::atomic<uint64_t> sojourn_max_ns{0};   // Largest since the reader last reset it
+        };
+
+        // `overhead`: bytes each packet gains when it is sealed after Dequeue, charged to its
+        // flow's rate limit and quantum along with the packet
+        explicit EgressScheduler(size_t quantum = 2048, size_t flow_limit = 512, size_t overhead = 0)
+            : quantum_(quantum), flow_limit_(flow_limit), overhead_(overhead) {}
+
+        // Check before queuing a packet; a refusal counts as a drop
+        bool Admit(uint32_t flow, TrafficClass cls);
+
+        // `bucket` is shared with the flow's other senders; null means unlimited
+        void Enqueue(uint32_t flow, TrafficClass cls, const std::shared_ptr<TokenBucket>& bucket,
+                     PacketBuffer&& data, bool traced, int64_t now);
+
+        // Move up to `max` packets that may leave at `now` (TokenBucket::Now) to the back of `out`.
+        // Returns how many were moved.
+        size_t Dequeue(std::vector<Packet>& out, size_t max, int64_t now);
+
+        // When a held-back packet may leave next; INT64_MAX if none is waiting on a rate limit
+        int64_t NextReadyAt() const;
+
+        bool Empty() const;
+        ClassStats& Stats(TrafficClass cls) { return stats_[static_cast<size_t>(cls)]; }
+
+    private:
+        // FIFO on a power-of-two ring
+        template <typename T>
+        class Ring {
+        public:
+            bool empty() const { return head_ == tail_; }
+            size_t size() const { return tail_ - head_; }
+            T& front() { return items_[head_ & (items_.size() - 1)]; }
+            const T& front() const { return items_[head_ & (items_.size() - 1)]; }
+            void push_back(T item) {
+                if (size() == items_.size()) Grow();
+                items_[tail_++ & (items_.size() - 1)] = std::move(item);
+            }
+            void pop_front() { items_[head_++ & (items_.size() - 1)] = T(); } // Drops what the slot held
+
+        private:
+            void Grow() {
+                std::vector<T> grown(items_.empty() ? 16 : items_.size() * 2);
+                size_t count = size();
+                for (size_t i = 0; i < count; ++i) grown[i] = std::move(items_[(head_ + i) & (items_.size() - 1)]);
+                items_.swap(grown);
+                head_ = 0;
+                tail_ = count;
+            }
+
+            std::vector<T> items_;
+            size_t head_ = 0;
+            size_t tail_ = 0;
+        };
+
+        struct Flow {
+            Ring<Packet> queue;
+            std::shared_ptr<TokenBucket> bucket;
+            size_t deficit = 0;
+            bool active = false;  // Backlogged, in the round-robin order
+            bool in_turn = false; // Quantum already granted for the current turn
+        };
+
+        // Deficit round robin between the flows of one class
+        struct ClassQueue {
+            std::unordered_map<uint32_t, Flow> flows; // Every flow seen, backlogged or not
+            Ring<uint32_t> active;                    // Round-robin order of the backlogged ones
+        };
+
+        size_t DequeueClass(size_t cls, std::vector<Packet>& out, size_t max, int64_t now);
+
+        size_t quantum_;
+        size_t flow_limit_;
+        size_t overhead_;
+        ClassQueue classes_[TRAFFIC_CLASS_COUNT];
+        ClassStats stats_[TRAFFIC_CLASS_COUNT];
+        size_t turn_ = 1;       // Weighted class whose turn it is
+        size_t turn_sent_ = 0;  // Packets it has sent this turn
+    };
+
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include "UdpSocket.h"
+#include "PacketBuffer.h"
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <chrono>
+
+namespace vpn::utils {
+
+    // Per-thread packet loop. The server runs one per worker, driving the worker's socket and TUN
+    // queue; the client runs one for its socket and TUN device.
+    // Handlers run on the loop thread. SendTo and SendBatch may only be called from the loop thread
+    // (SendTo can be batched with other submissions); other threads send with UdpSocket directly.
+    // Each datagram is handed over in its own pool buffer, which the handler may decrypt in place
+    // and move out to keep.
+    class EventLoop {
+    public:
+        using DatagramHandler = std::function<void(PacketBuffer& packet, const Endpoint& sender)>;
+
+        // Syscall accounting, to compare backends (vpn_server --stats-interval and its metrics,
+        // bench_event_loop). Kept by the loop thread, read from any thread.
+        struct Stats {
+            uint64_t packets_received = 0;
+            uint64_t packets_sent = 0;
+            uint64_t syscalls = 0;
+        };
+
+        virtual ~EventLoop() = default;
+
+        // Deliver every datagram received on `socket` to `handler`
+        virtual void AddSocket(UdpSocket& socket, DatagramHandler handler) = 0;
+
+        // Call `handler` whenever the POSIX descriptor `fd` is readable (e.g. a TUN queue, see
+        // TunDevice::ReadQueue). Level-triggered: the handler reads what it can without blocking,
+        // and is called again if something is left.
+        using ReadableHandler = std::function<void()>;
+        virtual void AddReadable(int fd, ReadableHandler handler) = 0;
+
+        // Queue a datagram for sending from the loop thread
+        virtual void SendTo(UdpSocket& socket, const Endpoint& dest, const std::vector<uint8_t>& data) = 0;
+
+        // Send a burst from the loop thread, with the socket's batched send (sendmmsg and GSO on
+        // Linux): one syscall moves the burst, and the buffers need not outlive the call.
+        // Returns how many were sent.
+        int SendBatch(UdpSocket& socket, const Datagram* datagrams, size_t count) {
+            int sent = socket.SendBatch(datagrams, count);
+            Count(stats_.packets_sent, sent > 0 ? static_cast<uint64_t>(sent) : 0);
+            Count(stats_.syscalls);
+            return sent;
+        }
+
+        // Process events until Stop() (callable from any thread)
+        virtual void Run() = 0;
+        virtual void Stop() = 0;
+
+        // Called on the loop thread after each burst of handler calls, e.g. to flush TUN writes
+        // the handlers accumulated so they can be coalesced
+        using BatchEndHandler = std::function<void()>;
+        void SetBatchEndHandler(BatchEndHandler handler) { batch_end_ = std::move(handler); }
+
+        // Called on the loop thread before each wait. Returns how long the wait may last (capped at
+        // MAX_WAIT), so work held back for later (shaping, handshake retries) goes out on time.
+        using TimerHandler = std::function<std::chrono::microseconds()>;
+        void SetTimerHandler(TimerHandler handler) { timer_ = std::move(handler); }
+        static constexpr std::chrono::microseconds MAX_WAIT = std::chrono::milliseconds(100);
+
+        virtual const char* Name() const = 0;
+        Stats GetStats() const {
+            return {stats_.packets_received.load(std::memory_order_relaxed), stats_.packets_sent.load(std::memory_order_relaxed),
+                    stats_.syscalls.load(std::memory_order_relaxed)};
+        }
+
+        // io_uring where the kernel allows it, blocking I/O otherwise (or if VPN_EVENT_LOOP=blocking)
+        static std::unique_ptr<EventLoop> Create();
+        static std::unique_ptr<EventLoop> CreateBlocking();
+        static std::unique_ptr<EventLoop> CreateIoUring(); // nullptr if unavailable
+
+    protected:
+        void EndBatch() {
+            if (batch_end_) batch_end_();
+        }
+
+        // How long the next wait may last
+        std::chrono::microseconds NextWait() {
+            if (!timer_) return MAX_WAIT;
+            auto wait = timer_();
+            if (wait < std::chrono::microseconds(0)) return std::chrono::microseconds(0);
+            return wait < MAX_WAIT ? wait : MAX_WAIT;
+        }
+
+        struct Counters {
+            std::atomic<uint64_t> packets_received = 0;
+            std::atomic<uint64_t> packets_sent = 0;
+            std::atomic<uint64_t> syscalls = 0;
+        };
+        // Only the loop thread writes, so no locked add: readers see whole values
+        static void Count(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+            counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        Counters stats_;
+        BatchEndHandler batch_end_;
+        TimerHandler timer_;
+    };
+
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace vpn::utils {
+
+    // Cycle counter for timing the data path: RDTSC on x86 (invariant on every CPU we run on),
+    // the virtual counter on AArch64, steady_clock elsewhere. Only differences are meaningful.
+    class Tsc {
+    public:
+        static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+            return __rdtsc();
+#elif defined(__aarch64__)
+            uint64_t ticks;
+            asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+            return ticks;
+#else
+            return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+        }
+
+        // Measured against steady_clock on first use (which takes ~20ms)
+        static double NanosPerTick();
+    };
+
+    // HDR-style log-linear histogram: exact below 32, then 32 buckets per power of two, so any
+    // value is reported within 3%. Values of 2^40 ticks (minutes) and more land in the last bucket.
+    // Written by one thread, read by any.
+    class LatencyHistogram {
+    public:
+        static constexpr unsigned SUB_BUCKET_BITS = 5;
+        static constexpr unsigned MAX_BITS = 40;
+        static constexpr size_t BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+        static size_t BucketOf(uint64_t value) {
+            if (value >> MAX_BITS) return BUCKETS - 1;
+            if (value < (1u << SUB_BUCKET_BITS)) return static_cast<size_t>(value);
+            unsigned top = 63 - static_cast<unsigned>(std::countl_zero(value));
+            unsigned shift = top - SUB_BUCKET_BITS;
+            return ((top - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + ((value >> shift) & ((1u << SUB_BUCKET_BITS) - 1));
+        }
+        // Largest value that falls in `bucket`
+        static uint64_t BucketMax(size_t bucket);
+
+        // Single writer: a plain load and store, no locked instruction
+        void Record(uint64_t value) {
+            auto& count = counts_[BucketOf(value)];
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        // Adds the counts to `counts` (BUCKETS long); may run while the writer records
+        void AddTo(std::vector<uint64_t>& counts) const;
+
+        // Upper bound of the bucket holding the q-quantile (0 < q <= 1) of `counts`, 0 if empty
+        static uint64_t Quantile(const std::vector<uint64_t>& counts, double q);
+
+    private:
+        std::atomic<uint64_t> counts_[BUCKETS] = {};
+    };
+
+    // Stage boundaries of the forwarding pipeline. TunRead, Send and TunWrite time one batch (a
+    // drain of a TUN queue, one SendBatch, one coalesced TUN write); the others time one packet.
+    enum class Stage : uint8_t {
+        TunRead,       // TUN -> UDP: reading and splitting a TUN queue's packets
+        Route,         // Route, classify and find the destination's session
+        Encrypt,
+        Send,
+        SessionLookup, // UDP -> TUN: find the sender's session
+        Decrypt,
+        TunWrite,
+    };
+    constexpr size_t STAGE_COUNT = 7;
+
+    const char* StageName(Stage stage);
+
+    // Per-stage latency histograms, one set per recording thread (so per core on the data path),
+    // merged when read. Exported through Metrics as vpn_stage_latency_seconds{stage,quantile}.
+    class StageLatency {
+    public:
+        static void Record(Stage stage, uint64_t ticks) {
+            thread_local constinit LatencyHistogram* histograms = nullptr;
+            if (!histograms) histograms = AddThread();
+            histograms[static_cast<size_t>(stage)].Record(ticks);
+        }
+
+        // Counts merged over every thread since startup, BUCKETS long, in ticks
+        static std::vector<uint64_t> Merge(Stage stage);
+        // q-quantile of merged counts in nanoseconds
+        static double QuantileNanos(const std::vector<uint64_t>& counts, double q);
+
+    private:
+        static LatencyHistogram* AddThread();
+    };
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace vpn::utils {
+
+    // Memory mapping of a whole file
+    class MappedFile {
+    public:
+        // Create (or truncate) the file to `size` bytes and map it read/write
+        MappedFile(const std::string& path, size_t size);
+        // Map an existing file read-only
+        explicit MappedFile(const std::string& path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        uint8_t* Data() { return data_; }
+        const uint8_t* Data() const { return data_; }
+        size_t Size() const { return size_; }
+
+        // Write dirty pages back to disk
+        void Flush();
+
+    private:
+        void Map(bool writable);
+
+        uint8_t* data_ = nullptr;
+        size_t size_ = 0;
+#ifdef _WIN32
+        void* file_ = nullptr;    // HANDLE
+        void* mapping_ = nullptr; // HANDLE
+#else
+        int fd_ = -1;
+#endif
+    };
+
+}
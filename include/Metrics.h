@@ -0,0 +1,90 @@
+#pragma once
+#include "UdpSocket.h"
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace vpn::utils {
+
+    // Process-wide counters and gauges, exported in the Prometheus text format.
+    // Every metric has one slot per shard, and each thread updates the shard it was given on its
+    // first update (threads on the data path are pinned one per core, so a shard is a core's):
+    // Add is one relaxed atomic add on a cache line no other core writes. Render sums the shards.
+    // Metrics are registered once, usually at static initialization, and live for the process.
+    class Metrics {
+    public:
+        static constexpr size_t MAX_SERIES = 256;
+        static constexpr size_t MAX_SHARDS = 64;
+
+        class Counter {
+        public:
+            void Add(uint64_t n = 1) const { Slot(index_).fetch_add(static_cast<int64_t>(n), std::memory_order_relaxed); }
+
+        private:
+            friend class Metrics;
+            explicit Counter(size_t index) : index_(index) {}
+            size_t index_;
+        };
+
+        // Summed across shards, so one thread may add what another subtracts
+        class Gauge {
+        public:
+            void Add(int64_t n) const { Slot(index_).fetch_add(n, std::memory_order_relaxed); }
+            void Sub(int64_t n) const { Add(-n); }
+
+        private:
+            friend class Metrics;
+            explicit Gauge(size_t index) : index_(index) {}
+            size_t index_;
+        };
+
+        // `name` as in Prometheus (vpn_packets_total); `labels` is the inside of the braces, e.g.
+        // direction="rx", or empty. Series sharing a name must be registered with the same help.
+        static Counter AddCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+        static Gauge AddGauge(const std::string& name, const std::string& help, const std::string& labels = "");
+        // Read when rendered, for values kept elsewhere (queue depths, pool sizes)
+        enum class Type { Counter, Gauge };
+        static void AddCallback(const std::string& name, const std::string& help, Type type,
+                                const std::string& labels, std::function<double()> read);
+
+        // Text exposition format 0.0.4
+        static std::string Render();
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<int64_t> values[MAX_SERIES];
+        };
+        static inline Shard shards_[MAX_SHARDS];
+
+        static size_t AssignShard();
+        static std::atomic<int64_t>& Slot(size_t index) {
+            thread_local constinit size_t shard = MAX_SHARDS;
+            if (shard == MAX_SHARDS) shard = AssignShard();
+            return shards_[shard].values[index];
+        }
+    };
+
+    // Serves Metrics::Render over HTTP on a TCP address or a Unix socket, one scrape at a time
+    class MetricsExporter {
+    public:
+        // "9100" (loopback), "127.0.0.1:9100", "[::1]:9100", or "unix:/run/vpn/metrics.sock".
+        // Binds immediately; throws std::runtime_error if that fails.
+        explicit MetricsExporter(const std::string& address);
+        ~MetricsExporter();
+
+        MetricsExporter(const MetricsExporter&) = delete;
+        MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    private:
+        void Serve();
+
+        SocketHandle listener_;
+        std::string unix_path_; // Removed again on destruction
+        std::atomic<bool> running_ = true;
+        std::thread thread_;
+    };
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace vpn::utils {
+
+    // Packet memory for the data path. Buffers have a fixed size and come from large slabs that are
+    // never given back; free ones are cached per thread and moved to and from a global free list in
+    // batches, so a steady packet rate allocates nothing.
+    // Data sits after some headroom and leaves tailroom behind it: the Data header and AEAD tag are
+    // added and stripped in place, and a packet goes from receive to send in the buffer it was
+    // read into. A packet too large for a pooled buffer (jumbo MTU) gets a heap buffer of its own.
+    //
+    // PacketBuffer is a ref-counted handle. Copies share the buffer; the last one to go returns it
+    // to the pool of the thread it goes on. Only modify a buffer through its only handle.
+    class PacketBuffer {
+    public:
+        static constexpr size_t BUFFER_SIZE = 2048; // Pooled buffer, header included
+        static constexpr size_t HEADROOM = 64;      // Default room in front of the data
+        static constexpr size_t TAILROOM = 32;      // Room always left behind the data
+
+        PacketBuffer() = default;
+        PacketBuffer(const PacketBuffer& other) : block_(other.block_) {
+            if (block_) block_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        PacketBuffer(PacketBuffer&& other) noexcept : block_(other.block_) { other.block_ = nullptr; }
+        PacketBuffer& operator=(const PacketBuffer& other) {
+            PacketBuffer(other).Swap(*this);
+            return *this;
+        }
+        PacketBuffer& operator=(PacketBuffer&& other) noexcept {
+            PacketBuffer(static_cast<PacketBuffer&&>(other)).Swap(*this);
+            return *this;
+        }
+        ~PacketBuffer() { Reset(); }
+
+        // `length` bytes of uninitialized data, `headroom` bytes in
+        static PacketBuffer Allocate(size_t length, size_t headroom = HEADROOM);
+        static PacketBuffer Copy(const uint8_t* data, size_t length, size_t headroom = HEADROOM);
+
+        explicit operator bool() const { return block_ != nullptr; }
+        void Reset() {
+            if (block_ && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) Release(block_);
+            block_ = nullptr;
+        }
+        void Swap(PacketBuffer& other) noexcept {
+            Block* block = block_;
+            block_ = other.block_;
+            other.block_ = block;
+        }
+        bool Unique() const { return block_ && block_->refs.load(std::memory_order_acquire) == 1; }
+
+        // Container-style access to the data
+        uint8_t* data() { return block_ ? Storage() + block_->offset : nullptr; }
+        const uint8_t* data() const { return block_ ? Storage() + block_->offset : nullptr; }
+        size_t size() const { return block_ ? block_->length : 0; }
+        bool empty() const { return size() == 0; }
+        const uint8_t* begin() const { return data(); }
+        const uint8_t* end() const { return data() + size(); }
+        uint8_t& operator[](size_t i) { return data()[i]; }
+        uint8_t operator[](size_t i) const { return data()[i]; }
+
+        size_t Headroom() const { return block_ ? block_->offset : 0; }
+        size_t Tailroom() const { return block_ ? block_->capacity - block_->offset - block_->length : 0; }
+
+        // Grow the data by `n` bytes at the front, into the headroom. Returns the new start.
+        uint8_t* Prepend(size_t n);
+        // Drop `n` bytes from the front
+        void Consume(size_t n);
+        // Grow the data by `n` bytes at the back, into the tailroom. Returns the first new byte.
+        uint8_t* Append(size_t n);
+        // Shrink, or grow into the tailroom
+        void Resize(size_t length);
+
+        struct PoolStats {
+            uint64_t pooled_buffers = 0; // Carved from slabs so far (in use or free)
+            uint64_t heap_buffers = 0;   // Oversized packets that bypassed the pool
+        };
+        static PoolStats Stats();
+
+    private:
+        struct Block {
+            std::atomic<uint32_t> refs{1};
+            uint32_t capacity = 0; // Storage bytes
+            uint32_t offset = 0;   // Data start within storage
+            uint32_t length = 0;
+            bool heap = false;
+            Block* next = nullptr; // Free list link
+        };
+        static constexpr size_t HEADER_SIZE = 64; // Block, padded so storage starts cache-aligned
+        static_assert(sizeof(Block) <= HEADER_SIZE);
+
+        explicit PacketBuffer(Block* block) : block_(block) {}
+        uint8_t* Storage() const { return reinterpret_cast<uint8_t*>(block_) + HEADER_SIZE; }
+        static void Release(Block* block);
+
+        friend struct PacketPool;
+        Block* block_ = nullptr;
+    };
+
+}
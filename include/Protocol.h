@@ -2,13 +2,16 @@
 #include <cstdint>
 #include <vector>
 #include <array>
+#include <cstddef>
 
 namespace vpn::protocol {
 
     enum class PacketType : uint8_t {
         ClientHello = 0x01,
         ServerHello = 0x02,
-        Data = 0x03
+        Data = 0x03,
+        ResumeHello = 0x04,
+        ResumeAck = 0x05
     };
 
     struct PacketHeader {
@@ -20,12 +23,70 @@ namespace vpn::protocol {
     // Nonce: 12 bytes (Random)
     constexpr size_t HANDSHAKE_SIZE = 1 + 32 + 12;
 
+    // Address the server assigns to the client from its pool.
+    // Serialized: [VirtualIP 4 (network byte order)][PrefixLen 1]
+    struct AddressAssignment {
+        uint32_t virtual_ip = 0; // Network byte order
+        uint8_t prefix_len = 0;
+    };
+    constexpr size_t ADDRESS_SIZE = 4 + 1;
+
+    // The client's IPv6 address is derived, not sent: the VIP in the low 32 bits of this /96 ULA
+    // prefix, with prefix length prefix_len + 96 (10.0.0.2/24 -> fd76:706e::a00:2/120).
+    constexpr std::array<uint8_t, 12> VIP6_PREFIX = {0xfd, 0x76, 0x70, 0x6e, 0, 0, 0, 0, 0, 0, 0, 0};
+    constexpr uint8_t VIP6_PREFIX_LEN = 96;
+    std::array<uint8_t, 16> EmbedVip6(uint32_t virtual_ip);
+
+    // The server names each session with a random index, sent to the client in the handshake and
+    // carried by every Data packet in both directions. The server finds a packet's session by it,
+    // not by the sender's address, so a client can change address (roam) without a new handshake.
+    // Serialized: 4 bytes, little endian.
+    constexpr size_t INDEX_SIZE = 4;
+
+    // ServerHello carries the client's address and session index, then optionally a resumption ticket:
+    // [Type][PublicKey][Nonce][Address][Index][Ticket (optional)]
+
+    // ResumeHello: [Type][Random][Ticket]
+    // ResumeAck:   [Type][Random][Address][Index][Ticket]
+    // Random: 32 bytes, mixed into the resumed keys so every resumption gets fresh keys
+    // ResumeAck carries a fresh ticket for the next reconnect.
+    constexpr size_t RESUME_RANDOM_LEN = 32;
+    constexpr size_t RESUME_HEADER_SIZE = 1 + RESUME_RANDOM_LEN;
+
     // Serialized: [Type][Nonce][Ciphertext...]
-    // Nonce: 12 bytes
+    // Nonce: 12 bytes, [Counter 8][Index 4] (little endian). The counter never repeats under a key
+    // and lets the receiver reject replays; the index is authenticated as part of the nonce.
     constexpr size_t DATA_HEADER_SIZE = 1 + 12;
+    constexpr size_t DATA_INDEX_OFFSET = 1 + 8;
+
+    // A Data packet with no payload is a keepalive. The client sends one as soon as its session is
+    // established and every KEEPALIVE_SECONDS after, and the server answers each with one; the
+    // server drops a session it has not heard from in SESSION_IDLE_SECONDS, and a client that has
+    // not heard from the server in PEER_DEAD_SECONDS reconnects (e.g. to a server that restarted
+    // with its receive window ahead of the client's counter).
+    constexpr int64_t KEEPALIVE_SECONDS = 25;
+    constexpr int64_t SESSION_IDLE_SECONDS = 180;
+    constexpr int64_t PEER_DEAD_SECONDS = 3 * KEEPALIVE_SECONDS;
+
+    // Inner MTU for the TUN devices: a full-size inner packet, sealed (header + 16-byte tag) inside
+    // UDP over IPv6 (48 bytes), must still fit a 1500-byte underlay. Larger packets would be
+    // fragmented, and a UDP GSO run of them is refused by the kernel outright.
+    constexpr unsigned TUNNEL_MTU = 1420;
 
     std::vector<uint8_t> CreateClientHello(const std::vector<uint8_t>& pub_key);
-    std::vector<uint8_t> CreateServerHello(const std::vector<uint8_t>& pub_key);
+    std::vector<uint8_t> CreateServerHello(const std::vector<uint8_t>& pub_key, const AddressAssignment& address, uint32_t index, const std::vector<uint8_t>& ticket = {});
+    std::vector<uint8_t> CreateResumeHello(const std::vector<uint8_t>& random, const std::vector<uint8_t>& ticket);
+    std::vector<uint8_t> CreateResumeAck(const std::vector<uint8_t>& random, const AddressAssignment& address, uint32_t index, const std::vector<uint8_t>& ticket);
+
+    void AppendAddress(std::vector<uint8_t>& packet, const AddressAssignment& address);
+    AddressAssignment ParseAddress(const uint8_t* data); // Reads ADDRESS_SIZE bytes
+    void AppendIndex(std::vector<uint8_t>& packet, uint32_t index);
+    uint32_t ParseIndex(const uint8_t* data); // Reads INDEX_SIZE bytes
+    // Session index of a Data packet of at least DATA_HEADER_SIZE bytes
+    inline uint32_t DataIndex(const uint8_t* packet) {
+        const uint8_t* p = packet + DATA_INDEX_OFFSET;
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
     std::vector<uint8_t> CreateDataPacket(const std::vector<uint8_t>& nonce, const std::vector<uint8_t>& ciphertext);
 
     struct ParsedPacket {
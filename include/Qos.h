@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace vpn::utils {
+
+    // Service classes for inner packets, highest priority first.
+    // Realtime is served with strict priority; the others share what is left by weight.
+    enum class TrafficClass : uint8_t {
+        Realtime,    // EF, VOICE-ADMIT, CS5-CS7, ICMP, DNS
+        Interactive, // AF2x-AF4x, CS2-CS4 (video, signalling, transactional)
+        BestEffort,  // Default
+        Bulk,        // CS1 and LE (scavenger)
+    };
+    constexpr size_t TRAFFIC_CLASS_COUNT = 4;
+
+    const char* TrafficClassName(TrafficClass cls);
+
+    // Class of an inner IPv4/IPv6 packet from its DSCP, then its protocol for unmarked traffic
+    TrafficClass Classify(const uint8_t* packet, size_t length);
+
+    // DSCP carried on the outer header for a class, so the underlay can prioritize the tunnel
+    // without seeing inside it. Returned as the TOS / traffic class byte (DSCP << 2, ECN bits clear).
+    uint8_t OuterTos(TrafficClass cls);
+
+}
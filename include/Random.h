@@ -0,0 +1,12 @@
+#pragma once
+#include "CryptoDefs.h"
+
+namespace vpn::crypto {
+
+    class Random {
+    public:
+        // Cryptographically secure random bytes
+        static Bytes Generate(size_t length);
+    };
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+namespace vpn::utils {
+
+    // Minimal epoch-based RCU.
+    // Readers mark themselves active for the duration of a read-side critical section with a single
+    // store (wait-free, never blocks on writers). Writers publish a new version with an atomic pointer
+    // swap and hand the old one to Retire(); it is freed once every reader that could still see it has left.
+    class Rcu {
+    public:
+        // Read-side critical section
+        class ReadGuard {
+        public:
+            ReadGuard();
+            ~ReadGuard();
+            ReadGuard(const ReadGuard&) = delete;
+            ReadGuard& operator=(const ReadGuard&) = delete;
+        private:
+            bool outermost_;
+        };
+
+        // Free `deleter` once no reader can hold a reference to the retired object.
+        // Called by writers; may reclaim earlier retirements as a side effect.
+        static void Retire(std::function<void()> deleter);
+
+        // Reclaim whatever is safe to reclaim now
+        static void Reclaim();
+
+        static constexpr size_t MAX_READERS = 256;
+    };
+
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace vpn::protocol {
+
+    // Sliding anti-replay window over the receive nonce counters (RFC 6479): a bitmap of the last
+    // BITS counters, kept as a ring of 64-bit words so moving the window clears words instead of
+    // shifting bits. Accept a counter only once its packet authenticated, or forged packets could
+    // move the window.
+    // The spinlock is only contended while a session's packets arrive on two workers at once
+    // (when a client roams), and is held for a few instructions.
+    class ReplayWindow {
+    public:
+        static constexpr uint64_t BITS = 2048;
+        static constexpr uint64_t SIZE = BITS - 64; // Counters accepted behind the highest one
+
+        // `next`: restored session, everything below it counts as seen
+        explicit ReplayWindow(uint64_t next = 0) : next_(next) {
+            if (!next) return;
+            for (auto& word : bits_) word = ~uint64_t(0);
+            bits_[(next / 64) % WORDS] = (uint64_t(2) << (next % 64)) - 1; // Higher ones are unseen
+        }
+
+        // True the first time `counter` is seen inside the window, false for a replay or a packet
+        // too old to tell
+        bool Accept(uint64_t counter) {
+            while (lock_.test_and_set(std::memory_order_acquire)) {}
+            bool accepted = Update(counter);
+            lock_.clear(std::memory_order_release);
+            return accepted;
+        }
+
+        // Another receiver of the same session got everything below `next`: count those counters as
+        // seen here too
+        void Advance(uint64_t next) {
+            while (lock_.test_and_set(std::memory_order_acquire)) {}
+            if (next > next_) {
+                uint64_t current = next_ / 64;
+                uint64_t advance = next / 64 - current < WORDS ? next / 64 - current : WORDS;
+                for (uint64_t i = 1; i <= advance; ++i) bits_[(current + i) % WORDS] = 0;
+                next_ = next;
+            }
+            uint64_t top = next / 64;
+            uint64_t bottom = next_ / 64 >= WORDS - 1 ? next_ / 64 - (WORDS - 1) : 0; // Oldest word still in the window
+            for (uint64_t word = bottom; word <= top; ++word) {
+                bits_[word % WORDS] |= word < top ? ~uint64_t(0) : (uint64_t(2) << (next % 64)) - 1;
+            }
+            lock_.clear(std::memory_order_release);
+        }
+
+        // Start over at `next` (as the constructor does), unless a counter was accepted since the
+        // window was started at `expected`. For a window started ahead as a precaution, once the
+        // exact point is known. False if counters were accepted.
+        bool Restart(uint64_t expected, uint64_t next) {
+            while (lock_.test_and_set(std::memory_order_acquire)) {}
+            bool restart = next_ == expected;
+            if (restart) {
+                next_ = next;
+                for (auto& word : bits_) word = next ? ~uint64_t(0) : 0;
+                if (next) bits_[(next / 64) % WORDS] = (uint64_t(2) << (next % 64)) - 1;
+            }
+            lock_.clear(std::memory_order_release);
+            return restart;
+        }
+
+        // One past the highest counter accepted so far
+        uint64_t Next() const {
+            while (lock_.test_and_set(std::memory_order_acquire)) {}
+            uint64_t next = next_;
+            lock_.clear(std::memory_order_release);
+            return next;
+        }
+
+    private:
+        static constexpr size_t WORDS = BITS / 64;
+
+        bool Update(uint64_t counter) {
+            uint64_t position = counter + 1; // next_ == 0 means nothing seen yet
+            if (position + SIZE < next_) return false;
+            uint64_t word = position / 64;
+            if (position > next_) {
+                uint64_t current = next_ / 64;
+                uint64_t advance = word - current < WORDS ? word - current : WORDS;
+                for (uint64_t i = 1; i <= advance; ++i) bits_[(current + i) % WORDS] = 0;
+                next_ = position;
+            }
+            uint64_t bit = uint64_t(1) << (position % 64);
+            uint64_t& slot = bits_[word % WORDS];
+            if (slot & bit) return false;
+            slot |= bit;
+            return true;
+        }
+
+        mutable std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+        uint64_t next_;
+        uint64_t bits_[WORDS] = {};
+    };
+
+}
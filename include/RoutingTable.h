@@ -0,0 +1,103 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+
+namespace vpn::utils {
+
+    // IPv4 longest-prefix-match table (DIR-24-8).
+    // A 2^24-entry first level is indexed by the top 24 address bits; prefixes longer than /24
+    // spill into 256-entry second-level groups. Every lookup is one or two array loads.
+    // Each entry packs [Valid 1][Extended 1][Depth 6][Index 24]: Index is a next-hop slot, or a
+    // second-level group when Extended is set. The first level is allocated with calloc, so only
+    // pages covered by routes become resident.
+    //
+    // Not thread-safe for writers: build the table, then publish it read-only (lookups on a
+    // table that is no longer modified may run from any number of threads).
+    class RoutingTable {
+    public:
+        RoutingTable();
+        ~RoutingTable();
+
+        RoutingTable(const RoutingTable&) = delete;
+        RoutingTable& operator=(const RoutingTable&) = delete;
+
+        // prefix in network byte order. A route of the same length replaces the existing one.
+        // Returns false for an invalid length or when the second level is full.
+        bool Add(uint32_t prefix, uint8_t prefix_len, uint32_t next_hop);
+
+        // Next hop of the longest prefix covering `ip` (network byte order)
+        std::optional<uint32_t> Lookup(uint32_t ip) const {
+            uint32_t host = ToHost(ip);
+            uint32_t entry = tbl24_[host >> 8];
+            if (entry & EXTENDED) entry = tbl8_[(entry & INDEX_MASK) * 256 + (host & 0xFF)];
+            if (!(entry & VALID)) return std::nullopt;
+            return next_hops_[entry & INDEX_MASK];
+        }
+
+    private:
+        static constexpr uint32_t VALID = 1u << 31;
+        static constexpr uint32_t EXTENDED = 1u << 30;
+        static constexpr uint32_t DEPTH_SHIFT = 24;
+        static constexpr uint32_t DEPTH_MASK = 0x3Fu << DEPTH_SHIFT;
+        static constexpr uint32_t INDEX_MASK = 0x00FFFFFF;
+
+        static uint32_t ToHost(uint32_t ip) {
+            const auto* b = reinterpret_cast<const uint8_t*>(&ip);
+            return uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 | b[3];
+        }
+        static uint32_t Depth(uint32_t entry) { return (entry & DEPTH_MASK) >> DEPTH_SHIFT; }
+
+        // Overwrite `entry` unless a longer prefix already owns it
+        static void Apply(uint32_t& entry, uint32_t value, uint32_t depth) {
+            if (!(entry & VALID) || Depth(entry) <= depth) entry = value;
+        }
+
+        uint32_t* tbl24_;
+        std::vector<uint32_t> tbl8_;
+        std::vector<uint32_t> next_hops_;
+    };
+
+    // IPv6 longest-prefix-match table, the same scheme stretched to 128 bits: a 2^16-entry first
+    // level indexed by the top 16 bits, then one 256-entry group per further byte, created only
+    // under routes longer than the level above. A lookup is one load plus one per group walked,
+    // so /48 routes cost five loads and the common /16../24 case one or two.
+    // Entries pack [Valid 1][Extended 1][Depth 8][Index 22]. Same threading rules as RoutingTable.
+    class RoutingTable6 {
+    public:
+        RoutingTable6();
+
+        // prefix: 16 bytes, network byte order. A route of the same length replaces the existing one.
+        // Returns false for an invalid length or when the groups are exhausted.
+        bool Add(const uint8_t* prefix, uint8_t prefix_len, uint32_t next_hop);
+
+        // Next hop of the longest prefix covering the 16-byte address `ip`
+        std::optional<uint32_t> Lookup(const uint8_t* ip) const {
+            uint32_t entry = tbl16_[size_t(ip[0]) << 8 | ip[1]];
+            for (size_t byte = 2; entry & EXTENDED; ++byte) entry = tbl8_[(entry & INDEX_MASK) * 256 + ip[byte]];
+            if (!(entry & VALID)) return std::nullopt;
+            return next_hops_[entry & INDEX_MASK];
+        }
+
+    private:
+        static constexpr uint32_t VALID = 1u << 31;
+        static constexpr uint32_t EXTENDED = 1u << 30;
+        static constexpr uint32_t DEPTH_SHIFT = 22;
+        static constexpr uint32_t DEPTH_MASK = 0xFFu << DEPTH_SHIFT;
+        static constexpr uint32_t INDEX_MASK = 0x003FFFFF;
+
+        // Entries are addressed by position so references survive tbl8_ growing:
+        // [0, 2^16) is the first level, the rest second-level groups in order
+        uint32_t& At(size_t position);
+        // Turn the entry at `position` into a group inheriting its route; returns the group's position
+        std::optional<size_t> Extend(size_t position);
+        // Apply the route to the entry at `position` and everything below it
+        void Cover(size_t position, uint32_t value, uint32_t depth);
+
+        std::vector<uint32_t> tbl16_;
+        std::vector<uint32_t> tbl8_;
+        std::vector<uint32_t> next_hops_;
+    };
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "ConfigFile.h"
+#include "UdpSocket.h"
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace vpn::utils {
+
+    // "10.0.0.1", network byte order; 0 if malformed
+    uint32_t ParseIpv4(const char* ip);
+
+    // "192.168.50.0/24" or "2001:db8:1::/48"
+    struct Cidr {
+        bool v6 = false;
+        uint8_t address[16] = {}; // Network byte order; IPv4 uses the first 4 bytes
+        uint8_t prefix_len = 0;
+    };
+
+    bool ParseCidr(const std::string& text, Cidr& cidr);
+
+    // "0123abcd...", empty if malformed
+    std::vector<uint8_t> ParseHex(const std::string& text);
+
+    uint64_t MbitToBytes(double mbit);
+
+    // Server settings: defaults, then the file given with --config, then the command line, which keeps
+    // overriding the file across reloads. SIGHUP re-reads both: peers, rates, routes and hairpin take
+    // effect at once (see vpn_server's ReloadConfig); the rest is fixed at startup.
+    struct PeerConfig {
+        std::optional<uint64_t> rate;    // Bytes per second, default_rate if unset
+        std::vector<std::string> routes; // Networks behind the peer, "192.168.50.0/24" or "2001:db8:1::/48"
+    };
+
+    // A server process of the cluster (see ClusterLink). listen_port and tun_name override the global
+    // settings on that node, so nodes sharing a host can each have their own.
+    struct NodeConfig {
+        Endpoint address = {}; // Cluster link
+        std::optional<uint16_t> listen_port;
+        std::optional<std::string> tun_name;
+    };
+
+    struct ServerConfig {
+        static constexpr unsigned MAX_WORKERS = 64;
+
+        uint16_t listen_port = 51820;
+        std::string tun_name = "VPNServer";
+        uint32_t pool_network = ParseIpv4("10.0.0.0");
+        uint8_t pool_prefix_len = 24;
+        unsigned workers = 0; // 0: one per core where SO_REUSEPORT is available
+        uint64_t default_rate = 0;
+        bool hairpin = true;
+        uint32_t handshake_rate = 20;
+        uint8_t handshake_prefix = 32;
+        uint8_t handshake_prefix6 = 64;
+        std::map<uint32_t, PeerConfig> peers; // By VIP
+        std::string metrics;
+        unsigned stats_interval = 0;
+        uint32_t trace_sample = 64;
+        std::vector<uint32_t> trace_vips;
+        std::string trace_file = "vpn_trace.pcapng";
+        std::map<uint32_t, NodeConfig> nodes; // By node id; empty unless the server runs as a cluster
+        std::optional<uint32_t> cluster_node; // This process
+        std::vector<uint8_t> cluster_key;
+        std::optional<Endpoint> load_balancer; // vpn_lb's backend address, when clients come through it
+
+        uint32_t Gateway() const { return htonl(ntohl(pool_network) + 1); }
+    };
+
+    // A config file over `config`; throws naming the file and line of a bad setting
+    void ApplyConfigFile(const ConfigFile& file, ServerConfig& config);
+
+    // The command line over `config`; throws on a malformed option
+    void ApplyArguments(const std::vector<std::string>& args, ServerConfig& config);
+
+    // Defaults, the files named by every --config in `args`, then `args` (without the program
+    // name). Throws if a cluster's nodes do not add up.
+    ServerConfig LoadConfig(const std::vector<std::string>& args);
+
+}
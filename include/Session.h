@@ -2,38 +2,147 @@
 #include "CryptoDefs.h"
 #include "KeyExchange.h"
 #include "AEAD.h"
+#include "Ticket.h"
+#include "Protocol.h"
+#include "PacketBuffer.h"
+#include "ReplayWindow.h"
 #include <vector>
 #include <cstdint>
+#include <optional>
+#include <atomic>
+#include <functional>
 
 namespace vpn {
 
+    // What a client keeps to resume a session without X25519
+    struct ResumptionState {
+        std::vector<uint8_t> ticket; // Opaque, sealed by the server
+        std::vector<uint8_t> secret; // Resumption secret (never sent on the wire)
+    };
+
+    // Established session state, enough to continue the data flow in another process
+    struct SessionState {
+        bool is_server = false;
+        std::vector<uint8_t> tx_key;
+        std::vector<uint8_t> rx_key;
+        std::vector<uint8_t> resumption_secret;
+        uint64_t tx_nonce_counter = 0;
+        uint64_t rx_nonce_next = 0; // Counters below this were received (or are too old)
+        uint32_t index = 0;
+    };
+
     class Session {
     public:
-        Session(bool is_server);
+        // Server: picks the client's address during the handshake. `requested_vip` is the address
+        // from a resumption ticket (network byte order), 0 for a full handshake. Returning nullopt
+        // (pool exhausted) rejects the handshake.
+        using AddressAllocator = std::function<std::optional<protocol::AddressAssignment>(uint32_t requested_vip)>;
+
+        // ticket_key: server only. When set, the server issues tickets and accepts ResumeHello.
+        Session(bool is_server, const protocol::TicketKey* ticket_key = nullptr);
+        // Restore an established session (see Export)
+        explicit Session(const SessionState& state, const protocol::TicketKey* ticket_key = nullptr);
         
         // Handshake
         std::vector<uint8_t> InitiateHandshake(); // Returns ClientHello
-        std::vector<uint8_t> HandleHandshake(const std::vector<uint8_t>& packet); // Returns response (ServerHello) or empty
+        std::vector<uint8_t> InitiateResumption(const ResumptionState& state); // Returns ResumeHello
+        std::vector<uint8_t> HandleHandshake(const std::vector<uint8_t>& packet); // Returns response (ServerHello/ResumeAck) or empty
+
+        // Data, in place: Encrypt turns an inner packet into a Data packet, using the buffer's
+        // headroom for the header and its tailroom for the tag; Decrypt turns a Data packet back
+        // into the inner packet and returns false (leaving garbage) if it does not authenticate or
+        // is a replay. Both are safe to call from several threads at once: each Encrypt reserves
+        // its own nonce, and the replay window takes each counter once.
+        void Encrypt(utils::PacketBuffer& packet);
+        void EncryptBatch(std::vector<utils::PacketBuffer>& packets); // One reservation for the whole batch
+
+        // Reserve `count` consecutive nonce counters with one atomic operation; returns the first.
+        // Use with EncryptWithCounter when a sender wants to encrypt a reserved range itself.
+        uint64_t ReserveNonces(uint64_t count);
 
-        // Data
-        std::vector<uint8_t> Encrypt(const std::vector<uint8_t>& plaintext);
-        std::vector<uint8_t> Decrypt(const std::vector<uint8_t>& packet_payload); // Payload starts with Nonce
+        // Cluster: several nodes may send on one replicated session. Counters come in blocks of
+        // NONCE_BLOCK and a node leases only the blocks b with b % stripes == stripe, so no two
+        // nodes ever use the same nonce. Set before the session sends.
+        // Striping keeps nonces unique, not in order: the peer's replay window (2048 counters) is far
+        // narrower than a block, so only one node may send to a peer at a time (see ClusterSessions).
+        static constexpr uint64_t NONCE_BLOCK = uint64_t(1) << 20;
+        void SetNonceStripe(uint32_t stripe, uint32_t stripes);
+        // The stripe whose block holds the last counter used below `counter` (a TxCounter, 0 if
+        // nothing was sent), which stays so when the counter is moved up by whole stripe rounds
+        static uint32_t CounterStripe(uint64_t counter, uint32_t stripes) {
+            return counter ? static_cast<uint32_t>((counter - 1) / NONCE_BLOCK % stripes) : 0;
+        }
+        // Move the send counter up to `counter` (another node's), so the peer's replay window
+        // keeps accepting what this node sends
+        void AdvanceTxCounter(uint64_t counter);
+        uint64_t TxCounter() const { return tx_nonce_counter_.load(std::memory_order_relaxed); }
+        // Receive side, the same for a session other nodes receive on too: `next` is another node's
+        // RxNext, and counters below it are not accepted here any more
+        void AdvanceRxWindow(uint64_t next) { rx_window_.Advance(next); }
+        // Move the receive window from `expected`, where it was started ahead, to `next`, unless
+        // something was received since. False if it was.
+        bool RestartRxWindow(uint64_t expected, uint64_t next) { return rx_window_.Restart(expected, next); }
+        uint64_t RxNext() const { return rx_window_.Next(); }
+        void EncryptWithCounter(uint64_t counter, utils::PacketBuffer& packet);
+        bool Decrypt(utils::PacketBuffer& packet);
 
-        bool IsEstablished() const { return established_; }
+        bool IsEstablished() const { return established_.load(std::memory_order_acquire); }
+        bool IsResumed() const { return resumed_; }
+        // Server: this session was resumed with the ticket `previous` issued
+        bool ResumedFrom(const Session& previous) const;
+
+        // Client: ticket received from the server, if any
+        std::optional<ResumptionState> GetResumptionState() const;
+
+        // Server: set before HandleHandshake. Without an allocator the client is assigned no address.
+        void SetAddressAllocator(AddressAllocator allocator) { allocator_ = std::move(allocator); }
+        // Server: set before HandleHandshake; the client learns it from the ServerHello/ResumeAck
+        void SetIndex(uint32_t index) { index_ = index; }
+        // Session index carried by Data packets (see Protocol.h)
+        uint32_t Index() const { return index_; }
+        // Address carried by the ServerHello/ResumeAck, once the handshake completed
+        std::optional<protocol::AddressAssignment> GetAssignedAddress() const;
+
+        // Snapshot of an established session. The nonce counter is advanced by `counter_margin`
+        // so packets sent after the snapshot was taken can never reuse a nonce once restored.
+        SessionState Export(uint64_t counter_margin) const;
 
     private:
         bool is_server_;
-        bool established_ = false;
+        std::atomic<bool> established_ = false; // Published after keys are set; keys are immutable afterwards
+        bool resumed_ = false;
+        const protocol::TicketKey* ticket_key_;
         
         crypto::KeyExchange key_exchange_;
         std::vector<uint8_t> shared_secret_;
         std::vector<uint8_t> tx_key_;
         std::vector<uint8_t> rx_key_;
+
+        // Resumption
+        std::vector<uint8_t> resumption_secret_;
+        std::vector<uint8_t> ticket_;      // Client: last ticket received
+        std::vector<uint8_t> pending_random_; // Client: random sent in ResumeHello
+        std::vector<uint8_t> pending_secret_; // Client: secret of the ticket being redeemed
+        std::vector<uint8_t> redeemed_secret_; // Server: secret of the ticket this session was resumed with
         
-        // Nonce counters (simple increment)
-        uint64_t tx_nonce_counter_ = 0;
+        // Address assignment
+        AddressAllocator allocator_;
+        protocol::AddressAssignment address_;
+
+        uint32_t index_ = 0;
+
+        // Nonce counter, reserved with fetch_add so concurrent senders never share a nonce
+        std::atomic<uint64_t> tx_nonce_counter_ = 0;
+        uint32_t nonce_stripe_ = 0;
+        uint32_t nonce_stripes_ = 1;
+        protocol::ReplayWindow rx_window_;
         
-        std::vector<uint8_t> GenerateNonce(uint64_t counter);
+        void GenerateNonce(uint64_t counter, uint8_t* nonce) const; // NONCE_LEN bytes
+
+        // Split 64 bytes of HKDF output into Tx/Rx keys and derive the next resumption secret
+        void DeriveKeys(const std::vector<uint8_t>& secret, const std::vector<uint8_t>& salt);
+        std::vector<uint8_t> HandleResumeHello(const std::vector<uint8_t>& payload);
+        bool AssignAddress(uint32_t requested_vip); // Server
     };
 
 }
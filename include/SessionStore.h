@@ -0,0 +1,43 @@
+#pragma once
+#include "Session.h"
+#include "UdpSocket.h"
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+
+namespace vpn {
+
+    // One server-side session as persisted across restarts
+    struct SessionRecord {
+        uint32_t virtual_ip = 0;    // Network byte order, 0 if not learned yet
+        std::array<uint8_t, 16> endpoint_ip = {}; // IPv6, IPv4-mapped for IPv4 peers
+        uint16_t endpoint_port = 0; // Network byte order
+        SessionState state;
+
+        utils::Endpoint GetEndpoint() const;
+        void SetEndpoint(const utils::Endpoint& endpoint);
+    };
+
+    // Snapshot file for hot restart.
+    // Layout: [Header 64][Record 144]...
+    // Header: [Magic "VPNS"][Version 4][Count 4][Flags 4][WrittenAt 8][TicketKey 32][Reserved 8]
+    // Record: [VIP 4][EndpointPort 2][Reserved 2][EndpointIP 16][TxCounter 8][TxKey 32][RxKey 32][ResumptionSecret 32]
+    //         [Index 4][Reserved 4][RxNext 8]
+    // The file holds live keys and is written with owner-only permissions where supported.
+    class SessionStore {
+    public:
+        // Write the snapshot to `path` atomically (temp file + rename). `clean`: written after the
+        // data path stopped, so the receive counters are exact rather than a point in the past.
+        static void Save(const std::string& path, const std::vector<uint8_t>& ticket_key, const std::vector<SessionRecord>& records, bool clean = false);
+
+        // Returns false if there is no usable snapshot at `path`
+        static bool Load(const std::string& path, std::vector<uint8_t>& ticket_key, std::vector<SessionRecord>& records, bool& clean);
+
+        // One record in the layout above; cluster nodes exchange sessions in it too (see ClusterLink)
+        static constexpr size_t RECORD_SIZE = 144;
+        static void EncodeRecord(const SessionRecord& record, uint8_t* out);
+        static SessionRecord DecodeRecord(const uint8_t* in);
+    };
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "UdpSocket.h"
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace vpn::protocol {
+
+    // Between vpn_lb and the servers behind it. Every datagram carries the client's address in
+    // front of the client's datagram, both ways, so the load balancer keeps no state per client:
+    // [Address 16][Port 2][Datagram...]
+    // Address: IPv6, IPv4-mapped for IPv4 clients. Port: network byte order.
+    constexpr size_t STEER_HEADER_SIZE = 16 + 2;
+
+    inline void WriteSteerHeader(uint8_t* out, const utils::Endpoint& client) {
+        std::memcpy(out, &client.sin6_addr, 16);
+        std::memcpy(out + 16, &client.sin6_port, 2);
+    }
+
+    // Reads STEER_HEADER_SIZE bytes
+    inline utils::Endpoint ReadSteerHeader(const uint8_t* in) {
+        utils::Endpoint client = {};
+        client.sin6_family = AF_INET6;
+        std::memcpy(&client.sin6_addr, in, 16);
+        std::memcpy(&client.sin6_port, in + 16, 2);
+        return client;
+    }
+
+    // vpn_lb's choice of backend for a client's datagram, out of `backends` (listed in cluster node
+    // order), or -1 to drop it. Data packets go to backend `index % backends`, the node that picked
+    // the session's index; hellos to HelloBackend.
+    int SteerToBackend(const uint8_t* datagram, size_t size, const utils::Endpoint& client, size_t backends);
+
+    // Rendezvous (highest random weight) hashing of the client's address: every backend scores
+    // the client and the best score wins, so adding or removing a backend only moves the clients
+    // whose best score it had
+    size_t HelloBackend(const utils::Endpoint& client, size_t backends);
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "CryptoDefs.h"
+#include <optional>
+#include <cstdint>
+
+namespace vpn::protocol {
+
+    // Serialized: [Nonce][Encrypted(IssuedAt | ResumptionSecret | VirtualIP)][Tag]
+    // IssuedAt: 8 bytes (Unix seconds, little endian)
+    // ResumptionSecret: 32 bytes
+    // VirtualIP: 4 bytes (network byte order), so a resumed client gets its address back
+    constexpr size_t TICKET_SECRET_LEN = 32;
+    constexpr size_t TICKET_SIZE = crypto::NONCE_LEN + 8 + TICKET_SECRET_LEN + 4 + crypto::TAG_LEN;
+
+    // Tickets older than this are rejected and the client falls back to a full handshake.
+    constexpr uint64_t TICKET_LIFETIME_SECONDS = 12 * 60 * 60;
+
+    struct TicketContents {
+        crypto::Bytes resumption_secret;
+        uint32_t virtual_ip = 0; // Network byte order
+    };
+
+    // Server-side key used to seal stateless resumption tickets.
+    // The server keeps no per-ticket state; everything needed to resume is inside the ticket.
+    class TicketKey {
+    public:
+        TicketKey(); // Random key
+        explicit TicketKey(const crypto::Bytes& key);
+
+        // Seal a resumption secret and the client's address into an opaque ticket
+        crypto::Bytes Seal(const crypto::Bytes& resumption_secret, uint32_t virtual_ip = 0) const;
+
+        // Returns the ticket contents if the ticket authenticates and has not expired
+        std::optional<TicketContents> Open(const crypto::Bytes& ticket) const;
+
+        const crypto::Bytes& GetKey() const { return key_; }
+
+    private:
+        crypto::Bytes key_;
+    };
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace vpn::utils {
+
+    // Byte-rate limiter shared by every thread sending for one client.
+    // Kept as a virtual scheduling time (GCRA): the bucket is "full" when that time is at or before
+    // now, and each packet pushes it forward by its transmission time at `rate`. A packet conforms
+    // while the push stays within `burst` of now. One atomic, updated with a CAS, no lock.
+    // The rate can be changed while senders use the bucket (SetRate, on a configuration reload).
+    class TokenBucket {
+    public:
+        // rate 0: unlimited
+        explicit TokenBucket(uint64_t rate_bytes_per_second = 0, uint64_t burst_bytes = 0)
+            : rate_(rate_bytes_per_second), burst_ns_(BurstNs(rate_bytes_per_second, burst_bytes)) {}
+
+        // The virtual time carries over, so traffic already sent still counts. A sender may briefly
+        // pair the new rate with the old burst; false if nothing changed.
+        bool SetRate(uint64_t rate_bytes_per_second, uint64_t burst_bytes) {
+            int64_t burst_ns = BurstNs(rate_bytes_per_second, burst_bytes);
+            if (rate_.load(std::memory_order_relaxed) == rate_bytes_per_second &&
+                burst_ns_.load(std::memory_order_relaxed) == burst_ns) return false;
+            burst_ns_.store(burst_ns, std::memory_order_relaxed);
+            rate_.store(rate_bytes_per_second, std::memory_order_relaxed);
+            return true;
+        }
+
+        static int64_t Now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        bool Unlimited() const { return Rate() == 0; }
+        uint64_t Rate() const { return rate_.load(std::memory_order_relaxed); }
+
+        // Take `bytes` if they may be sent at `now`; false leaves the bucket untouched
+        bool TryConsume(size_t bytes, int64_t now) {
+            uint64_t rate = Rate();
+            if (!rate) return true;
+            int64_t cost = Cost(bytes, rate);
+            int64_t burst_ns = burst_ns_.load(std::memory_order_relaxed);
+            int64_t tat = tat_.load(std::memory_order_relaxed);
+            for (;;) {
+                int64_t start = tat > now ? tat : now;
+                if (start + cost - now > burst_ns && tat > now) return false;
+                // An idle bucket always admits one packet, even one larger than the burst
+                if (tat_.compare_exchange_weak(tat, start + cost, std::memory_order_relaxed)) return true;
+            }
+        }
+
+        // Earliest time at which `bytes` would conform
+        int64_t ReadyAt(size_t bytes) const {
+            uint64_t rate = Rate();
+            if (!rate) return 0;
+            int64_t tat = tat_.load(std::memory_order_relaxed);
+            int64_t ready = tat + Cost(bytes, rate) - burst_ns_.load(std::memory_order_relaxed);
+            return ready < tat ? ready : tat; // An oversized packet waits only for the bucket to drain
+        }
+
+    private:
+        static int64_t Cost(size_t bytes, uint64_t rate) {
+            return static_cast<int64_t>(bytes * 1000000000ull / rate);
+        }
+        static int64_t BurstNs(uint64_t rate, uint64_t burst_bytes) {
+            return rate ? static_cast<int64_t>(burst_bytes * 1000000000ull / rate) : 0;
+        }
+
+        std::atomic<uint64_t> rate_;
+        std::atomic<int64_t> burst_ns_;
+        std::atomic<int64_t> tat_{0}; // Virtual time the bucket is next full, steady clock ns
+    };
+
+}
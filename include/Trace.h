@@ -0,0 +1,83 @@
+#pragma once
+#include "Latency.h"
+#include "UdpSocket.h"
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace vpn::utils {
+
+    enum class DropReason : uint8_t {
+        None,
+        NoRoute,       // Inner destination routes to no client
+        QueueFull,     // Egress queue over its limit
+        NoSession,     // Destination client has no established session
+        UnknownPeer,   // Data from an endpoint without a session
+        AuthFailed,    // AEAD open failed
+        SpoofedSource, // Inner source does not route back to the sender
+        RateLimited,   // Hairpinned packet over the destination's rate
+        HandshakeLimited, // Hello from a source over its handshake rate
+    };
+
+    const char* DropReasonName(DropReason reason);
+
+    struct TraceRing; // One per tracing thread, defined in Trace.cpp
+
+    // One step of a packet through the pipeline, or where it was dropped. `session` is the
+    // client's VIP (network byte order), 0 if not known yet.
+    struct TraceEvent {
+        uint64_t tsc;
+        uint32_t session;
+        uint16_t size;
+        Stage stage;
+        DropReason reason;
+    };
+
+    // Always-on flight recorder. Every thread on the data path owns two rings, written without
+    // locks or atomic read-modify-writes: compact events for one packet in `sample_every` plus
+    // every drop, and the first SNAPLEN bytes of those sampled packets, inner and outer, for the
+    // selected sessions. Dump copies the rings while they are being written and saves the packets
+    // as pcapng and the events as text.
+    class Trace {
+    public:
+        static constexpr size_t EVENT_RING = 16384;  // Per thread, a power of two
+        static constexpr size_t CAPTURE_RING = 2048; // Per thread, a power of two
+        static constexpr size_t SNAPLEN = 192;
+
+        // Before the data path starts. `sample_every` 0 disables sampling (drops are still
+        // recorded); empty `sessions` captures every session. `local_port` fills in the
+        // outer UDP headers, whose local address is left unspecified.
+        static void Configure(uint32_t sample_every, std::vector<uint32_t> sessions, uint16_t local_port);
+
+        // Once per packet: whether to trace it
+        static bool Sample() {
+            thread_local constinit uint32_t countdown = 0;
+            uint32_t every = sample_every_.load(std::memory_order_relaxed);
+            if (!every) return false;
+            if (countdown == 0) {
+                countdown = every - 1;
+                return true;
+            }
+            --countdown;
+            return false;
+        }
+
+        static void Event(Stage stage, uint32_t session, size_t size, uint64_t tsc, DropReason reason = DropReason::None);
+        // `outer` packets are UDP payloads exchanged with `peer`, inner ones IP packets
+        static void Capture(uint32_t session, const uint8_t* data, size_t size, bool outer, bool outbound,
+                            const Endpoint& peer, uint64_t tsc);
+
+        // Writes the captured packets to `path` (pcapng, through a memory mapping) and the events
+        // to `path`.events. Returns the number of packets written; throws std::runtime_error.
+        static size_t Dump(const std::string& path);
+
+    private:
+        static TraceRing& ThreadRing();
+        static bool Selected(uint32_t session);
+
+        static inline std::atomic<uint32_t> sample_every_{0};
+    };
+
+}
@@ -1,58 +1,93 @@
 #pragma once
-#include <winsock2.h>
-#include "wintun.h"
+#include "PacketBuffer.h"
 #include <string>
 #include <vector>
 #include <functional>
 #include <memory>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 
 namespace vpn::tun {
 
+    // Layer-3 virtual interface: Wintun on Windows, /dev/net/tun on Linux.
+    // On Linux the device can have several queues (IFF_MULTI_QUEUE). The kernel hashes inner flows
+    // across them and every queue gets its own receive thread, so TUN reads scale with the UDP workers.
+    // Wintun has a single ring; there the queue count is always 1.
+    // The Linux backend also negotiates TSO/checksum offload (IFF_VNET_HDR, see TunOffload.h):
+    // super-segments read from the kernel are split into MTU-sized packets before delivery.
     class TunDevice {
     public:
-        TunDevice(const std::wstring& name, const std::wstring& tunnel_type);
+        explicit TunDevice(const std::string& name, size_t queues = 1);
         ~TunDevice();
 
-        void Start();
+        // pin_queues: pin queue i's receive thread to core i (matching worker i)
+        void Start(bool pin_queues = false);
         void Stop();
 
+        // Instead of Start's threads, an event loop can drive a queue: it watches QueueHandle (a
+        // pollable descriptor, -1 where there is none, e.g. Wintun) and calls ReadQueue when it is
+        // readable. ReadQueue takes what the queue holds, up to one batch, without blocking, and
+        // delivers it to the batch callback on the calling thread. The timer callback is not used
+        // then: the loop has its own (see EventLoop::SetTimerHandler).
+        int QueueHandle(size_t queue) const;
+        void ReadQueue(size_t queue);
+
         // Read packet from TUN (blocking or callback)
         // For simplicity, we'll expose a Read method or use a callback.
         // Let's use a callback for the receive loop.
-        using ReceiveCallback = std::function<void(const std::vector<uint8_t>&)>;
+        using ReceiveCallback = std::function<void(const utils::PacketBuffer&)>;
         void SetReceiveCallback(ReceiveCallback cb);
 
-        // Write packet to TUN
-        void Write(const std::vector<uint8_t>& packet);
+        // Alternative to the per-packet callback: packets already queued in the ring are
+        // delivered together (up to MAX_BATCH), so the consumer can send them with one syscall.
+        // With several queues the callback runs concurrently, once per queue thread.
+        // Packets arrive in pool buffers with headroom (see PacketBuffer); the callback may seal them
+        // in place and move them out of the batch to keep them.
+        static constexpr size_t MAX_BATCH = 64;
+        using ReceiveBatchCallback = std::function<void(std::vector<utils::PacketBuffer>&, size_t queue)>;
+        void SetReceiveBatchCallback(ReceiveBatchCallback cb);
+
+        // Called on each queue thread before it waits for packets. Returns how long the wait may
+        // last (capped at 100ms), so a consumer holding packets back (shaping) can release them on
+        // time without a thread of its own.
+        using TimerCallback = std::function<std::chrono::microseconds(size_t queue)>;
+        void SetTimerCallback(TimerCallback cb);
+
+        // Write packet to TUN. Any queue may be used; writing from worker i to queue i avoids sharing.
+        void Write(const utils::PacketBuffer& packet, size_t queue = 0);
+
+        // Write several packets. With Linux offloads, in-order TCP segments of one flow are merged
+        // into super-segments first, so a bulk transfer takes a fraction of the write() calls.
+        void WriteBatch(const std::vector<utils::PacketBuffer>& packets, size_t queue = 0);
+
+        // Assign an IPv4 or IPv6 address and bring the interface up. Returns false on failure.
+        bool SetAddress(const std::string& ip, unsigned prefix_len);
+        // Route an IPv4 or IPv6 network into the device (the interface must be up)
+        bool AddRoute(const std::string& network, unsigned prefix_len);
+        bool SetMtu(unsigned mtu);
+
+        const std::string& Name() const { return name_; }
+        size_t QueueCount() const;
 
     private:
-        void LoadWintun();
-        void ReceiveLoop();
-
-        std::wstring name_;
-        std::wstring tunnel_type_;
-        HMODULE wintun_lib_ = nullptr;
-        WINTUN_ADAPTER_HANDLE adapter_ = nullptr;
-        WINTUN_SESSION_HANDLE session_ = nullptr;
-        
-        std::thread receive_thread_;
+        struct Impl; // Platform handles (Wintun session, or one fd per queue)
+
+        void OpenQueues();
+        void CloseQueues();
+        void ReceiveLoop(size_t queue);
+        void Deliver(std::vector<utils::PacketBuffer>& batch, size_t count, size_t queue);
+        std::chrono::microseconds RunTimer(size_t queue); // How long the queue thread may wait
+
+        std::string name_;
+        std::unique_ptr<Impl> impl_;
+
+        std::vector<std::thread> receive_threads_;
         std::atomic<bool> running_ = false;
         ReceiveCallback on_receive_;
-
-        // Function Pointers
-        WINTUN_CREATE_ADAPTER_FUNC* WintunCreateAdapter = nullptr;
-        WINTUN_OPEN_ADAPTER_FUNC* WintunOpenAdapter = nullptr;
-        WINTUN_CLOSE_ADAPTER_FUNC* WintunCloseAdapter = nullptr;
-        WINTUN_DELETE_DRIVER_FUNC* WintunDeleteDriver = nullptr;
-        WINTUN_START_SESSION_FUNC* WintunStartSession = nullptr;
-        WINTUN_END_SESSION_FUNC* WintunEndSession = nullptr;
-        WINTUN_GET_READ_WAIT_EVENT_FUNC* WintunGetReadWaitEvent = nullptr;
-        WINTUN_RECEIVE_PACKET_FUNC* WintunReceivePacket = nullptr;
-        WINTUN_RELEASE_RECEIVE_PACKET_FUNC* WintunReleaseReceivePacket = nullptr;
-        WINTUN_ALLOCATE_SEND_PACKET_FUNC* WintunAllocateSendPacket = nullptr;
-        WINTUN_SEND_PACKET_FUNC* WintunSendPacket = nullptr;
+        ReceiveBatchCallback on_receive_batch_;
+        TimerCallback on_timer_;
     };
 
 }
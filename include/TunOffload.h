@@ -0,0 +1,40 @@
+#pragma once
+#include "PacketBuffer.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace vpn::tun {
+
+    // Header the kernel puts in front of every packet on a TUN device opened with IFF_VNET_HDR
+    // (struct virtio_net_hdr, host byte order). With TUNSETOFFLOAD the device hands us TCP
+    // super-segments of up to 64KB and accepts them back, instead of one packet per MTU.
+    struct VirtioNetHeader {
+        uint8_t flags = 0;
+        uint8_t gso_type = 0;
+        uint16_t hdr_len = 0;     // IP + TCP header bytes
+        uint16_t gso_size = 0;    // Payload bytes per segment (MSS)
+        uint16_t csum_start = 0;  // Where the L4 checksum coverage starts
+        uint16_t csum_offset = 0; // Checksum field, relative to csum_start
+    };
+    static_assert(sizeof(VirtioNetHeader) == 10);
+
+    constexpr size_t VIRTIO_NET_HDR_SIZE = sizeof(VirtioNetHeader);
+    constexpr uint8_t VIRTIO_NET_HDR_F_NEEDS_CSUM = 1;
+    constexpr uint8_t VIRTIO_NET_HDR_GSO_NONE = 0;
+    constexpr uint8_t VIRTIO_NET_HDR_GSO_TCPV4 = 1;
+    constexpr uint8_t VIRTIO_NET_HDR_GSO_TCPV6 = 4;
+
+    // Receive side: `data` is [VirtioNetHeader][packet] as read from the device. Appends the
+    // ordinary IP packets it carries to out[count...] (one, or one per gso_size chunk of a
+    // super-segment) with checksums completed, and returns the new count. Malformed input is dropped.
+    // Each packet is copied into a pool buffer, with headroom for the consumer's headers.
+    size_t SplitSuperPacket(const uint8_t* data, size_t length, std::vector<utils::PacketBuffer>& out, size_t count);
+
+    // Send side: merges runs of in-order TCP segments of the same flow into super-segments.
+    // Every output buffer is [VirtioNetHeader][packet], ready for one write() each. Other packets
+    // pass through with an empty header. Returns the number of buffers filled in `out`.
+    // `out` entries are reused, so steady state does not reallocate.
+    size_t CoalescePackets(const std::vector<utils::PacketBuffer>& packets, std::vector<std::vector<uint8_t>>& out);
+
+}
@@ -1,28 +1,102 @@
 #pragma once
 #include <string>
+#include <atomic>
 #include <vector>
 #include <cstdint>
+
+#ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
-
 #pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
 
 namespace vpn::utils {
 
+#ifdef _WIN32
+    using SocketHandle = SOCKET;
+#else
+    using SocketHandle = int;
+#endif
+
+    // Outer peer address. Sockets are dual-stack, so IPv4 peers appear as IPv4-mapped IPv6
+    // addresses (::ffff:a.b.c.d) and one fixed-size key covers both families.
+    using Endpoint = sockaddr_in6;
+
+    // Parse an IPv4 or IPv6 literal; IPv4 is mapped. Returns false if `ip` is neither.
+    bool ParseEndpoint(const std::string& ip, uint16_t port, Endpoint& endpoint);
+    // "192.0.2.1:51820" or "[2001:db8::1]:51820"
+    bool ParseHostPort(const std::string& text, Endpoint& endpoint);
+
+    // One datagram in a batch. Buffers are owned by the caller.
+    struct Datagram {
+        uint8_t* data = nullptr;
+        size_t capacity = 0; // Receive: buffer size
+        size_t length = 0;   // Receive: bytes received. Send: bytes to send
+        Endpoint addr = {};    // Receive: sender. Send: destination
+        uint16_t segment_size = 0; // Receive with GRO: size of each coalesced datagram (last may be shorter), 0 if not an aggregate
+        uint8_t tos = 0;           // Send (Linux): outer DSCP as a TOS / traffic class byte, 0 for the socket default
+    };
+
+    // Calls fn(data, length) for every datagram inside `datagram`, splitting GRO aggregates
+    template <typename Fn>
+    void ForEachSegment(const Datagram& datagram, Fn&& fn) {
+        size_t step = datagram.segment_size ? datagram.segment_size : datagram.length;
+        if (step == 0) return;
+        for (size_t offset = 0; offset < datagram.length; offset += step) {
+            size_t length = datagram.length - offset < step ? datagram.length - offset : step;
+            fn(datagram.data + offset, length);
+        }
+    }
+
     class UdpSocket {
     public:
         UdpSocket();
         ~UdpSocket();
 
-        void Bind(uint16_t port);
+        // Binds the IPv6 wildcard with IPV6_V6ONLY off, so one socket serves IPv4 and IPv6 peers.
+        // reuse_port: let several sockets bind the same port and have the kernel spread
+        // flows across them by 4-tuple hash (SO_REUSEPORT). Not available on Windows.
+        void Bind(uint16_t port, bool reuse_port = false);
+        static bool SupportsReusePort();
+
         void SendTo(const std::string& ip, uint16_t port, const std::vector<uint8_t>& data);
-        void SendTo(const sockaddr_in& dest, const std::vector<uint8_t>& data);
+        void SendTo(const Endpoint& dest, const std::vector<uint8_t>& data);
         
         // Returns bytes read, fills sender info
-        int ReceiveFrom(std::vector<uint8_t>& buffer, sockaddr_in& sender);
+        int ReceiveFrom(std::vector<uint8_t>& buffer, Endpoint& sender);
+
+        // Move up to `count` datagrams per syscall (recvmmsg/sendmmsg on Linux, one at a time elsewhere).
+        // ReceiveBatch blocks until at least one datagram arrives and returns how many were received;
+        // SendBatch returns how many were sent; a datagram the kernel rejects (unreachable destination,
+        // too large) is dropped and the rest of the batch still goes out.
+        static constexpr size_t MAX_BATCH = 64;
+        int ReceiveBatch(Datagram* datagrams, size_t count);
+        int SendBatch(const Datagram* datagrams, size_t count);
+
+        // Linux UDP segmentation offloads; both return false where unsupported.
+        // GSO: SendBatch sends each run of equal-size datagrams to the same destination as one
+        //      super-buffer (UDP_SEGMENT) that the kernel or NIC splits again.
+        // GRO: received datagrams from one flow may arrive coalesced (see Datagram::segment_size);
+        //      receive buffers should be 64KB.
+        bool EnableGso();
+        bool EnableGro();
+        bool GroEnabled() const { return gro_enabled_; }
+
+        // Asks for a kernel receive buffer of `bytes` (past net.core.rmem_max where the process may,
+        // SO_RCVBUFFORCE); returns the size the kernel reports, which counts its overhead too
+        size_t SetReceiveBuffer(size_t bytes);
+
+        SocketHandle Handle() const { return sock_; }
 
     private:
-        SOCKET sock_ = INVALID_SOCKET;
+        SocketHandle sock_;
+        // Workers share the socket, and any of them may turn GSO off when the route rejects it
+        std::atomic<bool> gso_enabled_ = false;
+        bool gro_enabled_ = false;
     };
 
 }
@@ -2,67 +2,258 @@
 #include "UdpSocket.h"
 #include "Session.h"
 #include "Protocol.h"
+#include "EventLoop.h"
+#include "Qos.h"
+#include "ConfigFile.h"
+#include "MappedFile.h"
+#include <algorithm>
 #include <iostream>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 
 using namespace vpn;
 
 utils::UdpSocket udp_socket;
 std::unique_ptr<tun::TunDevice> tun_device;
-std::shared_ptr<Session> session;
+std::unique_ptr<utils::EventLoop> loop; // Drives the socket, and the TUN device where it has a descriptor
+bool tun_on_loop = false;
+// Replaced by a fallback handshake; read by the TUN thread where there is one
+std::atomic<std::shared_ptr<Session>> session;
 std::string server_ip = "127.0.0.1";
 uint16_t server_port = 51820;
+std::string tun_name = "VPNClient";
+std::string ticket_file = "vpn_client.ticket"; // Empty: never resume
 
-void HandleTunPacket(const std::vector<uint8_t>& packet) {
-    if (session && session->IsEstablished()) {
-        auto encrypted = session->Encrypt(packet);
-        udp_socket.SendTo(server_ip, server_port, encrypted);
+// Keys: server, port, tun_name, ticket_file (see README)
+void ApplyConfigFile(const utils::ConfigFile& file) {
+    for (const auto& section : file.Sections()) {
+        if (!section.name.empty()) file.Fail(section.line, "unknown section [" + section.name + "]");
+        for (const auto& setting : section.settings) {
+            if (setting.key == "server") server_ip = setting.value;
+            else if (setting.key == "port") server_port = static_cast<uint16_t>(file.Unsigned(setting, 65535));
+            else if (setting.key == "tun_name") tun_name = setting.value;
+            else if (setting.key == "ticket_file") ticket_file = setting.value;
+            else file.Fail(setting.line, "unknown setting " + setting.key);
+        }
+    }
+}
+
+utils::Endpoint server_addr = {};
+std::vector<utils::PacketBuffer> tun_writes; // Decrypted on the loop thread, flushed per burst
+
+// TUN -> UDP: seal everything the TUN ring had queued, in place, and send it with one SendBatch
+// (sendmmsg). Each packet's service class is carried on the outer DSCP (see Qos.h).
+// Runs on the loop thread, or on the TUN device's thread where the loop cannot watch it (Wintun).
+void HandleTunPacket(std::vector<utils::PacketBuffer>& packets, size_t /*queue*/) {
+    std::shared_ptr<Session> session = ::session.load();
+    if (!session || !session->IsEstablished()) return;
+
+    thread_local std::vector<utils::Datagram> outgoing;
+    outgoing.resize(packets.size());
+    for (size_t i = 0; i < packets.size(); ++i) {
+        outgoing[i].tos = utils::OuterTos(utils::Classify(packets[i].data(), packets[i].size()));
+    }
+    session->EncryptBatch(packets);
+    for (size_t i = 0; i < packets.size(); ++i) {
+        outgoing[i].data = packets[i].data();
+        outgoing[i].length = packets[i].size();
+        outgoing[i].addr = server_addr;
+    }
+    if (tun_on_loop) loop->SendBatch(udp_socket, outgoing.data(), outgoing.size());
+    else udp_socket.SendBatch(outgoing.data(), outgoing.size());
+}
+
+// The server assigns our virtual IP in the ServerHello
+void ConfigureAddress(const Session& session) {
+    auto address = session.GetAssignedAddress();
+    if (!address) return;
+
+    char ip[INET_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET, &address->virtual_ip, ip, sizeof(ip));
+    // The IPv6 address is derived from the VIP (see protocol::EmbedVip6)
+    char ip6[INET6_ADDRSTRLEN] = {};
+    auto embedded = protocol::EmbedVip6(address->virtual_ip);
+    inet_ntop(AF_INET6, embedded.data(), ip6, sizeof(ip6));
+    unsigned prefix6 = protocol::VIP6_PREFIX_LEN + address->prefix_len;
+
+    if (tun_device->SetAddress(ip, address->prefix_len) && tun_device->SetAddress(ip6, prefix6)) {
+        std::cout << "Assigned " << ip << "/" << int(address->prefix_len) << " and " << ip6 << "/" << prefix6 << std::endl;
+    } else {
+        std::cout << "Could not configure " << tun_device->Name() << ", please set " << ip << "/"
+                  << int(address->prefix_len) << " and " << ip6 << "/" << prefix6 << " manually" << std::endl;
+    }
+}
+
+// The ticket of the last session, kept across runs so reconnecting costs the server no X25519.
+// Layout: [Ticket TICKET_SIZE][Secret TICKET_SECRET_LEN]. The secret derives the next session's
+// keys, so the file is owner-only where supported.
+std::optional<ResumptionState> LoadTicket() {
+    constexpr size_t size = protocol::TICKET_SIZE + protocol::TICKET_SECRET_LEN;
+    try {
+        if (ticket_file.empty() || !std::filesystem::exists(ticket_file)) return std::nullopt;
+        utils::MappedFile file(ticket_file);
+        if (file.Size() != size) return std::nullopt;
+        const uint8_t* p = file.Data();
+        return ResumptionState{{p, p + protocol::TICKET_SIZE}, {p + protocol::TICKET_SIZE, p + size}};
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+void SaveTicket(const ResumptionState& state) {
+    if (ticket_file.empty()) return;
+    try {
+        utils::MappedFile file(ticket_file, state.ticket.size() + state.secret.size());
+        std::memcpy(file.Data(), state.ticket.data(), state.ticket.size());
+        std::memcpy(file.Data() + state.ticket.size(), state.secret.data(), state.secret.size());
+        file.Flush();
+    } catch (const std::exception& e) {
+        std::cerr << "Could not save the resumption ticket: " << e.what() << std::endl;
+    }
+}
+
+// Handshake, on the loop thread. A hello that goes unanswered is sent again. The server answers a
+// ResumeHello only if the ticket is valid, so one that goes unanswered (expired ticket, or a server
+// that restarted with a new ticket key) is dropped for a full handshake.
+constexpr auto HANDSHAKE_RETRY = std::chrono::seconds(1);
+std::vector<uint8_t> hello;
+bool resuming = false;
+std::chrono::steady_clock::time_point hello_sent_at;
+
+void Connect(bool resume) {
+    auto next = std::make_shared<Session>(false);
+    auto ticket = resume ? LoadTicket() : std::nullopt;
+    resuming = ticket.has_value();
+    hello = resuming ? next->InitiateResumption(*ticket) : next->InitiateHandshake();
+    session.store(next);
+    loop->SendTo(udp_socket, server_addr, hello);
+    hello_sent_at = std::chrono::steady_clock::now();
+    std::cout << (resuming ? "Sent ResumeHello..." : "Sent Handshake...") << std::endl;
+}
+
+// Keepalives (see protocol::KEEPALIVE_SECONDS): an empty Data packet as soon as the session is
+// established, which also lets a resumed session take over its address on the server, then one
+// every interval so the server does not expire the session while the tunnel is quiet. The server
+// answers each, so a session that authenticates nothing from the server for PEER_DEAD_SECONDS is
+// gone there (expired, or restored after a crash with its receive window ahead of ours) and is
+// replaced: resumed if the ticket is still good, otherwise with a full handshake.
+constexpr auto KEEPALIVE_INTERVAL = std::chrono::seconds(protocol::KEEPALIVE_SECONDS);
+constexpr auto PEER_DEAD_TIMEOUT = std::chrono::seconds(protocol::PEER_DEAD_SECONDS);
+std::chrono::steady_clock::time_point keepalive_due;
+std::chrono::steady_clock::time_point last_heard; // Last packet from the server that authenticated
+
+void SendKeepalive(Session& current) {
+    auto packet = utils::PacketBuffer::Allocate(0);
+    current.Encrypt(packet);
+    loop->SendTo(udp_socket, server_addr, std::vector<uint8_t>(packet.begin(), packet.end()));
+    keepalive_due = std::chrono::steady_clock::now() + KEEPALIVE_INTERVAL;
+}
+
+// Loop timer: hello retries until the session is established, keepalives after
+std::chrono::microseconds SessionTimer() {
+    std::shared_ptr<Session> current = session.load();
+    if (current->IsEstablished()) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_heard >= PEER_DEAD_TIMEOUT) {
+            std::cout << "No answer from the server, reconnecting" << std::endl;
+            Connect(true);
+            return HANDSHAKE_RETRY;
+        }
+        if (now >= keepalive_due) SendKeepalive(*current);
+        auto next = std::min(keepalive_due, last_heard + PEER_DEAD_TIMEOUT);
+        return std::chrono::duration_cast<std::chrono::microseconds>(next - std::chrono::steady_clock::now());
+    }
+    auto waited = std::chrono::steady_clock::now() - hello_sent_at;
+    if (waited < HANDSHAKE_RETRY) return std::chrono::duration_cast<std::chrono::microseconds>(HANDSHAKE_RETRY - waited);
+
+    if (resuming) {
+        std::cout << "No answer to ResumeHello, falling back to a full handshake" << std::endl;
+        if (!ticket_file.empty()) std::remove(ticket_file.c_str());
+        Connect(false);
+    } else {
+        // The same ClientHello: a late ServerHello to the first one still matches our key
+        loop->SendTo(udp_socket, server_addr, hello);
+        hello_sent_at = std::chrono::steady_clock::now();
     }
+    return HANDSHAKE_RETRY;
+}
+
+void HandleHandshakeResponse(utils::PacketBuffer& packet) {
+    std::shared_ptr<Session> current = session.load();
+    if (current->IsEstablished()) return; // A duplicate answer to a resent hello
+    current->HandleHandshake(std::vector<uint8_t>(packet.begin(), packet.end()));
+    if (!current->IsEstablished()) return;
+
+    std::cout << (current->IsResumed() ? "Session Resumed!" : "Session Established!") << std::endl;
+    if (auto state = current->GetResumptionState()) SaveTicket(*state);
+    last_heard = std::chrono::steady_clock::now();
+    ConfigureAddress(*current);
+    SendKeepalive(*current);
 }
 
 int main(int argc, char** argv) {
-    if (argc > 1) server_ip = argv[1];
+    // Usage: vpn_client [--config PATH] [SERVER]
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        try {
+            if (arg == "--config" && i + 1 < argc) ApplyConfigFile(utils::ConfigFile::Load(argv[++i]));
+            else server_ip = arg;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
 
     try {
         std::cout << "Starting VPN Client..." << std::endl;
 
-        tun_device = std::make_unique<tun::TunDevice>(L"VPNClient", L"Wintun");
-        tun_device->SetReceiveCallback(HandleTunPacket);
-        tun_device->Start();
-
-        std::cout << "TUN Device created. Please configure IP: 10.0.0.2/24" << std::endl;
-        std::cout << "Command: netsh interface ip set address name=\"VPNClient\" static 10.0.0.2 255.255.255.0" << std::endl;
-        system("netsh interface ip set address name=\"VPNClient\" static 10.0.0.2 255.255.255.0");
-
-        session = std::make_shared<Session>(false);
-        auto hello = session->InitiateHandshake();
-        udp_socket.SendTo(server_ip, server_port, hello);
-        std::cout << "Sent Handshake..." << std::endl;
-
-        std::vector<uint8_t> buffer(65535);
-        sockaddr_in sender;
-
-        while (true) {
-            int bytes = udp_socket.ReceiveFrom(buffer, sender);
-            if (bytes > 0) {
-                std::vector<uint8_t> packet(buffer.begin(), buffer.begin() + bytes);
-                auto pp = protocol::ParsePacket(packet);
-
-                if (pp.type == protocol::PacketType::ServerHello) {
-                    std::cout << "Received ServerHello" << std::endl;
-                    session->HandleHandshake(packet);
-                    if (session->IsEstablished()) {
-                        std::cout << "Session Established!" << std::endl;
-                    }
-                } else if (pp.type == protocol::PacketType::Data) {
-                    auto decrypted = session->Decrypt(pp.payload);
-                    if (!decrypted.empty()) {
-                        tun_device->Write(decrypted);
-                    }
-                }
-            }
+        tun_device = std::make_unique<tun::TunDevice>(tun_name);
+        if (!tun_device->SetMtu(protocol::TUNNEL_MTU)) {
+            std::cout << "Could not set the MTU of " << tun_device->Name() << ", please set it to " << protocol::TUNNEL_MTU << std::endl;
+        }
+        // The server may be given as an IPv4 or IPv6 literal
+        if (!utils::ParseEndpoint(server_ip, server_port, server_addr)) {
+            throw std::runtime_error("Invalid server address: " + server_ip);
         }
+
+        // Segmentation offloads cut per-datagram syscall cost on bulk transfers (Linux only)
+        udp_socket.EnableGso();
+        udp_socket.EnableGro();
+
+        tun_device->SetReceiveBatchCallback(HandleTunPacket);
+        loop = utils::EventLoop::Create();
+        tun_on_loop = tun_device->QueueHandle(0) >= 0;
+        if (tun_on_loop) loop->AddReadable(tun_device->QueueHandle(0), [] { tun_device->ReadQueue(0); });
+        else tun_device->Start();
+
+        Connect(true);
+
+        loop->AddSocket(udp_socket, [](utils::PacketBuffer& packet, const utils::Endpoint&) {
+            if (packet.empty()) return;
+            auto type = static_cast<protocol::PacketType>(packet[0]);
+
+            if (type == protocol::PacketType::ServerHello || type == protocol::PacketType::ResumeAck) {
+                HandleHandshakeResponse(packet);
+            } else if (type == protocol::PacketType::Data) {
+                // Opened in place and queued for the TUN writer in the same buffer
+                std::shared_ptr<Session> current = session.load();
+                if (!current->IsEstablished() || !current->Decrypt(packet)) return;
+                last_heard = std::chrono::steady_clock::now();
+                if (!packet.empty()) tun_writes.push_back(std::move(packet));
+            }
+        });
+        loop->SetTimerHandler(SessionTimer);
+        // Written once per receive burst so in-order TCP segments can be coalesced
+        loop->SetBatchEndHandler([] {
+            if (tun_writes.empty()) return;
+            tun_device->WriteBatch(tun_writes);
+            tun_writes.clear();
+        });
+        loop->Run();
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
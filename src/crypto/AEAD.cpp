@@ -1,107 +1,125 @@
 #include "AEAD.h"
+#include "Metrics.h"
 #include <openssl/evp.h>
 
 namespace vpn::crypto {
 
-    Bytes AEAD::Encrypt(const Bytes& key, const Bytes& nonce, const Bytes& plaintext, const Bytes& aad) {
-        if (key.size() != KEY_LEN) throw CryptoException("Invalid key length");
-        if (nonce.size() != NONCE_LEN) throw CryptoException("Invalid nonce length");
+    namespace {
+        const auto decrypt_failures = utils::Metrics::AddCounter(
+            "vpn_decrypt_failures_total", "AEAD decryptions that failed to authenticate (data packets and tickets)");
 
-        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-        if (!ctx) throw CryptoException("Failed to create cipher context");
+        // One cipher context per thread and direction, reused across packets and sessions.
+        // Avoids a context allocation per packet and lets threads encrypt concurrently.
+        struct ThreadCipherContext {
+            EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+            ~ThreadCipherContext() { if (ctx) EVP_CIPHER_CTX_free(ctx); }
+        };
 
-        if (EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, key.data(), nonce.data()) != 1) {
-            EVP_CIPHER_CTX_free(ctx);
-            throw CryptoException("Failed to init encryption");
+        EVP_CIPHER_CTX* EncryptContext() {
+            thread_local ThreadCipherContext holder;
+            return holder.ctx;
         }
 
-        // Set AAD
-        int len;
-        if (!aad.empty()) {
-            if (EVP_EncryptUpdate(ctx, NULL, &len, aad.data(), (int)aad.size()) != 1) {
-                EVP_CIPHER_CTX_free(ctx);
-                throw CryptoException("Failed to set AAD");
-            }
+        EVP_CIPHER_CTX* DecryptContext() {
+            thread_local ThreadCipherContext holder;
+            return holder.ctx;
         }
+    }
 
-        Bytes ciphertext(plaintext.size() + TAG_LEN); // Reserve space for tag? No, tag is separate in OpenSSL usually, but we append it.
-        // Actually, ciphertext size is same as plaintext. Tag is retrieved separately.
-        
-        if (EVP_EncryptUpdate(ctx, ciphertext.data(), &len, plaintext.data(), (int)plaintext.size()) != 1) {
-            EVP_CIPHER_CTX_free(ctx);
-            throw CryptoException("Failed to encrypt");
-        }
-        int ciphertext_len = len;
+    namespace {
+        // ChaCha20-Poly1305 from `in` to `out`, which may be the same buffer
+        void Seal(const Bytes& key, const Byte* nonce, const Byte* aad, size_t aad_length,
+                  const Byte* in, Byte* out, size_t length, Byte* tag) {
+            if (key.size() != KEY_LEN) throw CryptoException("Invalid key length");
 
-        if (EVP_EncryptFinal_ex(ctx, ciphertext.data() + len, &len) != 1) {
-            EVP_CIPHER_CTX_free(ctx);
-            throw CryptoException("Failed to finalize encryption");
-        }
-        ciphertext_len += len;
-        ciphertext.resize(ciphertext_len); // Should be same size
-
-        // Get Tag
-        Bytes tag(TAG_LEN);
-        if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, TAG_LEN, tag.data()) != 1) {
-            EVP_CIPHER_CTX_free(ctx);
-            throw CryptoException("Failed to get tag");
-        }
-
-        EVP_CIPHER_CTX_free(ctx);
+            EVP_CIPHER_CTX* ctx = EncryptContext();
+            if (!ctx) throw CryptoException("Failed to create cipher context");
 
-        // Append tag to ciphertext
-        ciphertext.insert(ciphertext.end(), tag.begin(), tag.end());
-        return ciphertext;
-    }
+            if (EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, key.data(), nonce) != 1) {
+                throw CryptoException("Failed to init encryption");
+            }
 
-    std::optional<Bytes> AEAD::Decrypt(const Bytes& key, const Bytes& nonce, const Bytes& ciphertext, const Bytes& aad) {
-        if (key.size() != KEY_LEN) return std::nullopt;
-        if (nonce.size() != NONCE_LEN) return std::nullopt;
-        if (ciphertext.size() < TAG_LEN) return std::nullopt;
+            int len;
+            if (aad_length) {
+                if (EVP_EncryptUpdate(ctx, NULL, &len, aad, (int)aad_length) != 1) {
+                    throw CryptoException("Failed to set AAD");
+                }
+            }
 
-        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-        if (!ctx) return std::nullopt;
+            // A stream cipher: the output is exactly as long as the input, and Final adds nothing
+            if (EVP_EncryptUpdate(ctx, out, &len, in, (int)length) != 1) {
+                throw CryptoException("Failed to encrypt");
+            }
+            if (EVP_EncryptFinal_ex(ctx, out + len, &len) != 1) {
+                throw CryptoException("Failed to finalize encryption");
+            }
 
-        if (EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, key.data(), nonce.data()) != 1) {
-            EVP_CIPHER_CTX_free(ctx);
-            return std::nullopt;
+            if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, TAG_LEN, tag) != 1) {
+                throw CryptoException("Failed to get tag");
+            }
         }
 
-        // Set AAD
-        int len;
-        if (!aad.empty()) {
-            if (EVP_DecryptUpdate(ctx, NULL, &len, aad.data(), (int)aad.size()) != 1) {
-                EVP_CIPHER_CTX_free(ctx);
-                return std::nullopt;
+        bool Open(const Bytes& key, const Byte* nonce, const Byte* aad, size_t aad_length,
+                  const Byte* in, Byte* out, size_t length, const Byte* tag) {
+            if (key.size() != KEY_LEN) return false;
+
+            EVP_CIPHER_CTX* ctx = DecryptContext();
+            if (!ctx) return false;
+
+            if (EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, key.data(), nonce) != 1) {
+                return false;
             }
-        }
 
-        // Separate tag
-        Bytes tag(ciphertext.end() - TAG_LEN, ciphertext.end());
-        Bytes actual_ciphertext(ciphertext.begin(), ciphertext.end() - TAG_LEN);
+            int len;
+            if (aad_length) {
+                if (EVP_DecryptUpdate(ctx, NULL, &len, aad, (int)aad_length) != 1) {
+                    return false;
+                }
+            }
 
-        // Set Tag
-        if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, TAG_LEN, tag.data()) != 1) {
-            EVP_CIPHER_CTX_free(ctx);
-            return std::nullopt;
+            if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, TAG_LEN, const_cast<Byte*>(tag)) != 1) {
+                return false;
+            }
+            if (EVP_DecryptUpdate(ctx, out, &len, in, (int)length) != 1) {
+                return false;
+            }
+            if (EVP_DecryptFinal_ex(ctx, out + len, &len) != 1) {
+                decrypt_failures.Add(); // Auth failed
+                return false;
+            }
+            return true;
         }
+    }
 
-        Bytes plaintext(actual_ciphertext.size());
-        if (EVP_DecryptUpdate(ctx, plaintext.data(), &len, actual_ciphertext.data(), (int)actual_ciphertext.size()) != 1) {
-            EVP_CIPHER_CTX_free(ctx);
+    Bytes AEAD::Encrypt(const Bytes& key, const Bytes& nonce, const Bytes& plaintext, const Bytes& aad) {
+        if (nonce.size() != NONCE_LEN) throw CryptoException("Invalid nonce length");
+
+        // Ciphertext with the tag appended
+        Bytes ciphertext(plaintext.size() + TAG_LEN);
+        Seal(key, nonce.data(), aad.data(), aad.size(), plaintext.data(), ciphertext.data(), plaintext.size(),
+             ciphertext.data() + plaintext.size());
+        return ciphertext;
+    }
+
+    std::optional<Bytes> AEAD::Decrypt(const Bytes& key, const Bytes& nonce, const Bytes& ciphertext, const Bytes& aad) {
+        if (nonce.size() != NONCE_LEN) return std::nullopt;
+        if (ciphertext.size() < TAG_LEN) return std::nullopt;
+
+        size_t length = ciphertext.size() - TAG_LEN;
+        Bytes plaintext(length);
+        if (!Open(key, nonce.data(), aad.data(), aad.size(), ciphertext.data(), plaintext.data(), length,
+                  ciphertext.data() + length)) {
             return std::nullopt;
         }
-        int plaintext_len = len;
+        return plaintext;
+    }
 
-        if (EVP_DecryptFinal_ex(ctx, plaintext.data() + len, &len) != 1) {
-            EVP_CIPHER_CTX_free(ctx);
-            return std::nullopt; // Auth failed
-        }
-        plaintext_len += len;
-        plaintext.resize(plaintext_len);
+    void AEAD::EncryptInPlace(const Bytes& key, const Byte* nonce, Byte* data, size_t length, Byte* tag) {
+        Seal(key, nonce, nullptr, 0, data, data, length, tag);
+    }
 
-        EVP_CIPHER_CTX_free(ctx);
-        return plaintext;
+    bool AEAD::DecryptInPlace(const Bytes& key, const Byte* nonce, Byte* data, size_t length, const Byte* tag) {
+        return Open(key, nonce, nullptr, 0, data, data, length, tag);
     }
 
 }
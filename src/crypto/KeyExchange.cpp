@@ -30,13 +30,6 @@ namespace vpn::crypto {
     Bytes KeyExchange::GetPublicKey() const {
         if (!pImpl->pkey) throw CryptoException("Key not generated");
 
-        size_t len = 0;
-        if (EVP_PKEY_get1_encoded_public_key(pImpl->pkey, NULL) <= 0) {
-             // For X25519, we can use EVP_PKEY_get_raw_public_key
-             // But let's check if get1_encoded returns SubjectPublicKeyInfo or raw.
-             // X25519 usually uses get_raw_public_key.
-        }
-
         // Use raw public key for X25519
         size_t key_len = PUBLIC_KEY_LEN;
         Bytes key(key_len);
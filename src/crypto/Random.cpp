@@ -0,0 +1,14 @@
+#include "Random.h"
+#include <openssl/rand.h>
+
+namespace vpn::crypto {
+
+    Bytes Random::Generate(size_t length) {
+        Bytes output(length);
+        if (length > 0 && RAND_bytes(output.data(), (int)length) != 1) {
+            throw CryptoException("Failed to generate random bytes");
+        }
+        return output;
+    }
+
+}
@@ -0,0 +1,200 @@
+#include "UdpSocket.h"
+#include "EventLoop.h"
+#include "Protocol.h"
+#include "Steering.h"
+#include "Affinity.h"
+#include "Latency.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstring>
+
+using namespace vpn;
+
+// Stateless front-end for a set of vpn_server backends (normally the nodes of a cluster, listed in
+// node order). Data packets go to backend `index % backends`, the node that picked the session's
+// index (see AllocateIndex in the server); hellos go to a backend chosen by rendezvous hashing of
+// the client's address, so adding or removing a backend only moves the clients that hashed to it.
+// Nothing is decrypted and nothing is remembered: the client's address travels with each datagram
+// (see Steering.h), and replies come back through here the same way.
+
+std::vector<utils::Endpoint> backends;
+
+bool SameEndpoint(const utils::Endpoint& a, const utils::Endpoint& b) {
+    return a.sin6_port == b.sin6_port && std::memcmp(&a.sin6_addr, &b.sin6_addr, sizeof(a.sin6_addr)) == 0;
+}
+
+// One per core: a client-facing socket and a backend-facing socket, both SO_REUSEPORT, driven by
+// one loop. Datagrams are forwarded in the buffer they were read into, a burst at a time. A burst
+// is queued per backend, so each backend's share leaves as one GSO super-buffer where possible
+// rather than alternating destinations datagram by datagram.
+struct Worker {
+    unsigned id = 0;
+    utils::UdpSocket front;
+    utils::UdpSocket back;
+    std::unique_ptr<utils::EventLoop> loop;
+    std::vector<utils::PacketBuffer> held; // Owns the data of this burst's datagrams
+    std::vector<std::vector<utils::Datagram>> to_backends; // By backend
+    std::vector<utils::Datagram> to_clients;
+    std::thread thread;
+
+    // Read by the stats thread
+    std::atomic<uint64_t> forwarded_in{0};  // Client -> backend
+    std::atomic<uint64_t> forwarded_out{0}; // Backend -> client
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> bursts{0};
+    std::atomic<uint64_t> busy_ticks{0};    // Tsc ticks spent steering and sending
+};
+
+std::vector<std::unique_ptr<Worker>> workers;
+
+void Queue(Worker& worker, std::vector<utils::Datagram>& batch, utils::PacketBuffer& packet, const utils::Endpoint& dest) {
+    utils::Datagram datagram;
+    datagram.data = packet.data();
+    datagram.length = packet.size();
+    datagram.addr = dest;
+    batch.push_back(datagram);
+    worker.held.push_back(std::move(packet)); // Moves the handle; the data stays put
+}
+
+void WorkerLoop(Worker& worker) try {
+    worker.loop->AddSocket(worker.front, [&worker](utils::PacketBuffer& packet, const utils::Endpoint& client) {
+        uint64_t start = utils::Tsc::Now();
+        int backend = protocol::SteerToBackend(packet.data(), packet.size(), client, backends.size());
+        if (backend < 0) {
+            worker.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        protocol::WriteSteerHeader(packet.Prepend(protocol::STEER_HEADER_SIZE), client);
+        Queue(worker, worker.to_backends[backend], packet, backends[backend]);
+        worker.busy_ticks.fetch_add(utils::Tsc::Now() - start, std::memory_order_relaxed);
+    });
+    worker.loop->AddSocket(worker.back, [&worker](utils::PacketBuffer& packet, const utils::Endpoint& sender) {
+        uint64_t start = utils::Tsc::Now();
+        // Only backends may have us send on their behalf
+        bool known = false;
+        for (const auto& backend : backends) known = known || SameEndpoint(backend, sender);
+        if (!known || packet.size() < protocol::STEER_HEADER_SIZE) {
+            worker.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        utils::Endpoint client = protocol::ReadSteerHeader(packet.data());
+        packet.Consume(protocol::STEER_HEADER_SIZE);
+        Queue(worker, worker.to_clients, packet, client);
+        worker.busy_ticks.fetch_add(utils::Tsc::Now() - start, std::memory_order_relaxed);
+    });
+    worker.loop->SetBatchEndHandler([&worker] {
+        uint64_t start = utils::Tsc::Now();
+        worker.bursts.fetch_add(1, std::memory_order_relaxed);
+        for (auto& batch : worker.to_backends) {
+            if (batch.empty()) continue;
+            int sent = worker.back.SendBatch(batch.data(), batch.size());
+            worker.forwarded_in.fetch_add(sent > 0 ? static_cast<uint64_t>(sent) : 0, std::memory_order_relaxed);
+            batch.clear();
+        }
+        if (!worker.to_clients.empty()) {
+            int sent = worker.front.SendBatch(worker.to_clients.data(), worker.to_clients.size());
+            worker.forwarded_out.fetch_add(sent > 0 ? static_cast<uint64_t>(sent) : 0, std::memory_order_relaxed);
+            worker.to_clients.clear();
+        }
+        worker.held.clear();
+        worker.busy_ticks.fetch_add(utils::Tsc::Now() - start, std::memory_order_relaxed);
+    });
+    worker.loop->Run();
+} catch (const std::exception& e) {
+    std::cerr << "Worker " << worker.id << " error: " << e.what() << std::endl;
+}
+
+// Every `interval`: packets per second each way, drops, packets per burst, and the forwarding cost
+// per packet (steering plus the send syscalls, not the receive)
+void StatsLoop(std::chrono::seconds interval) {
+    uint64_t last_in = 0, last_out = 0, last_ticks = 0, last_bursts = 0;
+    double nanos_per_tick = utils::Tsc::NanosPerTick();
+    for (;;) {
+        std::this_thread::sleep_for(interval);
+        uint64_t in = 0, out = 0, dropped = 0, ticks = 0, bursts = 0;
+        for (auto& worker : workers) {
+            in += worker->forwarded_in.load(std::memory_order_relaxed);
+            out += worker->forwarded_out.load(std::memory_order_relaxed);
+            dropped += worker->dropped.load(std::memory_order_relaxed);
+            ticks += worker->busy_ticks.load(std::memory_order_relaxed);
+            bursts += worker->bursts.load(std::memory_order_relaxed);
+        }
+        uint64_t packets = (in - last_in) + (out - last_out);
+        double cost = packets ? (ticks - last_ticks) * nanos_per_tick / packets : 0;
+        double per_burst = bursts > last_bursts ? static_cast<double>(packets) / (bursts - last_bursts) : 0;
+        std::cout << "lb: " << (in - last_in) / interval.count() << " pkt/s to backends, " << (out - last_out) / interval.count()
+                  << " pkt/s to clients, " << dropped << " dropped, " << per_burst << " pkt/burst, " << static_cast<uint64_t>(cost)
+                  << " ns/packet" << std::endl;
+        last_in = in;
+        last_out = out;
+        last_ticks = ticks;
+        last_bursts = bursts;
+    }
+}
+
+int main(int argc, char** argv) {
+    // Usage: vpn_lb [--port PORT] [--backend-port PORT] [--workers N] [--stats-interval SECONDS] BACKEND...
+    // Clients connect to --port (51820). BACKEND is HOST:PORT of a server's listen port, in cluster
+    // node order. The servers send back to --backend-port (51819) on this host, which they are
+    // given with --load-balancer (e.g. --load-balancer 127.0.0.1:51819).
+    uint16_t port = 51820;
+    uint16_t backend_port = 51819;
+    unsigned worker_count = 0;
+    unsigned stats_interval = 0;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--port" && has_value) port = static_cast<uint16_t>(std::stoul(argv[++i]));
+            else if (arg == "--backend-port" && has_value) backend_port = static_cast<uint16_t>(std::stoul(argv[++i]));
+            else if (arg == "--workers" && has_value) worker_count = static_cast<unsigned>(std::stoul(argv[++i]));
+            else if (arg == "--stats-interval" && has_value) stats_interval = static_cast<unsigned>(std::stoul(argv[++i]));
+            else {
+                utils::Endpoint backend;
+                if (!utils::ParseHostPort(arg, backend)) throw std::runtime_error("Invalid backend: " + arg);
+                backends.push_back(backend);
+            }
+        }
+        if (backends.empty()) throw std::runtime_error("No backends given");
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    bool reuse_port = utils::UdpSocket::SupportsReusePort();
+    if (worker_count == 0) worker_count = reuse_port ? std::thread::hardware_concurrency() : 1;
+    if (worker_count == 0 || !reuse_port) worker_count = 1;
+
+    try {
+        for (unsigned i = 0; i < worker_count; ++i) {
+            auto worker = std::make_unique<Worker>();
+            worker->id = i;
+            worker->front.Bind(port, worker_count > 1);
+            worker->back.Bind(backend_port, worker_count > 1);
+            for (auto* socket : {&worker->front, &worker->back}) {
+                socket->EnableGso();
+                socket->EnableGro();
+            }
+            worker->to_backends.resize(backends.size());
+            worker->loop = utils::EventLoop::Create();
+            workers.push_back(std::move(worker));
+        }
+
+        std::cout << "Load balancing UDP " << port << " over " << backends.size() << " backend(s), replies on UDP "
+                  << backend_port << ", " << worker_count << " worker(s), " << workers[0]->loop->Name() << " event loop" << std::endl;
+        if (stats_interval) std::thread(StatsLoop, std::chrono::seconds(stats_interval)).detach();
+
+        for (auto& worker : workers) {
+            worker->thread = std::thread(WorkerLoop, std::ref(*worker));
+            if (worker_count > 1) utils::PinThreadToCore(worker->thread, worker->id);
+        }
+        for (auto& worker : workers) worker->thread.join();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "ClientRoutes.h"
+#include "Protocol.h"
+#include <cstring>
+
+namespace vpn::protocol {
+
+    uint32_t ClientRoutes::ToVip(uint32_t ip) const {
+        auto hop = routes.Lookup(ip);
+        if (!hop) return 0;
+        return *hop ? *hop : ip;
+    }
+
+    uint32_t ClientRoutes::ToVip6(const uint8_t* ip) const {
+        if (std::memcmp(ip, VIP6_PREFIX.data(), VIP6_PREFIX.size()) == 0) {
+            uint32_t vip;
+            std::memcpy(&vip, ip + VIP6_PREFIX.size(), 4);
+            return ToVip(vip) == vip ? vip : 0; // Only the pool itself is mirrored
+        }
+        auto hop = routes6.Lookup(ip);
+        return hop ? *hop : 0;
+    }
+
+    uint32_t ClientRoutes::Route(const utils::PacketBuffer& packet, bool source) const {
+        if (packet.empty()) return 0;
+        switch (packet[0] >> 4) {
+            case 4: {
+                if (packet.size() < 20) return 0;
+                uint32_t ip;
+                std::memcpy(&ip, packet.data() + (source ? 12 : 16), 4);
+                return ToVip(ip);
+            }
+            case 6:
+                if (packet.size() < 40) return 0;
+                return ToVip6(packet.data() + (source ? 8 : 24));
+            default:
+                return 0;
+        }
+    }
+
+    bool DecrementTtl(utils::PacketBuffer& packet) {
+        uint8_t* ip = packet.data();
+        if ((ip[0] >> 4) == 4) {
+            if (ip[8] <= 1) return false;
+            ip[8]--;
+            // RFC 1141: the TTL is the high byte of its checksum word
+            uint32_t sum = ((ip[10] << 8) | ip[11]) + 0x0100;
+            sum = (sum & 0xFFFF) + (sum >> 16);
+            ip[10] = static_cast<uint8_t>(sum >> 8);
+            ip[11] = static_cast<uint8_t>(sum);
+            return true;
+        }
+        if (ip[7] <= 1) return false;
+        ip[7]--;
+        return true;
+    }
+
+}
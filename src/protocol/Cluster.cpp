@@ -0,0 +1,180 @@
+#include "Cluster.h"
+#include "AEAD.h"
+#include "Random.h"
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+namespace vpn {
+
+    namespace {
+        constexpr uint8_t MAGIC[4] = {'V', 'P', 'N', 'C'};
+        constexpr size_t HEADER_SIZE = 4 + 4 + crypto::NONCE_LEN;
+        constexpr size_t BODY_HEADER_SIZE = 8 + 8 + 1 + 2;
+        constexpr size_t MAX_DATAGRAM = 1400;
+        constexpr size_t RECEIVE_BUFFER = 16 << 20; // Some 7000 datagrams, 60000 records
+        constexpr size_t RECORDS_PER_DATAGRAM = (MAX_DATAGRAM - HEADER_SIZE - BODY_HEADER_SIZE - crypto::TAG_LEN) / SessionStore::RECORD_SIZE;
+        constexpr size_t INDEXES_PER_DATAGRAM = 256;
+
+        void Put32(uint8_t* p, uint32_t v) { for (int i = 0; i < 4; ++i) p[i] = (v >> (8 * i)) & 0xFF; }
+        void Put64(uint8_t* p, uint64_t v) { for (int i = 0; i < 8; ++i) p[i] = (v >> (8 * i)) & 0xFF; }
+        uint32_t Get32(const uint8_t* p) { uint32_t v = 0; for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(p[i]) << (8 * i); return v; }
+        uint64_t Get64(const uint8_t* p) { uint64_t v = 0; for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(p[i]) << (8 * i); return v; }
+
+        int64_t NowMs() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+    }
+
+    ClusterLink::ClusterLink(uint32_t self, std::vector<Node> nodes, const std::vector<uint8_t>& key)
+        : self_(self), nodes_(std::move(nodes)), key_(key) {
+        if (key_.size() != KEY_LEN) throw std::runtime_error("Cluster key must be 32 bytes");
+        if (self_ >= nodes_.size()) throw std::runtime_error("Cluster node " + std::to_string(self_) + " is not configured");
+        for (size_t i = 0; i < nodes_.size(); ++i) {
+            if (nodes_[i].id != i) throw std::runtime_error("Cluster nodes must be numbered 0 to " + std::to_string(nodes_.size() - 1));
+        }
+
+        // Wall clock: a restarted node's boot must compare higher than the one before it
+        boot_ = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        peers_ = std::make_unique<Peer[]>(nodes_.size());
+        socket_.Bind(ntohs(nodes_[self_].address.sin6_port));
+        // A sync sends every changed session in one burst, and a record lost on the way is only
+        // sent again when its session changes: room for the burst while the link thread applies it
+        socket_.SetReceiveBuffer(RECEIVE_BUFFER);
+    }
+
+    ClusterLink::~ClusterLink() {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+    }
+
+    void ClusterLink::Start() {
+        running_ = true;
+        thread_ = std::thread(&ClusterLink::Run, this);
+    }
+
+    bool ClusterLink::Alive(uint32_t node) const {
+        if (node == self_) return true;
+        if (node >= nodes_.size()) return false;
+        int64_t heard = peers_[node].last_heard.load(std::memory_order_relaxed);
+        return heard && NowMs() - heard < TIMEOUT_MS;
+    }
+
+    void ClusterLink::SendSessions(const std::vector<SessionRecord>& records, std::optional<uint32_t> node) {
+        std::vector<uint8_t> items(RECORDS_PER_DATAGRAM * SessionStore::RECORD_SIZE);
+        for (size_t first = 0; first < records.size(); first += RECORDS_PER_DATAGRAM) {
+            size_t count = std::min(RECORDS_PER_DATAGRAM, records.size() - first);
+            for (size_t i = 0; i < count; ++i) SessionStore::EncodeRecord(records[first + i], items.data() + i * SessionStore::RECORD_SIZE);
+            Send(Type::Sessions, static_cast<uint16_t>(count), items.data(), count * SessionStore::RECORD_SIZE, node);
+        }
+    }
+
+    void ClusterLink::SendRemoved(const std::vector<uint32_t>& indexes) {
+        std::vector<uint8_t> items(INDEXES_PER_DATAGRAM * 4);
+        for (size_t first = 0; first < indexes.size(); first += INDEXES_PER_DATAGRAM) {
+            size_t count = std::min(INDEXES_PER_DATAGRAM, indexes.size() - first);
+            for (size_t i = 0; i < count; ++i) Put32(items.data() + i * 4, indexes[first + i]);
+            Send(Type::Removed, static_cast<uint16_t>(count), items.data(), count * 4, std::nullopt);
+        }
+    }
+
+    void ClusterLink::Send(Type type, uint16_t count, const uint8_t* items, size_t size, std::optional<uint32_t> node) {
+        std::vector<uint8_t> header(HEADER_SIZE);
+        std::memcpy(header.data(), MAGIC, 4);
+        Put32(header.data() + 4, self_);
+        auto nonce = crypto::Random::Generate(crypto::NONCE_LEN);
+        std::memcpy(header.data() + 8, nonce.data(), crypto::NONCE_LEN);
+
+        std::vector<uint8_t> body(BODY_HEADER_SIZE + size);
+        Put64(body.data(), boot_);
+        Put64(body.data() + 8, sequence_.fetch_add(1, std::memory_order_relaxed));
+        body[16] = static_cast<uint8_t>(type);
+        body[17] = static_cast<uint8_t>(count);
+        body[18] = static_cast<uint8_t>(count >> 8);
+        if (size) std::memcpy(body.data() + BODY_HEADER_SIZE, items, size);
+
+        std::vector<uint8_t> datagram = header;
+        auto sealed = crypto::AEAD::Encrypt(key_, nonce, body, header);
+        datagram.insert(datagram.end(), sealed.begin(), sealed.end());
+
+        for (const auto& peer : nodes_) {
+            if (peer.id == self_ || (node && peer.id != *node)) continue;
+            socket_.SendTo(peer.address, datagram);
+        }
+    }
+
+    void ClusterLink::Run() {
+        std::vector<uint8_t> buffer(2048);
+        std::vector<bool> was_alive(nodes_.size(), false);
+        int64_t next_heartbeat = 0;
+        while (running_) {
+            int64_t now = NowMs();
+            if (now >= next_heartbeat) {
+                Send(Type::Heartbeat, 0, nullptr, 0, std::nullopt);
+                next_heartbeat = now + HEARTBEAT_MS;
+                for (uint32_t node = 0; node < nodes_.size(); ++node) {
+                    if (node == self_) continue;
+                    bool alive = Alive(node);
+                    if (was_alive[node] && !alive && on_down_) on_down_(node);
+                    was_alive[node] = alive;
+                }
+            }
+
+            pollfd pfd = {socket_.Handle(), POLLIN, 0};
+            if (poll(&pfd, 1, 100) <= 0) continue;
+            utils::Endpoint sender;
+            int size = socket_.ReceiveFrom(buffer, sender);
+            if (size <= 0) continue;
+            Receive(std::vector<uint8_t>(buffer.begin(), buffer.begin() + size));
+        }
+    }
+
+    void ClusterLink::Receive(const std::vector<uint8_t>& datagram) {
+        if (datagram.size() < HEADER_SIZE + BODY_HEADER_SIZE + crypto::TAG_LEN) return;
+        if (std::memcmp(datagram.data(), MAGIC, 4) != 0) return;
+        uint32_t node = Get32(datagram.data() + 4);
+        if (node >= nodes_.size() || node == self_) return;
+
+        std::vector<uint8_t> header(datagram.begin(), datagram.begin() + HEADER_SIZE);
+        std::vector<uint8_t> nonce(datagram.begin() + 8, datagram.begin() + HEADER_SIZE);
+        std::vector<uint8_t> sealed(datagram.begin() + HEADER_SIZE, datagram.end());
+        auto body = crypto::AEAD::Decrypt(key_, nonce, sealed, header);
+        if (!body) return;
+
+        // A newer boot is a restarted node; datagrams from an older one are stale or replayed
+        Peer& peer = peers_[node];
+        uint64_t boot = Get64(body->data());
+        if (boot < peer.boot) return;
+        bool joined = boot > peer.boot;
+        if (joined) {
+            peer.boot = boot;
+            peer.window = std::make_unique<protocol::ReplayWindow>();
+        }
+        if (!peer.window || !peer.window->Accept(Get64(body->data() + 8))) return;
+        peer.last_heard.store(NowMs(), std::memory_order_relaxed);
+        if (joined && on_join_) on_join_(node);
+
+        auto type = static_cast<Type>((*body)[16]);
+        size_t count = (*body)[17] | ((*body)[18] << 8);
+        const uint8_t* items = body->data() + BODY_HEADER_SIZE;
+        size_t size = body->size() - BODY_HEADER_SIZE;
+        if (type == Type::Sessions && size == count * SessionStore::RECORD_SIZE && on_sessions_) {
+            std::vector<SessionRecord> records;
+            records.reserve(count);
+            for (size_t i = 0; i < count; ++i) records.push_back(SessionStore::DecodeRecord(items + i * SessionStore::RECORD_SIZE));
+            on_sessions_(node, records);
+        } else if (type == Type::Removed && size == count * 4 && on_removed_) {
+            std::vector<uint32_t> indexes(count);
+            for (size_t i = 0; i < count; ++i) indexes[i] = Get32(items + i * 4);
+            on_removed_(node, indexes);
+        }
+    }
+
+}
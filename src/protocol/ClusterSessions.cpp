@@ -0,0 +1,29 @@
+#include "ClusterSessions.h"
+
+namespace vpn {
+
+    uint64_t ClusterCounterMargin(uint32_t nodes) {
+        uint64_t round = Session::NONCE_BLOCK * (nodes ? nodes : 1);
+        return (CLUSTER_COUNTER_MARGIN + round - 1) / round * round;
+    }
+
+    std::shared_ptr<Session> ReplicateSession(const SessionRecord& record, const protocol::TicketKey* ticket_key,
+                                              uint32_t self, uint32_t nodes, uint64_t& provisional_rx) {
+        SessionState state = record.state;
+        state.tx_nonce_counter += ClusterCounterMargin(nodes);
+        state.rx_nonce_next += CLUSTER_RX_MARGIN;
+        auto session = std::make_shared<Session>(state, ticket_key);
+        session->SetNonceStripe(self, nodes);
+        provisional_rx = state.rx_nonce_next;
+        return session;
+    }
+
+    void UpdateReplica(Session& session, uint64_t& provisional_rx, const SessionRecord& record, uint32_t nodes) {
+        session.AdvanceTxCounter(record.state.tx_nonce_counter + ClusterCounterMargin(nodes));
+        // What the sender received is not accepted here again
+        uint64_t rx = record.state.rx_nonce_next;
+        if (!provisional_rx || !session.RestartRxWindow(provisional_rx, rx)) session.AdvanceRxWindow(rx);
+        provisional_rx = 0;
+    }
+
+}
@@ -23,7 +23,7 @@ namespace vpn::protocol {
         return packet;
     }
 
-    std::vector<uint8_t> CreateServerHello(const std::vector<uint8_t>& pub_key) {
+    std::vector<uint8_t> CreateServerHello(const std::vector<uint8_t>& pub_key, const AddressAssignment& address, uint32_t index, const std::vector<uint8_t>& ticket) {
         std::vector<uint8_t> packet;
         packet.push_back(static_cast<uint8_t>(PacketType::ServerHello));
         packet.insert(packet.end(), pub_key.begin(), pub_key.end());
@@ -33,9 +33,58 @@ namespace vpn::protocol {
         std::uniform_int_distribution<> dis(0, 255);
         for(int i=0; i<12; ++i) packet.push_back(static_cast<uint8_t>(dis(gen)));
 
+        AppendAddress(packet, address);
+        AppendIndex(packet, index);
+        packet.insert(packet.end(), ticket.begin(), ticket.end());
         return packet;
     }
 
+    std::vector<uint8_t> CreateResumeHello(const std::vector<uint8_t>& random, const std::vector<uint8_t>& ticket) {
+        std::vector<uint8_t> packet;
+        packet.push_back(static_cast<uint8_t>(PacketType::ResumeHello));
+        packet.insert(packet.end(), random.begin(), random.end());
+        packet.insert(packet.end(), ticket.begin(), ticket.end());
+        return packet;
+    }
+
+    std::vector<uint8_t> CreateResumeAck(const std::vector<uint8_t>& random, const AddressAssignment& address, uint32_t index, const std::vector<uint8_t>& ticket) {
+        std::vector<uint8_t> packet;
+        packet.push_back(static_cast<uint8_t>(PacketType::ResumeAck));
+        packet.insert(packet.end(), random.begin(), random.end());
+        AppendAddress(packet, address);
+        AppendIndex(packet, index);
+        packet.insert(packet.end(), ticket.begin(), ticket.end());
+        return packet;
+    }
+
+    void AppendAddress(std::vector<uint8_t>& packet, const AddressAssignment& address) {
+        const auto* vip = reinterpret_cast<const uint8_t*>(&address.virtual_ip);
+        packet.insert(packet.end(), vip, vip + 4);
+        packet.push_back(address.prefix_len);
+    }
+
+    AddressAssignment ParseAddress(const uint8_t* data) {
+        AddressAssignment address;
+        std::memcpy(&address.virtual_ip, data, 4);
+        address.prefix_len = data[4];
+        return address;
+    }
+
+    void AppendIndex(std::vector<uint8_t>& packet, uint32_t index) {
+        for (int i = 0; i < 4; ++i) packet.push_back(static_cast<uint8_t>(index >> (8 * i)));
+    }
+
+    uint32_t ParseIndex(const uint8_t* data) {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    std::array<uint8_t, 16> EmbedVip6(uint32_t virtual_ip) {
+        std::array<uint8_t, 16> address = {};
+        std::memcpy(address.data(), VIP6_PREFIX.data(), VIP6_PREFIX.size());
+        std::memcpy(address.data() + VIP6_PREFIX.size(), &virtual_ip, 4);
+        return address;
+    }
+
     std::vector<uint8_t> CreateDataPacket(const std::vector<uint8_t>& nonce, const std::vector<uint8_t>& ciphertext) {
         std::vector<uint8_t> packet;
         packet.push_back(static_cast<uint8_t>(PacketType::Data));
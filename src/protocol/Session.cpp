@@ -1,98 +1,274 @@
 #include "Session.h"
 #include "Protocol.h"
 #include "KDF.h"
+#include "Random.h"
 #include <stdexcept>
 #include <cstring>
 
 namespace vpn {
 
-    Session::Session(bool is_server) : is_server_(is_server) {
-        key_exchange_.Generate();
+    Session::Session(bool is_server, const protocol::TicketKey* ticket_key)
+        : is_server_(is_server), ticket_key_(ticket_key) {
+        // Key pair is generated lazily: a resumed session never needs one.
+    }
+
+    Session::Session(const SessionState& state, const protocol::TicketKey* ticket_key)
+        : is_server_(state.is_server), ticket_key_(ticket_key), index_(state.index), rx_window_(state.rx_nonce_next) {
+        if (state.tx_key.size() != crypto::KEY_LEN || state.rx_key.size() != crypto::KEY_LEN) {
+            throw std::runtime_error("Invalid session state");
+        }
+
+        tx_key_ = state.tx_key;
+        rx_key_ = state.rx_key;
+        resumption_secret_ = state.resumption_secret;
+        tx_nonce_counter_.store(state.tx_nonce_counter, std::memory_order_relaxed);
+        established_.store(true, std::memory_order_release);
     }
 
     std::vector<uint8_t> Session::InitiateHandshake() {
         if (is_server_) throw std::runtime_error("Server cannot initiate handshake");
+        key_exchange_.Generate();
         return protocol::CreateClientHello(key_exchange_.GetPublicKey());
     }
 
+    std::vector<uint8_t> Session::InitiateResumption(const ResumptionState& state) {
+        if (is_server_) throw std::runtime_error("Server cannot initiate resumption");
+        if (state.ticket.size() != protocol::TICKET_SIZE || state.secret.size() != protocol::TICKET_SECRET_LEN) {
+            throw std::runtime_error("Invalid resumption state");
+        }
+
+        pending_random_ = crypto::Random::Generate(protocol::RESUME_RANDOM_LEN);
+        pending_secret_ = state.secret;
+        return protocol::CreateResumeHello(pending_random_, state.ticket);
+    }
+
     std::vector<uint8_t> Session::HandleHandshake(const std::vector<uint8_t>& packet) {
         auto pp = protocol::ParsePacket(packet);
         
         if (is_server_) {
+            if (pp.type == protocol::PacketType::ResumeHello) return HandleResumeHello(pp.payload);
             if (pp.type != protocol::PacketType::ClientHello) return {};
             
             // Extract Peer Public Key (first 32 bytes of payload)
             if (pp.payload.size() < 32) return {};
             std::vector<uint8_t> peer_key(pp.payload.begin(), pp.payload.begin() + 32);
-            
-            shared_secret_ = key_exchange_.DeriveSharedSecret(peer_key);
+
+            // Derived before an address is taken: a low-order key (e.g. all zeros) has no shared
+            // secret, and anyone can send one
+            key_exchange_.Generate();
+            try {
+                shared_secret_ = key_exchange_.DeriveSharedSecret(peer_key);
+            } catch (const crypto::CryptoException&) {
+                return {};
+            }
+            if (!AssignAddress(0)) return {};
             
             // Derive Keys
             // HKDF(secret, salt, info)
             // We use empty salt and info for simplicity, or "VPNv1"
-            std::vector<uint8_t> salt(32, 0);
-            std::vector<uint8_t> info = {'V', 'P', 'N', '1'};
-            
-            // Derive 64 bytes (32 for Tx, 32 for Rx)
-            auto keys = crypto::KDF::Derive(shared_secret_, salt, info, 64);
+            DeriveKeys(shared_secret_, std::vector<uint8_t>(32, 0));
             
-            // Server: Tx = keys[0..31], Rx = keys[32..63]
-            // Client: Tx = keys[32..63], Rx = keys[0..31] (Opposite)
-            tx_key_.assign(keys.begin(), keys.begin() + 32);
-            rx_key_.assign(keys.begin() + 32, keys.end());
-            
-            established_ = true;
-            return protocol::CreateServerHello(key_exchange_.GetPublicKey());
+            std::vector<uint8_t> ticket;
+            if (ticket_key_) ticket = ticket_key_->Seal(resumption_secret_, address_.virtual_ip);
+            return protocol::CreateServerHello(key_exchange_.GetPublicKey(), address_, index_, ticket);
         } else {
+            if (pp.type == protocol::PacketType::ResumeAck) {
+                if (pending_secret_.empty()) return {};
+                constexpr size_t fixed = protocol::RESUME_RANDOM_LEN + protocol::ADDRESS_SIZE + protocol::INDEX_SIZE;
+                if (pp.payload.size() < fixed) return {};
+
+                // Salt: ClientRandom | ServerRandom
+                std::vector<uint8_t> salt(pending_random_);
+                salt.insert(salt.end(), pp.payload.begin(), pp.payload.begin() + protocol::RESUME_RANDOM_LEN);
+
+                address_ = protocol::ParseAddress(pp.payload.data() + protocol::RESUME_RANDOM_LEN);
+                index_ = protocol::ParseIndex(pp.payload.data() + protocol::RESUME_RANDOM_LEN + protocol::ADDRESS_SIZE);
+                ticket_.assign(pp.payload.begin() + fixed, pp.payload.end());
+                DeriveKeys(pending_secret_, salt); // Publishes the session: index first
+                resumed_ = true;
+                pending_secret_.clear();
+                return {};
+            }
             if (pp.type != protocol::PacketType::ServerHello) return {};
             
-            if (pp.payload.size() < 32) return {};
+            constexpr size_t fixed = 32 + 12 + protocol::ADDRESS_SIZE + protocol::INDEX_SIZE;
+            if (pp.payload.size() < fixed) return {};
             std::vector<uint8_t> peer_key(pp.payload.begin(), pp.payload.begin() + 32);
             
-            shared_secret_ = key_exchange_.DeriveSharedSecret(peer_key);
-            
-            std::vector<uint8_t> salt(32, 0);
-            std::vector<uint8_t> info = {'V', 'P', 'N', '1'};
-            auto keys = crypto::KDF::Derive(shared_secret_, salt, info, 64);
-            
-            // Client: Tx = keys[32..63], Rx = keys[0..31]
+            try {
+                shared_secret_ = key_exchange_.DeriveSharedSecret(peer_key);
+            } catch (const crypto::CryptoException&) {
+                return {};
+            }
+            address_ = protocol::ParseAddress(pp.payload.data() + 32 + 12);
+            index_ = protocol::ParseIndex(pp.payload.data() + 32 + 12 + protocol::ADDRESS_SIZE);
+            DeriveKeys(shared_secret_, std::vector<uint8_t>(32, 0));
+
+            // Optional ticket after [PublicKey][Nonce][Address][Index]
+            if (pp.payload.size() == fixed + protocol::TICKET_SIZE) {
+                ticket_.assign(pp.payload.begin() + fixed, pp.payload.end());
+            }
+            return {};
+        }
+    }
+
+    std::vector<uint8_t> Session::HandleResumeHello(const std::vector<uint8_t>& payload) {
+        if (!ticket_key_) return {};
+        if (payload.size() != protocol::RESUME_RANDOM_LEN + protocol::TICKET_SIZE) return {};
+
+        std::vector<uint8_t> client_random(payload.begin(), payload.begin() + protocol::RESUME_RANDOM_LEN);
+        std::vector<uint8_t> ticket(payload.begin() + protocol::RESUME_RANDOM_LEN, payload.end());
+
+        auto contents = ticket_key_->Open(ticket);
+        if (!contents) return {}; // Invalid or expired: client must do a full handshake
+        redeemed_secret_ = contents->resumption_secret; // Read by the allocator (see ResumedFrom)
+        if (!AssignAddress(contents->virtual_ip)) return {};
+
+        // Both randoms go into the salt, so neither side alone can force key reuse
+        auto server_random = crypto::Random::Generate(protocol::RESUME_RANDOM_LEN);
+        std::vector<uint8_t> salt(client_random);
+        salt.insert(salt.end(), server_random.begin(), server_random.end());
+        DeriveKeys(contents->resumption_secret, salt);
+        resumed_ = true;
+
+        return protocol::CreateResumeAck(server_random, address_, index_, ticket_key_->Seal(resumption_secret_, address_.virtual_ip));
+    }
+
+    bool Session::ResumedFrom(const Session& previous) const {
+        if (redeemed_secret_.empty() || redeemed_secret_.size() != previous.resumption_secret_.size()) return false;
+        // Constant time: the secret is a key
+        uint8_t difference = 0;
+        for (size_t i = 0; i < redeemed_secret_.size(); ++i) difference |= redeemed_secret_[i] ^ previous.resumption_secret_[i];
+        return difference == 0;
+    }
+
+    bool Session::AssignAddress(uint32_t requested_vip) {
+        if (!allocator_) return true;
+        auto address = allocator_(requested_vip);
+        if (!address) return false;
+        address_ = *address;
+        return true;
+    }
+
+    void Session::DeriveKeys(const std::vector<uint8_t>& secret, const std::vector<uint8_t>& salt) {
+        std::vector<uint8_t> info = {'V', 'P', 'N', '1'};
+        std::vector<uint8_t> resume_info = {'V', 'P', 'N', '1', ' ', 'r', 'e', 's', 'u', 'm', 'e'};
+
+        // Derive 64 bytes (32 for Tx, 32 for Rx)
+        auto keys = crypto::KDF::Derive(secret, salt, info, 64);
+
+        // Server: Tx = keys[0..31], Rx = keys[32..63]
+        // Client: Tx = keys[32..63], Rx = keys[0..31] (Opposite)
+        if (is_server_) {
+            tx_key_.assign(keys.begin(), keys.begin() + 32);
+            rx_key_.assign(keys.begin() + 32, keys.end());
+        } else {
             rx_key_.assign(keys.begin(), keys.begin() + 32);
             tx_key_.assign(keys.begin() + 32, keys.end());
-            
-            established_ = true;
-            return {};
         }
+
+        // Secret for the next resumption, bound to this session's keys
+        resumption_secret_ = crypto::KDF::Derive(secret, salt, resume_info, protocol::TICKET_SECRET_LEN);
+
+        tx_nonce_counter_.store(0, std::memory_order_relaxed);
+        established_.store(true, std::memory_order_release);
     }
 
-    std::vector<uint8_t> Session::Encrypt(const std::vector<uint8_t>& plaintext) {
-        if (!established_) throw std::runtime_error("Session not established");
-        
-        auto nonce = GenerateNonce(tx_nonce_counter_++);
-        auto ciphertext = crypto::AEAD::Encrypt(tx_key_, nonce, plaintext);
-        
-        return protocol::CreateDataPacket(nonce, ciphertext);
+    std::optional<ResumptionState> Session::GetResumptionState() const {
+        if (is_server_ || !established_ || ticket_.size() != protocol::TICKET_SIZE) return std::nullopt;
+        return ResumptionState{ticket_, resumption_secret_};
     }
 
-    std::vector<uint8_t> Session::Decrypt(const std::vector<uint8_t>& packet_payload) {
-        if (!established_) throw std::runtime_error("Session not established");
-        
-        // Payload: [Nonce 12][Ciphertext...]
-        if (packet_payload.size() < 12) return {};
-        
-        std::vector<uint8_t> nonce(packet_payload.begin(), packet_payload.begin() + 12);
-        std::vector<uint8_t> ciphertext(packet_payload.begin() + 12, packet_payload.end());
-        
-        auto plaintext = crypto::AEAD::Decrypt(rx_key_, nonce, ciphertext);
-        if (!plaintext) return {}; // Decrypt failed
-        
-        return *plaintext;
+    std::optional<protocol::AddressAssignment> Session::GetAssignedAddress() const {
+        if (!established_ || address_.virtual_ip == 0) return std::nullopt;
+        return address_;
+    }
+
+    SessionState Session::Export(uint64_t counter_margin) const {
+        if (!IsEstablished()) throw std::runtime_error("Session not established");
+
+        SessionState state;
+        state.is_server = is_server_;
+        state.tx_key = tx_key_;
+        state.rx_key = rx_key_;
+        state.resumption_secret = resumption_secret_;
+        state.tx_nonce_counter = tx_nonce_counter_.load(std::memory_order_relaxed) + counter_margin;
+        state.rx_nonce_next = rx_window_.Next();
+        state.index = index_;
+        return state;
+    }
+
+    uint64_t Session::ReserveNonces(uint64_t count) {
+        // Counters only need to be unique, not ordered with other memory
+        if (nonce_stripes_ == 1) return tx_nonce_counter_.fetch_add(count, std::memory_order_relaxed);
+
+        // Striped: a range must lie inside one of this node's blocks, else skip to the next one
+        uint64_t counter = tx_nonce_counter_.load(std::memory_order_relaxed);
+        for (;;) {
+            uint64_t start = counter;
+            uint64_t block = counter / NONCE_BLOCK;
+            if (block % nonce_stripes_ != nonce_stripe_ || counter % NONCE_BLOCK + count > NONCE_BLOCK) {
+                block += 1;
+                block += (nonce_stripe_ + nonce_stripes_ - block % nonce_stripes_) % nonce_stripes_;
+                start = block * NONCE_BLOCK;
+            }
+            if (tx_nonce_counter_.compare_exchange_weak(counter, start + count, std::memory_order_relaxed)) return start;
+        }
+    }
+
+    void Session::SetNonceStripe(uint32_t stripe, uint32_t stripes) {
+        nonce_stripe_ = stripe;
+        nonce_stripes_ = stripes ? stripes : 1;
+    }
+
+    void Session::AdvanceTxCounter(uint64_t counter) {
+        uint64_t current = tx_nonce_counter_.load(std::memory_order_relaxed);
+        while (current < counter && !tx_nonce_counter_.compare_exchange_weak(current, counter, std::memory_order_relaxed)) {}
+    }
+
+    void Session::Encrypt(utils::PacketBuffer& packet) {
+        EncryptWithCounter(ReserveNonces(1), packet);
+    }
+
+    void Session::EncryptBatch(std::vector<utils::PacketBuffer>& packets) {
+        uint64_t counter = ReserveNonces(packets.size());
+        for (auto& packet : packets) EncryptWithCounter(counter++, packet);
+    }
+
+    void Session::EncryptWithCounter(uint64_t counter, utils::PacketBuffer& packet) {
+        if (!IsEstablished()) throw std::runtime_error("Session not established");
+
+        // [Type][Nonce] in front of the plaintext, the tag behind it
+        size_t length = packet.size();
+        uint8_t* header = packet.Prepend(protocol::DATA_HEADER_SIZE);
+        header[0] = static_cast<uint8_t>(protocol::PacketType::Data);
+        GenerateNonce(counter, header + 1);
+        uint8_t* tag = packet.Append(crypto::TAG_LEN);
+        crypto::AEAD::EncryptInPlace(tx_key_, header + 1, header + protocol::DATA_HEADER_SIZE, length, tag);
+    }
+
+    bool Session::Decrypt(utils::PacketBuffer& packet) {
+        if (!IsEstablished()) throw std::runtime_error("Session not established");
+
+        // [Type][Nonce 12][Ciphertext...][Tag 16]
+        if (packet.size() < protocol::DATA_HEADER_SIZE + crypto::TAG_LEN) return false;
+        size_t length = packet.size() - protocol::DATA_HEADER_SIZE - crypto::TAG_LEN;
+        uint8_t* nonce = packet.data() + 1;
+        uint8_t* ciphertext = nonce + crypto::NONCE_LEN;
+        if (!crypto::AEAD::DecryptInPlace(rx_key_, nonce, ciphertext, length, ciphertext + length)) return false;
+        uint64_t counter = 0;
+        for (int i = 0; i < 8; ++i) counter |= static_cast<uint64_t>(nonce[i]) << (8 * i);
+        if (!rx_window_.Accept(counter)) return false;
+
+        packet.Consume(protocol::DATA_HEADER_SIZE);
+        packet.Resize(length);
+        return true;
     }
 
-    std::vector<uint8_t> Session::GenerateNonce(uint64_t counter) {
-        std::vector<uint8_t> nonce(12, 0);
-        // Little endian 64-bit counter
-        for(int i=0; i<8; ++i) nonce[i] = (counter >> (8*i)) & 0xFF;
-        return nonce;
+    void Session::GenerateNonce(uint64_t counter, uint8_t* nonce) const {
+        // Little endian 64-bit counter, then the session index (see Protocol.h)
+        for (size_t i = 0; i < 8; ++i) nonce[i] = (counter >> (8 * i)) & 0xFF;
+        for (size_t i = 0; i < 4; ++i) nonce[8 + i] = (index_ >> (8 * i)) & 0xFF;
     }
 
 }
@@ -0,0 +1,120 @@
+#include "SessionStore.h"
+#include "MappedFile.h"
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+
+namespace vpn {
+
+    namespace {
+        constexpr uint8_t MAGIC[4] = {'V', 'P', 'N', 'S'};
+        constexpr uint32_t VERSION = 3; // 2: IPv6 endpoints, 3: session index and replay window
+        constexpr size_t HEADER_SIZE = 64;
+        constexpr size_t RECORD_SIZE = SessionStore::RECORD_SIZE;
+        constexpr size_t SECRET_LEN = 32;
+        constexpr uint32_t FLAG_CLEAN = 1;
+
+        void Put32(uint8_t* p, uint32_t v) { for (int i = 0; i < 4; ++i) p[i] = (v >> (8 * i)) & 0xFF; }
+        void Put64(uint8_t* p, uint64_t v) { for (int i = 0; i < 8; ++i) p[i] = (v >> (8 * i)) & 0xFF; }
+        uint32_t Get32(const uint8_t* p) { uint32_t v = 0; for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(p[i]) << (8 * i); return v; }
+        uint64_t Get64(const uint8_t* p) { uint64_t v = 0; for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(p[i]) << (8 * i); return v; }
+
+        void PutKey(uint8_t* p, const std::vector<uint8_t>& key) {
+            std::memset(p, 0, SECRET_LEN);
+            std::memcpy(p, key.data(), std::min(key.size(), SECRET_LEN));
+        }
+    }
+
+    utils::Endpoint SessionRecord::GetEndpoint() const {
+        utils::Endpoint endpoint = {};
+        endpoint.sin6_family = AF_INET6;
+        std::memcpy(&endpoint.sin6_addr, endpoint_ip.data(), 16);
+        endpoint.sin6_port = endpoint_port;
+        return endpoint;
+    }
+
+    void SessionRecord::SetEndpoint(const utils::Endpoint& endpoint) {
+        std::memcpy(endpoint_ip.data(), &endpoint.sin6_addr, 16);
+        endpoint_port = endpoint.sin6_port;
+    }
+
+    void SessionStore::Save(const std::string& path, const std::vector<uint8_t>& ticket_key, const std::vector<SessionRecord>& records, bool clean) {
+        std::string tmp_path = path + ".tmp";
+        {
+            utils::MappedFile file(tmp_path, HEADER_SIZE + records.size() * RECORD_SIZE);
+            uint8_t* p = file.Data();
+            std::memset(p, 0, file.Size());
+
+            auto now = std::chrono::system_clock::now().time_since_epoch();
+            std::memcpy(p, MAGIC, 4);
+            Put32(p + 4, VERSION);
+            Put32(p + 8, static_cast<uint32_t>(records.size()));
+            Put32(p + 12, clean ? FLAG_CLEAN : 0);
+            Put64(p + 16, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(now).count()));
+            PutKey(p + 24, ticket_key);
+
+            uint8_t* r = p + HEADER_SIZE;
+            for (const auto& record : records) {
+                EncodeRecord(record, r);
+                r += RECORD_SIZE;
+            }
+
+            file.Flush();
+        }
+
+        // Readers only ever see a complete snapshot
+        std::filesystem::rename(tmp_path, path);
+    }
+
+    bool SessionStore::Load(const std::string& path, std::vector<uint8_t>& ticket_key, std::vector<SessionRecord>& records, bool& clean) {
+        if (!std::filesystem::exists(path)) return false;
+
+        utils::MappedFile file(path);
+        const uint8_t* p = file.Data();
+        if (file.Size() < HEADER_SIZE) return false;
+        if (std::memcmp(p, MAGIC, 4) != 0 || Get32(p + 4) != VERSION) return false;
+
+        uint32_t count = Get32(p + 8);
+        if (file.Size() < HEADER_SIZE + static_cast<size_t>(count) * RECORD_SIZE) return false;
+
+        ticket_key.assign(p + 24, p + 24 + SECRET_LEN);
+        clean = (Get32(p + 12) & FLAG_CLEAN) != 0;
+
+        records.clear();
+        records.reserve(count);
+        const uint8_t* r = p + HEADER_SIZE;
+        for (uint32_t i = 0; i < count; ++i, r += RECORD_SIZE) records.push_back(DecodeRecord(r));
+        return true;
+    }
+
+    void SessionStore::EncodeRecord(const SessionRecord& record, uint8_t* r) {
+        std::memset(r, 0, RECORD_SIZE);
+        // Addresses stay in network byte order, copied as raw bytes
+        std::memcpy(r, &record.virtual_ip, 4);
+        std::memcpy(r + 4, &record.endpoint_port, 2);
+        std::memcpy(r + 8, record.endpoint_ip.data(), 16);
+        Put64(r + 24, record.state.tx_nonce_counter);
+        PutKey(r + 32, record.state.tx_key);
+        PutKey(r + 64, record.state.rx_key);
+        PutKey(r + 96, record.state.resumption_secret);
+        Put32(r + 128, record.state.index);
+        Put64(r + 136, record.state.rx_nonce_next);
+    }
+
+    SessionRecord SessionStore::DecodeRecord(const uint8_t* r) {
+        SessionRecord record;
+        std::memcpy(&record.virtual_ip, r, 4);
+        std::memcpy(&record.endpoint_port, r + 4, 2);
+        std::memcpy(record.endpoint_ip.data(), r + 8, 16);
+        record.state.is_server = true;
+        record.state.tx_nonce_counter = Get64(r + 24);
+        record.state.tx_key.assign(r + 32, r + 32 + SECRET_LEN);
+        record.state.rx_key.assign(r + 64, r + 64 + SECRET_LEN);
+        record.state.resumption_secret.assign(r + 96, r + 96 + SECRET_LEN);
+        record.state.index = Get32(r + 128);
+        record.state.rx_nonce_next = Get64(r + 136);
+        return record;
+    }
+
+}
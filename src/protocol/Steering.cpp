@@ -0,0 +1,48 @@
+#include "Steering.h"
+#include "Protocol.h"
+
+namespace vpn::protocol {
+
+    namespace {
+        // SplitMix64 finalizer
+        uint64_t Mix(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xBF58476D1CE4E5B9ull;
+            x ^= x >> 27;
+            x *= 0x94D049BB133111EBull;
+            return x ^ (x >> 31);
+        }
+    }
+
+    size_t HelloBackend(const utils::Endpoint& client, size_t backends) {
+        uint64_t high, low;
+        std::memcpy(&high, client.sin6_addr.s6_addr, 8);
+        std::memcpy(&low, client.sin6_addr.s6_addr + 8, 8);
+        uint64_t key = Mix(high ^ Mix(low ^ client.sin6_port));
+        size_t best = 0;
+        uint64_t best_score = 0;
+        for (size_t i = 0; i < backends; ++i) {
+            uint64_t score = Mix(key ^ Mix(i + 1));
+            if (score >= best_score) {
+                best = i;
+                best_score = score;
+            }
+        }
+        return best;
+    }
+
+    int SteerToBackend(const uint8_t* datagram, size_t size, const utils::Endpoint& client, size_t backends) {
+        if (size == 0 || backends == 0) return -1;
+        switch (static_cast<PacketType>(datagram[0])) {
+            case PacketType::Data:
+                if (size < DATA_HEADER_SIZE) return -1;
+                return static_cast<int>(DataIndex(datagram) % backends);
+            case PacketType::ClientHello:
+            case PacketType::ResumeHello:
+                return static_cast<int>(HelloBackend(client, backends));
+            default:
+                return -1; // Only servers send the other types
+        }
+    }
+
+}
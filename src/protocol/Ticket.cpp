@@ -0,0 +1,65 @@
+#include "Ticket.h"
+#include "AEAD.h"
+#include "Random.h"
+#include <chrono>
+#include <cstring>
+
+namespace vpn::protocol {
+
+    using namespace vpn::crypto;
+
+    namespace {
+        uint64_t NowSeconds() {
+            auto now = std::chrono::system_clock::now().time_since_epoch();
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(now).count());
+        }
+    }
+
+    TicketKey::TicketKey() : key_(Random::Generate(KEY_LEN)) {}
+
+    TicketKey::TicketKey(const Bytes& key) : key_(key) {
+        if (key_.size() != KEY_LEN) throw CryptoException("Invalid ticket key length");
+    }
+
+    Bytes TicketKey::Seal(const Bytes& resumption_secret, uint32_t virtual_ip) const {
+        if (resumption_secret.size() != TICKET_SECRET_LEN) throw CryptoException("Invalid resumption secret length");
+
+        Bytes nonce = Random::Generate(NONCE_LEN);
+
+        Bytes plaintext;
+        uint64_t issued_at = NowSeconds();
+        for (int i = 0; i < 8; ++i) plaintext.push_back((issued_at >> (8 * i)) & 0xFF);
+        plaintext.insert(plaintext.end(), resumption_secret.begin(), resumption_secret.end());
+        const auto* vip = reinterpret_cast<const uint8_t*>(&virtual_ip);
+        plaintext.insert(plaintext.end(), vip, vip + 4);
+
+        auto sealed = AEAD::Encrypt(key_, nonce, plaintext);
+
+        Bytes ticket(nonce);
+        ticket.insert(ticket.end(), sealed.begin(), sealed.end());
+        return ticket;
+    }
+
+    std::optional<TicketContents> TicketKey::Open(const Bytes& ticket) const {
+        if (ticket.size() != TICKET_SIZE) return std::nullopt;
+
+        Bytes nonce(ticket.begin(), ticket.begin() + NONCE_LEN);
+        Bytes sealed(ticket.begin() + NONCE_LEN, ticket.end());
+
+        auto plaintext = AEAD::Decrypt(key_, nonce, sealed);
+        if (!plaintext) return std::nullopt;
+
+        uint64_t issued_at = 0;
+        for (int i = 0; i < 8; ++i) issued_at |= static_cast<uint64_t>((*plaintext)[i]) << (8 * i);
+
+        // Reject expired tickets, and tickets from the future (clock went backwards)
+        uint64_t now = NowSeconds();
+        if (issued_at > now || now - issued_at > TICKET_LIFETIME_SECONDS) return std::nullopt;
+
+        TicketContents contents;
+        contents.resumption_secret.assign(plaintext->begin() + 8, plaintext->begin() + 8 + TICKET_SECRET_LEN);
+        std::memcpy(&contents.virtual_ip, plaintext->data() + 8 + TICKET_SECRET_LEN, 4);
+        return contents;
+    }
+
+}
@@ -2,177 +2,1138 @@
 #include "UdpSocket.h"
 #include "Session.h"
 #include "Protocol.h"
+#include "Ticket.h"
+#include "SessionStore.h"
+#include "ConcurrentMap.h"
+#include "AddressPool.h"
+#include "ClientRoutes.h"
+#include "TokenBucket.h"
+#include "EgressScheduler.h"
+#include "Affinity.h"
+#include "EventLoop.h"
+#include "Metrics.h"
+#include "Latency.h"
+#include "Trace.h"
+#include "ServerConfig.h"
+#include "Rcu.h"
+#include "Random.h"
+#include "KDF.h"
+#include "ClusterSessions.h"
+#include "Steering.h"
+#include "CountMinSketch.h"
 #include <iostream>
-#include <map>
 #include <thread>
-#include <mutex>
 #include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <string>
+#include <cstring>
+#include <unordered_map>
+#include <set>
+#include <optional>
 
 using namespace vpn;
 
-// Helper to compare sockaddr_in
-struct SockAddrCmp {
-    bool operator()(const sockaddr_in& a, const sockaddr_in& b) const {
-        if (a.sin_addr.s_addr != b.sin_addr.s_addr) return a.sin_addr.s_addr < b.sin_addr.s_addr;
-        return a.sin_port < b.sin_port;
+// Compares endpoints (IPv6, IPv4-mapped for IPv4 clients)
+struct SockAddrEq {
+    bool operator()(const utils::Endpoint& a, const utils::Endpoint& b) const {
+        return a.sin6_port == b.sin6_port && std::memcmp(&a.sin6_addr, &b.sin6_addr, sizeof(a.sin6_addr)) == 0;
     }
 };
 
-std::map<sockaddr_in, std::shared_ptr<Session>, SockAddrCmp> sessions;
-std::map<uint32_t, std::shared_ptr<Session>> ip_sessions; // Virtual IP -> Session
-std::mutex sessions_mutex;
-
-utils::UdpSocket udp_socket;
 std::unique_ptr<tun::TunDevice> tun_device;
+protocol::TicketKey ticket_key; // Seals resumption tickets; regenerated on every start
 
-void HandleTunPacket(const std::vector<uint8_t>& packet) {
-    if (packet.size() < 20) return; // Min IPv4 header
-
-    // Extract Dest IP (Offset 16)
-    uint32_t dest_ip = *reinterpret_cast<const uint32_t*>(packet.data() + 16);
-    // dest_ip is network byte order? Yes.
-    // Our map should store network byte order.
-
-    std::lock_guard<std::mutex> lock(sessions_mutex);
-    auto it = ip_sessions.find(dest_ip);
-    if (it != ip_sessions.end()) {
-        auto session = it->second;
-        if (session->IsEstablished()) {
-            auto encrypted = session->Encrypt(packet);
-            // We need to know the endpoint.
-            // Session doesn't store endpoint. We need to store it in the map or session.
-            // Let's iterate sessions map to find the endpoint? Slow.
-            // Better: Store endpoint in Session or separate map.
-            // For now, let's just find it in sessions map by value? No.
-            // Let's add endpoint to Session class or just keep a reverse map.
-            // Actually, we can just store the endpoint in the session object if we modify it, 
-            // or use a map: Session* -> Endpoint.
-        }
-    }
-}
-// Wait, I need to send to the correct endpoint.
-// I will modify the map structure.
-// Map: VirtualIP -> {Session, Endpoint}
+int64_t NowSeconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// What the forwarding path reads from the configuration (see ServerConfig.h), rebuilt on every
+// reload and published whole through RCU: no locks on the data path. Data-path threads hold an
+// Rcu::ReadGuard per burst, so each burst sees one snapshot and the next picks up a reload.
+struct DataPlane {
+    protocol::ClientRoutes routes; // Inner destination (or source) -> client VIP
+    // Egress rate limits in bytes per second, 0 = unlimited: per client VIP, otherwise the default
+    std::unordered_map<uint32_t, uint64_t> rates;
+    uint64_t default_rate = 0;
+    bool hairpin = true; // See Hairpin
+    // Hellos per second a source may send, 0 = unlimited, and how much of its address makes the
+    // source (see AdmitHandshake)
+    uint32_t handshake_rate = 0;
+    uint8_t handshake_prefix = 32;
+    uint8_t handshake_prefix6 = 64;
+};
+
+// Published by main before the data path starts, then only by SnapshotLoop (reloads)
+std::atomic<const DataPlane*> data_plane = nullptr;
+std::atomic<size_t> retired_planes = 0; // Replaced snapshots readers may still hold
+
+// Current snapshot; valid while the caller holds an Rcu::ReadGuard
+const DataPlane& Plane() {
+    return *data_plane.load(std::memory_order_seq_cst);
+}
+
+void PublishDataPlane(std::unique_ptr<const DataPlane> plane) {
+    const DataPlane* old_plane = data_plane.exchange(plane.release(), std::memory_order_seq_cst);
+    if (!old_plane) return;
+    ++retired_planes;
+    utils::Rcu::Retire([old_plane] {
+        delete old_plane;
+        --retired_planes;
+    });
+}
+
+// Burst allowance: this long at the client's rate, but at least one GSO super-buffer
+constexpr int64_t SHAPER_BURST_MS = 5;
+constexpr uint64_t SHAPER_MIN_BURST = 64 * 1024;
+
+// Rate and burst in bytes for the client holding `vip`
+std::pair<uint64_t, uint64_t> ShaperRate(const DataPlane& plane, uint32_t vip) {
+    auto it = plane.rates.find(vip);
+    uint64_t rate = it != plane.rates.end() ? it->second : plane.default_rate;
+    uint64_t burst = rate * SHAPER_BURST_MS / 1000;
+    return {rate, burst > SHAPER_MIN_BURST ? burst : SHAPER_MIN_BURST};
+}
 
+// Every client gets a bucket, unlimited (rate 0) or not, so a reload can change its rate in place
+std::shared_ptr<utils::TokenBucket> MakeShaper(uint32_t vip) {
+    utils::Rcu::ReadGuard guard;
+    auto [rate, burst] = ShaperRate(Plane(), vip);
+    return std::make_shared<utils::TokenBucket>(rate, burst);
+}
+
+// Exported with --metrics (see Metrics.h). Bytes are as sent or received on the wire.
+const auto rx_packets = utils::Metrics::AddCounter("vpn_packets_total", "Authenticated data packets", "direction=\"rx\"");
+const auto tx_packets = utils::Metrics::AddCounter("vpn_packets_total", "Authenticated data packets", "direction=\"tx\"");
+const auto rx_bytes = utils::Metrics::AddCounter("vpn_bytes_total", "Bytes of authenticated data packets", "direction=\"rx\"");
+const auto tx_bytes = utils::Metrics::AddCounter("vpn_bytes_total", "Bytes of authenticated data packets", "direction=\"tx\"");
+const auto handshakes_full = utils::Metrics::AddCounter("vpn_handshakes_total", "Client handshakes by outcome", "result=\"full\"");
+const auto handshakes_resumed = utils::Metrics::AddCounter("vpn_handshakes_total", "Client handshakes by outcome", "result=\"resumed\"");
+const auto handshakes_failed = utils::Metrics::AddCounter("vpn_handshakes_total", "Client handshakes by outcome", "result=\"failed\"");
+const auto handshakes_limited = utils::Metrics::AddCounter("vpn_handshakes_total", "Client handshakes by outcome", "result=\"limited\"");
+const auto sessions_active = utils::Metrics::AddGauge("vpn_sessions_active", "Client sessions held by the server");
+const auto hairpin_packets = utils::Metrics::AddCounter("vpn_hairpin_packets_total", "Client-to-client packets re-sealed without the TUN device");
+const auto roams = utils::Metrics::AddCounter("vpn_roams_total", "Sessions moved to a new client endpoint");
+
+// Map: VirtualIP -> {Session, Endpoint}
 struct ClientContext {
+    ClientContext(std::shared_ptr<Session> s, const utils::Endpoint& ep, uint32_t v)
+        : session(std::move(s)), index(session->Index()), vip(v), last_seen(NowSeconds()), shaper(MakeShaper(v)),
+          endpoint_(new utils::Endpoint(ep)) {
+        sessions_active.Add(1);
+    }
+    ~ClientContext() {
+        delete endpoint_.load(std::memory_order_relaxed);
+        sessions_active.Sub(1);
+    }
+
+    // Where the client's packets come from and ours go. Valid while the caller holds an
+    // Rcu::ReadGuard: a roaming client swaps in a new one.
+    const utils::Endpoint& GetEndpoint() const { return *endpoint_.load(std::memory_order_seq_cst); }
+    void SetEndpoint(const utils::Endpoint& endpoint) {
+        const utils::Endpoint* old_endpoint = endpoint_.exchange(new utils::Endpoint(endpoint), std::memory_order_seq_cst);
+        utils::Rcu::Retire([old_endpoint] { delete old_endpoint; });
+    }
+
     std::shared_ptr<Session> session;
-    sockaddr_in endpoint;
+    uint32_t index;                 // Session index, the key in `sessions`
+    uint32_t vip;                   // Assigned from the pool (network byte order), 0 if none
+    std::atomic<int64_t> last_seen; // Last authenticated packet, keepalives included, for expiring idle sessions
+                                    // and reclaiming addresses when the pool runs out
+    // A packet of this session authenticated. Anyone can complete a handshake from any address, so
+    // until then the session is expired after UNAUTHENTICATED_IDLE_SECONDS and is the first to lose
+    // its address when the pool runs out. Restored and replicated sessions start out authenticated.
+    std::atomic<bool> authenticated = false;
+    std::shared_ptr<utils::TokenBucket> shaper; // Egress rate limit shared by all TUN queues
+    // Cluster: send counter, receive window and last_seen as last sent to (or received from) the
+    // other nodes
+    std::atomic<uint64_t> synced_counter = 0;
+    std::atomic<uint64_t> synced_rx = 0;
+    std::atomic<int64_t> synced_seen = 0;
+    uint64_t provisional_rx = 0; // Replica: receive window started ahead of the owner's (link thread only)
+    uint64_t remote_counter = 0; // Highest send counter in another node's record (link thread only)
+    std::atomic<int64_t> remote_sent = 0; // When another node's record last showed it sending, 0 if never
+    // Resumed with a ticket from a session that still holds `vip`: the address moves here on this
+    // session's first authenticated packet (see TakeOver). Until then the session is not replicated
+    // or saved.
+    std::weak_ptr<ClientContext> predecessor;
+    std::atomic<bool> taking_over = false;
+
+private:
+    std::atomic<const utils::Endpoint*> endpoint_;
 };
 
-std::map<uint32_t, ClientContext> clients; // Virtual IP -> Context
-std::map<sockaddr_in, ClientContext*, SockAddrCmp> endpoint_map; // Endpoint -> Context
+// Session index -> Context. Data packets name their session by index (see Protocol.h), so a
+// client's packets are recognized from any address and on any worker: read on every received
+// packet, written once per handshake.
+utils::ConcurrentMap<uint32_t, std::shared_ptr<ClientContext>> sessions;
 
-void HandleTunPacket_Revised(const std::vector<uint8_t>& packet) {
-    if (packet.size() < 20) return;
-    uint32_t dest_ip = *reinterpret_cast<const uint32_t*>(packet.data() + 16);
+// Cluster (see ClusterSessions), null unless configured
+using Cluster = ClusterSessions<ClientContext>;
+std::unique_ptr<ClusterLink> cluster_link;
+std::unique_ptr<Cluster> cluster;
+
+// Set when the server sits behind vpn_lb (see Steering.h): it then takes datagrams only from the
+// load balancer, and sends everything for a client back through it
+std::optional<utils::Endpoint> load_balancer;
+
+// Where a sealed packet for `client` goes: straight there, or to the load balancer with the
+// client's address in front
+const utils::Endpoint& Steer(utils::PacketBuffer& packet, const utils::Endpoint& client) {
+    if (!load_balancer) return client;
+    protocol::WriteSteerHeader(packet.Prepend(protocol::STEER_HEADER_SIZE), client);
+    return *load_balancer;
+}
 
-    std::lock_guard<std::mutex> lock(sessions_mutex);
-    auto it = clients.find(dest_ip);
-    if (it != clients.end()) {
-        auto& ctx = it->second;
-        if (ctx.session->IsEstablished()) {
-            auto encrypted = ctx.session->Encrypt(packet);
-            udp_socket.SendTo(ctx.endpoint, encrypted);
+void SetNonceStripe(Session& session) {
+    if (cluster) cluster->SetNonceStripe(session);
+}
+
+// One thread per core, each with its own SO_REUSEPORT socket on the listen port and, on Linux,
+// its own TUN queue, both driven by one event loop.
+// The kernel hashes a client's 4-tuple to a fixed socket, so a client's packets keep arriving on
+// the same worker until it roams to a new address.
+struct Worker {
+    unsigned id = 0;
+    utils::UdpSocket socket;
+    std::unique_ptr<utils::EventLoop> loop; // Drives `socket` and the TUN queue; io_uring where available
+    std::optional<size_t> tun_queue;        // Read by `loop`; unset if the TUN device runs its own threads
+    std::vector<utils::PacketBuffer> tun_writes; // Decrypted this burst, written (coalesced) at its end
+    std::vector<utils::PacketBuffer> hairpin;    // Re-sealed for another client this burst, sent at its end
+    std::vector<utils::Datagram> hairpin_sends;  // Point into `hairpin`
+    std::thread thread;
+};
+
+std::vector<std::unique_ptr<Worker>> workers;
+
+// A full pool reclaims the address of the longest-idle session, if it has been idle this long
+constexpr int64_t VIP_RECLAIM_IDLE_SECONDS = 120;
+// A session whose client has not authenticated a packet this long after the handshake is dropped.
+// A real client sends a keepalive as soon as it has the ServerHello.
+constexpr int64_t UNAUTHENTICATED_IDLE_SECONDS = 5;
+
+// Virtual IP -> Context. Read on every TUN packet, written once per handshake.
+// Lookups index a flat array by host offset, lock-free (see AddressPool). A null context marks
+// an address reserved by a handshake in progress. Created at startup over the configured address
+// pool; the server owns the pool's first address (the gateway) on the TUN device.
+std::unique_ptr<utils::AddressPool<std::shared_ptr<ClientContext>>> clients;
+
+std::string FormatIpv6(const std::array<uint8_t, 16>& address) {
+    char text[INET6_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET6, address.data(), text, sizeof(text));
+    return text;
+}
+
+std::string FormatIpv4(uint32_t address) {
+    char text[INET_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET, &address, text, sizeof(text));
+    return text;
+}
+
+std::vector<std::string> arguments; // Command line, without the program name
+
+// Throws if a route is invalid or a peer lies outside the address pool
+std::unique_ptr<const DataPlane> BuildDataPlane(const utils::ServerConfig& config) {
+    auto plane = std::make_unique<DataPlane>();
+    plane->routes.routes.Add(config.pool_network, config.pool_prefix_len, 0);
+    uint32_t pool_mask = htonl(0xFFFFFFFFu << (32 - config.pool_prefix_len));
+    for (const auto& [vip, peer] : config.peers) {
+        if ((vip & pool_mask) != config.pool_network) throw std::runtime_error("Peer " + FormatIpv4(vip) + " is outside the address pool");
+        if (peer.rate) plane->rates[vip] = *peer.rate;
+        for (const auto& route : peer.routes) {
+            utils::Cidr cidr;
+            uint32_t network;
+            bool added = utils::ParseCidr(route, cidr);
+            std::memcpy(&network, cidr.address, 4);
+            if (added) added = cidr.v6 ? plane->routes.routes6.Add(cidr.address, cidr.prefix_len, vip) : plane->routes.routes.Add(network, cidr.prefix_len, vip);
+            if (!added) throw std::runtime_error("Could not add route " + route + " to " + FormatIpv4(vip));
         }
     }
+    plane->default_rate = config.default_rate;
+    plane->hairpin = config.hairpin;
+    plane->handshake_rate = config.handshake_rate;
+    plane->handshake_prefix = config.handshake_prefix;
+    plane->handshake_prefix6 = config.handshake_prefix6;
+    return plane;
 }
 
-int main() {
+// Hot restart: the session table is snapshotted periodically and on shutdown, and restored at startup
+std::string snapshot_path = "vpn_server.state"; // vpn_server.<node>.state in a cluster
+constexpr auto SNAPSHOT_INTERVAL = std::chrono::seconds(10);
+constexpr auto EXPIRY_INTERVAL = std::chrono::seconds(1); // See ExpireSessions
+// Added to every saved nonce counter. Must exceed the packets a session can send between two
+// snapshots, so a restore after a crash never reuses a nonce.
+constexpr uint64_t SNAPSHOT_COUNTER_MARGIN = 1ull << 32;
+// Added to every receive counter restored from a periodic snapshot, which is up to an interval
+// old: packets the client sent since then must not be accepted again. About a busy client's
+// packets per interval; a client still below it after a crash goes unheard until it reconnects.
+constexpr uint64_t SNAPSHOT_RX_MARGIN = 1ull << 20;
+
+// Set before the final snapshot: data packets are dropped from then on, so it records exactly
+// which counters were received
+std::atomic<bool> receive_stopped = false;
+
+std::atomic<bool> shutdown_requested = false;
+
+void OnShutdownSignal(int) {
+    shutdown_requested = true;
+}
+
+// Packet trace dump (see Trace.h), requested with SIGUSR1 and written by SnapshotLoop
+std::string trace_path = "vpn_trace.pcapng";
+std::atomic<bool> trace_dump_requested = false;
+
+void OnTraceSignal(int) {
+    trace_dump_requested = true;
+}
+
+void DumpTrace() {
     try {
-        std::cout << "Starting VPN Server..." << std::endl;
+        size_t packets = utils::Trace::Dump(trace_path);
+        std::cout << "Trace: " << packets << " packets written to " << trace_path << ", events to " << trace_path << ".events" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Trace dump failed: " << e.what() << std::endl;
+    }
+}
+
+void SaveSessions(bool clean = false) {
+    std::vector<SessionRecord> records;
+
+    sessions.ForEach([&](uint32_t, const std::shared_ptr<ClientContext>& ctx) {
+        if (ctx && ctx->session->IsEstablished() && ctx->authenticated && !ctx->taking_over) records.push_back(Cluster::MakeRecord(*ctx, SNAPSHOT_COUNTER_MARGIN));
+    });
+
+    SessionStore::Save(snapshot_path, ticket_key.GetKey(), records, clean);
+}
+
+void RestoreSessions() {
+    std::vector<uint8_t> saved_key;
+    std::vector<SessionRecord> records;
+    bool clean = false;
+    if (!SessionStore::Load(snapshot_path, saved_key, records, clean)) return;
+
+    // Tickets issued by the previous process stay valid (a cluster's key is derived from its config)
+    if (!cluster) ticket_key = protocol::TicketKey(saved_key);
+
+    for (const auto& record : records) {
+        SessionState state = record.state;
+        // The saved counter already has a margin, but the snapshot may have been loaded before by a
+        // process that sent from it and then died before writing another one
+        state.tx_nonce_counter += SNAPSHOT_COUNTER_MARGIN;
+        if (!clean) state.rx_nonce_next += SNAPSHOT_RX_MARGIN;
+        auto session = std::make_shared<Session>(state, &ticket_key);
+        SetNonceStripe(*session);
+        auto ctx = std::make_shared<ClientContext>(session, record.GetEndpoint(), record.virtual_ip);
+        ctx->authenticated = true;
+        sessions.Insert(ctx->index, ctx);
+        if (record.virtual_ip != 0) clients->Assign(record.virtual_ip, ctx);
+    }
+    std::cout << "Restored " << records.size() << " sessions from " << snapshot_path << (clean ? "" : " (after a crash)") << std::endl;
+
+    // Replaced before anything is sent or received: if this process dies before its first periodic
+    // snapshot, the next one restores ahead of whatever it used, not from the same (clean) record
+    SaveSessions();
+}
+
+// Every EXPIRY_INTERVAL: drops sessions not heard from in SESSION_IDLE_SECONDS (clients that went
+// away), and within UNAUTHENTICATED_IDLE_SECONDS handshakes never followed by a packet (abandoned,
+// or a hello sent or replayed by someone else), so hellos cannot hold the pool's addresses
+void ExpireSessions() {
+    int64_t now = NowSeconds();
+    std::vector<std::shared_ptr<ClientContext>> idle;
+    size_t unauthenticated = 0;
+    sessions.ForEach([&](uint32_t, const std::shared_ptr<ClientContext>& ctx) {
+        if (!ctx) return;
+        int64_t quiet = now - ctx->last_seen.load(std::memory_order_relaxed);
+        if (quiet >= protocol::SESSION_IDLE_SECONDS) {
+            idle.push_back(ctx);
+        } else if (!ctx->authenticated.load(std::memory_order_relaxed) && quiet >= UNAUTHENTICATED_IDLE_SECONDS) {
+            idle.push_back(ctx);
+            ++unauthenticated;
+        }
+    });
+    if (idle.empty()) return;
+
+    std::vector<uint32_t> indexes;
+    for (const auto& ctx : idle) {
+        sessions.Erase(ctx->index);
+        auto holder = ctx->vip ? clients->Find(ctx->vip) : std::nullopt;
+        if (holder && *holder == ctx) clients->Release(ctx->vip);
+        indexes.push_back(ctx->index);
+    }
+    if (cluster) cluster->SendRemoved(indexes);
+    // Unauthenticated ones come and go with every stray hello: not worth a line each second
+    if (idle.size() > unauthenticated) std::cout << "Expired " << idle.size() - unauthenticated << " idle session(s)" << std::endl;
+}
+
+void StartCluster(const utils::ServerConfig& config) {
+    std::vector<ClusterLink::Node> nodes;
+    for (const auto& [id, node] : config.nodes) nodes.push_back({id, node.address});
+    cluster_link = std::make_unique<ClusterLink>(*config.cluster_node, nodes, config.cluster_key);
+    ClusterLink& link = *cluster_link;
+    cluster = std::make_unique<Cluster>(link, sessions, *clients, &ticket_key);
+
+    // One ticket key for the whole cluster, so a client can resume on any node
+    const std::string salt = "vpn cluster", info = "ticket key";
+    ticket_key = protocol::TicketKey(crypto::KDF::Derive(config.cluster_key, crypto::Bytes(salt.begin(), salt.end()),
+                                                         crypto::Bytes(info.begin(), info.end()), crypto::KEY_LEN));
+    clients->Partition(link.Self(), link.NodeCount());
+    snapshot_path = "vpn_server." + std::to_string(link.Self()) + ".state";
+
+    link.SetSessionsHandler([](uint32_t node, const std::vector<SessionRecord>& records) {
+        for (const auto& ctx : cluster->OnSessions(records)) {
+            std::cout << "Cluster: client " << FormatIpv4(ctx->vip) << " replicated from node " << node << std::endl;
+        }
+    });
+    link.SetRemovedHandler([](uint32_t, const std::vector<uint32_t>& indexes) { cluster->OnRemoved(indexes); });
+    link.SetJoinHandler([](uint32_t node) {
+        size_t sent = cluster->SendAll(node);
+        std::cout << "Cluster: node " << node << " is up, sent it " << sent << " session(s)" << std::endl;
+    });
+    link.SetDownHandler([](uint32_t node) {
+        std::cout << "Cluster: node " << node << " is down, its sessions stay open here" << std::endl;
+    });
+    utils::Metrics::AddCallback("vpn_cluster_nodes_up", "Cluster nodes this node hears from, itself included", utils::Metrics::Type::Gauge, "", [] {
+        uint32_t up = 0;
+        for (uint32_t node = 0; node < cluster_link->NodeCount(); ++node) up += cluster_link->Alive(node);
+        return static_cast<double>(up);
+    });
+    const std::string records_help = "Session records exchanged with other cluster nodes";
+    utils::Metrics::AddCallback("vpn_cluster_sessions_total", records_help, utils::Metrics::Type::Counter, "direction=\"tx\"",
+                                [] { return static_cast<double>(cluster->RecordsSent()); });
+    utils::Metrics::AddCallback("vpn_cluster_sessions_total", records_help, utils::Metrics::Type::Counter, "direction=\"rx\"",
+                                [] { return static_cast<double>(cluster->RecordsReceived()); });
+    link.Start();
+    std::cout << "Cluster node " << link.Self() << " of " << link.NodeCount() << ", link on port "
+              << ntohs(config.nodes.at(link.Self()).address.sin6_port) << std::endl;
+}
+
+// Configuration reload, requested with SIGHUP and run by SnapshotLoop, the only writer of data_plane
+utils::ServerConfig startup_config;
+std::set<std::string> installed_routes; // Routed into the TUN device on the host; never removed
+std::atomic<bool> reload_requested = false;
+
+void OnReloadSignal(int) {
+    reload_requested = true;
+}
+
+// Host routes for the peers' networks, so the kernel sends their traffic into the TUN device
+void InstallRoutes(const utils::ServerConfig& config) {
+    for (const auto& [vip, peer] : config.peers) {
+        for (const auto& route : peer.routes) {
+            if (!installed_routes.insert(route).second) continue;
+            auto slash = route.find('/');
+            if (!tun_device->AddRoute(route.substr(0, slash), std::stoul(route.substr(slash + 1)))) {
+                std::cout << "Could not route " << route << " into " << tun_device->Name() << ", please add it manually" << std::endl;
+            }
+        }
+    }
+}
+
+// Gives every session the rate the current snapshot has for it. Buckets whose rate is unchanged
+// are not touched, so other sessions keep their state.
+size_t SyncRates() {
+    utils::Rcu::ReadGuard guard;
+    const DataPlane& plane = Plane();
+    size_t changed = 0;
+    clients->ForEach([&](uint32_t vip, const std::shared_ptr<ClientContext>& ctx) {
+        if (!ctx) return;
+        auto [rate, burst] = ShaperRate(plane, vip);
+        if (ctx->shaper->SetRate(rate, burst)) ++changed;
+    });
+    return changed;
+}
+
+// True if sessions may need their rates synced again once the old snapshot is gone
+bool ReloadConfig() {
+    utils::ServerConfig next;
+    std::unique_ptr<const DataPlane> plane;
+    try {
+        next = utils::LoadConfig(arguments);
+        plane = BuildDataPlane(next);
+    } catch (const std::exception& e) {
+        std::cerr << "Reload failed, keeping the current configuration: " << e.what() << std::endl;
+        return false;
+    }
+
+    const utils::ServerConfig& old = startup_config;
+    if (next.listen_port != old.listen_port || next.tun_name != old.tun_name || next.pool_network != old.pool_network ||
+        next.pool_prefix_len != old.pool_prefix_len || next.workers != old.workers || next.metrics != old.metrics ||
+        next.stats_interval != old.stats_interval || next.trace_sample != old.trace_sample ||
+        next.trace_vips != old.trace_vips || next.trace_file != old.trace_file || next.cluster_node != old.cluster_node ||
+        next.cluster_key != old.cluster_key || next.nodes.size() != old.nodes.size() ||
+        next.load_balancer.has_value() != old.load_balancer.has_value() ||
+        (next.load_balancer && !SockAddrEq{}(*next.load_balancer, *old.load_balancer))) {
+        std::cout << "Listen port, TUN name, address pool, workers, metrics, stats, trace, cluster and load balancer settings apply on restart only" << std::endl;
+    }
+
+    // Data-path threads move to the new snapshot at their next quiescent point
+    PublishDataPlane(std::move(plane));
+    InstallRoutes(next);
+    size_t changed = SyncRates();
+    std::cout << "Configuration reloaded: " << next.peers.size() << " peer(s), " << changed << " session rate(s) changed" << std::endl;
+    return true;
+}
+
+void SnapshotLoop() {
+    auto next_snapshot = std::chrono::steady_clock::now() + SNAPSHOT_INTERVAL;
+    auto next_sync = std::chrono::steady_clock::now() + CLUSTER_SYNC_INTERVAL;
+    auto next_expiry = std::chrono::steady_clock::now() + EXPIRY_INTERVAL;
+    bool resync_rates = false;
+    while (!shutdown_requested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (trace_dump_requested.exchange(false)) DumpTrace();
+        if (reload_requested.exchange(false)) resync_rates = ReloadConfig() || resync_rates;
+        // A handshake that read the old snapshot may have added its session after SyncRates ran;
+        // once no thread holds the old snapshot, every such session is in the pool
+        utils::Rcu::Reclaim();
+        if (resync_rates && retired_planes == 0) {
+            SyncRates();
+            resync_rates = false;
+        }
+        if (std::chrono::steady_clock::now() >= next_expiry) {
+            ExpireSessions();
+            next_expiry = std::chrono::steady_clock::now() + EXPIRY_INTERVAL;
+        }
+        if (cluster && std::chrono::steady_clock::now() >= next_sync) {
+            cluster->Sync();
+            next_sync = std::chrono::steady_clock::now() + CLUSTER_SYNC_INTERVAL;
+        }
+        if (std::chrono::steady_clock::now() >= next_snapshot) {
+            try {
+                SaveSessions();
+            } catch (const std::exception& e) {
+                std::cerr << "Snapshot failed: " << e.what() << std::endl;
+            }
+            next_snapshot = std::chrono::steady_clock::now() + SNAPSHOT_INTERVAL;
+        }
+    }
+
+    // Final snapshot, then exit without unwinding the blocked receive loop. Workers handle each
+    // burst under a read guard, so once this retirement runs none is still accepting packets.
+    receive_stopped = true;
+    std::atomic<bool> drained = false;
+    utils::Rcu::Retire([&drained] { drained = true; });
+    for (int i = 0; i < 1000 && !drained; ++i) {
+        utils::Rcu::Reclaim();
+        if (!drained) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    try {
+        SaveSessions(drained);
+        std::cout << "Session table saved to " << snapshot_path << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Snapshot failed: " << e.what() << std::endl;
+    }
+    std::cout.flush();
+    std::_Exit(0);
+}
 
-        // Initialize TUN
-        // Name: "VPNServer", Type: "Wintun"
-        tun_device = std::make_unique<tun::TunDevice>(L"VPNServer", L"Wintun");
-        tun_device->SetReceiveCallback(HandleTunPacket_Revised);
-        tun_device->Start();
-        
-        // Configure IP for TUN (User must do this manually or we use netsh)
-        std::cout << "TUN Device created. Please configure IP: 10.0.0.1/24" << std::endl;
-        std::cout << "Command: netsh interface ip set address name=\"VPNServer\" static 10.0.0.1 255.255.255.0" << std::endl;
-        // We could run this command automatically.
-        system("netsh interface ip set address name=\"VPNServer\" static 10.0.0.1 255.255.255.0");
-
-        // Bind UDP
-        udp_socket.Bind(51820);
-        std::cout << "Listening on UDP 51820" << std::endl;
-
-        std::vector<uint8_t> buffer(65535);
-        sockaddr_in sender;
-
-        while (true) {
-            int bytes = udp_socket.ReceiveFrom(buffer, sender);
-            if (bytes > 0) {
-                std::vector<uint8_t> packet(buffer.begin(), buffer.begin() + bytes);
-                
-                std::lock_guard<std::mutex> lock(sessions_mutex);
-                auto it = endpoint_map.find(sender);
-                
-                if (it != endpoint_map.end()) {
-                    // Existing client
-                    auto& ctx = *it->second;
-                    auto pp = protocol::ParsePacket(packet);
-                    
-                    if (pp.type == protocol::PacketType::Data) {
-                        auto decrypted = ctx.session->Decrypt(pp.payload);
-                        if (!decrypted.empty()) {
-                            tun_device->Write(decrypted);
-                            
-                            // Update Virtual IP map if needed (Source IP learning)
-                            if (decrypted.size() >= 20) {
-                                uint32_t src_ip = *reinterpret_cast<const uint32_t*>(decrypted.data() + 12);
-                                if (clients.find(src_ip) == clients.end()) {
-                                    clients[src_ip] = ctx;
-                                }
-                            }
-                        }
-                    }
-                } else {
-                    // New client?
-                    auto pp = protocol::ParsePacket(packet);
-                    if (pp.type == protocol::PacketType::ClientHello) {
-                        std::cout << "New Client Handshake" << std::endl;
-                        auto session = std::make_shared<Session>(true);
-                        auto response = session->HandleHandshake(packet);
-                        
-                        if (!response.empty()) {
-                            udp_socket.SendTo(sender, response);
-                            
-                            // Create Context
-                            // We don't know VIP yet. We can assign one or wait for first packet.
-                            // Let's just store in endpoint map for now.
-                            // We need a temporary storage or just use a dummy VIP or just endpoint map.
-                            // But HandleTunPacket needs VIP.
-                            // We'll assign a dynamic VIP? Or assume client configures 10.0.0.x
-                            // For now, we rely on Source IP learning from first data packet.
-                            
-                            // We need to store the session to handle Data packets.
-                            // We'll use a temporary context in endpoint_map.
-                            // But we can't put it in clients map yet.
-                            // We need a way to store "Unassigned" clients.
-                            // Actually, we can just new up a context.
-                            
-                            // Hack: We'll use the endpoint map to hold the session.
-                            // The clients map (VIP) will be populated when we see the first decrypted packet.
-                            
-                            // Wait, we need to store the context somewhere persistent.
-                            // Let's make a list of contexts?
-                            // Or just `new` it and manage memory?
-                            // Let's use shared_ptr.
-                            
-                            // We need a container for contexts.
-                            // Let's use a list of contexts, and maps point to them.
-                            // For simplicity:
-                            // We'll just put it in endpoint_map.
-                            // But endpoint_map value is ClientContext*.
-                            // We need to own the ClientContext.
-                            // Let's make endpoint_map value ClientContext (copy) or shared_ptr.
-                            // Let's change map to shared_ptr.
-                        }
-                    }
-                }
+// TUN -> UDP. Each packet (IPv4 or IPv6) is classified by its DSCP (see Qos.h) and queued per
+// class and client. Realtime leaves first, the other classes share by weight, and within a class
+// clients are served deficit round robin within their rate limits, so a bulk download cannot hold
+// up everyone else's packets (see EgressScheduler). Packets are sealed as they leave the queue, so
+// a session's nonce counters go out in order however long a packet waited, and to the client's
+// address at that moment. The class is copied onto the outer header's DSCP for the underlay.
+// TUN queue i is read by worker i's loop (or on core i by the device's own thread), so its packets
+// leave through worker i's socket in SendBatch (sendmmsg) calls: all worker sockets share the
+// listen port, and any of them can reach any client.
+std::vector<std::unique_ptr<utils::EgressScheduler>> egress_queues; // One per TUN queue, used by its thread only
+
+void FlushEgress(size_t queue) {
+    // Reused across calls (one per TUN queue thread)
+    thread_local std::vector<utils::EgressScheduler::Packet> ready;
+    thread_local std::vector<utils::Datagram> outgoing;
+
+    utils::Rcu::ReadGuard guard;
+    utils::EgressScheduler& egress = *egress_queues[queue];
+    int64_t now = utils::TokenBucket::Now();
+    while (egress.Dequeue(ready, utils::UdpSocket::MAX_BATCH, now) > 0) {
+        outgoing.clear();
+        for (auto& packet : ready) {
+            uint64_t start = utils::Tsc::Now();
+            // The client may have gone while its packets waited
+            auto ctx = clients->Find(packet.flow);
+            if (!ctx || !*ctx || !(*ctx)->session->IsEstablished()) {
+                utils::Trace::Event(utils::Stage::Encrypt, packet.flow, packet.data.size(), start, utils::DropReason::NoSession);
+                continue;
+            }
+            // Sealed in place, in the buffer it was read into
+            (*ctx)->session->Encrypt(packet.data);
+            uint64_t sealed = utils::Tsc::Now();
+            utils::StageLatency::Record(utils::Stage::Encrypt, sealed - start);
+            const utils::Endpoint& endpoint = (*ctx)->GetEndpoint();
+            if (packet.traced) {
+                utils::Trace::Event(utils::Stage::Encrypt, packet.flow, packet.data.size(), sealed);
+                utils::Trace::Capture(packet.flow, packet.data.data(), packet.data.size(), true, true, endpoint, sealed);
+            }
+
+            utils::Datagram& datagram = outgoing.emplace_back();
+            datagram.addr = Steer(packet.data, endpoint);
+            datagram.data = packet.data.data();
+            datagram.length = packet.data.size();
+            datagram.tos = utils::OuterTos(packet.cls);
+        }
+        if (!outgoing.empty()) {
+            uint64_t start = utils::Tsc::Now();
+            Worker& worker = *workers[queue % workers.size()];
+            int sent = worker.tun_queue ? worker.loop->SendBatch(worker.socket, outgoing.data(), outgoing.size())
+                                        : worker.socket.SendBatch(outgoing.data(), outgoing.size());
+            utils::StageLatency::Record(utils::Stage::Send, utils::Tsc::Now() - start);
+            uint64_t bytes = 0;
+            for (int i = 0; i < sent; ++i) bytes += outgoing[i].length;
+            tx_packets.Add(sent > 0 ? static_cast<uint64_t>(sent) : 0);
+            tx_bytes.Add(bytes);
+        }
+        ready.clear();
+    }
+}
+
+void HandleTunPacket_Revised(std::vector<utils::PacketBuffer>& packets, size_t queue) {
+    utils::Rcu::ReadGuard guard; // One DataPlane snapshot for the burst
+    utils::EgressScheduler& egress = *egress_queues[queue];
+    int64_t now = utils::TokenBucket::Now();
+    for (auto& packet : packets) {
+        uint64_t start = utils::Tsc::Now();
+        bool traced = utils::Trace::Sample();
+        uint32_t dest_vip = Plane().routes.Route(packet, false);
+        if (!dest_vip) {
+            utils::Trace::Event(utils::Stage::Route, 0, packet.size(), start, utils::DropReason::NoRoute);
+            continue;
+        }
+        auto cls = utils::Classify(packet.data(), packet.size());
+        if (!egress.Admit(dest_vip, cls)) { // Over its queue limit
+            utils::Trace::Event(utils::Stage::Route, dest_vip, packet.size(), start, utils::DropReason::QueueFull);
+            continue;
+        }
+
+        // No lock: the lookups are lock-free
+        auto ctx = clients->Find(dest_vip);
+        if (!ctx || !*ctx || !(*ctx)->session->IsEstablished()) {
+            utils::Trace::Event(utils::Stage::Route, dest_vip, packet.size(), start, utils::DropReason::NoSession);
+            continue;
+        }
+        uint64_t routed = utils::Tsc::Now();
+        utils::StageLatency::Record(utils::Stage::Route, routed - start);
+        if (traced) {
+            utils::Trace::Event(utils::Stage::Route, dest_vip, packet.size(), routed);
+            utils::Trace::Capture(dest_vip, packet.data(), packet.size(), false, true, (*ctx)->GetEndpoint(), routed);
+        }
+        // Queued without a copy
+        egress.Enqueue(dest_vip, cls, (*ctx)->shaper, std::move(packet), traced, now);
+    }
+    FlushEgress(queue);
+}
+
+// TUN queue timer: release shaped packets whose time has come, then sleep until the next is due
+std::chrono::microseconds EgressTimer(size_t queue) {
+    FlushEgress(queue);
+    const utils::EgressScheduler& egress = *egress_queues[queue];
+    if (egress.Empty()) return std::chrono::milliseconds(100);
+    int64_t wait_ns = egress.NextReadyAt() - utils::TokenBucket::Now();
+    return std::chrono::microseconds(wait_ns > 0 ? (wait_ns + 999) / 1000 : 0);
+}
+
+// Every `interval`, print each class's queue depth, throughput, drops and sojourn time (enqueue to
+// send) summed over the TUN queues, per-stage latency since startup (see Latency.h), the packet
+// buffer pool's size, and each worker's event loop packets and syscalls. The maximum sojourn and
+// the event loop counts are per interval.
+void EgressStatsLoop(std::chrono::seconds interval) {
+    uint64_t last_packets[utils::TRAFFIC_CLASS_COUNT] = {};
+    uint64_t last_sojourn[utils::TRAFFIC_CLASS_COUNT] = {};
+    std::vector<utils::EventLoop::Stats> last_loops(workers.size());
+    while (!shutdown_requested) {
+        std::this_thread::sleep_for(interval);
+        for (size_t c = 0; c < utils::TRAFFIC_CLASS_COUNT; ++c) {
+            auto cls = static_cast<utils::TrafficClass>(c);
+            uint64_t depth = 0, packets = 0, drops = 0, sojourn = 0, sojourn_max = 0;
+            for (auto& egress : egress_queues) {
+                auto& stats = egress->Stats(cls);
+                depth += stats.depth.load(std::memory_order_relaxed);
+                packets += stats.packets.load(std::memory_order_relaxed);
+                drops += stats.drops.load(std::memory_order_relaxed);
+                sojourn += stats.sojourn_total_ns.load(std::memory_order_relaxed);
+                uint64_t max = stats.sojourn_max_ns.exchange(0, std::memory_order_relaxed);
+                if (max > sojourn_max) sojourn_max = max;
             }
+            uint64_t sent = packets - last_packets[c];
+            uint64_t average = sent ? (sojourn - last_sojourn[c]) / sent : 0;
+            last_packets[c] = packets;
+            last_sojourn[c] = sojourn;
+            std::cout << "egress " << utils::TrafficClassName(cls) << ": depth " << depth << ", sent " << sent
+                      << ", drops " << drops << ", sojourn avg " << average / 1000 << " us, max "
+                      << sojourn_max / 1000 << " us" << std::endl;
+        }
+        for (size_t s = 0; s < utils::STAGE_COUNT; ++s) {
+            auto stage = static_cast<utils::Stage>(s);
+            auto counts = utils::StageLatency::Merge(stage);
+            std::cout << "latency " << utils::StageName(stage) << ": p50 " << utils::StageLatency::QuantileNanos(counts, 0.5) / 1000
+                      << " us, p99 " << utils::StageLatency::QuantileNanos(counts, 0.99) / 1000 << " us, p99.9 "
+                      << utils::StageLatency::QuantileNanos(counts, 0.999) / 1000 << " us" << std::endl;
+        }
+        auto pool = utils::PacketBuffer::Stats();
+        std::cout << "packet pool: " << pool.pooled_buffers << " buffers, " << pool.heap_buffers << " oversized" << std::endl;
+        for (size_t w = 0; w < workers.size(); ++w) {
+            auto loop = workers[w]->loop->GetStats();
+            uint64_t received = loop.packets_received - last_loops[w].packets_received;
+            uint64_t sent = loop.packets_sent - last_loops[w].packets_sent;
+            uint64_t syscalls = loop.syscalls - last_loops[w].syscalls;
+            last_loops[w] = loop;
+            std::cout << "worker " << w << " " << workers[w]->loop->Name() << " loop: received " << received << ", sent " << sent
+                      << ", syscalls " << syscalls;
+            if (received + sent) std::cout << " (" << static_cast<double>(syscalls) / (received + sent) << " per packet)";
+            std::cout << std::endl;
+        }
+    }
+}
+
+// Queue depths, drops and sent packets per class summed over the TUN queues, and the packet pool
+void RegisterEgressMetrics() {
+    using Stat = std::atomic<uint64_t> utils::EgressScheduler::ClassStats::*;
+    auto add = [](const char* name, const char* help, utils::Metrics::Type type, Stat stat) {
+        for (size_t c = 0; c < utils::TRAFFIC_CLASS_COUNT; ++c) {
+            auto cls = static_cast<utils::TrafficClass>(c);
+            std::string labels = std::string("class=\"") + utils::TrafficClassName(cls) + "\"";
+            utils::Metrics::AddCallback(name, help, type, labels, [cls, stat] {
+                uint64_t total = 0;
+                for (auto& egress : egress_queues) total += (egress->Stats(cls).*stat).load(std::memory_order_relaxed);
+                return static_cast<double>(total);
+            });
+        }
+    };
+    add("vpn_egress_queue_depth", "Packets waiting in the egress queues", utils::Metrics::Type::Gauge, &utils::EgressScheduler::ClassStats::depth);
+    add("vpn_egress_packets_total", "Packets released by the egress scheduler", utils::Metrics::Type::Counter, &utils::EgressScheduler::ClassStats::packets);
+    add("vpn_egress_drops_total", "Packets dropped at a full egress queue", utils::Metrics::Type::Counter, &utils::EgressScheduler::ClassStats::drops);
+
+    utils::Metrics::AddCallback("vpn_packet_buffers", "Packet buffers allocated", utils::Metrics::Type::Gauge, "kind=\"pooled\"",
+                                [] { return static_cast<double>(utils::PacketBuffer::Stats().pooled_buffers); });
+    utils::Metrics::AddCallback("vpn_packet_buffers", "Packet buffers allocated", utils::Metrics::Type::Gauge, "kind=\"oversized\"",
+                                [] { return static_cast<double>(utils::PacketBuffer::Stats().heap_buffers); });
+}
+
+// Packets and syscalls of the workers' event loops, summed (see EventLoop::Stats)
+void RegisterEventLoopMetrics() {
+    using Field = uint64_t utils::EventLoop::Stats::*;
+    auto sum = [](Field field) {
+        return [field] {
+            uint64_t total = 0;
+            for (auto& worker : workers) total += worker->loop->GetStats().*field;
+            return static_cast<double>(total);
+        };
+    };
+    utils::Metrics::AddCallback("vpn_event_loop_packets_total", "Datagrams received and sent by the workers' event loops",
+                                utils::Metrics::Type::Counter, "direction=\"rx\"", sum(&utils::EventLoop::Stats::packets_received));
+    utils::Metrics::AddCallback("vpn_event_loop_packets_total", "Datagrams received and sent by the workers' event loops",
+                                utils::Metrics::Type::Counter, "direction=\"tx\"", sum(&utils::EventLoop::Stats::packets_sent));
+    utils::Metrics::AddCallback("vpn_event_loop_syscalls_total", "Syscalls made by the workers' event loops",
+                                utils::Metrics::Type::Counter, "", sum(&utils::EventLoop::Stats::syscalls));
+}
+
+// Reserve a client address, `preferred` if it is free. When the pool is full, the oldest session
+// that never authenticated a packet, or else the longest-idle session (idle at least
+// VIP_RECLAIM_IDLE_SECONDS), loses its address and is dropped. Returns 0 if nothing could be reserved.
+uint32_t AllocateAddress(uint32_t preferred) {
+    if (auto vip = clients->Allocate(nullptr, preferred)) return *vip;
+
+    // Unauthenticated sessions first, then by age
+    auto before = [](const ClientContext& a, const ClientContext& b) {
+        bool a_auth = a.authenticated.load(std::memory_order_relaxed), b_auth = b.authenticated.load(std::memory_order_relaxed);
+        if (a_auth != b_auth) return !a_auth;
+        return a.last_seen.load(std::memory_order_relaxed) < b.last_seen.load(std::memory_order_relaxed);
+    };
+    std::shared_ptr<ClientContext> oldest;
+    clients->ForEach([&](uint32_t, const std::shared_ptr<ClientContext>& ctx) {
+        if (ctx && (!oldest || before(*ctx, *oldest))) oldest = ctx;
+    });
+    if (!oldest) return 0;
+    if (oldest->authenticated && NowSeconds() - oldest->last_seen.load(std::memory_order_relaxed) < VIP_RECLAIM_IDLE_SECONDS) return 0;
+
+    sessions.Erase(oldest->index);
+    clients->Release(oldest->vip);
+    if (cluster) cluster->SendRemoved({oldest->index});
+    if (oldest->authenticated) std::cout << "Address pool full, reclaimed an idle client's address" << std::endl;
+
+    auto vip = clients->Allocate(nullptr, oldest->vip);
+    return vip ? *vip : 0;
+}
+
+// Reserve an unused session index (random, so it does not reveal how many sessions there are).
+// Held by a null context until the handshake completes. A cluster node picks indexes equal to its
+// id modulo the node count, so vpn_lb sends a session's packets to the node that established it
+// without keeping state.
+uint32_t AllocateIndex() {
+    for (;;) {
+        auto random = crypto::Random::Generate(protocol::INDEX_SIZE);
+        uint64_t index = protocol::ParseIndex(random.data());
+        if (cluster) index = index - index % cluster_link->NodeCount() + cluster_link->Self();
+        if (index > UINT32_MAX) continue;
+        if (sessions.TryInsert(static_cast<uint32_t>(index), nullptr)) return static_cast<uint32_t>(index);
+    }
+}
+
+// Hellos per source, in fixed memory however many sources there are (256 KB). Seeded at startup.
+constexpr size_t HANDSHAKE_SKETCH_WIDTH = 16384;
+constexpr int64_t HANDSHAKE_HALF_LIFE_NS = 1000000000;
+std::unique_ptr<utils::CountMinSketch> handshake_sources;
+
+// Checked before a hello costs any crypto or state. A source (the sender's address cut to
+// handshake_prefix, or handshake_prefix6 for IPv6) is refused once it averages more than
+// handshake_rate hellos a second; counts halve every second, so a burst of up to twice that passes.
+bool AdmitHandshake(const utils::Endpoint& sender) {
+    const DataPlane& plane = Plane();
+    if (!plane.handshake_rate) return true;
+    uint8_t address[16];
+    std::memcpy(address, &sender.sin6_addr, 16);
+    bool v4 = IN6_IS_ADDR_V4MAPPED(&sender.sin6_addr);
+    int prefix = v4 ? 96 + plane.handshake_prefix : plane.handshake_prefix6;
+    for (int i = 0; i < 16; ++i) {
+        int bits = prefix - 8 * i;
+        address[i] &= bits >= 8 ? 0xFF : bits <= 0 ? 0 : static_cast<uint8_t>(0xFF << (8 - bits));
+    }
+    uint64_t high, low;
+    std::memcpy(&high, address, 8);
+    std::memcpy(&low, address + 8, 8);
+    uint32_t count = handshake_sources->Add(high, low, utils::TokenBucket::Now());
+    return count <= 2 * static_cast<uint64_t>(plane.handshake_rate);
+}
+
+// Client-to-client traffic skips the TUN device: a packet whose inner destination is another
+// connected client is re-sealed for it on the worker that opened it, instead of being written to
+// the TUN, routed back out by the kernel and read by a TUN queue thread. `hairpin = false` (or
+// --no-hairpin) turns this off, e.g. to filter client-to-client traffic in the kernel's forward chain.
+
+// Sends `packet`, opened from another client, straight to the client holding `dest_vip` (see
+// ForwardFromClient, which picked it)
+void Hairpin(Worker& worker, utils::PacketBuffer& packet, uint32_t dest_vip, const std::shared_ptr<ClientContext>& ctx, bool traced) {
+    auto cls = utils::Classify(packet.data(), packet.size());
+    uint64_t start = utils::Tsc::Now();
+    ctx->session->Encrypt(packet);
+    uint64_t sealed = utils::Tsc::Now();
+    utils::StageLatency::Record(utils::Stage::Encrypt, sealed - start);
+
+    // Nothing to queue in on this thread: over its rate, the packet is dropped (policed, not shaped)
+    if (ctx->shaper && !ctx->shaper->TryConsume(packet.size(), utils::TokenBucket::Now())) {
+        utils::Trace::Event(utils::Stage::Encrypt, dest_vip, packet.size(), sealed, utils::DropReason::RateLimited);
+        return;
+    }
+    if (traced) {
+        utils::Trace::Event(utils::Stage::Encrypt, dest_vip, packet.size(), sealed);
+        utils::Trace::Capture(dest_vip, packet.data(), packet.size(), true, true, ctx->GetEndpoint(), sealed);
+    }
+
+    utils::Datagram datagram;
+    datagram.addr = Steer(packet, ctx->GetEndpoint());
+    datagram.data = packet.data();
+    datagram.length = packet.size();
+    datagram.tos = utils::OuterTos(cls);
+    worker.hairpin_sends.push_back(datagram);
+    worker.hairpin.push_back(std::move(packet)); // Moves the handle; the data stays put
+}
+
+void Roam(ClientContext& ctx, const utils::Endpoint& sender) {
+    ctx.SetEndpoint(sender);
+    roams.Add();
+    if (cluster) cluster->Announce(ctx);
+    char address[INET6_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET6, &sender.sin6_addr, address, sizeof(address));
+    std::cout << "Client " << FormatIpv4(ctx.vip) << " roamed to [" << address << "]:" << ntohs(sender.sin6_port) << std::endl;
+}
+
+void HandleDatagram(Worker& worker, utils::PacketBuffer& packet, const utils::Endpoint& sender) {
+    if (packet.empty()) return;
+    auto type = static_cast<protocol::PacketType>(packet[0]);
+
+    if (type == protocol::PacketType::ClientHello || type == protocol::PacketType::ResumeHello) {
+        if (!AdmitHandshake(sender)) {
+            handshakes_limited.Add();
+            utils::Trace::Event(utils::Stage::SessionLookup, 0, packet.size(), utils::Tsc::Now(), utils::DropReason::HandshakeLimited);
+            return;
+        }
+        // Always a fresh session: anyone can send a hello from any address, so one proves nothing
+        // about earlier sessions, which stay until they go idle. ResumeHello with a valid ticket
+        // skips X25519 entirely.
+        auto session = std::make_shared<Session>(true, &ticket_key);
+        uint32_t index = AllocateIndex();
+        session->SetIndex(index);
+        SetNonceStripe(*session);
+
+        // A resumed client asks for the address in its ticket. If the session that issued the
+        // ticket still holds it, the client gets it back, but it moves only once this session
+        // authenticates a packet (see TakeOver).
+        uint32_t allocated = 0;
+        std::shared_ptr<ClientContext> predecessor;
+        session->SetAddressAllocator([&](uint32_t requested) -> std::optional<protocol::AddressAssignment> {
+            auto holder = requested ? clients->Find(requested) : std::nullopt;
+            if (holder && *holder && session->ResumedFrom(*(*holder)->session)) {
+                predecessor = *holder;
+                return protocol::AddressAssignment{requested, clients->PrefixLength()};
+            }
+            allocated = AllocateAddress(requested);
+            if (!allocated) return std::nullopt;
+            return protocol::AddressAssignment{allocated, clients->PrefixLength()};
+        });
+        auto response = session->HandleHandshake(std::vector<uint8_t>(packet.begin(), packet.end()));
+
+        if (!response.empty()) {
+            (session->IsResumed() ? handshakes_resumed : handshakes_full).Add();
+            std::cout << (session->IsResumed() ? "Client Resumed Session" : "New Client Handshake")
+                      << " (worker " << worker.id << ")" << std::endl;
+            // In the tables before the client can answer: its first packet may reach another worker
+            // before this one is back from sending
+            auto ctx = std::make_shared<ClientContext>(session, sender, predecessor ? predecessor->vip : allocated);
+            ctx->predecessor = predecessor;
+            ctx->taking_over = predecessor != nullptr;
+            sessions.Insert(index, ctx);
+            if (allocated) clients->Assign(allocated, ctx);
+            if (!predecessor && cluster) cluster->Announce(*ctx);
+
+            if (load_balancer) {
+                response.insert(response.begin(), protocol::STEER_HEADER_SIZE, 0);
+                protocol::WriteSteerHeader(response.data(), sender);
+            }
+            worker.loop->SendTo(worker.socket, load_balancer ? *load_balancer : sender, response);
+        } else {
+            handshakes_failed.Add();
+            sessions.Erase(index);
+            if (allocated) clients->Release(allocated);
+        }
+    } else if (type == protocol::PacketType::Data) {
+        if (receive_stopped) return;
+        uint64_t start = utils::Tsc::Now();
+        bool traced = utils::Trace::Sample();
+        auto entry = packet.size() >= protocol::DATA_HEADER_SIZE ? sessions.Find(protocol::DataIndex(packet.data())) : std::nullopt;
+        if (!entry || !*entry) {
+            utils::Trace::Event(utils::Stage::SessionLookup, 0, packet.size(), start, utils::DropReason::UnknownPeer);
+            return;
+        }
+        const std::shared_ptr<ClientContext>& ctx = *entry;
+        uint64_t found = utils::Tsc::Now();
+        utils::StageLatency::Record(utils::Stage::SessionLookup, found - start);
+        if (traced) {
+            utils::Trace::Event(utils::Stage::SessionLookup, ctx->vip, packet.size(), found);
+            utils::Trace::Capture(ctx->vip, packet.data(), packet.size(), true, false, sender, found);
+        }
+
+        // Existing client: opened in place, then handed to the TUN writer in the same buffer
+        size_t wire_size = packet.size();
+        bool opened = ctx->session->Decrypt(packet);
+        uint64_t opened_at = utils::Tsc::Now();
+        utils::StageLatency::Record(utils::Stage::Decrypt, opened_at - found);
+        if (!opened) {
+            utils::Trace::Event(utils::Stage::Decrypt, ctx->vip, wire_size, opened_at, utils::DropReason::AuthFailed);
+            return;
+        }
+        // Authentic and not a replay, so from the client: if it came from a new address, the client
+        // roamed (or its NAT rebound) and replies go there from now on
+        if (ctx->taking_over.load(std::memory_order_relaxed) && ctx->taking_over.exchange(false) && !TakeOver(sessions, *clients, ctx, cluster.get())) return;
+        if (!SockAddrEq{}(ctx->GetEndpoint(), sender)) Roam(*ctx, sender);
+        ctx->last_seen.store(NowSeconds(), std::memory_order_relaxed);
+        if (!ctx->authenticated.load(std::memory_order_relaxed)) ctx->authenticated.store(true, std::memory_order_relaxed);
+        if (packet.empty()) {
+            // Keepalive: answered, so the client can tell a quiet tunnel from a dead session. Not
+            // while another node sends to the client: it hears that one, and only one node may send.
+            if (cluster && cluster->OtherNodeSending(*ctx)) return;
+            ctx->session->Encrypt(packet);
+            const utils::Endpoint& dest = Steer(packet, ctx->GetEndpoint());
+            worker.loop->SendTo(worker.socket, dest, std::vector<uint8_t>(packet.begin(), packet.end()));
+            return;
+        }
+        rx_packets.Add();
+        rx_bytes.Add(wire_size);
+        if (traced) {
+            utils::Trace::Event(utils::Stage::Decrypt, ctx->vip, packet.size(), opened_at);
+            utils::Trace::Capture(ctx->vip, packet.data(), packet.size(), false, false, sender, opened_at);
+        }
+
+        // Ingress filter, then straight to another client or into the TUN device. A client another
+        // cluster node sends to is reached through the TUN device too, by way of that node.
+        const DataPlane& plane = Plane();
+        uint32_t dest_vip = 0;
+        std::shared_ptr<ClientContext> dest;
+        auto forward = protocol::ForwardFromClient(plane.routes, packet, ctx->vip, plane.hairpin, [&dest](uint32_t vip) {
+            auto found = clients->Find(vip);
+            if (found && *found && (*found)->session->IsEstablished() && !(cluster && cluster->OtherNodeSending(**found))) dest = *found;
+            return dest != nullptr;
+        }, dest_vip);
+        if (forward == protocol::Forward::Drop) {
+            utils::Trace::Event(utils::Stage::Decrypt, ctx->vip, packet.size(), opened_at, utils::DropReason::SpoofedSource);
+            return;
+        }
+        if (forward == protocol::Forward::Hairpin) {
+            Hairpin(worker, packet, dest_vip, dest, traced);
+            return;
+        }
+        worker.tun_writes.push_back(std::move(packet));
+    }
+}
+
+void WorkerLoop(Worker& worker) try {
+    worker.loop->AddSocket(worker.socket, [&worker](utils::PacketBuffer& packet, const utils::Endpoint& sender) {
+        utils::Rcu::ReadGuard guard;
+        // Whatever a datagram makes go wrong costs that datagram, never the worker
+        try {
+            if (!load_balancer) {
+                HandleDatagram(worker, packet, sender);
+                return;
+            }
+            // Behind the load balancer the client's address comes in front of its datagram
+            if (!SockAddrEq{}(sender, *load_balancer) || packet.size() < protocol::STEER_HEADER_SIZE) return;
+            utils::Endpoint client = protocol::ReadSteerHeader(packet.data());
+            packet.Consume(protocol::STEER_HEADER_SIZE);
+            HandleDatagram(worker, packet, client);
+        } catch (const std::exception& e) {
+            std::cerr << "Worker " << worker.id << " dropped a datagram: " << e.what() << std::endl;
+        }
+    });
+    if (worker.tun_queue) {
+        size_t queue = *worker.tun_queue;
+        worker.loop->AddReadable(tun_device->QueueHandle(queue), [queue] { tun_device->ReadQueue(queue); });
+        worker.loop->SetTimerHandler([queue] { return EgressTimer(queue); });
+    }
+    worker.loop->SetBatchEndHandler([&worker] {
+        if (!worker.hairpin_sends.empty()) {
+            uint64_t start = utils::Tsc::Now();
+            int sent = worker.loop->SendBatch(worker.socket, worker.hairpin_sends.data(), worker.hairpin_sends.size());
+            utils::StageLatency::Record(utils::Stage::Send, utils::Tsc::Now() - start);
+            uint64_t bytes = 0;
+            for (int i = 0; i < sent; ++i) bytes += worker.hairpin_sends[i].length;
+            tx_packets.Add(sent > 0 ? static_cast<uint64_t>(sent) : 0);
+            tx_bytes.Add(bytes);
+            hairpin_packets.Add(sent > 0 ? static_cast<uint64_t>(sent) : 0);
+            worker.hairpin_sends.clear();
+            worker.hairpin.clear();
+        }
+        if (worker.tun_writes.empty()) return;
+        uint64_t start = utils::Tsc::Now();
+        tun_device->WriteBatch(worker.tun_writes, worker.id);
+        utils::StageLatency::Record(utils::Stage::TunWrite, utils::Tsc::Now() - start);
+        worker.tun_writes.clear();
+    });
+    worker.loop->Run();
+} catch (const std::exception& e) {
+    std::cerr << "Worker " << worker.id << " error: " << e.what() << std::endl;
+}
+
+int main(int argc, char** argv) {
+    // Usage: vpn_server [--config PATH]... [--node ID] [--load-balancer HOST:PORT] [--workers N] [--route CIDR=VIP]... [--default-rate MBIT] [--rate VIP=MBIT]...
+    //                   [--stats-interval SECONDS] [--metrics ADDRESS]
+    //                   [--trace-sample N] [--trace-vip VIP]... [--trace-file PATH] [--no-hairpin] [--handshake-rate N]
+    // --config reads settings from PATH (see README); the other options override them.
+    // --node picks this process's [node ID] section when the config describes a cluster.
+    // --load-balancer takes clients only through vpn_lb, whose backend socket is at HOST:PORT.
+    // Defaults to one worker per core where SO_REUSEPORT is available, otherwise a single worker.
+    // --route sends a network to the client holding VIP, e.g. --route 192.168.50.0/24=10.0.0.2
+    // or --route 2001:db8:1::/48=10.0.0.2.
+    // --default-rate and --rate cap server -> client traffic in Mbit/s, for every client or for the
+    // client holding VIP (e.g. --rate 10.0.0.2=50). Unlimited by default.
+    // --stats-interval prints per-class egress queue and per-worker event loop statistics that often.
+    // --metrics serves Prometheus metrics on ADDRESS: a port on loopback (9100), IP:PORT, [IPv6]:PORT
+    // or unix:PATH.
+    // --no-hairpin sends client-to-client traffic through the TUN device (see Hairpin).
+    // --trace-sample traces one packet in N (default 64, 0 for drops only); --trace-vip limits packet
+    // capture to the client holding VIP. SIGUSR1 dumps the trace to --trace-file (vpn_trace.pcapng).
+    // --handshake-rate refuses hellos from a source (IP address) sending more than N a second on
+    // average (default 20, 0 = unlimited).
+    // SIGHUP reloads the config files and options; routes, rates, hairpin and handshake limits take effect in place.
+    arguments.assign(argv + 1, argv + argc);
+    try {
+        startup_config = utils::LoadConfig(arguments);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    const utils::ServerConfig& config = startup_config;
+
+    unsigned worker_count = config.workers;
+    if (worker_count == 0) worker_count = utils::UdpSocket::SupportsReusePort() ? std::thread::hardware_concurrency() : 1;
+    if (worker_count == 0) worker_count = 1;
+    if (worker_count > utils::ServerConfig::MAX_WORKERS) worker_count = utils::ServerConfig::MAX_WORKERS;
+    if (worker_count > 1 && !utils::UdpSocket::SupportsReusePort()) {
+        std::cout << "SO_REUSEPORT not supported, using a single worker" << std::endl;
+        worker_count = 1;
+    }
+
+    try {
+        std::cout << "Starting VPN Server..." << std::endl;
+
+        clients = std::make_unique<utils::AddressPool<std::shared_ptr<ClientContext>>>(config.pool_network, config.pool_prefix_len, config.Gateway());
+        auto seed = crypto::Random::Generate(8);
+        handshake_sources = std::make_unique<utils::CountMinSketch>(HANDSHAKE_SKETCH_WIDTH, HANDSHAKE_HALF_LIFE_NS,
+                                                                    protocol::ParseIndex(seed.data()) | uint64_t(protocol::ParseIndex(seed.data() + 4)) << 32);
+        PublishDataPlane(BuildDataPlane(config));
+        if (!config.nodes.empty()) StartCluster(config);
+        load_balancer = config.load_balancer;
+
+        trace_path = config.trace_file;
+        utils::Trace::Configure(config.trace_sample, config.trace_vips, config.listen_port);
+
+        // Bind UDP: one socket per worker, all on the same port
+        for (unsigned i = 0; i < worker_count; ++i) {
+            auto worker = std::make_unique<Worker>();
+            worker->id = i;
+            worker->socket.Bind(config.listen_port, worker_count > 1);
+            worker->socket.EnableGso();
+            worker->socket.EnableGro();
+            worker->loop = utils::EventLoop::Create();
+            workers.push_back(std::move(worker));
+        }
+
+        RestoreSessions();
+        std::signal(SIGINT, OnShutdownSignal);
+        std::signal(SIGTERM, OnShutdownSignal);
+#ifdef SIGUSR1
+        std::signal(SIGUSR1, OnTraceSignal);
+#endif
+        // Initialize TUN: one queue per worker where the platform supports it (Linux IFF_MULTI_QUEUE)
+        tun_device = std::make_unique<tun::TunDevice>(config.tun_name, worker_count);
+        for (size_t i = 0; i < tun_device->QueueCount(); ++i) egress_queues.push_back(std::make_unique<utils::EgressScheduler>(2048, 512, protocol::DATA_HEADER_SIZE + crypto::TAG_LEN));
+        RegisterEgressMetrics();
+        RegisterEventLoopMetrics();
+        tun_device->SetReceiveBatchCallback(HandleTunPacket_Revised);
+        // Worker i's loop reads queue i where the queues have descriptors (Linux); otherwise the
+        // device reads them on threads of its own
+        bool queues_on_workers = tun_device->QueueCount() == worker_count;
+        for (size_t i = 0; i < tun_device->QueueCount(); ++i) queues_on_workers = queues_on_workers && tun_device->QueueHandle(i) >= 0;
+        if (queues_on_workers) {
+            for (unsigned i = 0; i < worker_count; ++i) workers[i]->tun_queue = i;
+        } else {
+            tun_device->SetTimerCallback(EgressTimer);
+            tun_device->Start(worker_count > 1);
+        }
+        if (!tun_device->SetMtu(protocol::TUNNEL_MTU)) {
+            std::cout << "Could not set the MTU of " << tun_device->Name() << ", please set it to " << protocol::TUNNEL_MTU << std::endl;
+        }
+
+        std::string gateway = FormatIpv4(config.Gateway());
+        std::string gateway6 = FormatIpv6(protocol::EmbedVip6(config.Gateway()));
+        unsigned prefix6 = protocol::VIP6_PREFIX_LEN + config.pool_prefix_len;
+        if (!tun_device->SetAddress(gateway, config.pool_prefix_len) || !tun_device->SetAddress(gateway6, prefix6)) {
+            std::cout << "Could not configure " << tun_device->Name() << ", please set " << gateway << "/"
+                      << int(config.pool_prefix_len) << " and " << gateway6 << "/" << prefix6 << " manually" << std::endl;
+        }
+        InstallRoutes(config);
+        std::cout << "TUN device " << tun_device->Name() << " up with " << tun_device->QueueCount() << " queue(s)" << std::endl;
+
+        // Reloads touch the TUN device's routes, so they start once it is up
+        std::thread(SnapshotLoop).detach();
+#ifdef SIGHUP
+        std::signal(SIGHUP, OnReloadSignal);
+#endif
+        if (config.stats_interval) std::thread(EgressStatsLoop, std::chrono::seconds(config.stats_interval)).detach();
+        std::unique_ptr<utils::MetricsExporter> exporter;
+        if (!config.metrics.empty()) {
+            exporter = std::make_unique<utils::MetricsExporter>(config.metrics);
+            std::cout << "Serving metrics on " << config.metrics << std::endl;
+        }
+
+        std::cout << "Listening on UDP " << config.listen_port << " with " << worker_count << " worker(s), "
+                  << workers[0]->loop->Name() << " event loop" << std::endl;
+
+        for (auto& worker : workers) {
+            worker->thread = std::thread(WorkerLoop, std::ref(*worker));
+            if (worker_count > 1) utils::PinThreadToCore(worker->thread, worker->id);
         }
+        for (auto& worker : workers) worker->thread.join();
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
@@ -0,0 +1,236 @@
+#include "TunDevice.h"
+
+#ifdef __linux__
+
+#include "TunOffload.h"
+#include "Metrics.h"
+#include "Latency.h"
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <net/route.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace vpn::tun {
+
+    namespace {
+        constexpr size_t MAX_PACKET = 65535;
+
+        const auto write_drops = utils::Metrics::AddCounter(
+            "vpn_tun_write_drops_total", "Writes to the TUN device dropped because its queue was full (a super-segment counts once)");
+
+        // struct in6_ifreq from <linux/ipv6.h>, which clashes with the libc headers
+        struct Ipv6IfReq {
+            in6_addr address;
+            uint32_t prefix_len;
+            int ifindex;
+        };
+    }
+
+    struct TunDevice::Impl {
+        std::vector<int> fds; // One per queue; the interface lives as long as they are open
+        bool offload = false; // TSO accepted: reads may be super-segments, writes may coalesce
+    };
+
+    TunDevice::TunDevice(const std::string& name, size_t queues)
+        : name_(name), impl_(std::make_unique<Impl>()) {
+        if (queues == 0) queues = 1;
+
+        for (size_t i = 0; i < queues; ++i) {
+            int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+            if (fd < 0) {
+                for (int open_fd : impl_->fds) close(open_fd);
+                throw std::runtime_error("Failed to open /dev/net/tun: " + std::string(strerror(errno)));
+            }
+
+            // Every queue attaches to the same interface by name
+            ifreq ifr = {};
+            // Every packet is preceded by a virtio-net header, with or without offloads
+            ifr.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_VNET_HDR;
+            if (queues > 1) ifr.ifr_flags |= IFF_MULTI_QUEUE;
+            std::strncpy(ifr.ifr_name, name_.c_str(), IFNAMSIZ - 1);
+            if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+                int error = errno;
+                close(fd);
+                for (int open_fd : impl_->fds) close(open_fd);
+                throw std::runtime_error("Failed to create TUN device " + name_ + ": " + strerror(error));
+            }
+            name_ = ifr.ifr_name; // The kernel may have expanded a "%d" template
+            impl_->fds.push_back(fd);
+
+            // TSO needs checksum offload. Without it the kernel segments before handing packets over.
+            int header_size = VIRTIO_NET_HDR_SIZE;
+            unsigned offloads = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6;
+            bool offload = ioctl(fd, TUNSETVNETHDRSZ, &header_size) == 0 && ioctl(fd, TUNSETOFFLOAD, offloads) == 0;
+            impl_->offload = i == 0 ? offload : impl_->offload && offload;
+        }
+    }
+
+    TunDevice::~TunDevice() {
+        Stop();
+        for (int fd : impl_->fds) close(fd);
+    }
+
+    size_t TunDevice::QueueCount() const {
+        return impl_->fds.size();
+    }
+
+    void TunDevice::OpenQueues() {
+        // Queues are attached in the constructor
+    }
+
+    void TunDevice::CloseQueues() {
+    }
+
+    void TunDevice::Write(const utils::PacketBuffer& packet, size_t queue) {
+        int fd = impl_->fds[queue % impl_->fds.size()];
+        // Plain packet: all-zero header (no GSO, checksum complete)
+        VirtioNetHeader header;
+        iovec iov[2] = {{&header, VIRTIO_NET_HDR_SIZE}, {const_cast<uint8_t*>(packet.data()), packet.size()}};
+        // Non-blocking: if the kernel queue is full the packet is dropped, as a NIC would
+        if (writev(fd, iov, 2) < 0) write_drops.Add();
+    }
+
+    void TunDevice::WriteBatch(const std::vector<utils::PacketBuffer>& packets, size_t queue) {
+        if (!impl_->offload) {
+            for (const auto& packet : packets) Write(packet, queue);
+            return;
+        }
+
+        int fd = impl_->fds[queue % impl_->fds.size()];
+        thread_local std::vector<std::vector<uint8_t>> coalesced;
+        size_t count = CoalescePackets(packets, coalesced);
+        for (size_t i = 0; i < count; ++i) {
+            if (write(fd, coalesced[i].data(), coalesced[i].size()) < 0) write_drops.Add();
+        }
+    }
+
+    bool TunDevice::SetAddress(const std::string& ip, unsigned prefix_len) {
+        bool v6 = ip.find(':') != std::string::npos;
+        int sock = socket(v6 ? AF_INET6 : AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock < 0) return false;
+
+        ifreq ifr = {};
+        std::strncpy(ifr.ifr_name, name_.c_str(), IFNAMSIZ - 1);
+        bool ok;
+        if (v6) {
+            // SIOCSIFADDR on an AF_INET6 socket takes the kernel's in6_ifreq
+            Ipv6IfReq request = {};
+            request.prefix_len = prefix_len;
+            ok = inet_pton(AF_INET6, ip.c_str(), &request.address) == 1 && ioctl(sock, SIOCGIFINDEX, &ifr) == 0;
+            if (ok) {
+                request.ifindex = ifr.ifr_ifindex;
+                ok = ioctl(sock, SIOCSIFADDR, &request) == 0 || errno == EEXIST;
+            }
+        } else {
+            auto* addr = reinterpret_cast<sockaddr_in*>(&ifr.ifr_addr);
+            addr->sin_family = AF_INET;
+            ok = inet_pton(AF_INET, ip.c_str(), &addr->sin_addr) == 1 && ioctl(sock, SIOCSIFADDR, &ifr) == 0;
+            if (ok) {
+                addr->sin_addr.s_addr = htonl(prefix_len == 0 ? 0 : 0xFFFFFFFFu << (32 - prefix_len));
+                ok = ioctl(sock, SIOCSIFNETMASK, &ifr) == 0;
+            }
+        }
+        if (ok) ok = ioctl(sock, SIOCGIFFLAGS, &ifr) == 0;
+        if (ok) {
+            ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+            ok = ioctl(sock, SIOCSIFFLAGS, &ifr) == 0;
+        }
+        close(sock);
+        return ok;
+    }
+
+    bool TunDevice::SetMtu(unsigned mtu) {
+        int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock < 0) return false;
+        ifreq ifr = {};
+        std::strncpy(ifr.ifr_name, name_.c_str(), IFNAMSIZ - 1);
+        ifr.ifr_mtu = static_cast<int>(mtu);
+        bool ok = ioctl(sock, SIOCSIFMTU, &ifr) == 0;
+        close(sock);
+        return ok;
+    }
+
+    bool TunDevice::AddRoute(const std::string& network, unsigned prefix_len) {
+        bool v6 = network.find(':') != std::string::npos;
+        int sock = socket(v6 ? AF_INET6 : AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock < 0) return false;
+
+        bool ok;
+        if (v6) {
+            ifreq ifr = {};
+            std::strncpy(ifr.ifr_name, name_.c_str(), IFNAMSIZ - 1);
+            in6_rtmsg route = {};
+            route.rtmsg_dst_len = static_cast<unsigned short>(prefix_len);
+            route.rtmsg_metric = 1;
+            route.rtmsg_flags = RTF_UP;
+            ok = inet_pton(AF_INET6, network.c_str(), &route.rtmsg_dst) == 1 && ioctl(sock, SIOCGIFINDEX, &ifr) == 0;
+            if (ok) {
+                route.rtmsg_ifindex = ifr.ifr_ifindex;
+                ok = ioctl(sock, SIOCADDRT, &route) == 0;
+            }
+        } else {
+            rtentry route = {};
+            auto* dst = reinterpret_cast<sockaddr_in*>(&route.rt_dst);
+            auto* mask = reinterpret_cast<sockaddr_in*>(&route.rt_genmask);
+            dst->sin_family = AF_INET;
+            mask->sin_family = AF_INET;
+            mask->sin_addr.s_addr = htonl(prefix_len == 0 ? 0 : 0xFFFFFFFFu << (32 - prefix_len));
+            route.rt_flags = RTF_UP;
+            route.rt_dev = const_cast<char*>(name_.c_str());
+            ok = inet_pton(AF_INET, network.c_str(), &dst->sin_addr) == 1 && ioctl(sock, SIOCADDRT, &route) == 0;
+        }
+        close(sock);
+        return ok;
+    }
+
+    int TunDevice::QueueHandle(size_t queue) const {
+        return impl_->fds[queue];
+    }
+
+    void TunDevice::ReadQueue(size_t queue) {
+        int fd = impl_->fds[queue];
+
+        // Reused across calls (one per thread reading a queue); packets are copied out of `buffer`
+        // into pool buffers
+        thread_local std::vector<utils::PacketBuffer> batch;
+        thread_local uint8_t buffer[VIRTIO_NET_HDR_SIZE + MAX_PACKET];
+
+        // Drain what this queue has, up to one batch, then hand it over. A super-segment is split
+        // here, right before the consumer seals it; it may take the batch past MAX_BATCH.
+        uint64_t start = utils::Tsc::Now();
+        size_t batch_size = 0;
+        while (batch_size < MAX_BATCH) {
+            ssize_t size = read(fd, buffer, sizeof(buffer));
+            if (size <= 0) break; // EAGAIN: queue drained
+            batch_size = SplitSuperPacket(buffer, static_cast<size_t>(size), batch, batch_size);
+        }
+        if (batch_size > 0) {
+            utils::StageLatency::Record(utils::Stage::TunRead, utils::Tsc::Now() - start);
+            Deliver(batch, batch_size, queue);
+        }
+    }
+
+    void TunDevice::ReceiveLoop(size_t queue) {
+        int fd = impl_->fds[queue];
+        while (running_) {
+            auto wait = RunTimer(queue);
+            timespec timeout = {static_cast<time_t>(wait.count() / 1000000), static_cast<long>(wait.count() % 1000000) * 1000};
+            pollfd pfd = {fd, POLLIN, 0};
+            if (ppoll(&pfd, 1, &timeout, nullptr) <= 0) continue; // Timeout re-checks running_
+            ReadQueue(queue);
+        }
+    }
+
+}
+
+#endif
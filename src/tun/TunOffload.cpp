@@ -0,0 +1,276 @@
+#include "TunOffload.h"
+#include <cstring>
+
+namespace vpn::tun {
+
+    namespace {
+
+        constexpr uint8_t IPPROTO_TCP_NUMBER = 6;
+        constexpr uint8_t TCP_FIN = 0x01;
+        constexpr uint8_t TCP_PSH = 0x08;
+        constexpr uint8_t TCP_ACK = 0x10;
+        constexpr uint8_t TCP_CWR = 0x80;
+        constexpr uint8_t VIRTIO_NET_HDR_GSO_ECN = 0x80;
+
+        constexpr size_t MAX_IP_PACKET = 65535;
+        constexpr size_t MAX_COALESCED_SEGMENTS = 64;
+
+        uint16_t Load16(const uint8_t* p) { return static_cast<uint16_t>(p[0] << 8 | p[1]); }
+        uint32_t Load32(const uint8_t* p) { return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3]; }
+        void Store16(uint8_t* p, uint16_t v) { p[0] = uint8_t(v >> 8); p[1] = uint8_t(v); }
+        void Store32(uint8_t* p, uint32_t v) { p[0] = uint8_t(v >> 24); p[1] = uint8_t(v >> 16); p[2] = uint8_t(v >> 8); p[3] = uint8_t(v); }
+
+        // Internet checksum: one's complement sum of big-endian 16-bit words
+        uint64_t Sum(const uint8_t* data, size_t length, uint64_t initial = 0) {
+            uint64_t sum = initial;
+            size_t i = 0;
+            for (; i + 1 < length; i += 2) sum += Load16(data + i);
+            if (i < length) sum += uint16_t(data[i] << 8);
+            return sum;
+        }
+
+        uint16_t Fold(uint64_t sum) {
+            while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+            return static_cast<uint16_t>(sum);
+        }
+
+        // TCP/IP packet as far as offloads care. `length` excludes link padding.
+        struct TcpPacket {
+            bool v6 = false;
+            size_t ip_len = 0;
+            size_t tcp_len = 0;
+            size_t length = 0;
+
+            size_t PayloadLength() const { return length - ip_len - tcp_len; }
+        };
+
+        bool ParseTcp(const uint8_t* p, size_t length, TcpPacket& out) {
+            if (length < 20) return false;
+            uint8_t version = p[0] >> 4;
+            if (version == 4) {
+                out.v6 = false;
+                out.ip_len = (p[0] & 0x0F) * 4;
+                out.length = Load16(p + 2);
+                if (out.ip_len < 20 || out.length < out.ip_len || out.length > length) return false;
+                if (p[9] != IPPROTO_TCP_NUMBER) return false;
+                if (Load16(p + 6) & 0x3FFF) return false; // Fragment
+            } else if (version == 6) {
+                if (length < 40) return false;
+                out.v6 = true;
+                out.ip_len = 40;
+                out.length = 40 + Load16(p + 4);
+                if (out.length > length) return false;
+                if (p[6] != IPPROTO_TCP_NUMBER) return false; // Extension headers are not handled
+            } else {
+                return false;
+            }
+
+            if (out.length < out.ip_len + 20) return false;
+            out.tcp_len = (p[out.ip_len + 12] >> 4) * 4;
+            return out.tcp_len >= 20 && out.ip_len + out.tcp_len <= out.length;
+        }
+
+        uint64_t PseudoHeaderSum(const uint8_t* ip, const TcpPacket& tcp, size_t tcp_length) {
+            uint64_t sum = IPPROTO_TCP_NUMBER + tcp_length;
+            return tcp.v6 ? Sum(ip + 8, 32, sum) : Sum(ip + 12, 8, sum);
+        }
+
+        void UpdateIpv4Checksum(uint8_t* ip, size_t ip_len) {
+            ip[10] = ip[11] = 0;
+            Store16(ip + 10, static_cast<uint16_t>(~Fold(Sum(ip, ip_len))));
+        }
+
+        template <typename Buffer>
+        Buffer& Slot(std::vector<Buffer>& out, size_t index) {
+            if (out.size() <= index) out.resize(index + 1);
+            return out[index];
+        }
+
+    }
+
+    size_t SplitSuperPacket(const uint8_t* data, size_t length, std::vector<utils::PacketBuffer>& out, size_t count) {
+        if (length <= VIRTIO_NET_HDR_SIZE) return count;
+        VirtioNetHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        const uint8_t* packet = data + VIRTIO_NET_HDR_SIZE;
+        size_t packet_len = length - VIRTIO_NET_HDR_SIZE;
+
+        if (header.gso_type == VIRTIO_NET_HDR_GSO_NONE) {
+            // The kernel left the L4 checksum to us (partial: the field holds the pseudo-header sum)
+            if (header.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+                size_t field = size_t(header.csum_start) + header.csum_offset;
+                if (field + 2 > packet_len) return count;
+                utils::PacketBuffer& dst = Slot(out, count);
+                dst = utils::PacketBuffer::Copy(packet, packet_len);
+                uint16_t checksum = static_cast<uint16_t>(~Fold(Sum(dst.data() + header.csum_start, packet_len - header.csum_start)));
+                Store16(dst.data() + field, checksum);
+                return count + 1;
+            }
+            Slot(out, count) = utils::PacketBuffer::Copy(packet, packet_len);
+            return count + 1;
+        }
+
+        uint8_t gso_type = header.gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+        if (gso_type != VIRTIO_NET_HDR_GSO_TCPV4 && gso_type != VIRTIO_NET_HDR_GSO_TCPV6) return count;
+
+        TcpPacket tcp;
+        if (!ParseTcp(packet, packet_len, tcp) || tcp.v6 != (gso_type == VIRTIO_NET_HDR_GSO_TCPV6)) return count;
+        size_t mss = header.gso_size;
+        size_t headers = tcp.ip_len + tcp.tcp_len;
+        size_t payload = tcp.PayloadLength();
+        if (mss == 0 || payload == 0) return count;
+
+        uint32_t seq = Load32(packet + tcp.ip_len + 4);
+        uint16_t id = tcp.v6 ? 0 : Load16(packet + 4);
+
+        // Every segment gets a copy of the headers with its own lengths, sequence number and checksums
+        for (size_t offset = 0, index = 0; offset < payload; offset += mss, ++index) {
+            size_t segment = payload - offset < mss ? payload - offset : mss;
+            utils::PacketBuffer& dst = Slot(out, count++);
+            dst = utils::PacketBuffer::Allocate(headers + segment);
+            std::memcpy(dst.data(), packet, headers);
+            std::memcpy(dst.data() + headers, packet + headers + offset, segment);
+
+            uint8_t* ip = dst.data();
+            if (tcp.v6) {
+                Store16(ip + 4, static_cast<uint16_t>(tcp.tcp_len + segment));
+            } else {
+                Store16(ip + 2, static_cast<uint16_t>(headers + segment));
+                Store16(ip + 4, static_cast<uint16_t>(id + index));
+                UpdateIpv4Checksum(ip, tcp.ip_len);
+            }
+
+            uint8_t* th = ip + tcp.ip_len;
+            Store32(th + 4, seq + static_cast<uint32_t>(offset));
+            if (offset + segment < payload) th[13] &= ~(TCP_FIN | TCP_PSH); // Only the last segment ends a push
+            if (offset > 0) th[13] &= ~TCP_CWR;                             // Only the first signals CWR
+
+            th[16] = th[17] = 0;
+            size_t tcp_length = tcp.tcp_len + segment;
+            Store16(th + 16, static_cast<uint16_t>(~Fold(Sum(th, tcp_length, PseudoHeaderSum(ip, tcp, tcp_length)))));
+        }
+        return count;
+    }
+
+    size_t CoalescePackets(const std::vector<utils::PacketBuffer>& packets, std::vector<std::vector<uint8_t>>& out) {
+        // A run of segments being merged into out[index]
+        struct Group {
+            size_t index;
+            TcpPacket tcp;       // Headers of the first segment
+            bool parsed;         // TCP, so later segments of its flow must not overtake it
+            bool open;
+            size_t segments;
+            uint16_t gso_size;
+            uint32_t next_seq;
+            bool push;
+        };
+        thread_local std::vector<Group> groups;
+        groups.clear();
+
+        auto same_flow = [](const uint8_t* a, const TcpPacket& ta, const uint8_t* b, const TcpPacket& tb) {
+            if (ta.v6 != tb.v6 || ta.ip_len != tb.ip_len) return false;
+            bool same_hosts = ta.v6 ? std::memcmp(a + 8, b + 8, 32) == 0 : std::memcmp(a + 12, b + 12, 8) == 0;
+            return same_hosts && std::memcmp(a + ta.ip_len, b + tb.ip_len, 4) == 0; // Ports
+        };
+
+        size_t count = 0;
+        for (const auto& packet : packets) {
+            TcpPacket tcp;
+            bool parsed = ParseTcp(packet.data(), packet.size(), tcp);
+            bool mergeable = parsed && tcp.PayloadLength() > 0 &&
+                             (packet[tcp.ip_len + 13] & ~TCP_PSH) == TCP_ACK; // Plain data segments only
+
+            if (parsed) {
+                // Most recent group of the same flow, if any. Anything that cannot join it ends it,
+                // so segments never move past other packets of their flow.
+                Group* group = nullptr;
+                for (size_t i = groups.size(); i-- > 0;) {
+                    if (!groups[i].parsed) continue;
+                    const uint8_t* first = out[groups[i].index].data() + VIRTIO_NET_HDR_SIZE;
+                    if (same_flow(first, groups[i].tcp, packet.data(), tcp)) {
+                        group = &groups[i];
+                        break;
+                    }
+                }
+
+                if (group && group->open && mergeable) {
+                    std::vector<uint8_t>& merged = out[group->index];
+                    const uint8_t* first = merged.data() + VIRTIO_NET_HDR_SIZE;
+                    const uint8_t* p = packet.data();
+                    size_t payload = tcp.PayloadLength();
+
+                    // In order, same ACK and options, same IP header fields that GSO copies to every segment
+                    bool fits = Load32(p + tcp.ip_len + 4) == group->next_seq &&
+                                tcp.tcp_len == group->tcp.tcp_len &&
+                                std::memcmp(first + tcp.ip_len + 8, p + tcp.ip_len + 8, 4) == 0 &&
+                                std::memcmp(first + tcp.ip_len + 20, p + tcp.ip_len + 20, tcp.tcp_len - 20) == 0 &&
+                                (tcp.v6 ? std::memcmp(first, p, 4) == 0 && first[7] == p[7]
+                                        : first[1] == p[1] && first[8] == p[8] && (first[6] & 0x40) == (p[6] & 0x40)) &&
+                                payload <= group->gso_size &&
+                                merged.size() - VIRTIO_NET_HDR_SIZE + payload <= MAX_IP_PACKET &&
+                                group->segments < MAX_COALESCED_SEGMENTS;
+
+                    if (fits) {
+                        size_t headers = tcp.ip_len + tcp.tcp_len;
+                        merged.insert(merged.end(), p + headers, p + tcp.length);
+                        group->segments++;
+                        group->next_seq += static_cast<uint32_t>(payload);
+                        group->push = (p[tcp.ip_len + 13] & TCP_PSH) != 0;
+                        // A short or pushed segment must stay last
+                        if (payload < group->gso_size || group->push) group->open = false;
+                        continue;
+                    }
+                }
+                if (group) group->open = false;
+            }
+
+            // Start a new output buffer with this packet
+            std::vector<uint8_t>& dst = Slot(out, count);
+            dst.resize(VIRTIO_NET_HDR_SIZE);
+            std::memset(dst.data(), 0, VIRTIO_NET_HDR_SIZE);
+            dst.insert(dst.end(), packet.begin(), mergeable ? packet.begin() + tcp.length : packet.end());
+
+            Group group = {count, tcp, parsed, mergeable, 1, 0, 0, false};
+            if (mergeable) {
+                size_t payload = tcp.PayloadLength();
+                group.gso_size = static_cast<uint16_t>(payload);
+                group.next_seq = Load32(packet.data() + tcp.ip_len + 4) + static_cast<uint32_t>(payload);
+                group.push = (packet[tcp.ip_len + 13] & TCP_PSH) != 0;
+                if (group.push) group.open = false;
+            }
+            groups.push_back(group);
+            count++;
+        }
+
+        // Turn merged runs into super-segments: new lengths, and a partial checksum the kernel
+        // completes per segment when it splits them again
+        for (const Group& group : groups) {
+            if (group.segments < 2) continue;
+            std::vector<uint8_t>& merged = out[group.index];
+            uint8_t* ip = merged.data() + VIRTIO_NET_HDR_SIZE;
+            size_t length = merged.size() - VIRTIO_NET_HDR_SIZE;
+
+            if (group.tcp.v6) {
+                Store16(ip + 4, static_cast<uint16_t>(length - 40));
+            } else {
+                Store16(ip + 2, static_cast<uint16_t>(length));
+                UpdateIpv4Checksum(ip, group.tcp.ip_len);
+            }
+
+            uint8_t* th = ip + group.tcp.ip_len;
+            if (group.push) th[13] |= TCP_PSH;
+            Store16(th + 16, Fold(PseudoHeaderSum(ip, group.tcp, length - group.tcp.ip_len)));
+
+            VirtioNetHeader header;
+            header.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+            header.gso_type = group.tcp.v6 ? VIRTIO_NET_HDR_GSO_TCPV6 : VIRTIO_NET_HDR_GSO_TCPV4;
+            header.hdr_len = static_cast<uint16_t>(group.tcp.ip_len + group.tcp.tcp_len);
+            header.gso_size = group.gso_size;
+            header.csum_start = static_cast<uint16_t>(group.tcp.ip_len);
+            header.csum_offset = 16;
+            std::memcpy(merged.data(), &header, sizeof(header));
+        }
+        return count;
+    }
+
+}
@@ -0,0 +1,223 @@
+#include "TunDevice.h"
+
+#ifdef _WIN32
+
+#include <winsock2.h>
+#include "wintun.h"
+#include "Metrics.h"
+#include "Latency.h"
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+
+namespace vpn::tun {
+
+    namespace {
+        const auto write_drops = utils::Metrics::AddCounter(
+            "vpn_tun_write_drops_total", "Writes to the TUN device dropped because its ring was full");
+    }
+
+    struct TunDevice::Impl {
+        HMODULE wintun_lib = nullptr;
+        WINTUN_ADAPTER_HANDLE adapter = nullptr;
+        WINTUN_SESSION_HANDLE session = nullptr;
+
+        // Function Pointers
+        WINTUN_CREATE_ADAPTER_FUNC* WintunCreateAdapter = nullptr;
+        WINTUN_OPEN_ADAPTER_FUNC* WintunOpenAdapter = nullptr;
+        WINTUN_CLOSE_ADAPTER_FUNC* WintunCloseAdapter = nullptr;
+        WINTUN_DELETE_DRIVER_FUNC* WintunDeleteDriver = nullptr;
+        WINTUN_START_SESSION_FUNC* WintunStartSession = nullptr;
+        WINTUN_END_SESSION_FUNC* WintunEndSession = nullptr;
+        WINTUN_GET_READ_WAIT_EVENT_FUNC* WintunGetReadWaitEvent = nullptr;
+        WINTUN_RECEIVE_PACKET_FUNC* WintunReceivePacket = nullptr;
+        WINTUN_RELEASE_RECEIVE_PACKET_FUNC* WintunReleaseReceivePacket = nullptr;
+        WINTUN_ALLOCATE_SEND_PACKET_FUNC* WintunAllocateSendPacket = nullptr;
+        WINTUN_SEND_PACKET_FUNC* WintunSendPacket = nullptr;
+
+        void LoadWintun() {
+            wintun_lib = LoadLibraryA("wintun.dll");
+            if (!wintun_lib) {
+                throw std::runtime_error("Failed to load wintun.dll");
+            }
+
+            WintunCreateAdapter = (WINTUN_CREATE_ADAPTER_FUNC*)GetProcAddress(wintun_lib, "WintunCreateAdapter");
+            WintunOpenAdapter = (WINTUN_OPEN_ADAPTER_FUNC*)GetProcAddress(wintun_lib, "WintunOpenAdapter");
+            WintunCloseAdapter = (WINTUN_CLOSE_ADAPTER_FUNC*)GetProcAddress(wintun_lib, "WintunCloseAdapter");
+            WintunDeleteDriver = (WINTUN_DELETE_DRIVER_FUNC*)GetProcAddress(wintun_lib, "WintunDeleteDriver");
+            WintunStartSession = (WINTUN_START_SESSION_FUNC*)GetProcAddress(wintun_lib, "WintunStartSession");
+            WintunEndSession = (WINTUN_END_SESSION_FUNC*)GetProcAddress(wintun_lib, "WintunEndSession");
+            WintunGetReadWaitEvent = (WINTUN_GET_READ_WAIT_EVENT_FUNC*)GetProcAddress(wintun_lib, "WintunGetReadWaitEvent");
+            WintunReceivePacket = (WINTUN_RECEIVE_PACKET_FUNC*)GetProcAddress(wintun_lib, "WintunReceivePacket");
+            WintunReleaseReceivePacket = (WINTUN_RELEASE_RECEIVE_PACKET_FUNC*)GetProcAddress(wintun_lib, "WintunReleaseReceivePacket");
+            WintunAllocateSendPacket = (WINTUN_ALLOCATE_SEND_PACKET_FUNC*)GetProcAddress(wintun_lib, "WintunAllocateSendPacket");
+            WintunSendPacket = (WINTUN_SEND_PACKET_FUNC*)GetProcAddress(wintun_lib, "WintunSendPacket");
+
+            if (!WintunCreateAdapter || !WintunOpenAdapter || !WintunCloseAdapter || !WintunDeleteDriver ||
+                !WintunStartSession || !WintunEndSession || !WintunGetReadWaitEvent || !WintunReceivePacket ||
+                !WintunReleaseReceivePacket || !WintunAllocateSendPacket || !WintunSendPacket) {
+                throw std::runtime_error("Failed to load one or more Wintun functions");
+            }
+        }
+    };
+
+    TunDevice::TunDevice(const std::string& name, size_t /*queues*/)
+        : name_(name), impl_(std::make_unique<Impl>()) {
+        impl_->LoadWintun();
+
+        // Create or Open Adapter
+        // We try to open first, if fails, create.
+        // Actually, WintunCreateAdapter will fail if it exists? No, it might create a new one with same name if GUID is null?
+        // WireGuard usually creates one.
+        // Let's try Create.
+        GUID guid;
+        CoCreateGuid(&guid); // Or use a fixed GUID if we want persistence.
+
+        std::wstring wide_name(name_.begin(), name_.end());
+        impl_->adapter = impl_->WintunCreateAdapter(wide_name.c_str(), L"Wintun", &guid);
+        if (!impl_->adapter) {
+            // Try opening?
+            impl_->adapter = impl_->WintunOpenAdapter(wide_name.c_str());
+            if (!impl_->adapter) {
+                throw std::runtime_error("Failed to create or open Wintun adapter");
+            }
+        }
+    }
+
+    TunDevice::~TunDevice() {
+        Stop();
+        if (impl_->adapter) impl_->WintunCloseAdapter(impl_->adapter);
+        if (impl_->wintun_lib) FreeLibrary(impl_->wintun_lib);
+    }
+
+    size_t TunDevice::QueueCount() const {
+        return 1; // One Wintun ring per adapter
+    }
+
+    void TunDevice::OpenQueues() {
+        impl_->session = impl_->WintunStartSession(impl_->adapter, WINTUN_MAX_RING_CAPACITY);
+        if (!impl_->session) {
+            throw std::runtime_error("Failed to start Wintun session");
+        }
+    }
+
+    void TunDevice::CloseQueues() {
+        if (impl_->session) {
+            impl_->WintunEndSession(impl_->session);
+            impl_->session = nullptr;
+        }
+    }
+
+    void TunDevice::Write(const utils::PacketBuffer& packet, size_t /*queue*/) {
+        if (!impl_->session) return;
+
+        DWORD size = static_cast<DWORD>(packet.size());
+        BYTE* buffer = impl_->WintunAllocateSendPacket(impl_->session, size);
+        if (buffer) {
+            memcpy(buffer, packet.data(), size);
+            impl_->WintunSendPacket(impl_->session, buffer);
+        } else {
+            write_drops.Add(); // Ring full: dropped, as a NIC would
+        }
+    }
+
+    void TunDevice::WriteBatch(const std::vector<utils::PacketBuffer>& packets, size_t queue) {
+        for (const auto& packet : packets) Write(packet, queue);
+    }
+
+    bool TunDevice::SetAddress(const std::string& ip, unsigned prefix_len) {
+        if (ip.find(':') != std::string::npos) {
+            std::string command = "netsh interface ipv6 add address \"" + name_ + "\" " + ip + "/" + std::to_string(prefix_len);
+            return system(command.c_str()) == 0;
+        }
+        uint32_t mask = prefix_len == 0 ? 0 : 0xFFFFFFFFu << (32 - prefix_len);
+        std::string netmask = std::to_string(mask >> 24) + "." + std::to_string((mask >> 16) & 0xFF) + "." +
+                              std::to_string((mask >> 8) & 0xFF) + "." + std::to_string(mask & 0xFF);
+        std::string command = "netsh interface ip set address name=\"" + name_ + "\" static " + ip + " " + netmask;
+        return system(command.c_str()) == 0;
+    }
+
+    bool TunDevice::SetMtu(unsigned mtu) {
+        bool ok = true;
+        for (const char* family : {"ipv4", "ipv6"}) {
+            std::string command = std::string("netsh interface ") + family + " set subinterface \"" + name_ + "\" mtu=" + std::to_string(mtu) + " store=active";
+            ok = system(command.c_str()) == 0 && ok;
+        }
+        return ok;
+    }
+
+    bool TunDevice::AddRoute(const std::string& network, unsigned prefix_len) {
+        const char* family = network.find(':') != std::string::npos ? "ipv6" : "ip";
+        std::string command = std::string("netsh interface ") + family + " add route " + network + "/" + std::to_string(prefix_len) + " \"" + name_ + "\"";
+        return system(command.c_str()) == 0;
+    }
+
+    int TunDevice::QueueHandle(size_t) const {
+        return -1; // The ring signals a Windows event, which poll() cannot wait on
+    }
+
+    void TunDevice::ReadQueue(size_t queue) {
+        thread_local std::vector<utils::PacketBuffer> batch;
+        uint64_t start = utils::Tsc::Now();
+        size_t batch_size = 0;
+        while (batch_size < MAX_BATCH) {
+            DWORD size;
+            BYTE* packet = impl_->WintunReceivePacket(impl_->session, &size);
+            if (!packet) break; // ERROR_NO_MORE_ITEMS: ring drained
+            if (batch.size() <= batch_size) batch.emplace_back();
+            batch[batch_size++] = utils::PacketBuffer::Copy(packet, size);
+            impl_->WintunReleaseReceivePacket(impl_->session, packet);
+        }
+        if (batch_size > 0) {
+            utils::StageLatency::Record(utils::Stage::TunRead, utils::Tsc::Now() - start);
+            Deliver(batch, batch_size, queue);
+        }
+    }
+
+    void TunDevice::ReceiveLoop(size_t queue) {
+        HANDLE wait_event = impl_->WintunGetReadWaitEvent(impl_->session);
+
+        // Reused across iterations; packets are copied out of the ring into pool buffers
+        std::vector<utils::PacketBuffer> batch;
+        size_t batch_size = 0;
+        uint64_t batch_start = 0;
+
+        while (running_) {
+            DWORD size;
+            BYTE* packet = impl_->WintunReceivePacket(impl_->session, &size);
+
+            if (packet) {
+                if (batch_size == 0) batch_start = utils::Tsc::Now();
+                if (batch.size() <= batch_size) batch.emplace_back();
+                batch[batch_size++] = utils::PacketBuffer::Copy(packet, size);
+                impl_->WintunReleaseReceivePacket(impl_->session, packet);
+
+                if (batch_size == MAX_BATCH) {
+                    utils::StageLatency::Record(utils::Stage::TunRead, utils::Tsc::Now() - batch_start);
+                    Deliver(batch, batch_size, queue);
+                    batch_size = 0;
+                }
+            } else {
+                DWORD error = GetLastError();
+                if (error == ERROR_NO_MORE_ITEMS) {
+                    // Ring drained: hand over what we have before sleeping
+                    if (batch_size > 0) {
+                        utils::StageLatency::Record(utils::Stage::TunRead, utils::Tsc::Now() - batch_start);
+                        Deliver(batch, batch_size, queue);
+                        batch_size = 0;
+                        continue;
+                    }
+                    // Wait for data, or until the consumer's timer is due (rounded up to whole ms)
+                    auto wait = RunTimer(queue);
+                    WaitForSingleObject(wait_event, static_cast<DWORD>((wait.count() + 999) / 1000));
+                } else {
+                    // Error
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+            }
+        }
+    }
+
+}
+
+#endif
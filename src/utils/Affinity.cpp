@@ -0,0 +1,28 @@
+#include "Affinity.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace vpn::utils {
+
+    bool PinThreadToCore(std::thread& thread, unsigned core) {
+#ifdef _WIN32
+        if (core >= sizeof(DWORD_PTR) * 8) return false;
+        return SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core) != 0;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+        (void)thread;
+        (void)core;
+        return false;
+#endif
+    }
+
+}
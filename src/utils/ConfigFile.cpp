@@ -0,0 +1,91 @@
+#include "ConfigFile.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cerrno>
+
+namespace vpn::utils {
+
+    namespace {
+        std::string Trim(const std::string& text) {
+            size_t begin = text.find_first_not_of(" \t\r");
+            if (begin == std::string::npos) return "";
+            size_t end = text.find_last_not_of(" \t\r");
+            return text.substr(begin, end - begin + 1);
+        }
+    }
+
+    ConfigFile ConfigFile::Load(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) throw std::runtime_error("Cannot open config file " + path);
+        std::stringstream text;
+        text << file.rdbuf();
+        return Parse(text.str(), path);
+    }
+
+    ConfigFile ConfigFile::Parse(const std::string& text, const std::string& origin) {
+        ConfigFile config;
+        config.origin_ = origin;
+        config.sections_.push_back({});
+
+        std::istringstream lines(text);
+        std::string raw;
+        int number = 0;
+        while (std::getline(lines, raw)) {
+            ++number;
+            std::string line = Trim(raw.substr(0, raw.find('#')));
+            if (line.empty()) continue;
+
+            if (line.front() == '[') {
+                if (line.back() != ']') config.Fail(number, "unterminated section header");
+                std::string header = Trim(line.substr(1, line.size() - 2));
+                auto space = header.find_first_of(" \t");
+                Section section;
+                section.name = header.substr(0, space);
+                if (space != std::string::npos) section.argument = Trim(header.substr(space));
+                section.line = number;
+                if (section.name.empty()) config.Fail(number, "empty section header");
+                config.sections_.push_back(std::move(section));
+                continue;
+            }
+
+            auto equals = line.find('=');
+            if (equals == std::string::npos) config.Fail(number, "expected key = value");
+            Setting setting{Trim(line.substr(0, equals)), Trim(line.substr(equals + 1)), number};
+            if (setting.key.empty()) config.Fail(number, "missing key");
+            config.sections_.back().settings.push_back(std::move(setting));
+        }
+        return config;
+    }
+
+    uint64_t ConfigFile::Unsigned(const Setting& setting, uint64_t max) const {
+        const char* begin = setting.value.c_str();
+        char* end = nullptr;
+        errno = 0;
+        unsigned long long value = std::strtoull(begin, &end, 10);
+        if (setting.value.empty() || *end != '\0' || errno == ERANGE || setting.value.front() == '-' || value > max) {
+            Fail(setting.line, setting.key + ": expected a whole number up to " + std::to_string(max));
+        }
+        return value;
+    }
+
+    double ConfigFile::Number(const Setting& setting) const {
+        const char* begin = setting.value.c_str();
+        char* end = nullptr;
+        double value = std::strtod(begin, &end);
+        if (setting.value.empty() || *end != '\0' || value < 0) Fail(setting.line, setting.key + ": expected a non-negative number");
+        return value;
+    }
+
+    bool ConfigFile::Bool(const Setting& setting) const {
+        if (setting.value == "true" || setting.value == "yes" || setting.value == "on") return true;
+        if (setting.value == "false" || setting.value == "no" || setting.value == "off") return false;
+        Fail(setting.line, setting.key + ": expected true or false");
+    }
+
+    void ConfigFile::Fail(int line, const std::string& message) const {
+        throw std::runtime_error(origin_ + ":" + std::to_string(line) + ": " + message);
+    }
+
+}
@@ -0,0 +1,141 @@
+#include "EgressScheduler.h"
+#include <limits>
+
+namespace vpn::utils {
+
+    namespace {
+        constexpr size_t REALTIME = static_cast<size_t>(TrafficClass::Realtime);
+        // Packets per turn for the weighted classes, indexed by class (Realtime is strict priority)
+        constexpr size_t CLASS_WEIGHTS[TRAFFIC_CLASS_COUNT] = {0, 8, 4, 1};
+    }
+
+    bool EgressScheduler::Admit(uint32_t flow, TrafficClass cls) {
+        size_t index = static_cast<size_t>(cls);
+        auto it = classes_[index].flows.find(flow);
+        if (it == classes_[index].flows.end() || it->second.queue.size() < flow_limit_) return true;
+        stats_[index].drops.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void EgressScheduler::Enqueue(uint32_t flow, TrafficClass cls, const std::shared_ptr<TokenBucket>& bucket,
+                                  PacketBuffer&& data, bool traced, int64_t now) {
+        size_t index = static_cast<size_t>(cls);
+        ClassQueue& queue = classes_[index];
+        Flow& entry = queue.flows[flow];
+        if (!entry.active) {
+            entry.bucket = bucket; // A reconnected client brings a new one
+            entry.active = true;
+            queue.active.push_back(flow);
+        }
+        entry.queue.push_back({std::move(data), flow, cls, traced, now});
+        stats_[index].depth.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t EgressScheduler::Dequeue(std::vector<Packet>& out, size_t max, int64_t now) {
+        size_t moved = DequeueClass(REALTIME, out, max, now);
+
+        // Weighted classes take turns until the batch is full or a whole round moves nothing
+        size_t idle_turns = 0;
+        while (moved < max && idle_turns < TRAFFIC_CLASS_COUNT - 1) {
+            size_t budget = CLASS_WEIGHTS[turn_] - turn_sent_;
+            size_t sent = DequeueClass(turn_, out, budget < max - moved ? budget : max - moved, now);
+            moved += sent;
+            turn_sent_ += sent;
+            idle_turns = sent ? 0 : idle_turns + 1;
+
+            if (sent == 0 || turn_sent_ >= CLASS_WEIGHTS[turn_]) {
+                turn_ = turn_ + 1 < TRAFFIC_CLASS_COUNT ? turn_ + 1 : REALTIME + 1;
+                turn_sent_ = 0;
+            }
+        }
+        return moved;
+    }
+
+    size_t EgressScheduler::DequeueClass(size_t cls, std::vector<Packet>& out, size_t max, int64_t now) {
+        ClassQueue& queue = classes_[cls];
+        ClassStats& stats = stats_[cls];
+        size_t moved = 0;
+        size_t idle_turns = 0; // Consecutive turns stopped by a rate limit; a full round of them means every flow is held back
+
+        while (moved < max && !queue.active.empty() && idle_turns < queue.active.size()) {
+            uint32_t id = queue.active.front();
+            Flow& flow = queue.flows.at(id);
+            if (!flow.in_turn) {
+                flow.deficit += quantum_;
+                flow.in_turn = true;
+            }
+
+            bool sent = false;
+            bool limited = false;
+            while (moved < max && !flow.queue.empty()) {
+                size_t size = flow.queue.front().data.size() + overhead_;
+                if (size > flow.deficit) break;
+                if (flow.bucket && !flow.bucket->TryConsume(size, now)) {
+                    limited = true;
+                    break;
+                }
+                flow.deficit -= size;
+
+                uint64_t sojourn = static_cast<uint64_t>(now - flow.queue.front().enqueued);
+                stats.packets.fetch_add(1, std::memory_order_relaxed);
+                stats.depth.fetch_sub(1, std::memory_order_relaxed);
+                stats.sojourn_total_ns.fetch_add(sojourn, std::memory_order_relaxed);
+                if (sojourn > stats.sojourn_max_ns.load(std::memory_order_relaxed)) {
+                    stats.sojourn_max_ns.store(sojourn, std::memory_order_relaxed);
+                }
+
+                out.push_back(std::move(flow.queue.front()));
+                flow.queue.pop_front();
+                moved++;
+                sent = true;
+            }
+
+            if (flow.queue.empty()) {
+                flow.active = false;
+                flow.in_turn = false;
+                flow.deficit = 0;
+                flow.bucket.reset();
+                queue.active.pop_front();
+                idle_turns = 0;
+                continue;
+            }
+            if (moved == max && !limited && flow.queue.front().data.size() + overhead_ <= flow.deficit) {
+                break; // Batch full mid-turn: the flow resumes its turn on the next call
+            }
+
+            // Turn over: to the back of the round. A rate-limited flow does not bank deficit while it
+            // waits, or it would burst past the others once its bucket refills; it keeps just enough
+            // that its next turn goes straight to the bucket check.
+            if (limited) {
+                size_t head = flow.queue.front().data.size() + overhead_;
+                flow.deficit = head > quantum_ ? head - quantum_ : 0;
+            }
+            flow.in_turn = false;
+            queue.active.pop_front();
+            queue.active.push_back(id);
+            idle_turns = limited && !sent ? idle_turns + 1 : 0;
+        }
+        return moved;
+    }
+
+    int64_t EgressScheduler::NextReadyAt() const {
+        int64_t next = std::numeric_limits<int64_t>::max();
+        for (const auto& queue : classes_) {
+            for (const auto& [id, flow] : queue.flows) {
+                if (!flow.active) continue;
+                if (!flow.bucket || flow.bucket->Unlimited()) return 0;
+                int64_t ready = flow.bucket->ReadyAt(flow.queue.front().data.size() + overhead_);
+                if (ready < next) next = ready;
+            }
+        }
+        return next;
+    }
+
+    bool EgressScheduler::Empty() const {
+        for (const auto& queue : classes_) {
+            if (!queue.active.empty()) return false;
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,119 @@
+#include "EventLoop.h"
+#include <atomic>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+namespace vpn::utils {
+
+    namespace {
+
+        // Batched receives (recvmmsg where available), one sendto per reply; poll() to multiplex
+        // the sockets and descriptors, wait for the timer and notice Stop().
+        class BlockingEventLoop : public EventLoop {
+        public:
+            void AddSocket(UdpSocket& socket, DatagramHandler handler) override {
+                sockets_.push_back({&socket, std::move(handler)});
+            }
+
+            void AddReadable(int fd, ReadableHandler handler) override {
+                readables_.push_back({fd, std::move(handler)});
+            }
+
+            void SendTo(UdpSocket& socket, const Endpoint& dest, const std::vector<uint8_t>& data) override {
+                socket.SendTo(dest, data);
+                Count(stats_.packets_sent);
+                Count(stats_.syscalls);
+            }
+
+            void Run() override {
+                // One batch worth of receive buffers, reused for every call
+                constexpr size_t BATCH = 32;
+                constexpr size_t BUFFER_SIZE = 65535;
+                std::vector<uint8_t> arena(BATCH * BUFFER_SIZE);
+                Datagram batch[BATCH];
+                for (size_t i = 0; i < BATCH; ++i) {
+                    batch[i].data = arena.data() + i * BUFFER_SIZE;
+                    batch[i].capacity = BUFFER_SIZE;
+                }
+
+                // Sockets first, then the other descriptors
+                std::vector<pollfd> fds;
+                for (auto& entry : sockets_) fds.push_back({entry.socket->Handle(), POLLIN, 0});
+                for (auto& entry : readables_) fds.push_back({static_cast<decltype(pollfd::fd)>(entry.fd), POLLIN, 0});
+
+                while (running_) {
+                    auto wait = NextWait();
+#ifdef _WIN32
+                    int ready = WSAPoll(fds.data(), (ULONG)fds.size(), static_cast<INT>((wait.count() + 999) / 1000));
+#elif !defined(__linux__)
+                    int ready = poll(fds.data(), fds.size(), static_cast<int>((wait.count() + 999) / 1000));
+#else
+                    timespec timeout = {static_cast<time_t>(wait.count() / 1000000), static_cast<long>(wait.count() % 1000000) * 1000};
+                    int ready = ppoll(fds.data(), fds.size(), &timeout, nullptr);
+#endif
+                    Count(stats_.syscalls);
+                    if (ready <= 0) continue;
+
+                    for (size_t i = 0; i < sockets_.size(); ++i) {
+                        if (!(fds[i].revents & POLLIN)) continue;
+
+                        int received = sockets_[i].socket->ReceiveBatch(batch, BATCH);
+                        Count(stats_.syscalls);
+                        if (received <= 0) continue;
+
+                        for (int j = 0; j < received; ++j) {
+                            ForEachSegment(batch[j], [&](const uint8_t* data, size_t length) {
+                                PacketBuffer packet = PacketBuffer::Copy(data, length);
+                                Count(stats_.packets_received);
+                                sockets_[i].handler(packet, batch[j].addr);
+                            });
+                        }
+                    }
+                    for (size_t i = 0; i < readables_.size(); ++i) {
+                        if (fds[sockets_.size() + i].revents & (POLLIN | POLLERR | POLLHUP)) readables_[i].handler();
+                    }
+                    EndBatch();
+                }
+            }
+
+            void Stop() override { running_ = false; }
+
+            const char* Name() const override { return "blocking"; }
+
+        private:
+            struct Entry {
+                UdpSocket* socket;
+                DatagramHandler handler;
+            };
+
+            struct Readable {
+                int fd;
+                ReadableHandler handler;
+            };
+
+            std::vector<Entry> sockets_;
+            std::vector<Readable> readables_;
+            std::atomic<bool> running_ = true; // A Stop() before Run() makes Run() return at once
+        };
+
+    }
+
+    std::unique_ptr<EventLoop> EventLoop::CreateBlocking() {
+        return std::make_unique<BlockingEventLoop>();
+    }
+
+    std::unique_ptr<EventLoop> EventLoop::Create() {
+        // VPN_EVENT_LOOP=blocking forces the blocking backend, to compare against io_uring
+        const char* backend = std::getenv("VPN_EVENT_LOOP");
+        if (backend && std::strcmp(backend, "blocking") == 0) return CreateBlocking();
+
+        if (auto loop = CreateIoUring()) return loop;
+        return CreateBlocking();
+    }
+
+}
@@ -0,0 +1,553 @@
+#include "EventLoop.h"
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+#include <poll.h>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace vpn::utils {
+
+    namespace {
+
+        constexpr unsigned RING_ENTRIES = 256;
+
+        // Receive buffers handed to the kernel up front (provided buffer ring).
+        // Multishot receives pick from it without a syscall per packet.
+        constexpr unsigned RECV_BUFFERS = 512; // Power of two
+        // recvmsg header + address + control + a full GRO aggregate. Pages are only faulted in when
+        // written, so without GRO each buffer costs one page of resident memory.
+        constexpr size_t RECV_BUFFER_SIZE = 68 * 1024;
+        constexpr uint16_t RECV_GROUP = 0;
+
+        // Send slots: a datagram is copied in and stays put until its completion arrives
+        constexpr unsigned SEND_SLOTS = 256;
+        constexpr size_t SEND_SLOT_SIZE = 65536;
+
+        enum class Op : uint64_t { Recv = 1, Send = 2, Wake = 3, Readable = 4, Timer = 5 };
+
+        uint64_t Tag(Op op, uint64_t index) { return (static_cast<uint64_t>(op) << 56) | index; }
+        Op TagOp(uint64_t tag) { return static_cast<Op>(tag >> 56); }
+        uint64_t TagIndex(uint64_t tag) { return tag & ((1ull << 56) - 1); }
+
+        int Setup(unsigned entries, io_uring_params* params) {
+            return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+        }
+
+        int Enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+            return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+        }
+
+        int Register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+            return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+        }
+
+        // Completion-driven loop: one multishot recvmsg per socket keeps delivering datagrams into
+        // the provided buffer ring, sends are queued as SQEs and submitted together with the wait for
+        // the next completions, so a busy loop makes one io_uring_enter per batch instead of one
+        // syscall per packet. Other descriptors (TUN queues) are watched with poll requests and the
+        // timer is a timeout request, so all of them wake the same wait.
+        // Multishot recvmsg needs Linux 6.0. A kernel that has buffer rings (5.19) but rejects it
+        // fails the first receive with EINVAL; the loop then hands everything to the blocking loop.
+        class IoUringEventLoop : public EventLoop {
+        public:
+            IoUringEventLoop() {
+                io_uring_params params = {};
+                ring_fd_ = Setup(RING_ENTRIES, &params);
+                if (ring_fd_ < 0) throw std::runtime_error("io_uring_setup failed");
+                if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+                    close(ring_fd_);
+                    throw std::runtime_error("io_uring too old (no single mmap)");
+                }
+
+                // Submission and completion rings share one mapping
+                ring_size_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+                ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+                if (ring_ == MAP_FAILED) {
+                    close(ring_fd_);
+                    throw std::runtime_error("Failed to map io_uring");
+                }
+
+                sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+                void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+                if (sqes == MAP_FAILED) {
+                    munmap(ring_, ring_size_);
+                    close(ring_fd_);
+                    throw std::runtime_error("Failed to map io_uring SQEs");
+                }
+                sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+                auto* base = static_cast<uint8_t*>(ring_);
+                sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+                sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+                sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+                sq_entries_ = params.sq_entries;
+                sq_array_ = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+                cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+                cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+                cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+                cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+                sq_local_tail_ = *sq_tail_;
+
+                try {
+                    SetupRecvBuffers();
+                    SetupSendSlots();
+                } catch (...) {
+                    Release();
+                    throw;
+                }
+
+                wake_fd_ = eventfd(0, EFD_CLOEXEC);
+            }
+
+            ~IoUringEventLoop() override {
+                Release();
+                if (wake_fd_ >= 0) close(wake_fd_);
+            }
+
+            void AddSocket(UdpSocket& socket, DatagramHandler handler) override {
+                auto source = std::make_unique<Source>();
+                source->socket = &socket;
+                source->handler = std::move(handler);
+                // Multishot recvmsg only looks at the name/control lengths
+                source->msg.msg_namelen = sizeof(Endpoint);
+                if (socket.GroEnabled()) source->msg.msg_controllen = CMSG_SPACE(sizeof(int));
+                sources_.push_back(std::move(source));
+            }
+
+            void AddReadable(int fd, ReadableHandler handler) override {
+                readables_.push_back({fd, std::move(handler)});
+            }
+
+            void SendTo(UdpSocket& socket, const Endpoint& dest, const std::vector<uint8_t>& data) override {
+                if (EventLoop* fallback = fallback_.load(std::memory_order_relaxed)) {
+                    fallback->SendTo(socket, dest, data);
+                    return;
+                }
+                if (data.size() > SEND_SLOT_SIZE) return;
+                if (free_slots_.empty()) {
+                    // All slots in flight: wait for some to complete
+                    SubmitAndWait(1);
+                    ReapCompletions();
+                    if (free_slots_.empty()) return;
+                }
+
+                unsigned index = free_slots_.back();
+                free_slots_.pop_back();
+                SendSlot& slot = send_slots_[index];
+
+                std::memcpy(slot.data, data.data(), data.size());
+                slot.dest = dest;
+                slot.iov.iov_base = slot.data;
+                slot.iov.iov_len = data.size();
+                slot.msg = {};
+                slot.msg.msg_name = &slot.dest;
+                slot.msg.msg_namelen = sizeof(slot.dest);
+                slot.msg.msg_iov = &slot.iov;
+                slot.msg.msg_iovlen = 1;
+
+                io_uring_sqe* sqe = GetSqe();
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = socket.Handle();
+                sqe->addr = reinterpret_cast<uint64_t>(&slot.msg);
+                sqe->len = 1;
+                sqe->user_data = Tag(Op::Send, index);
+                // Not submitted yet: goes out with the next batch
+            }
+
+            void Run() override {
+                for (size_t i = 0; i < sources_.size(); ++i) ArmRecv(i);
+                for (size_t i = 0; i < readables_.size(); ++i) ArmReadable(i);
+                ArmWake();
+
+                while (running_) {
+                    // Without a timer only a completion (or Stop) ends the wait
+                    bool wait = !timer_ || ArmTimer();
+                    SubmitAndWait(wait ? 1 : 0);
+                    ReapCompletions();
+                    EndBatch();
+                    if (multishot_rejected_) {
+                        RunBlocking();
+                        return;
+                    }
+                }
+            }
+
+            void Stop() override {
+                running_ = false;
+                uint64_t one = 1;
+                if (wake_fd_ >= 0) (void)!write(wake_fd_, &one, sizeof(one));
+                if (EventLoop* fallback = fallback_.load()) fallback->Stop();
+            }
+
+            const char* Name() const override {
+                EventLoop* fallback = fallback_.load();
+                return fallback ? fallback->Name() : "io_uring";
+            }
+
+        private:
+            struct Source {
+                UdpSocket* socket;
+                DatagramHandler handler;
+                msghdr msg = {};
+            };
+
+            struct SendSlot {
+                uint8_t* data;
+                Endpoint dest;
+                iovec iov;
+                msghdr msg;
+            };
+
+            void SetupRecvBuffers() {
+                recv_ring_size_ = RECV_BUFFERS * sizeof(io_uring_buf);
+                void* ring = mmap(nullptr, recv_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (ring == MAP_FAILED) throw std::runtime_error("Failed to allocate buffer ring");
+                recv_ring_ = static_cast<io_uring_buf_ring*>(ring);
+
+                recv_buffers_size_ = RECV_BUFFERS * RECV_BUFFER_SIZE;
+                void* buffers = mmap(nullptr, recv_buffers_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (buffers == MAP_FAILED) throw std::runtime_error("Failed to allocate receive buffers");
+                recv_buffers_ = static_cast<uint8_t*>(buffers);
+
+                io_uring_buf_reg reg = {};
+                reg.ring_addr = reinterpret_cast<uint64_t>(recv_ring_);
+                reg.ring_entries = RECV_BUFFERS;
+                reg.bgid = RECV_GROUP;
+                if (Register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+                    throw std::runtime_error("Failed to register buffer ring");
+                }
+
+                for (unsigned bid = 0; bid < RECV_BUFFERS; ++bid) AddRecvBuffer(static_cast<uint16_t>(bid));
+                PublishRecvBuffers();
+            }
+
+            void SetupSendSlots() {
+                send_slab_size_ = SEND_SLOTS * SEND_SLOT_SIZE;
+                void* slab = mmap(nullptr, send_slab_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (slab == MAP_FAILED) throw std::runtime_error("Failed to allocate send slab");
+                send_slab_ = static_cast<uint8_t*>(slab);
+
+                send_slots_.resize(SEND_SLOTS);
+                for (unsigned i = 0; i < SEND_SLOTS; ++i) {
+                    send_slots_[i].data = send_slab_ + i * SEND_SLOT_SIZE;
+                    free_slots_.push_back(SEND_SLOTS - 1 - i);
+                }
+            }
+
+            void Release() {
+                if (send_slab_) munmap(send_slab_, send_slab_size_);
+                if (recv_buffers_) munmap(recv_buffers_, recv_buffers_size_);
+                if (recv_ring_) munmap(recv_ring_, recv_ring_size_);
+                if (sqes_) munmap(sqes_, sqes_size_);
+                if (ring_) munmap(ring_, ring_size_);
+                if (ring_fd_ >= 0) close(ring_fd_);
+                send_slab_ = nullptr;
+                recv_buffers_ = nullptr;
+                recv_ring_ = nullptr;
+                sqes_ = nullptr;
+                ring_ = nullptr;
+                ring_fd_ = -1;
+            }
+
+            void AddRecvBuffer(uint16_t bid) {
+                // Index the entries by hand: in C++ the header's flexible-array member sits at the wrong offset
+                auto* entries = reinterpret_cast<io_uring_buf*>(recv_ring_);
+                io_uring_buf& buf = entries[recv_local_tail_ & (RECV_BUFFERS - 1)];
+                buf.addr = reinterpret_cast<uint64_t>(recv_buffers_ + static_cast<size_t>(bid) * RECV_BUFFER_SIZE);
+                buf.len = RECV_BUFFER_SIZE;
+                buf.bid = bid;
+                recv_local_tail_++;
+            }
+
+            void PublishRecvBuffers() {
+                std::atomic_ref<uint16_t>(recv_ring_->tail).store(recv_local_tail_, std::memory_order_release);
+            }
+
+            io_uring_sqe* GetSqe() {
+                unsigned head = std::atomic_ref<unsigned>(*sq_head_).load(std::memory_order_acquire);
+                if (sq_local_tail_ - head >= sq_entries_) {
+                    // Ring full: push what we have to the kernel first
+                    Submit();
+                    head = std::atomic_ref<unsigned>(*sq_head_).load(std::memory_order_acquire);
+                    if (sq_local_tail_ - head >= sq_entries_) throw std::runtime_error("io_uring submission queue full");
+                }
+
+                unsigned index = sq_local_tail_ & sq_mask_;
+                io_uring_sqe* sqe = &sqes_[index];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sq_array_[index] = index;
+                sq_local_tail_++;
+                pending_++;
+                return sqe;
+            }
+
+            void Submit() {
+                std::atomic_ref<unsigned>(*sq_tail_).store(sq_local_tail_, std::memory_order_release);
+                if (pending_ == 0) return;
+                int ret = Enter(ring_fd_, pending_, 0, 0);
+                Count(stats_.syscalls);
+                if (ret > 0) pending_ -= std::min<unsigned>(pending_, static_cast<unsigned>(ret));
+            }
+
+            // Submit everything queued and wait for completions, in one syscall
+            void SubmitAndWait(unsigned min_complete) {
+                std::atomic_ref<unsigned>(*sq_tail_).store(sq_local_tail_, std::memory_order_release);
+
+                // Completions already waiting: only submit
+                unsigned head = std::atomic_ref<unsigned>(*cq_head_).load(std::memory_order_relaxed);
+                unsigned tail = std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+                if (head != tail) min_complete = 0;
+                if (min_complete == 0 && pending_ == 0) return;
+
+                int ret = Enter(ring_fd_, pending_, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0);
+                Count(stats_.syscalls);
+                if (ret > 0) pending_ -= std::min<unsigned>(pending_, static_cast<unsigned>(ret));
+            }
+
+            void ArmRecv(size_t source) {
+                io_uring_sqe* sqe = GetSqe();
+                sqe->opcode = IORING_OP_RECVMSG;
+                sqe->fd = sources_[source]->socket->Handle();
+                sqe->addr = reinterpret_cast<uint64_t>(&sources_[source]->msg);
+                sqe->len = 1;
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = RECV_GROUP;
+                sqe->user_data = Tag(Op::Recv, source);
+            }
+
+            void ArmReadable(size_t readable) {
+                io_uring_sqe* sqe = GetSqe();
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = readables_[readable].fd;
+                sqe->poll32_events = POLLIN;
+                sqe->user_data = Tag(Op::Readable, readable);
+            }
+
+            // Arms a timeout for the timer's next deadline unless one no later is pending. Returns
+            // false if the timer is already due, so the caller should not wait at all.
+            bool ArmTimer() {
+                auto wait = NextWait();
+                if (wait.count() == 0) return false;
+                uint64_t deadline = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch() + wait).count());
+                if (timer_deadline_ && timer_deadline_ <= deadline) return true;
+
+                // Read when submitted, so one timespec serves every timeout
+                timer_timeout_.tv_sec = wait.count() / 1000000;
+                timer_timeout_.tv_nsec = (wait.count() % 1000000) * 1000;
+                io_uring_sqe* sqe = GetSqe();
+                sqe->opcode = IORING_OP_TIMEOUT;
+                sqe->addr = reinterpret_cast<uint64_t>(&timer_timeout_);
+                sqe->len = 1;
+                sqe->user_data = Tag(Op::Timer, deadline); // Microseconds fit the 56 bits for millennia
+                timer_deadline_ = deadline;
+                return true;
+            }
+
+            // Everything registered moves to a blocking loop, which runs on this thread from now on
+            void RunBlocking() {
+                auto loop = CreateBlocking();
+                for (auto& source : sources_) loop->AddSocket(*source->socket, source->handler);
+                for (auto& readable : readables_) loop->AddReadable(readable.fd, readable.handler);
+                loop->SetBatchEndHandler(batch_end_);
+                loop->SetTimerHandler(timer_);
+                fallback_owner_ = std::move(loop);
+                fallback_.store(fallback_owner_.get());
+                if (running_) fallback_owner_->Run(); // Stop() from now on also reaches the fallback
+            }
+
+            void ArmWake() {
+                if (wake_fd_ < 0) return;
+                io_uring_sqe* sqe = GetSqe();
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = wake_fd_;
+                sqe->addr = reinterpret_cast<uint64_t>(&wake_value_);
+                sqe->len = sizeof(wake_value_);
+                sqe->user_data = Tag(Op::Wake, 0);
+            }
+
+            void ReapCompletions() {
+                bool recycled = false;
+
+                while (true) {
+                    // Re-read both ends every time: a handler may reap completions itself (see SendTo)
+                    unsigned head = std::atomic_ref<unsigned>(*cq_head_).load(std::memory_order_relaxed);
+                    unsigned tail = std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+                    if (head == tail) break;
+
+                    io_uring_cqe cqe = cqes_[head & cq_mask_];
+                    // Release the CQE slot before running handlers, which may queue more work
+                    std::atomic_ref<unsigned>(*cq_head_).store(head + 1, std::memory_order_release);
+
+                    switch (TagOp(cqe.user_data)) {
+                    case Op::Recv:
+                        recycled |= HandleRecv(cqe);
+                        break;
+                    case Op::Send:
+                        free_slots_.push_back(static_cast<unsigned>(TagIndex(cqe.user_data)));
+                        if (cqe.res >= 0) Count(stats_.packets_sent);
+                        break;
+                    case Op::Wake:
+                        if (running_) ArmWake();
+                        break;
+                    case Op::Readable: {
+                        size_t readable = TagIndex(cqe.user_data);
+                        readables_[readable].handler();
+                        // Single-shot: re-armed after the handler, so whatever it left wakes us again
+                        if (running_ && cqe.res >= 0) ArmReadable(readable);
+                        break;
+                    }
+                    case Op::Timer:
+                        if (TagIndex(cqe.user_data) == timer_deadline_) timer_deadline_ = 0;
+                        break;
+                    }
+                }
+
+                if (recycled) PublishRecvBuffers();
+            }
+
+            // UDP_GRO segment size from the control data the kernel copied ahead of the payload, or 0
+            static uint16_t GroSegmentSize(const uint8_t* control, uint32_t length) {
+                if (length == 0) return 0;
+                msghdr msg = {};
+                msg.msg_control = const_cast<uint8_t*>(control);
+                msg.msg_controllen = length;
+                for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                        int segment_size;
+                        std::memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+                        return segment_size > 0 ? static_cast<uint16_t>(segment_size) : 0;
+                    }
+                }
+                return 0;
+            }
+
+            // Returns true if a buffer went back to the ring
+            bool HandleRecv(const io_uring_cqe& cqe) {
+                size_t source = TagIndex(cqe.user_data);
+                bool recycled = false;
+
+                if (cqe.res >= 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+                    uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                    const uint8_t* buffer = recv_buffers_ + static_cast<size_t>(bid) * RECV_BUFFER_SIZE;
+
+                    // [io_uring_recvmsg_out][name][control][payload]
+                    io_uring_recvmsg_out out;
+                    std::memcpy(&out, buffer, sizeof(out));
+                    const uint8_t* name = buffer + sizeof(out);
+                    const msghdr& msg = sources_[source]->msg;
+                    const uint8_t* control = name + msg.msg_namelen;
+                    const uint8_t* payload = control + msg.msg_controllen;
+
+                    if (!(out.flags & MSG_TRUNC) && out.namelen >= sizeof(Endpoint)) {
+                        Datagram datagram;
+                        datagram.data = const_cast<uint8_t*>(payload);
+                        datagram.length = out.payloadlen;
+                        std::memcpy(&datagram.addr, name, sizeof(datagram.addr));
+                        datagram.segment_size = GroSegmentSize(control, out.controllen);
+
+                        ForEachSegment(datagram, [&](const uint8_t* data, size_t length) {
+                            PacketBuffer packet = PacketBuffer::Copy(data, length);
+                            Count(stats_.packets_received);
+                            sources_[source]->handler(packet, datagram.addr);
+                        });
+                    }
+
+                    AddRecvBuffer(bid);
+                    recycled = true;
+                }
+
+                // Multishot ends on error or when the buffer ring ran dry (-ENOBUFS): re-arm. EINVAL
+                // means the kernel does not do multishot recvmsg at all; re-arming would spin.
+                if (cqe.res == -EINVAL) {
+                    multishot_rejected_ = true;
+                    return recycled;
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE) && running_) ArmRecv(source);
+                return recycled;
+            }
+
+            int ring_fd_ = -1;
+            void* ring_ = nullptr;
+            size_t ring_size_ = 0;
+            io_uring_sqe* sqes_ = nullptr;
+            size_t sqes_size_ = 0;
+
+            unsigned* sq_head_ = nullptr;
+            unsigned* sq_tail_ = nullptr;
+            unsigned sq_mask_ = 0;
+            unsigned sq_entries_ = 0;
+            unsigned* sq_array_ = nullptr;
+            unsigned sq_local_tail_ = 0;
+            unsigned pending_ = 0;
+
+            unsigned* cq_head_ = nullptr;
+            unsigned* cq_tail_ = nullptr;
+            unsigned cq_mask_ = 0;
+            io_uring_cqe* cqes_ = nullptr;
+
+            io_uring_buf_ring* recv_ring_ = nullptr;
+            size_t recv_ring_size_ = 0;
+            uint8_t* recv_buffers_ = nullptr;
+            size_t recv_buffers_size_ = 0;
+            uint16_t recv_local_tail_ = 0;
+
+            uint8_t* send_slab_ = nullptr;
+            size_t send_slab_size_ = 0;
+            std::vector<SendSlot> send_slots_;
+            std::vector<unsigned> free_slots_;
+
+            int wake_fd_ = -1;
+            uint64_t wake_value_ = 0;
+
+            struct Readable {
+                int fd;
+                ReadableHandler handler;
+            };
+
+            __kernel_timespec timer_timeout_ = {};
+            uint64_t timer_deadline_ = 0; // Steady clock, us, of the earliest pending timeout; 0 if none
+
+            std::vector<std::unique_ptr<Source>> sources_;
+            std::vector<Readable> readables_;
+            std::atomic<bool> running_ = true; // A Stop() before Run() makes Run() return at once
+            bool multishot_rejected_ = false;
+            std::unique_ptr<EventLoop> fallback_owner_;
+            std::atomic<EventLoop*> fallback_ = nullptr;
+        };
+
+    }
+
+    std::unique_ptr<EventLoop> EventLoop::CreateIoUring() {
+        try {
+            return std::make_unique<IoUringEventLoop>();
+        } catch (const std::exception&) {
+            return nullptr; // Kernel without io_uring / provided buffer rings, or io_uring disabled
+        }
+    }
+
+}
+
+#else
+
+namespace vpn::utils {
+
+    std::unique_ptr<EventLoop> EventLoop::CreateIoUring() {
+        return nullptr;
+    }
+
+}
+
+#endif
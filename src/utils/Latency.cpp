@@ -0,0 +1,120 @@
+#include "Latency.h"
+#include "Metrics.h"
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace vpn::utils {
+
+    namespace {
+        struct Registry {
+            std::mutex mutex;
+            std::vector<LatencyHistogram*> threads; // STAGE_COUNT histograms each, never freed
+        };
+
+        // Never destroyed: detached threads may still record during exit
+        Registry& Global() {
+            static Registry* registry = new Registry();
+            return *registry;
+        }
+
+        // Quantiles exported per stage
+        constexpr double QUANTILES[] = {0.5, 0.99, 0.999};
+        constexpr const char* QUANTILE_LABELS[] = {"0.5", "0.99", "0.999"};
+
+        const bool registered = [] {
+            for (size_t s = 0; s < STAGE_COUNT; ++s) {
+                auto stage = static_cast<Stage>(s);
+                std::string labels = std::string("stage=\"") + StageName(stage) + "\"";
+                for (size_t q = 0; q < std::size(QUANTILES); ++q) {
+                    double quantile = QUANTILES[q];
+                    Metrics::AddCallback("vpn_stage_latency_seconds", "Time spent in each forwarding stage since startup",
+                                         Metrics::Type::Gauge, labels + ",quantile=\"" + QUANTILE_LABELS[q] + "\"",
+                                         [stage, quantile] { return StageLatency::QuantileNanos(StageLatency::Merge(stage), quantile) / 1e9; });
+                }
+                Metrics::AddCallback("vpn_stage_samples_total", "Timings recorded for each forwarding stage",
+                                     Metrics::Type::Counter, labels, [stage] {
+                                         uint64_t total = 0;
+                                         for (uint64_t count : StageLatency::Merge(stage)) total += count;
+                                         return static_cast<double>(total);
+                                     });
+            }
+            return true;
+        }();
+    }
+
+    double Tsc::NanosPerTick() {
+        static const double nanos_per_tick = [] {
+            auto start_time = std::chrono::steady_clock::now();
+            uint64_t start = Now();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            uint64_t ticks = Now() - start;
+            auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+            return ticks ? static_cast<double>(nanos) / static_cast<double>(ticks) : 1.0;
+        }();
+        return nanos_per_tick;
+    }
+
+    uint64_t LatencyHistogram::BucketMax(size_t bucket) {
+        if (bucket < (1u << SUB_BUCKET_BITS)) return bucket;
+        unsigned top = static_cast<unsigned>(bucket >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1;
+        unsigned shift = top - SUB_BUCKET_BITS;
+        uint64_t low = ((1ull << SUB_BUCKET_BITS) + (bucket & ((1u << SUB_BUCKET_BITS) - 1))) << shift;
+        return low + (1ull << shift) - 1;
+    }
+
+    void LatencyHistogram::AddTo(std::vector<uint64_t>& counts) const {
+        for (size_t i = 0; i < BUCKETS; ++i) counts[i] += counts_[i].load(std::memory_order_relaxed);
+    }
+
+    uint64_t LatencyHistogram::Quantile(const std::vector<uint64_t>& counts, double q) {
+        uint64_t total = 0;
+        for (uint64_t count : counts) total += count;
+        if (!total) return 0;
+
+        // Rank of the quantile, 1-based, rounded up: p50 of 3 samples is the 2nd
+        auto rank = static_cast<uint64_t>(q * static_cast<double>(total) + 0.999999);
+        if (rank < 1) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) return BucketMax(i);
+        }
+        return BucketMax(counts.size() - 1);
+    }
+
+    const char* StageName(Stage stage) {
+        switch (stage) {
+        case Stage::TunRead: return "tun_read";
+        case Stage::Route: return "route";
+        case Stage::Encrypt: return "encrypt";
+        case Stage::Send: return "send";
+        case Stage::SessionLookup: return "session_lookup";
+        case Stage::Decrypt: return "decrypt";
+        case Stage::TunWrite: return "tun_write";
+        }
+        return "unknown";
+    }
+
+    LatencyHistogram* StageLatency::AddThread() {
+        auto* histograms = new LatencyHistogram[STAGE_COUNT];
+        Registry& registry = Global();
+        std::lock_guard lock(registry.mutex);
+        registry.threads.push_back(histograms);
+        return histograms;
+    }
+
+    std::vector<uint64_t> StageLatency::Merge(Stage stage) {
+        std::vector<uint64_t> counts(LatencyHistogram::BUCKETS);
+        Registry& registry = Global();
+        std::lock_guard lock(registry.mutex);
+        for (LatencyHistogram* histograms : registry.threads) histograms[static_cast<size_t>(stage)].AddTo(counts);
+        return counts;
+    }
+
+    double StageLatency::QuantileNanos(const std::vector<uint64_t>& counts, double q) {
+        return static_cast<double>(LatencyHistogram::Quantile(counts, q)) * Tsc::NanosPerTick();
+    }
+
+}
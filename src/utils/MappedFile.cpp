@@ -0,0 +1,123 @@
+#include "MappedFile.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vpn::utils {
+
+#ifdef _WIN32
+
+    MappedFile::MappedFile(const std::string& path, size_t size) : size_(size) {
+        file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            file_ = nullptr;
+            throw std::runtime_error("Failed to create " + path);
+        }
+        Map(true);
+    }
+
+    MappedFile::MappedFile(const std::string& path) {
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            file_ = nullptr;
+            throw std::runtime_error("Failed to open " + path);
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_, &file_size)) {
+            CloseHandle(file_);
+            throw std::runtime_error("Failed to stat " + path);
+        }
+        size_ = static_cast<size_t>(file_size.QuadPart);
+        Map(false);
+    }
+
+    MappedFile::~MappedFile() {
+        if (data_) UnmapViewOfFile(data_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_) CloseHandle(file_);
+    }
+
+    void MappedFile::Map(bool writable) {
+        if (size_ == 0) return; // Nothing to map
+
+        LARGE_INTEGER max_size;
+        max_size.QuadPart = static_cast<LONGLONG>(size_);
+        mapping_ = CreateFileMappingA(file_, NULL, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                      max_size.HighPart, max_size.LowPart, NULL);
+        if (!mapping_) {
+            CloseHandle(file_);
+            throw std::runtime_error("Failed to create file mapping");
+        }
+
+        data_ = static_cast<uint8_t*>(MapViewOfFile(mapping_, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size_));
+        if (!data_) {
+            CloseHandle(mapping_);
+            CloseHandle(file_);
+            throw std::runtime_error("Failed to map file");
+        }
+    }
+
+    void MappedFile::Flush() {
+        if (!data_) return;
+        FlushViewOfFile(data_, size_);
+        FlushFileBuffers(file_);
+    }
+
+#else
+
+    MappedFile::MappedFile(const std::string& path, size_t size) : size_(size) {
+        // Owner-only: mapped files may hold key material
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd_ < 0) throw std::runtime_error("Failed to create " + path);
+
+        if (ftruncate(fd_, static_cast<off_t>(size_)) != 0) {
+            close(fd_);
+            throw std::runtime_error("Failed to size " + path);
+        }
+        Map(true);
+    }
+
+    MappedFile::MappedFile(const std::string& path) {
+        fd_ = open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) throw std::runtime_error("Failed to open " + path);
+
+        struct stat st;
+        if (fstat(fd_, &st) != 0) {
+            close(fd_);
+            throw std::runtime_error("Failed to stat " + path);
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        Map(false);
+    }
+
+    MappedFile::~MappedFile() {
+        if (data_) munmap(data_, size_);
+        if (fd_ >= 0) close(fd_);
+    }
+
+    void MappedFile::Map(bool writable) {
+        if (size_ == 0) return; // Nothing to map
+
+        void* addr = mmap(nullptr, size_, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd_, 0);
+        if (addr == MAP_FAILED) {
+            close(fd_);
+            throw std::runtime_error("Failed to map file");
+        }
+        data_ = static_cast<uint8_t*>(addr);
+    }
+
+    void MappedFile::Flush() {
+        if (!data_) return;
+        msync(data_, size_, MS_SYNC);
+    }
+
+#endif
+
+}
@@ -0,0 +1,101 @@
+#include "Metrics.h"
+#include <mutex>
+#include <vector>
+#include <stdexcept>
+#include <cstdio>
+
+namespace vpn::utils {
+
+    namespace {
+        struct Series {
+            std::string name;
+            std::string help;
+            std::string labels;
+            Metrics::Type type;
+            size_t slot;                  // Unless `read` is set
+            std::function<double()> read;
+        };
+
+        struct Registry {
+            std::mutex mutex;
+            std::vector<Series> series;
+            size_t slots = 0;
+            std::atomic<size_t> next_shard{0};
+        };
+
+        // Never destroyed: detached threads may still count during exit
+        Registry& Global() {
+            static Registry* registry = new Registry();
+            return *registry;
+        }
+
+        size_t Register(Series series, bool needs_slot) {
+            Registry& registry = Global();
+            std::lock_guard lock(registry.mutex);
+            if (needs_slot) {
+                if (registry.slots == Metrics::MAX_SERIES) throw std::runtime_error("Too many metrics: " + series.name);
+                series.slot = registry.slots++;
+            }
+            registry.series.push_back(std::move(series));
+            return registry.series.back().slot;
+        }
+
+        void AppendValue(std::string& out, double value) {
+            char text[32];
+            std::snprintf(text, sizeof(text), "%.17g", value);
+            out += text;
+        }
+    }
+
+    Metrics::Counter Metrics::AddCounter(const std::string& name, const std::string& help, const std::string& labels) {
+        return Counter(Register({name, help, labels, Type::Counter, 0, nullptr}, true));
+    }
+
+    Metrics::Gauge Metrics::AddGauge(const std::string& name, const std::string& help, const std::string& labels) {
+        return Gauge(Register({name, help, labels, Type::Gauge, 0, nullptr}, true));
+    }
+
+    void Metrics::AddCallback(const std::string& name, const std::string& help, Type type,
+                              const std::string& labels, std::function<double()> read) {
+        Register({name, help, labels, type, 0, std::move(read)}, false);
+    }
+
+    size_t Metrics::AssignShard() {
+        return Global().next_shard.fetch_add(1, std::memory_order_relaxed) % MAX_SHARDS;
+    }
+
+    std::string Metrics::Render() {
+        Registry& registry = Global();
+        std::lock_guard lock(registry.mutex);
+
+        // Series of one name together, under one HELP/TYPE, in registration order
+        std::string out;
+        std::vector<bool> done(registry.series.size());
+        for (size_t i = 0; i < registry.series.size(); ++i) {
+            if (done[i]) continue;
+            const Series& first = registry.series[i];
+            out += "# HELP " + first.name + " " + first.help + "\n";
+            out += "# TYPE " + first.name + (first.type == Type::Counter ? " counter\n" : " gauge\n");
+
+            for (size_t j = i; j < registry.series.size(); ++j) {
+                const Series& series = registry.series[j];
+                if (done[j] || series.name != first.name) continue;
+                done[j] = true;
+
+                out += series.name;
+                if (!series.labels.empty()) out += "{" + series.labels + "}";
+                out += " ";
+                if (series.read) {
+                    AppendValue(out, series.read());
+                } else {
+                    int64_t sum = 0;
+                    for (auto& shard : shards_) sum += shard.values[series.slot].load(std::memory_order_relaxed);
+                    out += std::to_string(sum);
+                }
+                out += "\n";
+            }
+        }
+        return out;
+    }
+
+}
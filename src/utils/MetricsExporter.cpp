@@ -0,0 +1,133 @@
+#include "Metrics.h"
+#include <stdexcept>
+#include <cstring>
+
+#ifdef _WIN32
+#define CloseSocket closesocket
+#define poll WSAPoll
+#else
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#define INVALID_SOCKET (-1)
+#define CloseSocket close
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace vpn::utils {
+
+    namespace {
+        constexpr size_t MAX_REQUEST = 4096;
+
+        void SendAll(SocketHandle sock, const std::string& data) {
+            size_t sent = 0;
+            while (sent < data.size()) {
+                int n = static_cast<int>(send(sock, data.data() + sent, static_cast<int>(data.size() - sent), MSG_NOSIGNAL));
+                if (n <= 0) return;
+                sent += static_cast<size_t>(n);
+            }
+        }
+    }
+
+    MetricsExporter::MetricsExporter(const std::string& address) {
+#ifdef _WIN32
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+        sockaddr_storage storage = {};
+        socklen_t length = 0;
+
+        if (address.rfind("unix:", 0) == 0) {
+#ifdef _WIN32
+            throw std::runtime_error("Unix socket metrics are not supported on Windows");
+#else
+            unix_path_ = address.substr(5);
+            auto* addr = reinterpret_cast<sockaddr_un*>(&storage);
+            if (unix_path_.empty() || unix_path_.size() >= sizeof(addr->sun_path)) throw std::runtime_error("Invalid metrics socket path: " + address);
+            addr->sun_family = AF_UNIX;
+            std::memcpy(addr->sun_path, unix_path_.c_str(), unix_path_.size() + 1);
+            length = sizeof(sockaddr_un);
+            unlink(unix_path_.c_str()); // Left behind by an earlier run
+#endif
+        } else {
+            // [v6]:port, v4:port, or a bare port on loopback
+            std::string host = "127.0.0.1";
+            std::string port = address;
+            auto colon = address.rfind(':');
+            if (colon != std::string::npos) {
+                host = address.substr(0, colon);
+                port = address.substr(colon + 1);
+                if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+            }
+
+            auto* v4 = reinterpret_cast<sockaddr_in*>(&storage);
+            auto* v6 = reinterpret_cast<sockaddr_in6*>(&storage);
+            uint16_t port_number = static_cast<uint16_t>(std::stoul(port));
+            if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+                v4->sin_family = AF_INET;
+                v4->sin_port = htons(port_number);
+                length = sizeof(sockaddr_in);
+            } else if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+                v6->sin6_family = AF_INET6;
+                v6->sin6_port = htons(port_number);
+                length = sizeof(sockaddr_in6);
+            } else {
+                throw std::runtime_error("Invalid metrics address: " + address);
+            }
+        }
+
+        listener_ = socket(storage.ss_family, SOCK_STREAM, 0);
+        if (listener_ == INVALID_SOCKET) throw std::runtime_error("Failed to create metrics socket");
+        int on = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+        if (bind(listener_, reinterpret_cast<sockaddr*>(&storage), length) != 0 || listen(listener_, 16) != 0) {
+            CloseSocket(listener_);
+            throw std::runtime_error("Failed to bind metrics address: " + address);
+        }
+
+        thread_ = std::thread(&MetricsExporter::Serve, this);
+    }
+
+    MetricsExporter::~MetricsExporter() {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        CloseSocket(listener_);
+#ifndef _WIN32
+        if (!unix_path_.empty()) unlink(unix_path_.c_str());
+#endif
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    void MetricsExporter::Serve() {
+        pollfd pfd = {listener_, POLLIN, 0};
+        while (running_) {
+            // Wakes every 100ms to notice the destructor
+            if (poll(&pfd, 1, 100) <= 0) continue;
+            SocketHandle client = accept(listener_, nullptr, nullptr);
+            if (client == INVALID_SOCKET) continue;
+
+            // Read the request head and ignore it: every path gets the metrics
+            std::string request;
+            char buffer[1024];
+            pollfd cpfd = {client, POLLIN, 0};
+            while (request.size() < MAX_REQUEST && request.find("\r\n\r\n") == std::string::npos && poll(&cpfd, 1, 1000) > 0) {
+                int n = static_cast<int>(recv(client, buffer, sizeof(buffer), 0));
+                if (n <= 0) break;
+                request.append(buffer, static_cast<size_t>(n));
+            }
+
+            std::string body = Metrics::Render();
+            SendAll(client, "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                            "Connection: close\r\n\r\n" + body);
+            CloseSocket(client);
+        }
+    }
+
+}
@@ -0,0 +1,196 @@
+#include "PacketBuffer.h"
+#include <mutex>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace vpn::utils {
+
+    // Global free list plus one cache per thread. Blocks are linked through Block::next, so moving
+    // them around never allocates.
+    struct PacketPool {
+        using Block = PacketBuffer::Block;
+
+        static constexpr size_t SLAB_BUFFERS = 512; // 1MB per slab
+        static constexpr size_t BATCH = 64;         // Moved between a thread cache and the global list at once
+        static constexpr size_t STORAGE = PacketBuffer::BUFFER_SIZE - PacketBuffer::HEADER_SIZE;
+
+        struct Global {
+            std::mutex mutex;
+            Block* free = nullptr;
+            std::atomic<uint64_t> pooled{0};
+            std::atomic<uint64_t> heap{0};
+        };
+
+        // Trivially destructible, so a buffer released after the thread's flusher ran (by another
+        // thread_local going away) still has somewhere to go
+        struct ThreadCache {
+            Block* free;
+            size_t count;
+        };
+
+        // Returns a thread's cached buffers to the global list when it exits
+        struct CacheFlusher {
+            ~CacheFlusher() {
+                ThreadCache& cache = Cache();
+                while (cache.free) {
+                    Block* chain = cache.free;
+                    cache.count -= Detach(cache.free, BATCH);
+                    GiveBack(chain);
+                }
+            }
+        };
+
+        // Never destroyed: detached threads may still return buffers during exit
+        static Global& Shared() {
+            static Global* global = new Global();
+            return *global;
+        }
+
+        static ThreadCache& Cache() {
+            thread_local constinit ThreadCache cache = {nullptr, 0};
+            return cache;
+        }
+
+        // Cut up to `n` blocks off the front of `list`; the cut chain stays at the old head
+        static size_t Detach(Block*& list, size_t n) {
+            Block* last = list;
+            size_t taken = 1;
+            while (taken < n && last->next) {
+                last = last->next;
+                taken++;
+            }
+            list = last->next;
+            last->next = nullptr;
+            return taken;
+        }
+
+        static void GiveBack(Block* chain) {
+            Block* last = chain;
+            while (last->next) last = last->next;
+            Global& global = Shared();
+            std::lock_guard lock(global.mutex);
+            last->next = global.free;
+            global.free = chain;
+        }
+
+        // Refill an empty thread cache from the global list, carving a new slab if that is empty too
+        static void Refill(ThreadCache& cache) {
+            thread_local CacheFlusher flusher; // Registered with the thread's first buffer
+            (void)flusher;
+
+            Global& global = Shared();
+            {
+                std::lock_guard lock(global.mutex);
+                if (global.free) {
+                    Block* chain = global.free;
+                    cache.count = Detach(global.free, BATCH);
+                    cache.free = chain;
+                    return;
+                }
+            }
+
+            auto* slab = static_cast<uint8_t*>(::operator new(SLAB_BUFFERS * PacketBuffer::BUFFER_SIZE, std::align_val_t(64)));
+            Block* chain = nullptr;
+            for (size_t i = SLAB_BUFFERS; i-- > 0;) {
+                auto* block = new (slab + i * PacketBuffer::BUFFER_SIZE) Block();
+                block->capacity = STORAGE;
+                block->next = chain;
+                chain = block;
+            }
+            global.pooled.fetch_add(SLAB_BUFFERS, std::memory_order_relaxed);
+
+            // Keep one batch, share the rest
+            cache.free = chain;
+            cache.count = Detach(chain, BATCH);
+            GiveBack(chain);
+        }
+
+        static Block* Take(size_t storage) {
+            if (storage > STORAGE) {
+                void* memory = ::operator new(PacketBuffer::HEADER_SIZE + storage, std::align_val_t(64));
+                auto* block = new (memory) Block();
+                block->capacity = static_cast<uint32_t>(storage);
+                block->heap = true;
+                Shared().heap.fetch_add(1, std::memory_order_relaxed);
+                return block;
+            }
+
+            ThreadCache& cache = Cache();
+            if (!cache.free) Refill(cache);
+            Block* block = cache.free;
+            cache.free = block->next;
+            cache.count--;
+            block->next = nullptr;
+            block->refs.store(1, std::memory_order_relaxed);
+            return block;
+        }
+
+        static void Put(Block* block) {
+            if (block->heap) {
+                block->~Block();
+                ::operator delete(block, std::align_val_t(64));
+                return;
+            }
+
+            ThreadCache& cache = Cache();
+            block->next = cache.free;
+            cache.free = block;
+            // Buffers freed on a thread other than the one that took them pile up here: hand a
+            // batch back once the cache holds two
+            if (++cache.count >= 2 * BATCH) {
+                Block* chain = cache.free;
+                cache.count -= Detach(cache.free, BATCH);
+                GiveBack(chain);
+            }
+        }
+    };
+
+    PacketBuffer PacketBuffer::Allocate(size_t length, size_t headroom) {
+        Block* block = PacketPool::Take(headroom + length + TAILROOM);
+        block->offset = static_cast<uint32_t>(headroom);
+        block->length = static_cast<uint32_t>(length);
+        return PacketBuffer(block);
+    }
+
+    PacketBuffer PacketBuffer::Copy(const uint8_t* data, size_t length, size_t headroom) {
+        PacketBuffer buffer = Allocate(length, headroom);
+        if (length) std::memcpy(buffer.data(), data, length);
+        return buffer;
+    }
+
+    void PacketBuffer::Release(Block* block) {
+        PacketPool::Put(block);
+    }
+
+    uint8_t* PacketBuffer::Prepend(size_t n) {
+        if (n > Headroom()) throw std::runtime_error("Packet buffer headroom exhausted");
+        block_->offset -= static_cast<uint32_t>(n);
+        block_->length += static_cast<uint32_t>(n);
+        return data();
+    }
+
+    void PacketBuffer::Consume(size_t n) {
+        if (n > size()) throw std::runtime_error("Packet buffer underflow");
+        block_->offset += static_cast<uint32_t>(n);
+        block_->length -= static_cast<uint32_t>(n);
+    }
+
+    uint8_t* PacketBuffer::Append(size_t n) {
+        if (n > Tailroom()) throw std::runtime_error("Packet buffer tailroom exhausted");
+        uint8_t* tail = data() + block_->length;
+        block_->length += static_cast<uint32_t>(n);
+        return tail;
+    }
+
+    void PacketBuffer::Resize(size_t length) {
+        if (length > size() + Tailroom()) throw std::runtime_error("Packet buffer tailroom exhausted");
+        block_->length = static_cast<uint32_t>(length);
+    }
+
+    PacketBuffer::PoolStats PacketBuffer::Stats() {
+        PacketPool::Global& global = PacketPool::Shared();
+        return {global.pooled.load(std::memory_order_relaxed), global.heap.load(std::memory_order_relaxed)};
+    }
+
+}
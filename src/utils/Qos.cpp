@@ -0,0 +1,82 @@
+#include "Qos.h"
+
+namespace vpn::utils {
+
+    namespace {
+        constexpr uint8_t PROTO_ICMP = 1;
+        constexpr uint8_t PROTO_TCP = 6;
+        constexpr uint8_t PROTO_UDP = 17;
+        constexpr uint8_t PROTO_ICMPV6 = 58;
+        constexpr uint16_t PORT_DNS = 53;
+
+        TrafficClass FromDscp(uint8_t dscp) {
+            switch (dscp) {
+                case 46: case 44: case 40: case 48: case 56: // EF, VOICE-ADMIT, CS5, CS6, CS7
+                    return TrafficClass::Realtime;
+                case 16: case 24: case 32:                   // CS2-CS4
+                case 18: case 20: case 22:                   // AF2x
+                case 26: case 28: case 30:                   // AF3x
+                case 34: case 36: case 38:                   // AF4x
+                    return TrafficClass::Interactive;
+                case 8: case 1:                              // CS1, LE
+                    return TrafficClass::Bulk;
+                default:
+                    return TrafficClass::BestEffort;
+            }
+        }
+
+        // Unmarked traffic: control messages and name lookups are small and latency-bound
+        TrafficClass FromProtocol(uint8_t protocol, const uint8_t* l4, size_t l4_length) {
+            if (protocol == PROTO_ICMP || protocol == PROTO_ICMPV6) return TrafficClass::Realtime;
+            if ((protocol == PROTO_UDP || protocol == PROTO_TCP) && l4 && l4_length >= 4) {
+                uint16_t source = uint16_t(l4[0] << 8 | l4[1]);
+                uint16_t dest = uint16_t(l4[2] << 8 | l4[3]);
+                if (source == PORT_DNS || dest == PORT_DNS) return TrafficClass::Realtime;
+            }
+            return TrafficClass::BestEffort;
+        }
+    }
+
+    const char* TrafficClassName(TrafficClass cls) {
+        switch (cls) {
+            case TrafficClass::Realtime: return "realtime";
+            case TrafficClass::Interactive: return "interactive";
+            case TrafficClass::BestEffort: return "best_effort";
+            case TrafficClass::Bulk: return "bulk";
+        }
+        return "unknown";
+    }
+
+    TrafficClass Classify(const uint8_t* packet, size_t length) {
+        if (length < 1) return TrafficClass::BestEffort;
+
+        if ((packet[0] >> 4) == 4 && length >= 20) {
+            uint8_t dscp = packet[1] >> 2;
+            if (dscp) return FromDscp(dscp);
+            size_t header = size_t(packet[0] & 0x0F) * 4;
+            bool first_fragment = ((packet[6] & 0x1F) | packet[7]) == 0; // Later fragments carry no ports
+            const uint8_t* l4 = first_fragment && header < length ? packet + header : nullptr;
+            return FromProtocol(packet[9], l4, l4 ? length - header : 0);
+        }
+
+        if ((packet[0] >> 4) == 6 && length >= 40) {
+            uint8_t traffic_class = uint8_t((packet[0] & 0x0F) << 4 | packet[1] >> 4);
+            uint8_t dscp = traffic_class >> 2;
+            if (dscp) return FromDscp(dscp);
+            // Extension headers are not walked: such packets fall through to best effort
+            return FromProtocol(packet[6], packet + 40, length - 40);
+        }
+
+        return TrafficClass::BestEffort;
+    }
+
+    uint8_t OuterTos(TrafficClass cls) {
+        switch (cls) {
+            case TrafficClass::Realtime: return 46 << 2;    // EF
+            case TrafficClass::Interactive: return 34 << 2; // AF41
+            case TrafficClass::Bulk: return 8 << 2;         // CS1
+            default: return 0;
+        }
+    }
+
+}
@@ -0,0 +1,109 @@
+#include "Rcu.h"
+#include <mutex>
+#include <vector>
+#include <array>
+#include <stdexcept>
+
+namespace vpn::utils {
+
+    namespace {
+        constexpr uint64_t QUIESCENT = 0;
+
+        struct alignas(64) ReaderSlot {
+            std::atomic<uint64_t> epoch = QUIESCENT; // Epoch observed on entry, or QUIESCENT
+            std::atomic<bool> in_use = false;
+        };
+
+        struct Retired {
+            uint64_t epoch;
+            std::function<void()> deleter;
+        };
+
+        std::atomic<uint64_t> global_epoch = 1;
+        std::array<ReaderSlot, Rcu::MAX_READERS> slots;
+
+        std::mutex retired_mutex;
+        std::vector<Retired> retired;
+
+        // Each thread claims a slot on first use and gives it back on exit
+        struct ThreadSlot {
+            ReaderSlot* slot = nullptr;
+            int depth = 0;
+
+            ThreadSlot() {
+                for (auto& candidate : slots) {
+                    bool expected = false;
+                    if (candidate.in_use.compare_exchange_strong(expected, true)) {
+                        slot = &candidate;
+                        return;
+                    }
+                }
+                throw std::runtime_error("Too many RCU reader threads");
+            }
+
+            ~ThreadSlot() {
+                slot->epoch.store(QUIESCENT, std::memory_order_release);
+                slot->in_use.store(false, std::memory_order_release);
+            }
+        };
+
+        ThreadSlot& CurrentThread() {
+            thread_local ThreadSlot thread_slot;
+            return thread_slot;
+        }
+
+        uint64_t OldestActiveEpoch() {
+            uint64_t oldest = UINT64_MAX;
+            for (auto& slot : slots) {
+                uint64_t epoch = slot.epoch.load(std::memory_order_seq_cst);
+                if (epoch != QUIESCENT && epoch < oldest) oldest = epoch;
+            }
+            return oldest;
+        }
+    }
+
+    Rcu::ReadGuard::ReadGuard() {
+        auto& thread = CurrentThread();
+        outermost_ = thread.depth++ == 0;
+        if (outermost_) {
+            // seq_cst so the writer's scan cannot miss a reader that already loaded the old pointer
+            thread.slot->epoch.store(global_epoch.load(std::memory_order_acquire), std::memory_order_seq_cst);
+        }
+    }
+
+    Rcu::ReadGuard::~ReadGuard() {
+        auto& thread = CurrentThread();
+        --thread.depth;
+        if (outermost_) thread.slot->epoch.store(QUIESCENT, std::memory_order_release);
+    }
+
+    void Rcu::Retire(std::function<void()> deleter) {
+        // Readers that entered before this bump may still see the object
+        uint64_t epoch = global_epoch.fetch_add(1, std::memory_order_seq_cst);
+        {
+            std::lock_guard<std::mutex> lock(retired_mutex);
+            retired.push_back({epoch, std::move(deleter)});
+        }
+        Reclaim();
+    }
+
+    void Rcu::Reclaim() {
+        std::vector<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lock(retired_mutex);
+            uint64_t oldest = OldestActiveEpoch();
+
+            auto it = retired.begin();
+            while (it != retired.end()) {
+                if (it->epoch < oldest) {
+                    ready.push_back(std::move(it->deleter));
+                    it = retired.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        for (auto& deleter : ready) deleter();
+    }
+
+}
@@ -0,0 +1,132 @@
+#include "RoutingTable.h"
+#include <cstdlib>
+#include <new>
+
+namespace vpn::utils {
+
+    namespace {
+        constexpr size_t TBL24_ENTRIES = size_t(1) << 24;
+        constexpr size_t TBL8_GROUP = 256;
+        constexpr size_t MAX_TBL8_GROUPS = size_t(1) << 24;
+
+        constexpr size_t TBL16_ENTRIES = size_t(1) << 16;
+        constexpr size_t MAX_TBL8_GROUPS6 = size_t(1) << 22;
+    }
+
+    RoutingTable::RoutingTable() {
+        // 64MB of address space; calloc maps it zeroed without touching the pages
+        tbl24_ = static_cast<uint32_t*>(std::calloc(TBL24_ENTRIES, sizeof(uint32_t)));
+        if (!tbl24_) throw std::bad_alloc();
+    }
+
+    RoutingTable::~RoutingTable() {
+        std::free(tbl24_);
+    }
+
+    bool RoutingTable::Add(uint32_t prefix, uint8_t prefix_len, uint32_t next_hop) {
+        if (prefix_len > 32 || next_hops_.size() > INDEX_MASK) return false;
+
+        uint32_t host = ToHost(prefix);
+        if (prefix_len < 32) host &= prefix_len == 0 ? 0 : ~0u << (32 - prefix_len);
+
+        uint32_t index = static_cast<uint32_t>(next_hops_.size());
+        next_hops_.push_back(next_hop);
+        uint32_t value = VALID | (uint32_t(prefix_len) << DEPTH_SHIFT) | index;
+
+        if (prefix_len <= 24) {
+            // Covers whole first-level entries; groups under them only take it where no longer prefix sits
+            size_t first = host >> 8;
+            size_t count = size_t(1) << (24 - prefix_len);
+            for (size_t i = first; i < first + count; ++i) {
+                uint32_t& entry = tbl24_[i];
+                if (entry & EXTENDED) {
+                    uint32_t* group = &tbl8_[(entry & INDEX_MASK) * TBL8_GROUP];
+                    for (size_t j = 0; j < TBL8_GROUP; ++j) Apply(group[j], value, prefix_len);
+                } else {
+                    Apply(entry, value, prefix_len);
+                }
+            }
+            return true;
+        }
+
+        // Longer than /24: split the first-level entry into a group that inherits its route
+        uint32_t& entry = tbl24_[host >> 8];
+        if (!(entry & EXTENDED)) {
+            size_t groups = tbl8_.size() / TBL8_GROUP;
+            if (groups >= MAX_TBL8_GROUPS) return false;
+            tbl8_.insert(tbl8_.end(), TBL8_GROUP, entry);
+            entry = EXTENDED | static_cast<uint32_t>(groups);
+        }
+
+        uint32_t* group = &tbl8_[(entry & INDEX_MASK) * TBL8_GROUP];
+        size_t first = host & 0xFF;
+        size_t count = size_t(1) << (32 - prefix_len);
+        for (size_t j = first; j < first + count; ++j) Apply(group[j], value, prefix_len);
+        return true;
+    }
+
+    RoutingTable6::RoutingTable6() : tbl16_(TBL16_ENTRIES, 0) {
+    }
+
+    uint32_t& RoutingTable6::At(size_t position) {
+        return position < TBL16_ENTRIES ? tbl16_[position] : tbl8_[position - TBL16_ENTRIES];
+    }
+
+    std::optional<size_t> RoutingTable6::Extend(size_t position) {
+        uint32_t entry = At(position);
+        if (!(entry & EXTENDED)) {
+            size_t groups = tbl8_.size() / TBL8_GROUP;
+            if (groups >= MAX_TBL8_GROUPS6) return std::nullopt;
+            tbl8_.insert(tbl8_.end(), TBL8_GROUP, entry);
+            entry = EXTENDED | static_cast<uint32_t>(groups);
+            At(position) = entry;
+        }
+        return TBL16_ENTRIES + (entry & INDEX_MASK) * TBL8_GROUP;
+    }
+
+    void RoutingTable6::Cover(size_t position, uint32_t value, uint32_t depth) {
+        uint32_t& entry = At(position);
+        if (!(entry & EXTENDED)) {
+            if (!(entry & VALID) || ((entry & DEPTH_MASK) >> DEPTH_SHIFT) <= depth) entry = value;
+            return;
+        }
+        size_t group = TBL16_ENTRIES + (entry & INDEX_MASK) * TBL8_GROUP;
+        for (size_t j = 0; j < TBL8_GROUP; ++j) Cover(group + j, value, depth);
+    }
+
+    bool RoutingTable6::Add(const uint8_t* prefix, uint8_t prefix_len, uint32_t next_hop) {
+        if (prefix_len > 128 || next_hops_.size() > INDEX_MASK) return false;
+
+        // Host bits cleared
+        uint8_t network[16];
+        for (size_t i = 0; i < 16; ++i) {
+            int bits = int(prefix_len) - int(i) * 8;
+            network[i] = bits >= 8 ? prefix[i] : bits <= 0 ? 0 : prefix[i] & static_cast<uint8_t>(0xFF << (8 - bits));
+        }
+
+        uint32_t index = static_cast<uint32_t>(next_hops_.size());
+        next_hops_.push_back(next_hop);
+        uint32_t value = VALID | (uint32_t(prefix_len) << DEPTH_SHIFT) | index;
+
+        if (prefix_len <= 16) {
+            size_t first = size_t(network[0]) << 8 | network[1];
+            size_t count = size_t(1) << (16 - prefix_len);
+            for (size_t i = first; i < first + count; ++i) Cover(i, value, prefix_len);
+            return true;
+        }
+
+        // Walk down to the group of the byte the prefix ends in, splitting entries on the way
+        size_t last = (prefix_len - 1) / 8;
+        size_t position = size_t(network[0]) << 8 | network[1];
+        for (size_t byte = 2; byte <= last; ++byte) {
+            auto group = Extend(position);
+            if (!group) return false;
+            position = *group + network[byte];
+        }
+
+        size_t count = size_t(1) << ((last + 1) * 8 - prefix_len);
+        for (size_t j = 0; j < count; ++j) Cover(position + j, value, prefix_len);
+        return true;
+    }
+
+}
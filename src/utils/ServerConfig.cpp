@@ -0,0 +1,176 @@
+#include "ServerConfig.h"
+#include "Cluster.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace vpn::utils {
+
+    uint32_t ParseIpv4(const char* ip) {
+        in_addr addr = {};
+        inet_pton(AF_INET, ip, &addr);
+        return addr.s_addr;
+    }
+
+    bool ParseCidr(const std::string& text, Cidr& cidr) {
+        auto slash = text.find('/');
+        if (slash == std::string::npos) return false;
+        std::string address = text.substr(0, slash);
+        cidr.v6 = address.find(':') != std::string::npos;
+        if (inet_pton(cidr.v6 ? AF_INET6 : AF_INET, address.c_str(), cidr.address) != 1) return false;
+        int len = std::atoi(text.c_str() + slash + 1);
+        if (len < 0 || len > (cidr.v6 ? 128 : 32)) return false;
+        cidr.prefix_len = static_cast<uint8_t>(len);
+        return true;
+    }
+
+    std::vector<uint8_t> ParseHex(const std::string& text) {
+        if (text.size() % 2) return {};
+        std::vector<uint8_t> bytes;
+        for (size_t i = 0; i < text.size(); i += 2) {
+            char* end = nullptr;
+            std::string digits = text.substr(i, 2);
+            unsigned long byte = std::strtoul(digits.c_str(), &end, 16);
+            if (*end != '\0' || !std::isxdigit(static_cast<unsigned char>(digits[0]))) return {};
+            bytes.push_back(static_cast<uint8_t>(byte));
+        }
+        return bytes;
+    }
+
+    uint64_t MbitToBytes(double mbit) {
+        return static_cast<uint64_t>(mbit * 1000000 / 8);
+    }
+
+    void ApplyConfigFile(const ConfigFile& file, ServerConfig& config) {
+        for (const auto& section : file.Sections()) {
+            if (section.name.empty()) {
+                for (const auto& setting : section.settings) {
+                    const std::string& key = setting.key;
+                    if (key == "listen_port") config.listen_port = static_cast<uint16_t>(file.Unsigned(setting, 65535));
+                    else if (key == "tun_name") config.tun_name = setting.value;
+                    else if (key == "address_pool") {
+                        Cidr cidr;
+                        if (!ParseCidr(setting.value, cidr) || cidr.v6 || cidr.prefix_len < 16 || cidr.prefix_len > 30) {
+                            file.Fail(setting.line, "address_pool: expected an IPv4 network from /16 to /30");
+                        }
+                        std::memcpy(&config.pool_network, cidr.address, 4);
+                        config.pool_prefix_len = cidr.prefix_len;
+                        if (config.pool_network & ~htonl(0xFFFFFFFFu << (32 - cidr.prefix_len))) file.Fail(setting.line, "address_pool: host bits set");
+                    }
+                    else if (key == "workers") config.workers = static_cast<unsigned>(file.Unsigned(setting, ServerConfig::MAX_WORKERS));
+                    else if (key == "default_rate") config.default_rate = MbitToBytes(file.Number(setting));
+                    else if (key == "hairpin") config.hairpin = file.Bool(setting);
+                    else if (key == "handshake_rate") config.handshake_rate = static_cast<uint32_t>(file.Unsigned(setting, 1000000));
+                    else if (key == "handshake_prefix") config.handshake_prefix = static_cast<uint8_t>(file.Unsigned(setting, 32));
+                    else if (key == "handshake_prefix6") config.handshake_prefix6 = static_cast<uint8_t>(file.Unsigned(setting, 128));
+                    else if (key == "metrics") config.metrics = setting.value;
+                    else if (key == "stats_interval") config.stats_interval = static_cast<unsigned>(file.Unsigned(setting, 86400));
+                    else if (key == "trace_sample") config.trace_sample = static_cast<uint32_t>(file.Unsigned(setting, UINT32_MAX));
+                    else if (key == "trace_vip") {
+                        in_addr vip = {};
+                        if (inet_pton(AF_INET, setting.value.c_str(), &vip) != 1) file.Fail(setting.line, "trace_vip: invalid address");
+                        config.trace_vips.push_back(vip.s_addr);
+                    }
+                    else if (key == "trace_file") config.trace_file = setting.value;
+                    else if (key == "load_balancer") {
+                        Endpoint address;
+                        if (!ParseHostPort(setting.value, address)) file.Fail(setting.line, "load_balancer: expected HOST:PORT");
+                        config.load_balancer = address;
+                    }
+                    else if (key == "cluster_node") config.cluster_node = static_cast<uint32_t>(file.Unsigned(setting, UINT32_MAX));
+                    else if (key == "cluster_key") {
+                        config.cluster_key = ParseHex(setting.value);
+                        if (config.cluster_key.size() != ClusterLink::KEY_LEN) file.Fail(setting.line, "cluster_key: expected 64 hex digits");
+                    }
+                    else file.Fail(setting.line, "unknown setting " + key);
+                }
+            } else if (section.name == "node") {
+                NodeConfig node;
+                ConfigFile::Setting id{"node", section.argument, section.line};
+                uint32_t node_id = static_cast<uint32_t>(file.Unsigned(id, UINT32_MAX));
+                bool has_address = false;
+                for (const auto& setting : section.settings) {
+                    if (setting.key == "address") {
+                        if (!ParseHostPort(setting.value, node.address)) file.Fail(setting.line, "address: expected HOST:PORT");
+                        has_address = true;
+                    }
+                    else if (setting.key == "listen_port") node.listen_port = static_cast<uint16_t>(file.Unsigned(setting, 65535));
+                    else if (setting.key == "tun_name") node.tun_name = setting.value;
+                    else file.Fail(setting.line, "unknown node setting " + setting.key);
+                }
+                if (!has_address) file.Fail(section.line, "[node " + section.argument + "] needs an address");
+                config.nodes[node_id] = node;
+            } else if (section.name == "peer") {
+                in_addr vip = {};
+                if (inet_pton(AF_INET, section.argument.c_str(), &vip) != 1) file.Fail(section.line, "expected [peer VIP]");
+                PeerConfig& peer = config.peers[vip.s_addr];
+                for (const auto& setting : section.settings) {
+                    if (setting.key == "rate") peer.rate = MbitToBytes(file.Number(setting));
+                    else if (setting.key == "route") {
+                        Cidr cidr;
+                        if (!ParseCidr(setting.value, cidr)) file.Fail(setting.line, "route: invalid network " + setting.value);
+                        peer.routes.push_back(setting.value);
+                    }
+                    else file.Fail(setting.line, "unknown peer setting " + setting.key);
+                }
+            } else {
+                file.Fail(section.line, "unknown section [" + section.name + "]");
+            }
+        }
+    }
+
+    void ApplyArguments(const std::vector<std::string>& args, ServerConfig& config) {
+        for (size_t i = 0; i < args.size(); ++i) {
+            const std::string& arg = args[i];
+            bool has_value = i + 1 < args.size();
+            if (arg == "--config" && has_value) ++i; // Read by LoadConfig
+            else if (arg == "--load-balancer" && has_value) {
+                Endpoint address;
+                if (!ParseHostPort(args[++i], address)) throw std::runtime_error("Invalid load balancer address: " + args[i]);
+                config.load_balancer = address;
+            }
+            else if (arg == "--node" && has_value) config.cluster_node = static_cast<uint32_t>(std::stoul(args[++i]));
+            else if (arg == "--workers" && has_value) config.workers = static_cast<unsigned>(std::stoul(args[++i]));
+            else if (arg == "--route" && has_value) {
+                std::string route = args[++i];
+                auto equals = route.find('=');
+                Cidr cidr;
+                if (equals == std::string::npos || !ParseCidr(route.substr(0, equals), cidr)) throw std::runtime_error("Invalid route: " + route);
+                config.peers[ParseIpv4(route.substr(equals + 1).c_str())].routes.push_back(route.substr(0, equals));
+            }
+            else if (arg == "--stats-interval" && has_value) config.stats_interval = static_cast<unsigned>(std::stoul(args[++i]));
+            else if (arg == "--no-hairpin") config.hairpin = false;
+            else if (arg == "--handshake-rate" && has_value) config.handshake_rate = static_cast<uint32_t>(std::stoul(args[++i]));
+            else if (arg == "--metrics" && has_value) config.metrics = args[++i];
+            else if (arg == "--trace-sample" && has_value) config.trace_sample = static_cast<uint32_t>(std::stoul(args[++i]));
+            else if (arg == "--trace-vip" && has_value) config.trace_vips.push_back(ParseIpv4(args[++i].c_str()));
+            else if (arg == "--trace-file" && has_value) config.trace_file = args[++i];
+            else if (arg == "--default-rate" && has_value) config.default_rate = MbitToBytes(std::stod(args[++i]));
+            else if (arg == "--rate" && has_value) {
+                std::string rate = args[++i];
+                auto equals = rate.find('=');
+                if (equals == std::string::npos) throw std::runtime_error("Invalid rate: " + rate);
+                config.peers[ParseIpv4(rate.substr(0, equals).c_str())].rate = MbitToBytes(std::stod(rate.substr(equals + 1)));
+            }
+        }
+    }
+
+    ServerConfig LoadConfig(const std::vector<std::string>& args) {
+        ServerConfig config;
+        for (size_t i = 0; i + 1 < args.size(); ++i) {
+            if (args[i] == "--config") ApplyConfigFile(ConfigFile::Load(args[i + 1]), config);
+        }
+        ApplyArguments(args, config);
+
+        if (config.nodes.empty()) return config;
+        if (!config.cluster_node || !config.nodes.count(*config.cluster_node)) throw std::runtime_error("Cluster: this node's id (cluster_node or --node) is not one of the [node] sections");
+        if (config.cluster_key.empty()) throw std::runtime_error("Cluster: cluster_key is not set");
+        if (config.nodes.rbegin()->first != config.nodes.size() - 1) throw std::runtime_error("Cluster: nodes must be numbered from 0 without gaps");
+        const NodeConfig& self = config.nodes[*config.cluster_node];
+        if (self.listen_port) config.listen_port = *self.listen_port;
+        if (self.tun_name) config.tun_name = *self.tun_name;
+        return config;
+    }
+
+}
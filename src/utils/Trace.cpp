@@ -0,0 +1,375 @@
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace vpn::utils {
+
+    namespace {
+        struct CaptureSlot {
+            uint64_t tsc;
+            uint32_t session;
+            uint16_t length;   // As seen on the wire or the TUN device
+            uint16_t captured; // At most SNAPLEN
+            bool outer;
+            bool outbound;
+            Endpoint peer;
+            uint8_t data[Trace::SNAPLEN];
+        };
+
+        std::vector<uint32_t> selected_sessions; // Set by Configure, read-only afterwards
+        uint16_t outer_local_port = 0;
+
+        // Single writer: fill the slot, then publish it
+        template <typename T, size_t N>
+        T& NextSlot(std::atomic<uint64_t>& head, T (&slots)[N], uint64_t& index) {
+            index = head.load(std::memory_order_relaxed);
+            return slots[index & (N - 1)];
+        }
+
+        // Copies the slots still in the ring. The writer keeps going meanwhile: whatever it reached
+        // before the copy finished, including the slot it may be filling, is discarded as torn.
+        template <typename T, size_t N>
+        void CopyRing(const std::atomic<uint64_t>& head, const T (&slots)[N], std::vector<T>& out) {
+            uint64_t end = head.load(std::memory_order_acquire);
+            uint64_t begin = end > N ? end - N : 0;
+            size_t first = out.size();
+            for (uint64_t i = begin; i < end; ++i) out.push_back(slots[i & (N - 1)]);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t now = head.load(std::memory_order_relaxed);
+            uint64_t valid_from = now + 1 > N ? now + 1 - N : 0;
+            if (valid_from > begin) {
+                size_t torn = static_cast<size_t>(std::min(valid_from, end) - begin);
+                out.erase(out.begin() + first, out.begin() + first + torn);
+            }
+        }
+
+        // pcapng (draft-ietf-opsawg-pcapng): one section, interface 0 carries inner packets and
+        // interface 1 outer ones, both raw IP. Outer packets get synthesized IP and UDP headers.
+        constexpr uint32_t BLOCK_SHB = 0x0A0D0D0A;
+        constexpr uint32_t BLOCK_IDB = 1;
+        constexpr uint32_t BLOCK_EPB = 6;
+        constexpr uint16_t LINKTYPE_RAW = 101;
+        constexpr size_t SHB_SIZE = 28;
+        constexpr size_t IDB_SIZE = 44;
+        constexpr size_t UDP_HEADER = 8;
+
+        size_t Pad4(size_t n) { return (n + 3) & ~size_t(3); }
+
+        bool IsV4(const Endpoint& peer) {
+            return IN6_IS_ADDR_V4MAPPED(&peer.sin6_addr);
+        }
+
+        size_t OuterHeaderSize(const CaptureSlot& slot) {
+            if (!slot.outer) return 0;
+            return (IsV4(slot.peer) ? 20 : 40) + UDP_HEADER;
+        }
+
+        size_t EpbSize(const CaptureSlot& slot) {
+            return 28 + Pad4(OuterHeaderSize(slot) + slot.captured) + 12 + 4;
+        }
+
+        class BlockWriter {
+        public:
+            explicit BlockWriter(uint8_t* out) : out_(out) {}
+
+            void U8(uint8_t v) { *out_++ = v; }
+            void U16(uint16_t v) { Bytes(&v, 2); }
+            void U32(uint32_t v) { Bytes(&v, 4); }
+            void U64(uint64_t v) { Bytes(&v, 8); }
+            void Be16(uint16_t v) { U8(static_cast<uint8_t>(v >> 8)); U8(static_cast<uint8_t>(v)); }
+            void Bytes(const void* data, size_t n) {
+                std::memcpy(out_, data, n);
+                out_ += n;
+            }
+            void Zeros(size_t n) {
+                std::memset(out_, 0, n);
+                out_ += n;
+            }
+
+        private:
+            uint8_t* out_;
+        };
+
+        void WriteInterface(BlockWriter& w, const char* name) {
+            w.U32(BLOCK_IDB);
+            w.U32(IDB_SIZE);
+            w.U16(LINKTYPE_RAW);
+            w.U16(0);
+            w.U32(0); // No snap length limit declared
+            w.U16(2); // if_name
+            w.U16(5);
+            w.Bytes(name, 5);
+            w.Zeros(3);
+            w.U16(9); // if_tsresol: nanoseconds
+            w.U16(1);
+            w.U8(9);
+            w.Zeros(3);
+            w.U32(0); // opt_endofopt
+            w.U32(IDB_SIZE);
+        }
+
+        // IP and UDP headers for an outer packet; checksums are left for the reader to ignore,
+        // except IPv4's, which is cheap
+        void WriteOuterHeaders(BlockWriter& w, const CaptureSlot& slot) {
+            uint16_t udp_length = static_cast<uint16_t>(UDP_HEADER + slot.length);
+            uint16_t peer_port = ntohs(slot.peer.sin6_port);
+            if (IsV4(slot.peer)) {
+                uint8_t header[20] = {0x45, 0, 0, 0, 0, 0, 0x40, 0, 64, 17};
+                uint16_t total = static_cast<uint16_t>(20 + udp_length);
+                header[2] = static_cast<uint8_t>(total >> 8);
+                header[3] = static_cast<uint8_t>(total);
+                std::memcpy(header + (slot.outbound ? 16 : 12), slot.peer.sin6_addr.s6_addr + 12, 4);
+                uint32_t sum = 0;
+                for (size_t i = 0; i < 20; i += 2) sum += (header[i] << 8) | header[i + 1];
+                while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+                header[10] = static_cast<uint8_t>(~sum >> 8);
+                header[11] = static_cast<uint8_t>(~sum);
+                w.Bytes(header, sizeof(header));
+            } else {
+                uint8_t header[40] = {0x60};
+                header[4] = static_cast<uint8_t>(udp_length >> 8);
+                header[5] = static_cast<uint8_t>(udp_length);
+                header[6] = 17;
+                header[7] = 64;
+                std::memcpy(header + (slot.outbound ? 24 : 8), slot.peer.sin6_addr.s6_addr, 16);
+                w.Bytes(header, sizeof(header));
+            }
+            w.Be16(slot.outbound ? outer_local_port : peer_port);
+            w.Be16(slot.outbound ? peer_port : outer_local_port);
+            w.Be16(udp_length);
+            w.U16(0);
+        }
+
+        void WritePacket(BlockWriter& w, const CaptureSlot& slot, uint64_t timestamp_ns) {
+            size_t header = OuterHeaderSize(slot);
+            size_t captured = header + slot.captured;
+            uint32_t size = static_cast<uint32_t>(EpbSize(slot));
+            w.U32(BLOCK_EPB);
+            w.U32(size);
+            w.U32(slot.outer ? 1 : 0);
+            w.U32(static_cast<uint32_t>(timestamp_ns >> 32));
+            w.U32(static_cast<uint32_t>(timestamp_ns));
+            w.U32(static_cast<uint32_t>(captured));
+            w.U32(static_cast<uint32_t>(header + slot.length));
+            if (slot.outer) WriteOuterHeaders(w, slot);
+            w.Bytes(slot.data, slot.captured);
+            w.Zeros(Pad4(captured) - captured);
+            w.U16(2); // epb_flags: direction
+            w.U16(4);
+            w.U32(slot.outbound ? 2 : 1);
+            w.U32(0); // opt_endofopt
+            w.U32(size);
+        }
+
+        // Maps a new file of `size` bytes for writing; unmapped and closed on destruction
+        class MappedFile {
+        public:
+            MappedFile(const std::string& path, size_t size) : size_(size) {
+#ifdef _WIN32
+                file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+                if (file_ == INVALID_HANDLE_VALUE) throw std::runtime_error("Failed to create " + path);
+                mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32),
+                                              static_cast<DWORD>(size), nullptr);
+                if (mapping_) data_ = static_cast<uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, size));
+                if (!data_) {
+                    if (mapping_) CloseHandle(mapping_);
+                    CloseHandle(file_);
+                    throw std::runtime_error("Failed to map " + path);
+                }
+#else
+                fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+                if (fd_ < 0) throw std::runtime_error("Failed to create " + path);
+                void* data = MAP_FAILED;
+                if (ftruncate(fd_, static_cast<off_t>(size)) == 0) data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+                if (data == MAP_FAILED) {
+                    close(fd_);
+                    throw std::runtime_error("Failed to map " + path);
+                }
+                data_ = static_cast<uint8_t*>(data);
+#endif
+            }
+
+            ~MappedFile() {
+#ifdef _WIN32
+                UnmapViewOfFile(data_);
+                CloseHandle(mapping_);
+                CloseHandle(file_);
+#else
+                munmap(data_, size_);
+                close(fd_);
+#endif
+            }
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            uint8_t* Data() const { return data_; }
+
+        private:
+            size_t size_;
+            uint8_t* data_ = nullptr;
+#ifdef _WIN32
+            HANDLE file_ = INVALID_HANDLE_VALUE;
+            HANDLE mapping_ = nullptr;
+#else
+            int fd_ = -1;
+#endif
+        };
+
+        std::string FormatSession(uint32_t session) {
+            if (!session) return "-";
+            char text[INET_ADDRSTRLEN] = {};
+            inet_ntop(AF_INET, &session, text, sizeof(text));
+            return text;
+        }
+    }
+
+    struct TraceRing {
+        std::atomic<uint64_t> event_head{0};
+        TraceEvent events[Trace::EVENT_RING];
+        std::atomic<uint64_t> capture_head{0};
+        CaptureSlot captures[Trace::CAPTURE_RING];
+    };
+
+    namespace {
+        struct Registry {
+            std::mutex mutex;
+            std::vector<TraceRing*> rings; // Never freed
+        };
+
+        // Never destroyed: detached threads may still trace during exit
+        Registry& Global() {
+            static Registry* registry = new Registry();
+            return *registry;
+        }
+    }
+
+    const char* DropReasonName(DropReason reason) {
+        switch (reason) {
+        case DropReason::None: return "-";
+        case DropReason::NoRoute: return "no_route";
+        case DropReason::QueueFull: return "queue_full";
+        case DropReason::NoSession: return "no_session";
+        case DropReason::UnknownPeer: return "unknown_peer";
+        case DropReason::AuthFailed: return "auth_failed";
+        case DropReason::SpoofedSource: return "spoofed_source";
+        case DropReason::RateLimited: return "rate_limited";
+        case DropReason::HandshakeLimited: return "handshake_limited";
+        }
+        return "unknown";
+    }
+
+    void Trace::Configure(uint32_t sample_every, std::vector<uint32_t> sessions, uint16_t local_port) {
+        selected_sessions = std::move(sessions);
+        outer_local_port = local_port;
+        sample_every_.store(sample_every, std::memory_order_relaxed);
+    }
+
+    TraceRing& Trace::ThreadRing() {
+        thread_local constinit TraceRing* ring = nullptr;
+        if (!ring) {
+            ring = new TraceRing();
+            Registry& registry = Global();
+            std::lock_guard lock(registry.mutex);
+            registry.rings.push_back(ring);
+        }
+        return *ring;
+    }
+
+    bool Trace::Selected(uint32_t session) {
+        return selected_sessions.empty() || std::find(selected_sessions.begin(), selected_sessions.end(), session) != selected_sessions.end();
+    }
+
+    void Trace::Event(Stage stage, uint32_t session, size_t size, uint64_t tsc, DropReason reason) {
+        TraceRing& ring = ThreadRing();
+        uint64_t index;
+        TraceEvent& event = NextSlot(ring.event_head, ring.events, index);
+        event = {tsc, session, static_cast<uint16_t>(size), stage, reason};
+        ring.event_head.store(index + 1, std::memory_order_release);
+    }
+
+    void Trace::Capture(uint32_t session, const uint8_t* data, size_t size, bool outer, bool outbound,
+                        const Endpoint& peer, uint64_t tsc) {
+        if (!Selected(session)) return;
+        TraceRing& ring = ThreadRing();
+        uint64_t index;
+        CaptureSlot& slot = NextSlot(ring.capture_head, ring.captures, index);
+        slot.tsc = tsc;
+        slot.session = session;
+        slot.length = static_cast<uint16_t>(size);
+        slot.captured = static_cast<uint16_t>(std::min(size, SNAPLEN));
+        slot.outer = outer;
+        slot.outbound = outbound;
+        slot.peer = peer;
+        std::memcpy(slot.data, data, slot.captured);
+        ring.capture_head.store(index + 1, std::memory_order_release);
+    }
+
+    size_t Trace::Dump(const std::string& path) {
+        std::vector<TraceEvent> events;
+        std::vector<CaptureSlot> captures;
+        {
+            Registry& registry = Global();
+            std::lock_guard lock(registry.mutex);
+            for (TraceRing* ring : registry.rings) {
+                CopyRing(ring->event_head, ring->events, events);
+                CopyRing(ring->capture_head, ring->captures, captures);
+            }
+        }
+        std::sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) { return a.tsc < b.tsc; });
+        std::sort(captures.begin(), captures.end(), [](const CaptureSlot& a, const CaptureSlot& b) { return a.tsc < b.tsc; });
+
+        // Cycle counts to wall-clock nanoseconds, anchored at now
+        double nanos_per_tick = Tsc::NanosPerTick();
+        uint64_t anchor_tsc = Tsc::Now();
+        auto anchor_ns = static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                  std::chrono::system_clock::now().time_since_epoch()).count());
+        auto wall_ns = [&](uint64_t tsc) {
+            return static_cast<uint64_t>(anchor_ns - static_cast<int64_t>(static_cast<double>(anchor_tsc - tsc) * nanos_per_tick));
+        };
+
+        size_t size = SHB_SIZE + 2 * IDB_SIZE;
+        for (const auto& slot : captures) size += EpbSize(slot);
+        {
+            MappedFile file(path, size);
+            BlockWriter w(file.Data());
+            w.U32(BLOCK_SHB);
+            w.U32(SHB_SIZE);
+            w.U32(0x1A2B3C4D); // Byte-order magic
+            w.U16(1);
+            w.U16(0);
+            w.U64(~0ull); // Section length not given
+            w.U32(SHB_SIZE);
+            WriteInterface(w, "inner");
+            WriteInterface(w, "outer");
+            for (const auto& slot : captures) WritePacket(w, slot, wall_ns(slot.tsc));
+        }
+
+        std::ofstream text(path + ".events");
+        if (!text) throw std::runtime_error("Failed to create " + path + ".events");
+        for (const auto& event : events) {
+            uint64_t ns = wall_ns(event.tsc);
+            char time[32];
+            std::snprintf(time, sizeof(time), "%llu.%09llu", static_cast<unsigned long long>(ns / 1000000000),
+                          static_cast<unsigned long long>(ns % 1000000000));
+            text << time << " " << StageName(event.stage) << " " << FormatSession(event.session) << " "
+                 << event.size << " " << DropReasonName(event.reason) << "\n";
+        }
+        return captures.size();
+    }
+
+}
@@ -1,29 +1,96 @@
 #include "UdpSocket.h"
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#include <cerrno>
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define closesocket close
+#endif
 
 namespace vpn::utils {
 
+    bool ParseEndpoint(const std::string& ip, uint16_t port, Endpoint& endpoint) {
+        endpoint = {};
+        endpoint.sin6_family = AF_INET6;
+        endpoint.sin6_port = htons(port);
+        if (inet_pton(AF_INET6, ip.c_str(), &endpoint.sin6_addr) == 1) return true;
+
+        in_addr v4 = {};
+        if (inet_pton(AF_INET, ip.c_str(), &v4) != 1) return false;
+        endpoint.sin6_addr.s6_addr[10] = 0xFF;
+        endpoint.sin6_addr.s6_addr[11] = 0xFF;
+        std::memcpy(&endpoint.sin6_addr.s6_addr[12], &v4, 4);
+        return true;
+    }
+
+    bool ParseHostPort(const std::string& text, Endpoint& endpoint) {
+        auto colon = text.rfind(':');
+        if (colon == std::string::npos || colon + 1 == text.size()) return false;
+        std::string host = text.substr(0, colon);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+        char* end = nullptr;
+        unsigned long port = std::strtoul(text.c_str() + colon + 1, &end, 10);
+        if (*end != '\0' || port == 0 || port > 65535) return false;
+        return ParseEndpoint(host, static_cast<uint16_t>(port), endpoint);
+    }
+
     UdpSocket::UdpSocket() {
+#ifdef _WIN32
         WSADATA wsaData;
         WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
 
-        sock_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        sock_ = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
         if (sock_ == INVALID_SOCKET) {
             throw std::runtime_error("Failed to create socket");
         }
+
+        // Dual-stack: also the default on Linux, but not on Windows
+        int zero = 0;
+        if (setsockopt(sock_, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&zero, sizeof(zero)) == SOCKET_ERROR) {
+            closesocket(sock_);
+            throw std::runtime_error("Failed to enable dual-stack socket");
+        }
     }
 
     UdpSocket::~UdpSocket() {
         if (sock_ != INVALID_SOCKET) closesocket(sock_);
+#ifdef _WIN32
         WSACleanup();
+#endif
     }
 
-    void UdpSocket::Bind(uint16_t port) {
-        sockaddr_in addr = {};
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(port);
+    bool UdpSocket::SupportsReusePort() {
+#ifdef SO_REUSEPORT
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void UdpSocket::Bind(uint16_t port, bool reuse_port) {
+        if (reuse_port) {
+#ifdef SO_REUSEPORT
+            int one = 1;
+            if (setsockopt(sock_, SOL_SOCKET, SO_REUSEPORT, (const char*)&one, sizeof(one)) == SOCKET_ERROR) {
+                throw std::runtime_error("Failed to set SO_REUSEPORT");
+            }
+#else
+            throw std::runtime_error("SO_REUSEPORT is not supported on this platform");
+#endif
+        }
+
+        Endpoint addr = {};
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port);
 
         if (bind(sock_, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
             throw std::runtime_error("Failed to bind socket");
@@ -31,22 +98,237 @@ namespace vpn::utils {
     }
 
     void UdpSocket::SendTo(const std::string& ip, uint16_t port, const std::vector<uint8_t>& data) {
-        sockaddr_in dest = {};
-        dest.sin_family = AF_INET;
-        inet_pton(AF_INET, ip.c_str(), &dest.sin_addr);
-        dest.sin_port = htons(port);
-
+        Endpoint dest;
+        if (!ParseEndpoint(ip, port, dest)) return;
         SendTo(dest, data);
     }
 
-    void UdpSocket::SendTo(const sockaddr_in& dest, const std::vector<uint8_t>& data) {
+    void UdpSocket::SendTo(const Endpoint& dest, const std::vector<uint8_t>& data) {
         sendto(sock_, (const char*)data.data(), (int)data.size(), 0, (sockaddr*)&dest, sizeof(dest));
     }
 
-    int UdpSocket::ReceiveFrom(std::vector<uint8_t>& buffer, sockaddr_in& sender) {
-        int sender_len = sizeof(sender);
+    int UdpSocket::ReceiveFrom(std::vector<uint8_t>& buffer, Endpoint& sender) {
+        socklen_t sender_len = sizeof(sender);
         int bytes = recvfrom(sock_, (char*)buffer.data(), (int)buffer.size(), 0, (sockaddr*)&sender, &sender_len);
         return bytes;
     }
 
+    bool UdpSocket::EnableGso() {
+#if defined(__linux__) && defined(UDP_SEGMENT)
+        // Segment size is set per send; this only checks that the kernel knows the option
+        int zero = 0;
+        gso_enabled_.store(setsockopt(sock_, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0, std::memory_order_relaxed);
+#endif
+        return gso_enabled_.load(std::memory_order_relaxed);
+    }
+
+    size_t UdpSocket::SetReceiveBuffer(size_t bytes) {
+        int size = static_cast<int>(bytes);
+#ifdef SO_RCVBUFFORCE
+        if (setsockopt(sock_, SOL_SOCKET, SO_RCVBUFFORCE, (const char*)&size, sizeof(size)) == SOCKET_ERROR)
+#endif
+            setsockopt(sock_, SOL_SOCKET, SO_RCVBUF, (const char*)&size, sizeof(size));
+        size = 0;
+        socklen_t length = sizeof(size);
+        getsockopt(sock_, SOL_SOCKET, SO_RCVBUF, (char*)&size, &length);
+        return static_cast<size_t>(size);
+    }
+
+    bool UdpSocket::EnableGro() {
+#if defined(__linux__) && defined(UDP_GRO)
+        int one = 1;
+        gro_enabled_ = setsockopt(sock_, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+#endif
+        return gro_enabled_;
+    }
+
+#ifdef __linux__
+    namespace {
+        // Kernel limits for one UDP_SEGMENT send
+        constexpr size_t GSO_MAX_SEGMENTS = 64;
+        constexpr size_t GSO_MAX_BYTES = 65000;
+        constexpr size_t MAX_IOVECS = 1024;
+
+        bool SameEndpoint(const Endpoint& a, const Endpoint& b) {
+            return a.sin6_port == b.sin6_port && std::memcmp(&a.sin6_addr, &b.sin6_addr, sizeof(a.sin6_addr)) == 0;
+        }
+
+        // UDP_SEGMENT and the outer TOS / traffic class
+        union SendControl {
+            char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(int))];
+            cmsghdr align;
+        };
+
+        union GroControl {
+            char buf[CMSG_SPACE(sizeof(int))];
+            cmsghdr align;
+        };
+    }
+#endif
+
+    int UdpSocket::ReceiveBatch(Datagram* datagrams, size_t count) {
+        if (count == 0) return 0;
+#ifdef __linux__
+        if (count > MAX_BATCH) count = MAX_BATCH;
+        mmsghdr msgs[MAX_BATCH];
+        iovec iovs[MAX_BATCH];
+        GroControl controls[MAX_BATCH];
+        for (size_t i = 0; i < count; ++i) {
+            iovs[i] = {datagrams[i].data, datagrams[i].capacity};
+            msgs[i] = {};
+            msgs[i].msg_hdr.msg_name = &datagrams[i].addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(Endpoint);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            if (gro_enabled_) {
+                msgs[i].msg_hdr.msg_control = controls[i].buf;
+                msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].buf);
+            }
+        }
+
+        // Block for the first datagram, then take whatever else is already queued
+        int received = recvmmsg(sock_, msgs, (unsigned)count, MSG_WAITFORONE, nullptr);
+        for (int i = 0; i < received; ++i) {
+            datagrams[i].length = msgs[i].msg_len;
+            datagrams[i].segment_size = 0;
+            if (!gro_enabled_) continue;
+
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    int segment_size;
+                    std::memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+                    if (segment_size > 0 && static_cast<size_t>(segment_size) < datagrams[i].length) {
+                        datagrams[i].segment_size = static_cast<uint16_t>(segment_size);
+                    }
+                }
+            }
+        }
+        return received;
+#else
+        socklen_t sender_len = sizeof(Endpoint);
+        int bytes = recvfrom(sock_, (char*)datagrams[0].data, (int)datagrams[0].capacity, 0, (sockaddr*)&datagrams[0].addr, &sender_len);
+        if (bytes < 0) return bytes;
+        datagrams[0].length = bytes;
+        datagrams[0].segment_size = 0;
+        return 1;
+#endif
+    }
+
+    int UdpSocket::SendBatch(const Datagram* datagrams, size_t count) {
+#ifdef __linux__
+        int total = 0;
+        while (count > 0) {
+            bool gso = gso_enabled_.load(std::memory_order_relaxed);
+            mmsghdr msgs[MAX_BATCH];
+            size_t runs[MAX_BATCH]; // Datagrams carried by each message
+            iovec iovs[MAX_IOVECS];
+            SendControl controls[MAX_BATCH];
+            size_t msg_count = 0;
+            size_t iov_count = 0;
+            size_t next = 0;
+
+            while (next < count && msg_count < MAX_BATCH && iov_count < MAX_IOVECS) {
+                // With GSO, extend the run while datagrams go to the same endpoint with the same size.
+                // Only the last datagram of a run may be shorter.
+                size_t run = 1;
+                size_t segment = datagrams[next].length;
+                size_t bytes = segment;
+                if (gso) {
+                    while (next + run < count && run < GSO_MAX_SEGMENTS && iov_count + run < MAX_IOVECS) {
+                        const Datagram& candidate = datagrams[next + run];
+                        if (!SameEndpoint(candidate.addr, datagrams[next].addr) || candidate.tos != datagrams[next].tos) break;
+                        if (candidate.length > segment || bytes + candidate.length > GSO_MAX_BYTES) break;
+                        bytes += candidate.length;
+                        run++;
+                        if (candidate.length < segment) break;
+                    }
+                }
+
+                for (size_t i = 0; i < run; ++i) {
+                    iovs[iov_count + i] = {datagrams[next + i].data, datagrams[next + i].length};
+                }
+
+                mmsghdr& msg = msgs[msg_count];
+                msg = {};
+                msg.msg_hdr.msg_name = const_cast<Endpoint*>(&datagrams[next].addr);
+                msg.msg_hdr.msg_namelen = sizeof(Endpoint);
+                msg.msg_hdr.msg_iov = &iovs[iov_count];
+                msg.msg_hdr.msg_iovlen = run;
+
+                uint8_t tos = datagrams[next].tos;
+                if (run > 1 || tos) {
+                    char* control = controls[msg_count].buf;
+                    size_t control_len = 0;
+                    if (run > 1) {
+                        auto* cmsg = reinterpret_cast<cmsghdr*>(control);
+                        cmsg->cmsg_level = SOL_UDP;
+                        cmsg->cmsg_type = UDP_SEGMENT;
+                        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                        uint16_t gso_size = static_cast<uint16_t>(segment);
+                        std::memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+                        control_len += CMSG_SPACE(sizeof(uint16_t));
+                    }
+                    if (tos) {
+                        // The kernel reads IP_TOS for IPv4(-mapped) destinations, IPV6_TCLASS otherwise
+                        auto* cmsg = reinterpret_cast<cmsghdr*>(control + control_len);
+                        bool v4 = IN6_IS_ADDR_V4MAPPED(&datagrams[next].addr.sin6_addr);
+                        cmsg->cmsg_level = v4 ? IPPROTO_IP : IPPROTO_IPV6;
+                        cmsg->cmsg_type = v4 ? IP_TOS : IPV6_TCLASS;
+                        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                        int value = tos;
+                        std::memcpy(CMSG_DATA(cmsg), &value, sizeof(value));
+                        control_len += CMSG_SPACE(sizeof(int));
+                    }
+                    msg.msg_hdr.msg_control = control;
+                    msg.msg_hdr.msg_controllen = control_len;
+                }
+
+                runs[msg_count++] = run;
+                iov_count += run;
+                next += run;
+            }
+
+            // sendmmsg stops at the first message that fails and reports the error on the next call,
+            // with that message first
+            int sent = sendmmsg(sock_, msgs, (unsigned)msg_count, 0);
+            if (sent <= 0) {
+                if (errno == EINTR) continue;
+                // EIO: the route's device cannot checksum segmented sends. Fall back to plain sends.
+                if (gso && errno == EIO) {
+                    gso_enabled_.store(false, std::memory_order_relaxed);
+                    continue;
+                }
+                // The socket buffer is full: the rest would fail the same way
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) return total > 0 ? total : -1;
+                // Only this message's destination or size is at fault (ENETUNREACH, EMSGSIZE, ...)
+                datagrams += runs[0];
+                count -= runs[0];
+                continue;
+            }
+
+            size_t done = 0;
+            for (int i = 0; i < sent; ++i) done += runs[i];
+            total += static_cast<int>(done);
+            datagrams += done;
+            count -= done;
+        }
+        return total;
+#else
+        int total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (sendto(sock_, (const char*)datagrams[i].data, (int)datagrams[i].length, 0,
+                       (const sockaddr*)&datagrams[i].addr, sizeof(Endpoint)) == SOCKET_ERROR) {
+#ifdef _WIN32
+                if (WSAGetLastError() == WSAEWOULDBLOCK) break;
+#else
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) break;
+#endif
+                continue; // Only this datagram is at fault
+            }
+            total++;
+        }
+        return total;
+#endif
+    }
+
 }
@@ -0,0 +1,232 @@
+#include "ClusterSessions.h"
+#include "Session.h"
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A session replicated between two server processes over a loopback ClusterLink: node 1 learns
+// the session node 0 established, opens the client's packets that node 0 has not received and
+// refuses the ones it has, and sends ahead of node 0's counter. Then the reason only one node may
+// send to a client: node 0's packets fall behind the client's replay window until node 1's record
+// reaches it, and node 0 then knows node 1 is sending (OtherNodeSending).
+
+using namespace vpn;
+
+namespace {
+    constexpr uint32_t POOL = 0x0000000A;    // 10.0.0.0/24
+    constexpr uint32_t GATEWAY = 0x0100000A; // 10.0.0.1
+    constexpr uint32_t VIP = 0x0200000A;     // 10.0.0.2
+    constexpr uint32_t INDEX = 5;
+    const std::vector<uint8_t> KEY(ClusterLink::KEY_LEN, 0x42);
+
+    int failures = 0;
+
+    void Check(bool ok, const char* what) {
+        if (ok) return;
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+
+    // What ClusterSessions needs of a session's state (see vpn_server's ClientContext)
+    struct Context {
+        Context(std::shared_ptr<Session> s, const utils::Endpoint& ep, uint32_t v)
+            : session(std::move(s)), index(session->Index()), vip(v), last_seen(ClusterSessions<Context>::Now()), endpoint_(ep) {}
+
+        const utils::Endpoint& GetEndpoint() const { return endpoint_; }
+        void SetEndpoint(const utils::Endpoint& endpoint) { endpoint_ = endpoint; }
+
+        std::shared_ptr<Session> session;
+        uint32_t index;
+        uint32_t vip;
+        std::atomic<int64_t> last_seen;
+        std::atomic<bool> authenticated = false;
+        std::atomic<uint64_t> synced_counter = 0;
+        std::atomic<uint64_t> synced_rx = 0;
+        std::atomic<int64_t> synced_seen = 0;
+        uint64_t provisional_rx = 0;
+        uint64_t remote_counter = 0;
+        std::atomic<int64_t> remote_sent = 0;
+        std::weak_ptr<Context> predecessor;
+        std::atomic<bool> taking_over = false;
+
+    private:
+        utils::Endpoint endpoint_;
+    };
+
+    // One server process's cluster state, wired as vpn_server wires it
+    struct Node {
+        ClusterSessions<Context>::Sessions sessions;
+        ClusterSessions<Context>::Clients clients{POOL, 24, GATEWAY};
+        ClusterLink link;
+        ClusterSessions<Context> cluster{link, sessions, clients, nullptr};
+
+        Node(uint32_t self, const std::vector<ClusterLink::Node>& nodes) : link(self, nodes, KEY) {
+            link.SetSessionsHandler([this](uint32_t, const std::vector<SessionRecord>& records) { cluster.OnSessions(records); });
+            link.SetRemovedHandler([this](uint32_t, const std::vector<uint32_t>& indexes) { cluster.OnRemoved(indexes); });
+            link.SetJoinHandler([this](uint32_t node) { cluster.SendAll(node); });
+            link.Start();
+        }
+
+        std::shared_ptr<Context> Find(uint32_t index) const {
+            auto entry = sessions.Find(index);
+            return entry ? *entry : nullptr;
+        }
+    };
+
+    // Polls `done` for up to five seconds
+    template <typename Done>
+    bool WaitFor(Done&& done) {
+        for (int i = 0; i < 500; ++i) {
+            if (done()) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    uint16_t FreePort() {
+        utils::UdpSocket socket;
+        socket.Bind(0);
+        utils::Endpoint bound = {};
+        socklen_t length = sizeof(bound);
+        getsockname(socket.Handle(), reinterpret_cast<sockaddr*>(&bound), &length);
+        return ntohs(bound.sin6_port);
+    }
+
+    // The two processes talk over a socketpair, one message per sealed packet or step
+    void Put(int fd, const std::vector<uint8_t>& message) { send(fd, message.data(), message.size(), 0); }
+
+    std::vector<uint8_t> Take(int fd) {
+        pollfd readable = {fd, POLLIN, 0};
+        if (poll(&readable, 1, 10000) <= 0) return {};
+        std::vector<uint8_t> message(2048);
+        ssize_t length = recv(fd, message.data(), message.size(), 0);
+        message.resize(length > 0 ? size_t(length) : 0);
+        return message;
+    }
+
+    std::vector<uint8_t> Seal(Session& session, uint8_t mark) {
+        const uint8_t payload[20] = {0x45, mark};
+        auto packet = utils::PacketBuffer::Copy(payload, sizeof(payload));
+        session.Encrypt(packet);
+        return std::vector<uint8_t>(packet.begin(), packet.end());
+    }
+
+    bool Open(Session& session, const std::vector<uint8_t>& sealed) {
+        auto packet = utils::PacketBuffer::Copy(sealed.data(), sealed.size());
+        return session.Decrypt(packet);
+    }
+
+    // Node 1: replicates node 0's session and reports what it accepts
+    int RunNode1(int fd, const std::vector<ClusterLink::Node>& nodes) {
+        Node node(1, nodes);
+        std::vector<std::vector<uint8_t>> packets;
+        for (int i = 0; i < 3; ++i) packets.push_back(Take(fd));
+
+        // Node 0 received two packets before its last record
+        std::shared_ptr<Context> ctx;
+        bool synced = WaitFor([&] { return (ctx = node.Find(INDEX)) && ctx->session->RxNext() == 2; });
+        Check(synced, "node 1: session replicated with node 0's receive window");
+        if (!synced) return 1;
+        Check(ctx->vip == VIP && node.clients.Find(VIP) == std::optional(ctx), "node 1: address held by the replica");
+        Check(node.cluster.OtherNodeSending(*ctx), "node 1: node 0 is sending to the client");
+
+        std::vector<uint8_t> results;
+        for (const auto& packet : packets) results.push_back(Open(*ctx->session, packet));
+        results.push_back(Open(*ctx->session, packets[2]));
+        Put(fd, results);
+        Put(fd, Seal(*ctx->session, 1));
+
+        Take(fd); // Node 0 has seen node 1's packet arrive ahead of its own
+        Check(node.cluster.Sync() == 1, "node 1: record for the session it sent on");
+        Take(fd); // Node 0 is done
+        return failures ? 1 : 0;
+    }
+}
+
+int main() {
+    // A counter moved by the margin still names the node that sent last
+    for (uint32_t nodes : {1u, 2u, 3u, 5u}) {
+        Check(ClusterCounterMargin(nodes) >= CLUSTER_COUNTER_MARGIN && ClusterCounterMargin(nodes) % (Session::NONCE_BLOCK * nodes) == 0,
+              "margin in whole stripe rounds");
+        uint64_t counter = 7 * Session::NONCE_BLOCK + 10;
+        Check(Session::CounterStripe(counter + ClusterCounterMargin(nodes), nodes) == Session::CounterStripe(counter, nodes),
+              "stripe kept across the margin");
+    }
+
+    std::vector<ClusterLink::Node> nodes(2);
+    for (uint32_t id = 0; id < 2; ++id) {
+        nodes[id].id = id;
+        utils::ParseEndpoint("127.0.0.1", FreePort(), nodes[id].address);
+    }
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) != 0) {
+        std::cerr << "FAIL: socketpair" << std::endl;
+        return 1;
+    }
+    // Before any thread starts: each process runs its own link
+    pid_t child = fork();
+    if (child == 0) {
+        close(pair[0]);
+        _exit(RunNode1(pair[1], nodes));
+    }
+    close(pair[1]);
+    int fd = pair[0];
+
+    // Node 0 establishes the session and tells node 1
+    Node node(0, nodes);
+    Session client(false);
+    auto server = std::make_shared<Session>(true);
+    server->SetIndex(INDEX);
+    server->SetAddressAllocator([](uint32_t) { return std::optional<protocol::AddressAssignment>({VIP, 24}); });
+    node.cluster.SetNonceStripe(*server);
+    client.HandleHandshake(server->HandleHandshake(client.InitiateHandshake()));
+    Check(client.IsEstablished() && server->IsEstablished(), "handshake");
+    utils::Endpoint endpoint;
+    utils::ParseEndpoint("127.0.0.1", 40000, endpoint);
+    auto ctx = std::make_shared<Context>(server, endpoint, VIP);
+    ctx->authenticated = true;
+    node.sessions.Insert(INDEX, ctx);
+    node.clients.Assign(VIP, ctx);
+    Check(WaitFor([&] { return node.link.Alive(1); }), "node 1 is up");
+    node.cluster.Announce(*ctx);
+
+    // Node 0 receives two of three packets and answers once, then syncs
+    std::vector<std::vector<uint8_t>> packets;
+    for (uint8_t i = 0; i < 3; ++i) packets.push_back(Seal(client, i));
+    Check(Open(*server, packets[0]) && Open(*server, packets[1]), "node 0 opens the client's packets");
+    Check(Open(client, Seal(*server, 0)), "client opens node 0's packet");
+    Check(node.cluster.Sync() == 1, "node 0: record for the changed session");
+    for (const auto& packet : packets) Put(fd, packet);
+
+    // Node 1 refuses what node 0 received, once opens what it did not, and sends ahead of node 0
+    auto results = Take(fd);
+    Check(results == std::vector<uint8_t>({0, 0, 1, 0}), "node 1 refuses replays of what node 0 received");
+    auto from_node1 = Take(fd);
+    Check(!from_node1.empty() && Open(client, from_node1), "client opens node 1's packet");
+    Check(!node.cluster.OtherNodeSending(*ctx), "node 0 has not yet heard node 1 send");
+
+    // Two senders: node 0's counter is now far behind the client's window
+    Check(!Open(client, Seal(*server, 2)), "node 0's next packet is dropped as too old");
+
+    // Until node 1's record moves node 0's counter past its own
+    Put(fd, {1});
+    Check(WaitFor([&] { return server->TxCounter() > ClusterCounterMargin(2); }), "node 0 learns node 1's counter");
+    Check(node.cluster.OtherNodeSending(*ctx), "node 0 knows node 1 is sending");
+    Check(Open(client, Seal(*server, 3)), "node 0's packets accepted again");
+    Check(node.cluster.RecordsSent() >= 2 && node.cluster.RecordsReceived() >= 1, "record counts");
+
+    Put(fd, {2});
+    int status = 0;
+    if (waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "FAIL: node 1" << std::endl;
+        ++failures;
+    }
+    close(fd);
+    return failures ? 1 : 0;
+}
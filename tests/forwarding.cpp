@@ -0,0 +1,151 @@
+#include "ClientRoutes.h"
+#include "Protocol.h"
+#include <iostream>
+#include <cstring>
+#include <set>
+#include <vector>
+
+// The server's choice for a packet opened from a client: the ingress filter drops a spoofed
+// source whether or not the destination is another client, hairpinning re-seals for a connected
+// client with the TTL decremented and the IPv4 checksum still valid, and with hairpinning off
+// (--no-hairpin), for a client that is not connected, or for a packet that would expire, the
+// packet goes to the TUN device untouched.
+
+using namespace vpn;
+
+namespace {
+    // Pool 10.0.0.0/24; 192.168.50.0/24 and 2001:db8:1::/48 are behind 10.0.0.2
+    constexpr uint32_t POOL = 0x0000000A;
+    constexpr uint32_t CLIENT_A = 0x0200000A; // 10.0.0.2
+    constexpr uint32_t CLIENT_B = 0x0300000A; // 10.0.0.3
+    constexpr uint32_t OFFLINE = 0x0400000A;  // 10.0.0.4, no session
+    constexpr uint32_t GATEWAY = 0x0100000A;  // 10.0.0.1, the server
+    constexpr uint32_t BEHIND_A = 0x0732A8C0; // 192.168.50.7
+    constexpr uint32_t INTERNET = 0x08080808; // 8.8.8.8
+
+    int failures = 0;
+
+    void Check(bool ok, const char* what) {
+        if (ok) return;
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+
+    uint32_t Sum(const uint8_t* p, size_t length) {
+        uint32_t sum = 0;
+        for (size_t i = 0; i + 1 < length; i += 2) sum += p[i] << 8 | p[i + 1];
+        while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+        return sum;
+    }
+
+    utils::PacketBuffer Ipv4(uint32_t source, uint32_t dest, uint8_t ttl = 64) {
+        uint8_t ip[28] = {0x45, 0, 0, 28, 0x12, 0x34, 0x40, 0, ttl, 17};
+        std::memcpy(ip + 12, &source, 4);
+        std::memcpy(ip + 16, &dest, 4);
+        uint16_t checksum = static_cast<uint16_t>(~Sum(ip, 20));
+        ip[10] = static_cast<uint8_t>(checksum >> 8);
+        ip[11] = static_cast<uint8_t>(checksum);
+        return utils::PacketBuffer::Copy(ip, sizeof(ip));
+    }
+
+    // A pool address in the IPv6 mirror, or any other 16 bytes
+    std::vector<uint8_t> Mirror(uint32_t vip) {
+        std::vector<uint8_t> address(protocol::VIP6_PREFIX.begin(), protocol::VIP6_PREFIX.end());
+        address.resize(16);
+        std::memcpy(address.data() + protocol::VIP6_PREFIX.size(), &vip, 4);
+        return address;
+    }
+
+    utils::PacketBuffer Ipv6(const std::vector<uint8_t>& source, const std::vector<uint8_t>& dest, uint8_t hop_limit = 64) {
+        uint8_t ip[48] = {0x60, 0, 0, 0, 0, 8, 17, hop_limit};
+        std::memcpy(ip + 8, source.data(), 16);
+        std::memcpy(ip + 24, dest.data(), 16);
+        return utils::PacketBuffer::Copy(ip, sizeof(ip));
+    }
+
+    struct Server {
+        protocol::ClientRoutes routes;
+        std::set<uint32_t> connected = {CLIENT_A, CLIENT_B};
+        bool hairpin = true;
+
+        Server() {
+            routes.routes.Add(POOL, 24, 0);
+            routes.routes.Add(0x0032A8C0, 24, CLIENT_A);
+            const uint8_t network[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0x01};
+            routes.routes6.Add(network, 48, CLIENT_A);
+        }
+
+        protocol::Forward Forward(utils::PacketBuffer& packet, uint32_t from, uint32_t& dest_vip) const {
+            return protocol::ForwardFromClient(routes, packet, from, hairpin, [this](uint32_t vip) { return connected.count(vip) > 0; }, dest_vip);
+        }
+    };
+
+    // Forwards a copy of `packet` and checks where it went and whether it was left untouched
+    void Expect(const Server& server, const utils::PacketBuffer& packet, uint32_t from, protocol::Forward expected,
+                uint32_t expected_dest, const char* what) {
+        auto copy = utils::PacketBuffer::Copy(packet.data(), packet.size());
+        uint32_t dest_vip = 0;
+        bool ok = server.Forward(copy, from, dest_vip) == expected;
+        if (expected == protocol::Forward::Hairpin) ok = ok && dest_vip == expected_dest;
+        else ok = ok && std::memcmp(copy.data(), packet.data(), packet.size()) == 0;
+        Check(ok, what);
+    }
+}
+
+int main() {
+    using protocol::Forward;
+    Server server;
+
+    // Client to client, IPv4: re-sealed, TTL down by one, header checksum still right
+    {
+        auto packet = Ipv4(CLIENT_A, CLIENT_B);
+        uint32_t dest_vip = 0;
+        Check(server.Forward(packet, CLIENT_A, dest_vip) == Forward::Hairpin && dest_vip == CLIENT_B, "hairpinned to the other client");
+        Check(packet[8] == 63 && Sum(packet.data(), 20) == 0xFFFF, "TTL decremented, checksum updated");
+    }
+    // To a network behind a client, and from one
+    Expect(server, Ipv4(CLIENT_B, BEHIND_A), CLIENT_B, Forward::Hairpin, CLIENT_A, "hairpinned to a network behind a client");
+    Expect(server, Ipv4(BEHIND_A, CLIENT_B), CLIENT_A, Forward::Hairpin, CLIENT_B, "hairpinned from a network behind a client");
+    // Not for a connected client: the TUN device
+    Expect(server, Ipv4(CLIENT_A, OFFLINE), CLIENT_A, Forward::Tun, 0, "client without a session");
+    Expect(server, Ipv4(CLIENT_A, GATEWAY), CLIENT_A, Forward::Tun, 0, "the server itself");
+    Expect(server, Ipv4(CLIENT_A, INTERNET), CLIENT_A, Forward::Tun, 0, "outside the tunnel");
+    Expect(server, Ipv4(CLIENT_A, CLIENT_B, 1), CLIENT_A, Forward::Tun, 0, "expiring packet left to the kernel");
+
+    // The ingress filter comes first: a spoofed source is dropped even when the destination is a
+    // connected client, so hairpinning cannot be used to reach one from someone else's address
+    Expect(server, Ipv4(CLIENT_B, CLIENT_B), CLIENT_A, Forward::Drop, 0, "another client's address, to that client");
+    Expect(server, Ipv4(OFFLINE, CLIENT_B), CLIENT_A, Forward::Drop, 0, "unassigned pool address, to a client");
+    Expect(server, Ipv4(BEHIND_A, CLIENT_A), CLIENT_B, Forward::Drop, 0, "another client's network, to that client");
+    Expect(server, Ipv4(INTERNET, CLIENT_B), CLIENT_A, Forward::Drop, 0, "unroutable source, to a client");
+    Expect(server, Ipv4(INTERNET, INTERNET), CLIENT_A, Forward::Drop, 0, "unroutable source, outside the tunnel");
+
+    // IPv6: the pool's mirror and routed networks, hop limit decremented
+    {
+        auto packet = Ipv6(Mirror(CLIENT_A), Mirror(CLIENT_B));
+        uint32_t dest_vip = 0;
+        Check(server.Forward(packet, CLIENT_A, dest_vip) == Forward::Hairpin && dest_vip == CLIENT_B, "IPv6 hairpinned");
+        Check(packet[7] == 63, "hop limit decremented");
+    }
+    std::vector<uint8_t> behind_a = {0x20, 0x01, 0x0d, 0xb8, 0, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x07};
+    Expect(server, Ipv6(Mirror(CLIENT_B), behind_a), CLIENT_B, Forward::Hairpin, CLIENT_A, "IPv6 to a network behind a client");
+    Expect(server, Ipv6(behind_a, Mirror(CLIENT_B)), CLIENT_B, Forward::Drop, 0, "IPv6 from another client's network");
+    Expect(server, Ipv6(Mirror(CLIENT_B), Mirror(CLIENT_A)), CLIENT_A, Forward::Drop, 0, "IPv6 from another client's address");
+    Expect(server, Ipv6(Mirror(CLIENT_A), Mirror(CLIENT_B), 1), CLIENT_A, Forward::Tun, 0, "IPv6 expiring packet left to the kernel");
+
+    // Hairpinning off: client-to-client traffic goes to the TUN device as it came, and the filter
+    // still applies
+    server.hairpin = false;
+    Expect(server, Ipv4(CLIENT_A, CLIENT_B), CLIENT_A, Forward::Tun, 0, "no hairpin: to the TUN device");
+    Expect(server, Ipv4(CLIENT_B, BEHIND_A), CLIENT_B, Forward::Tun, 0, "no hairpin: to a network behind a client");
+    Expect(server, Ipv6(Mirror(CLIENT_A), Mirror(CLIENT_B)), CLIENT_A, Forward::Tun, 0, "no hairpin: IPv6");
+    Expect(server, Ipv4(CLIENT_B, CLIENT_A), CLIENT_A, Forward::Drop, 0, "no hairpin: spoofed source still dropped");
+
+    // Truncated or not IP
+    const uint8_t junk[10] = {0x45};
+    Expect(server, utils::PacketBuffer::Copy(junk, sizeof(junk)), CLIENT_A, Forward::Drop, 0, "truncated IPv4");
+    const uint8_t other[20] = {0x50};
+    Expect(server, utils::PacketBuffer::Copy(other, sizeof(other)), CLIENT_A, Forward::Drop, 0, "not IP");
+
+    return failures ? 1 : 0;
+}
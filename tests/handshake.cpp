@@ -0,0 +1,93 @@
+#include "Session.h"
+#include "Ticket.h"
+#include "Protocol.h"
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Hellos come from anyone: a malformed or hostile one must be refused without throwing and
+// without taking an address from the pool.
+
+using namespace vpn;
+
+namespace {
+    int failures = 0;
+
+    void Check(bool ok, const char* what) {
+        if (ok) return;
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+
+    // Server session with an allocator that counts the addresses it hands out
+    std::unique_ptr<Session> MakeServer(protocol::TicketKey& ticket_key, int& assigned) {
+        auto server = std::make_unique<Session>(true, &ticket_key);
+        server->SetIndex(7);
+        server->SetAddressAllocator([&assigned](uint32_t) -> std::optional<protocol::AddressAssignment> {
+            ++assigned;
+            return protocol::AddressAssignment{0x0200000A, 24}; // 10.0.0.2
+        });
+        return server;
+    }
+
+    // Runs HandleHandshake, turning an exception into a failure
+    std::vector<uint8_t> Handle(Session& session, const std::vector<uint8_t>& packet, const char* what) {
+        try {
+            return session.HandleHandshake(packet);
+        } catch (const std::exception& e) {
+            std::cerr << what << " threw: " << e.what() << std::endl;
+            ++failures;
+            return {};
+        }
+    }
+}
+
+int main() {
+    protocol::TicketKey ticket_key;
+
+    // A regular hello gets a ServerHello and one address
+    {
+        int assigned = 0;
+        auto server = MakeServer(ticket_key, assigned);
+        Session client(false);
+        auto response = Handle(*server, client.InitiateHandshake(), "regular hello");
+        Check(!response.empty(), "regular hello answered");
+        Check(assigned == 1, "regular hello assigned one address");
+        Handle(client, response, "ServerHello");
+        Check(client.IsEstablished() && server->IsEstablished(), "regular handshake established");
+    }
+
+    // A low-order public key (all zeros) has no shared secret: refused, no address taken
+    {
+        int assigned = 0;
+        auto server = MakeServer(ticket_key, assigned);
+        auto hello = protocol::CreateClientHello(std::vector<uint8_t>(32, 0));
+        auto response = Handle(*server, hello, "zero-key hello");
+        Check(response.empty(), "zero-key hello refused");
+        Check(assigned == 0, "zero-key hello took no address");
+        Check(!server->IsEstablished(), "zero-key hello established nothing");
+    }
+
+    // The same from the server's side: a ServerHello with a zero key leaves the client waiting
+    {
+        int assigned = 0;
+        auto server = MakeServer(ticket_key, assigned);
+        Session client(false);
+        client.InitiateHandshake();
+        auto forged = protocol::CreateServerHello(std::vector<uint8_t>(32, 0), protocol::AddressAssignment{0x0200000A, 24}, 7);
+        Handle(client, forged, "zero-key ServerHello");
+        Check(!client.IsEstablished(), "zero-key ServerHello established nothing");
+    }
+
+    // Truncated hello
+    {
+        int assigned = 0;
+        auto server = MakeServer(ticket_key, assigned);
+        auto hello = protocol::CreateClientHello(std::vector<uint8_t>(16, 1));
+        Check(Handle(*server, hello, "short hello").empty(), "short hello refused");
+        Check(assigned == 0, "short hello took no address");
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+#include "Session.h"
+#include "SessionStore.h"
+#include "Ticket.h"
+#include "Protocol.h"
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// An existing client across an unclean server restart: the server restores its session from a
+// periodic snapshot with the receive window moved ahead (vpn_server's SNAPSHOT_RX_MARGIN), so the
+// client's packets go unheard until it notices the silence and reconnects. Its ticket is still
+// good (the ticket key is in the snapshot), so it resumes and gets its address back.
+
+using namespace vpn;
+
+namespace {
+    // As vpn_server restores sessions from a snapshot written while it was running
+    constexpr uint64_t SNAPSHOT_COUNTER_MARGIN = uint64_t(1) << 32;
+    constexpr uint64_t SNAPSHOT_RX_MARGIN = uint64_t(1) << 20;
+    constexpr uint32_t VIP = 0x0200000A; // 10.0.0.2
+
+    int failures = 0;
+
+    void Check(bool ok, const char* what) {
+        if (ok) return;
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+
+    // Seals a small packet on `from` and opens it on `to`
+    bool Deliver(Session& from, Session& to) {
+        const uint8_t payload[20] = {0x45};
+        auto packet = utils::PacketBuffer::Copy(payload, sizeof(payload));
+        from.Encrypt(packet);
+        return to.Decrypt(packet) && packet.size() == sizeof(payload);
+    }
+}
+
+int main() {
+    const std::string path = "test_restart.state";
+
+    // First server process: one client, some traffic, then a periodic snapshot
+    auto ticket_key = std::make_unique<protocol::TicketKey>();
+    Session client(false), server(true, ticket_key.get());
+    server.SetIndex(7);
+    server.SetAddressAllocator([](uint32_t) { return std::optional<protocol::AddressAssignment>({VIP, 24}); });
+    client.HandleHandshake(server.HandleHandshake(client.InitiateHandshake()));
+    Check(client.IsEstablished() && server.IsEstablished(), "handshake");
+    for (int i = 0; i < 100; ++i) Deliver(client, server);
+
+    SessionRecord record;
+    record.virtual_ip = VIP;
+    record.state = server.Export(SNAPSHOT_COUNTER_MARGIN);
+    SessionStore::Save(path, ticket_key->GetKey(), {record}, false);
+    // Sent after the snapshot, received by the process that then crashes
+    for (int i = 0; i < 100; ++i) Deliver(client, server);
+
+    // Second process
+    std::vector<uint8_t> saved_key;
+    std::vector<SessionRecord> records;
+    bool clean = true;
+    Check(SessionStore::Load(path, saved_key, records, clean), "snapshot loads");
+    std::remove(path.c_str());
+    Check(!clean && records.size() == 1, "snapshot is unclean with one session");
+    if (records.size() != 1) return 1;
+
+    protocol::TicketKey restored_key(saved_key);
+    SessionState state = records[0].state;
+    state.tx_nonce_counter += SNAPSHOT_COUNTER_MARGIN;
+    state.rx_nonce_next += SNAPSHOT_RX_MARGIN;
+    Session restored(state, &restored_key);
+
+    // The server still reaches the client, but the client's packets are behind the restored window
+    Check(Deliver(restored, client), "restored server -> client");
+    Check(!Deliver(client, restored), "client -> restored server is dropped");
+
+    // What the client does after PEER_DEAD_SECONDS without an answer: resume with its ticket
+    auto ticket = client.GetResumptionState();
+    Check(ticket.has_value(), "client holds a ticket");
+    if (!ticket) return 1;
+    Session resumed_client(false), resumed_server(true, &restored_key);
+    resumed_server.SetIndex(8);
+    bool took_over = false;
+    resumed_server.SetAddressAllocator([&](uint32_t requested) -> std::optional<protocol::AddressAssignment> {
+        // The restored session still holds the address; the ticket proves the client is its owner
+        took_over = requested == VIP && resumed_server.ResumedFrom(restored);
+        return protocol::AddressAssignment{requested, 24};
+    });
+    auto ack = resumed_server.HandleHandshake(resumed_client.InitiateResumption(*ticket));
+    Check(!ack.empty(), "restored server accepts the ticket");
+    resumed_client.HandleHandshake(ack);
+    Check(resumed_client.IsEstablished() && resumed_client.IsResumed(), "client resumed");
+    Check(took_over, "resumed session takes over the restored session's address");
+    auto address = resumed_client.GetAssignedAddress();
+    Check(address && address->virtual_ip == VIP, "client keeps its address");
+    Check(Deliver(resumed_client, resumed_server), "client -> server after resuming");
+    Check(Deliver(resumed_server, resumed_client), "server -> client after resuming");
+
+    return failures ? 1 : 0;
+}
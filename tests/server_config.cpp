@@ -0,0 +1,171 @@
+#include "ServerConfig.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// vpn_server's configuration: the address, network and key parsers, a config file's settings and
+// sections, the command line over the file, and the errors that name the offending line or option.
+
+using namespace vpn;
+
+namespace {
+    int failures = 0;
+
+    void Check(bool ok, const char* what) {
+        if (ok) return;
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+
+    utils::ServerConfig FromFile(const std::string& text) {
+        utils::ServerConfig config;
+        utils::ApplyConfigFile(utils::ConfigFile::Parse(text, "test.conf"), config);
+        return config;
+    }
+
+    // The message a config file fails with, empty if it is accepted
+    std::string FileError(const std::string& text) {
+        try {
+            FromFile(text);
+        } catch (const std::runtime_error& e) {
+            return e.what();
+        }
+        return "";
+    }
+
+    bool ArgumentsFail(const std::vector<std::string>& args) {
+        utils::ServerConfig config;
+        try {
+            utils::ApplyArguments(args, config);
+        } catch (const std::exception&) {
+            return true;
+        }
+        return false;
+    }
+
+    bool Contains(const std::string& text, const std::string& part) {
+        return text.find(part) != std::string::npos;
+    }
+}
+
+int main() {
+    // Addresses and networks
+    Check(utils::ParseIpv4("10.1.2.3") == htonl(0x0A010203), "IPv4 in network byte order");
+    Check(utils::ParseIpv4("10.1.2") == 0, "malformed IPv4 is 0");
+
+    utils::Cidr cidr;
+    Check(utils::ParseCidr("192.168.50.0/24", cidr) && !cidr.v6 && cidr.prefix_len == 24, "IPv4 network");
+    Check(std::memcmp(cidr.address, "\xC0\xA8\x32\x00", 4) == 0, "IPv4 network address");
+    Check(utils::ParseCidr("2001:db8:1::/48", cidr) && cidr.v6 && cidr.prefix_len == 48, "IPv6 network");
+    Check(cidr.address[0] == 0x20 && cidr.address[1] == 0x01 && cidr.address[5] == 0x01 && cidr.address[15] == 0, "IPv6 network address");
+    Check(utils::ParseCidr("10.0.0.0/0", cidr) && cidr.prefix_len == 0, "zero-length prefix");
+    Check(utils::ParseCidr("::/128", cidr) && cidr.prefix_len == 128, "IPv6 host route");
+    Check(!utils::ParseCidr("10.0.0.0", cidr), "network without a prefix length");
+    Check(!utils::ParseCidr("10.0.0.0/33", cidr), "IPv4 prefix over 32");
+    Check(!utils::ParseCidr("2001:db8::/129", cidr), "IPv6 prefix over 128");
+    Check(!utils::ParseCidr("10.0.0/24", cidr), "malformed IPv4 network");
+    Check(!utils::ParseCidr("2001:db8:::/48", cidr), "malformed IPv6 network");
+
+    // Keys and rates
+    Check(utils::ParseHex("00ff7A") == std::vector<uint8_t>({0x00, 0xFF, 0x7A}), "hex bytes");
+    Check(utils::ParseHex("").empty(), "empty hex");
+    Check(utils::ParseHex("abc").empty(), "odd number of hex digits");
+    Check(utils::ParseHex("0g").empty(), "non-hex digit");
+    Check(utils::ParseHex(" 1").empty() && utils::ParseHex("+1").empty() && utils::ParseHex("-1").empty(), "sign or space in hex");
+    Check(utils::MbitToBytes(8) == 1000000 && utils::MbitToBytes(0.5) == 62500, "Mbit/s to bytes per second");
+
+    // A config file
+    auto config = FromFile(
+        "# comment\n"
+        "listen_port = 4500\n"
+        "tun_name = vpn0\n"
+        "address_pool = 10.8.0.0/16\n"
+        "workers = 4\n"
+        "default_rate = 80\n"
+        "hairpin = off\n"
+        "handshake_rate = 5\n"
+        "trace_vip = 10.8.0.9\n"
+        "load_balancer = 127.0.0.1:51819\n"
+        "cluster_node = 1\n"
+        "cluster_key = " + std::string(64, 'a') + "\n"
+        "[peer 10.8.0.2]\n"
+        "rate = 16\n"
+        "route = 192.168.50.0/24\n"
+        "route = 2001:db8:1::/48\n"
+        "[node 0]\n"
+        "address = 127.0.0.1:7100\n"
+        "[node 1]\n"
+        "address = [::1]:7101\n"
+        "listen_port = 51822\n");
+    Check(config.listen_port == 4500 && config.tun_name == "vpn0", "port and TUN name");
+    Check(config.pool_network == utils::ParseIpv4("10.8.0.0") && config.pool_prefix_len == 16, "address pool");
+    Check(config.Gateway() == utils::ParseIpv4("10.8.0.1"), "gateway is the pool's first address");
+    Check(config.workers == 4 && config.default_rate == 10000000 && !config.hairpin && config.handshake_rate == 5, "global settings");
+    Check(config.trace_vips == std::vector<uint32_t>{utils::ParseIpv4("10.8.0.9")}, "trace VIP");
+    Check(config.load_balancer && ntohs(config.load_balancer->sin6_port) == 51819, "load balancer");
+    Check(config.cluster_node == 1u && config.cluster_key == std::vector<uint8_t>(32, 0xAA), "cluster node and key");
+    const auto& peer = config.peers[utils::ParseIpv4("10.8.0.2")];
+    Check(peer.rate == 2000000u, "peer rate");
+    Check(peer.routes == std::vector<std::string>({"192.168.50.0/24", "2001:db8:1::/48"}), "peer routes");
+    Check(config.nodes.size() == 2 && ntohs(config.nodes[1].address.sin6_port) == 7101, "nodes");
+    Check(!config.nodes[0].listen_port && config.nodes[1].listen_port == 51822, "per-node listen port");
+
+    // Errors name the file and line
+    Check(Contains(FileError("listen_port = 1\nworkers = 65\n"), "test.conf:2: workers"), "too many workers");
+    Check(Contains(FileError("address_pool = 10.0.0.0/8\n"), "/16 to /30"), "pool too large");
+    Check(Contains(FileError("address_pool = 10.0.0.1/24\n"), "host bits set"), "pool with host bits");
+    Check(Contains(FileError("address_pool = 2001:db8::/64\n"), "address_pool"), "IPv6 pool");
+    Check(Contains(FileError("cluster_key = abcd\n"), "64 hex digits"), "short cluster key");
+    Check(Contains(FileError("hairpin = maybe\n"), "true or false"), "hairpin not a boolean");
+    Check(Contains(FileError("colour = blue\n"), "unknown setting colour"), "unknown setting");
+    Check(Contains(FileError("[peer 10.0.0.2]\nroute = 192.168.50.0\n"), "test.conf:2: route"), "peer route without a prefix");
+    Check(Contains(FileError("[peer nobody]\n"), "expected [peer VIP]"), "peer without an address");
+    Check(Contains(FileError("[node 0]\nlisten_port = 1\n"), "test.conf:1: [node 0] needs an address"), "node without an address");
+    Check(Contains(FileError("[nodes 0]\n"), "unknown section [nodes]"), "unknown section");
+
+    // The command line over the file
+    utils::ApplyArguments({"--config", "ignored.conf", "--workers", "2", "--route", "192.168.60.0/24=10.8.0.3",
+                           "--rate", "10.8.0.2=8", "--default-rate", "1", "--stats-interval", "5", "--node", "0"}, config);
+    Check(config.workers == 2 && config.stats_interval == 5 && config.cluster_node == 0u, "options override the file");
+    Check(config.default_rate == 125000 && config.peers[utils::ParseIpv4("10.8.0.2")].rate == 1000000u, "rates override the file");
+    Check(config.peers[utils::ParseIpv4("10.8.0.2")].routes.size() == 2, "file routes kept");
+    Check(config.peers[utils::ParseIpv4("10.8.0.3")].routes == std::vector<std::string>{"192.168.60.0/24"}, "route added");
+    utils::ServerConfig hairpin = FromFile("hairpin = yes\n");
+    Check(hairpin.hairpin, "hairpin on in the file");
+    utils::ApplyArguments({"--no-hairpin"}, hairpin);
+    Check(!hairpin.hairpin, "--no-hairpin overrides the file");
+    Check(utils::ServerConfig().hairpin, "hairpin on by default");
+    Check(ArgumentsFail({"--route", "192.168.60.0/24"}), "route without a VIP");
+    Check(ArgumentsFail({"--route", "192.168.60.0=10.0.0.2"}), "route without a prefix length");
+    Check(ArgumentsFail({"--rate", "10.0.0.2"}), "rate without a value");
+    Check(ArgumentsFail({"--workers", "many"}), "workers not a number");
+    Check(ArgumentsFail({"--load-balancer", "localhost"}), "load balancer without a port");
+
+    // LoadConfig reads every --config, then the options, and checks the cluster adds up
+    const std::string path = "test_server_config.conf";
+    std::ofstream(path) << "cluster_key = " << std::string(64, '0') << "\n[node 0]\naddress = 127.0.0.1:7100\nlisten_port = 51821\n"
+                        << "[node 1]\naddress = 127.0.0.1:7101\nlisten_port = 51822\ntun_name = node1\n";
+    auto node = utils::LoadConfig({"--config", path, "--node", "1"});
+    Check(node.listen_port == 51822 && node.tun_name == "node1", "this node's port and TUN name");
+    bool refused = false;
+    try {
+        utils::LoadConfig({"--config", path, "--node", "2"});
+    } catch (const std::runtime_error&) {
+        refused = true;
+    }
+    Check(refused, "node id not in the cluster");
+    refused = false;
+    try {
+        utils::LoadConfig({"--config", path});
+    } catch (const std::runtime_error&) {
+        refused = true;
+    }
+    Check(refused, "cluster without a node id");
+    std::remove(path.c_str());
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+#include "TunOffload.h"
+#include "PacketBuffer.h"
+#include <iostream>
+#include <cstring>
+#include <vector>
+
+// TSO from the TUN device: a 64KB TCP super-segment with a vnet header, as the kernel hands one
+// over, splits into MSS-sized segments whose lengths, IPv4 IDs, sequence numbers, flags and IP
+// and TCP checksums are what the sender's stack would have produced, and CoalescePackets merges
+// the segments back into super-segments carrying the same bytes. Checksums are verified here
+// independently of TunOffload's own arithmetic.
+
+using namespace vpn;
+
+namespace {
+    constexpr size_t MSS = 1448;
+    constexpr size_t TCP_HEADER = 32; // With the timestamp option
+    constexpr uint32_t SEQ = 0xFFFFF000; // Wraps within the super-segment
+    constexpr uint8_t FLAGS = 0x10 | 0x08 | 0x01 | 0x80; // ACK PSH FIN CWR
+
+    int failures = 0;
+
+    void Check(bool ok, const char* what) {
+        if (ok) return;
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+
+    uint16_t Load16(const uint8_t* p) { return static_cast<uint16_t>(p[0] << 8 | p[1]); }
+    uint32_t Load32(const uint8_t* p) { return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3]; }
+    void Store16(uint8_t* p, uint16_t v) { p[0] = static_cast<uint8_t>(v >> 8); p[1] = static_cast<uint8_t>(v); }
+    void Store32(uint8_t* p, uint32_t v) { Store16(p, static_cast<uint16_t>(v >> 16)); Store16(p + 2, static_cast<uint16_t>(v)); }
+
+    // One's complement sum of 16-bit words, folded
+    uint32_t Sum(const uint8_t* p, size_t length, uint32_t sum = 0) {
+        for (size_t i = 0; i + 1 < length; i += 2) sum += Load16(p + i);
+        if (length & 1) sum += p[length - 1] << 8;
+        while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+        return sum;
+    }
+
+    // A segment's TCP checksum is right if the sum over pseudo-header and segment is all ones
+    bool TcpChecksumValid(const uint8_t* ip, bool v6, size_t ip_len, size_t tcp_length) {
+        uint32_t pseudo = v6 ? Sum(ip + 8, 32) : Sum(ip + 12, 8);
+        pseudo += 6 + static_cast<uint32_t>(tcp_length);
+        return Sum(ip + ip_len, tcp_length, pseudo) == 0xFFFF;
+    }
+
+    // [VirtioNetHeader][IP][TCP + options][payload], `payload` bytes numbered by their offset
+    std::vector<uint8_t> MakeSuperSegment(bool v6, size_t payload) {
+        size_t ip_len = v6 ? 40 : 20;
+        size_t headers = ip_len + TCP_HEADER;
+        std::vector<uint8_t> buffer(tun::VIRTIO_NET_HDR_SIZE + headers + payload);
+
+        tun::VirtioNetHeader header;
+        header.flags = tun::VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        header.gso_type = v6 ? tun::VIRTIO_NET_HDR_GSO_TCPV6 : tun::VIRTIO_NET_HDR_GSO_TCPV4;
+        header.hdr_len = static_cast<uint16_t>(headers);
+        header.gso_size = MSS;
+        header.csum_start = static_cast<uint16_t>(ip_len);
+        header.csum_offset = 16;
+        std::memcpy(buffer.data(), &header, sizeof(header));
+
+        uint8_t* ip = buffer.data() + tun::VIRTIO_NET_HDR_SIZE;
+        if (v6) {
+            ip[0] = 0x60;
+            Store16(ip + 4, static_cast<uint16_t>(TCP_HEADER + payload));
+            ip[6] = 6;
+            ip[7] = 64;
+            ip[8] = 0xFD;
+            ip[23] = 1;
+            ip[24] = 0xFD;
+            ip[39] = 2;
+        } else {
+            ip[0] = 0x45;
+            Store16(ip + 2, static_cast<uint16_t>(headers + payload));
+            Store16(ip + 4, 0xFFF0); // IDs wrap too
+            ip[6] = 0x40;            // DF
+            ip[8] = 64;
+            ip[9] = 6;
+            const uint8_t source[4] = {10, 0, 0, 1}, destination[4] = {10, 0, 0, 2};
+            std::memcpy(ip + 12, source, 4);
+            std::memcpy(ip + 16, destination, 4);
+            Store16(ip + 10, static_cast<uint16_t>(~Sum(ip, 20)));
+        }
+        uint8_t* th = ip + ip_len;
+        Store16(th, 443);
+        Store16(th + 2, 50000);
+        Store32(th + 4, SEQ);
+        Store32(th + 8, 0x12345678);
+        th[12] = (TCP_HEADER / 4) << 4;
+        th[13] = FLAGS;
+        Store16(th + 14, 65535);
+        th[20] = 1; // NOP NOP Timestamps
+        th[21] = 1;
+        th[22] = 8;
+        th[23] = 10;
+        Store32(th + 24, 1000);
+        Store32(th + 28, 2000);
+        // As the kernel leaves it with NEEDS_CSUM: the pseudo-header sum only
+        Store16(th + 16, static_cast<uint16_t>(v6 ? Sum(ip + 8, 32, 6 + TCP_HEADER + payload) : Sum(ip + 12, 8, 6 + TCP_HEADER + payload)));
+        for (size_t i = 0; i < payload; ++i) th[TCP_HEADER + i] = static_cast<uint8_t>(i * 7 + i / 251);
+        return buffer;
+    }
+
+    void CheckSplit(bool v6) {
+        size_t ip_len = v6 ? 40 : 20;
+        size_t headers = ip_len + TCP_HEADER;
+        size_t payload = 65535 - headers; // The largest super-segment: 45 full segments and a short one
+        auto super = MakeSuperSegment(v6, payload);
+        const uint8_t* original = super.data() + tun::VIRTIO_NET_HDR_SIZE;
+
+        std::vector<utils::PacketBuffer> segments;
+        size_t count = tun::SplitSuperPacket(super.data(), super.size(), segments, 0);
+        segments.resize(count);
+        Check(count == (payload + MSS - 1) / MSS, "one packet per MSS");
+
+        size_t offset = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const uint8_t* ip = segments[i].data();
+            const uint8_t* th = ip + ip_len;
+            size_t segment = payload - offset < MSS ? payload - offset : MSS;
+            bool last = i + 1 == count;
+            Check(segments[i].size() == headers + segment, "segment size");
+            if (v6) {
+                Check(Load16(ip + 4) == TCP_HEADER + segment, "IPv6 payload length");
+            } else {
+                Check(Load16(ip + 2) == headers + segment, "IPv4 total length");
+                Check(Load16(ip + 4) == static_cast<uint16_t>(0xFFF0 + i), "IPv4 ID increments");
+                Check(Sum(ip, 20) == 0xFFFF, "IPv4 header checksum");
+            }
+            Check(Load32(th + 4) == SEQ + static_cast<uint32_t>(offset), "sequence number");
+            Check(std::memcmp(th + 8, original + ip_len + 8, 4) == 0, "ACK number kept");
+            Check(std::memcmp(th + 20, original + ip_len + 20, TCP_HEADER - 20) == 0, "options kept");
+            Check(((th[13] & 0x01) != 0) == last && ((th[13] & 0x08) != 0) == last, "FIN and PSH only on the last segment");
+            Check(((th[13] & 0x80) != 0) == (i == 0), "CWR only on the first segment");
+            Check(TcpChecksumValid(ip, v6, ip_len, TCP_HEADER + segment), "TCP checksum");
+            Check(std::memcmp(th + TCP_HEADER, original + headers + offset, segment) == 0, "payload slice");
+            offset += segment;
+        }
+        Check(offset == payload, "payload covered");
+
+        // And back: the segments merge into super-segments carrying the same bytes
+        std::vector<std::vector<uint8_t>> merged;
+        size_t buffers = tun::CoalescePackets(segments, merged);
+        std::vector<uint8_t> bytes;
+        for (size_t i = 0; i < buffers; ++i) {
+            tun::VirtioNetHeader header;
+            std::memcpy(&header, merged[i].data(), sizeof(header));
+            Check(header.gso_type == 0 || header.gso_size == MSS, "merged with the same MSS");
+            bytes.insert(bytes.end(), merged[i].begin() + tun::VIRTIO_NET_HDR_SIZE + headers, merged[i].end());
+        }
+        Check(buffers < count, "segments merged");
+        Check(bytes.size() == payload && std::memcmp(bytes.data(), original + headers, payload) == 0, "merged payload");
+    }
+}
+
+int main() {
+    CheckSplit(false);
+    CheckSplit(true);
+
+    // A super-segment whose headers claim more than was read is dropped
+    auto super = MakeSuperSegment(false, 4 * MSS);
+    std::vector<utils::PacketBuffer> segments;
+    Check(tun::SplitSuperPacket(super.data(), tun::VIRTIO_NET_HDR_SIZE + 30, segments, 0) == 0, "truncated super-segment dropped");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+#include "UdpSocket.h"
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <cerrno>
+#include <netinet/udp.h>
+#endif
+
+// UdpSocket::SendBatch on loopback: equal-size datagrams to one destination go out as GSO
+// super-buffers and arrive intact (split again by ForEachSegment under GRO), a device that
+// rejects segmented sends with EIO turns GSO off without losing the batch, and a datagram the
+// kernel rejects is skipped while the rest of the batch still goes out. sendmmsg is wrapped here
+// to fail on demand, as such a device or route would.
+
+#ifdef __linux__
+namespace {
+    enum class Fault { None, EioOnSegment, UnreachablePort };
+    Fault fault = Fault::None;
+    uint16_t unreachable_port = 0; // Network byte order
+    int segmented_sends = 0;       // Messages carrying UDP_SEGMENT that reached the kernel
+    int eio_returned = 0;
+
+    bool Segmented(const msghdr& msg) {
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&msg), cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_SEGMENT) return true;
+        }
+        return false;
+    }
+}
+
+// Like the kernel, sends the messages before the first one that fails, and fails on the next call
+// if that one comes first
+extern "C" int sendmmsg(int fd, mmsghdr* msgs, unsigned int count, int flags) {
+    using Real = int (*)(int, mmsghdr*, unsigned int, int);
+    static Real real = reinterpret_cast<Real>(dlsym(RTLD_NEXT, "sendmmsg"));
+    for (unsigned int i = 0; i < count; ++i) {
+        const auto* dest = static_cast<const vpn::utils::Endpoint*>(msgs[i].msg_hdr.msg_name);
+        int error = 0;
+        if (fault == Fault::EioOnSegment && Segmented(msgs[i].msg_hdr)) error = EIO;
+        if (fault == Fault::UnreachablePort && dest->sin6_port == unreachable_port) error = ENETUNREACH;
+        if (!error) continue;
+        if (i == 0) {
+            if (error == EIO) ++eio_returned;
+            errno = error;
+            return -1;
+        }
+        count = i;
+        break;
+    }
+    for (unsigned int i = 0; i < count; ++i) segmented_sends += Segmented(msgs[i].msg_hdr);
+    return real(fd, msgs, count, flags);
+}
+#endif
+
+using namespace vpn;
+
+namespace {
+    constexpr size_t SIZE = 1200;
+
+    int failures = 0;
+
+    void Check(bool ok, const char* what) {
+        if (ok) return;
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+
+    uint16_t LocalPort(const utils::UdpSocket& socket) {
+        utils::Endpoint bound = {};
+        socklen_t length = sizeof(bound);
+        getsockname(socket.Handle(), reinterpret_cast<sockaddr*>(&bound), &length);
+        return ntohs(bound.sin6_port);
+    }
+
+    utils::Endpoint Loopback(uint16_t port) {
+        utils::Endpoint endpoint;
+        utils::ParseEndpoint("127.0.0.1", port, endpoint);
+        return endpoint;
+    }
+
+    // `count` datagrams of SIZE bytes, the first byte of each numbering it
+    struct Batch {
+        std::vector<std::vector<uint8_t>> payloads;
+        std::vector<utils::Datagram> datagrams;
+    };
+
+    Batch MakeBatch(size_t count, const utils::Endpoint& dest) {
+        Batch batch;
+        for (size_t i = 0; i < count; ++i) batch.payloads.emplace_back(SIZE, static_cast<uint8_t>(i));
+        for (auto& payload : batch.payloads) batch.datagrams.push_back({payload.data(), 0, payload.size(), dest});
+        return batch;
+    }
+
+    // The first byte of each datagram received until `expected` have arrived (or nothing more comes)
+    std::vector<uint8_t> Receive(utils::UdpSocket& socket, size_t expected) {
+        std::vector<std::vector<uint8_t>> buffers(utils::UdpSocket::MAX_BATCH, std::vector<uint8_t>(65535));
+        utils::Datagram batch[utils::UdpSocket::MAX_BATCH];
+        std::vector<uint8_t> seen;
+        while (seen.size() < expected) {
+            for (size_t i = 0; i < utils::UdpSocket::MAX_BATCH; ++i) batch[i] = {buffers[i].data(), buffers[i].size()};
+            int received = socket.ReceiveBatch(batch, utils::UdpSocket::MAX_BATCH);
+            if (received <= 0) break;
+            for (int i = 0; i < received; ++i) {
+                utils::ForEachSegment(batch[i], [&](const uint8_t* data, size_t length) {
+                    bool intact = length == SIZE;
+                    for (size_t b = 1; b < length && intact; ++b) intact = data[b] == data[0];
+                    Check(intact, "datagram arrived intact");
+                    seen.push_back(data[0]);
+                });
+            }
+        }
+        return seen;
+    }
+}
+
+int main() {
+#ifdef __linux__
+    utils::UdpSocket sender, receiver, other;
+    sender.Bind(0, false);
+    receiver.Bind(0, false);
+    other.Bind(0, false);
+    timeval timeout = {1, 0}; // A lost datagram fails the test instead of hanging it
+    setsockopt(receiver.Handle(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(other.Handle(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (!sender.EnableGso() || !receiver.EnableGro()) {
+        std::cout << "UDP GSO/GRO unavailable, skipped" << std::endl;
+        return 0;
+    }
+    utils::Endpoint to_receiver = Loopback(LocalPort(receiver));
+    std::vector<uint8_t> all;
+    for (uint8_t i = 0; i < 16; ++i) all.push_back(i);
+
+    // GSO: one segmented message carries the whole run
+    {
+        auto batch = MakeBatch(16, to_receiver);
+        Check(sender.SendBatch(batch.datagrams.data(), batch.datagrams.size()) == 16, "GSO batch sent");
+        Check(segmented_sends == 1, "GSO batch went out as one segmented message");
+        Check(Receive(receiver, 16) == all, "GSO batch received in order");
+    }
+
+    // EIO on a segmented send: GSO is turned off and the same batch goes out datagram by datagram
+    {
+        fault = Fault::EioOnSegment;
+        segmented_sends = 0;
+        auto batch = MakeBatch(16, to_receiver);
+        Check(sender.SendBatch(batch.datagrams.data(), batch.datagrams.size()) == 16, "batch sent after EIO");
+        Check(eio_returned == 1, "EIO seen once");
+        Check(segmented_sends == 0, "no segmented send after EIO");
+        Check(Receive(receiver, 16) == all, "batch received after EIO");
+        Check(sender.SendBatch(batch.datagrams.data(), batch.datagrams.size()) == 16, "next batch sent");
+        Check(eio_returned == 1 && segmented_sends == 0, "GSO stays off");
+        Receive(receiver, 16);
+        fault = Fault::None;
+    }
+
+    // A message the kernel rejects is skipped, the rest of the batch still goes out in order:
+    // datagrams 4-7 go to an unreachable destination, 0-3 and 8-15 to the receiver
+    {
+        utils::UdpSocket plain;
+        plain.Bind(0, false);
+        unreachable_port = htons(LocalPort(other));
+        fault = Fault::UnreachablePort;
+        auto batch = MakeBatch(16, to_receiver);
+        for (size_t i = 4; i < 8; ++i) batch.datagrams[i].addr = Loopback(LocalPort(other));
+        Check(plain.SendBatch(batch.datagrams.data(), batch.datagrams.size()) == 12, "all but the rejected sent");
+        std::vector<uint8_t> expected = {0, 1, 2, 3, 8, 9, 10, 11, 12, 13, 14, 15};
+        Check(Receive(receiver, 12) == expected, "rest of the batch received in order");
+        fault = Fault::None;
+    }
+
+    // The same with GSO: the rejected run is one message, the runs around it still segmented
+    {
+        utils::UdpSocket gso;
+        gso.Bind(0, false);
+        gso.EnableGso();
+        segmented_sends = 0;
+        fault = Fault::UnreachablePort;
+        auto batch = MakeBatch(16, to_receiver);
+        for (size_t i = 4; i < 8; ++i) batch.datagrams[i].addr = Loopback(LocalPort(other));
+        Check(gso.SendBatch(batch.datagrams.data(), batch.datagrams.size()) == 12, "GSO: all but the rejected run sent");
+        Check(segmented_sends == 2, "GSO: the runs around it segmented");
+        std::vector<uint8_t> expected = {0, 1, 2, 3, 8, 9, 10, 11, 12, 13, 14, 15};
+        Check(Receive(receiver, 12) == expected, "GSO: rest of the batch received in order");
+        fault = Fault::None;
+    }
+
+    // A real rejection: a datagram larger than UDP allows fails with EMSGSIZE on its own
+    {
+        utils::UdpSocket plain;
+        plain.Bind(0, false);
+        std::vector<uint8_t> huge(70000, 0xEE);
+        auto batch = MakeBatch(3, to_receiver);
+        batch.datagrams.insert(batch.datagrams.begin() + 1, {huge.data(), 0, huge.size(), to_receiver});
+        Check(plain.SendBatch(batch.datagrams.data(), batch.datagrams.size()) == 3, "oversized datagram skipped");
+        Check(Receive(receiver, 3) == std::vector<uint8_t>{0, 1, 2}, "datagrams around the oversized one received");
+    }
+#endif
+    return failures ? 1 : 0;
+}